@@ -0,0 +1,63 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "blob.h"
+#include "utility.h"
+
+static Blob* make(Blob b);
+
+Blob* Blob_fromHeap(uint8_t* data, size_t len) {
+  assert(data || len == 0);
+  return make((Blob){.data = data, .len = len, .storage = data});
+}
+
+Blob* Blob_map(int fd, size_t len) {
+  /* Nothing to map of an empty file */
+  void* map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  if (map == MAP_FAILED)
+    return NULL;
+  return make((Blob){.data = map, .len = len, .storage = map, .map_len = len});
+}
+
+Blob* Blob_slice(Blob* b, size_t offset, size_t len) {
+  assert(b);
+  assert(offset <= b->len && len <= b->len - offset);
+
+  /* A slice of a slice shows the bytes of the first */
+  Blob* base = b->base ? b->base : b;
+  return make((Blob){.data = b->data + offset, .len = len, .base = Blob_retain(base)});
+}
+
+Blob* Blob_retain(Blob* b) {
+  assert(b);
+  __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+  return b;
+}
+
+void Blob_release(Blob* b) {
+  assert(b);
+
+  if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  if (b->base)
+    Blob_release(b->base);
+  else if (b->map_len)
+    munmap(b->storage, b->map_len);
+  else
+    free(b->storage);
+  free(b);
+}
+
+static Blob* make(Blob b) {
+  Blob* blob = malloc(sizeof(Blob));
+  if (!blob)
+    die("malloc() failed");
+  *blob = b;
+  blob->refs = 1;
+  return blob;
+}
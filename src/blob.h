@@ -0,0 +1,43 @@
+#ifndef BLOB_H
+#define BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes shared by the IR items that refer to them
+ *
+ * Data directives keep their bytes in a blob rather than one item per byte:
+ * a heap buffer filled by DB or DW, or a file INCBIN maps and never copies.
+ * A slice shows part of another blob, which it keeps alive. Statements are
+ * copied and resolved on other threads, so references are counted
+ * atomically.
+ */
+typedef struct Blob Blob;
+struct Blob {
+  uint8_t const* data;
+  size_t len;
+  Blob* base;     //< Whose bytes a slice shows, NULL if they're its own
+  void* storage;  //< The heap buffer or mapping holding the bytes, if its own
+  size_t map_len; //< Of the mapping, 0 if on the heap
+  size_t refs;
+};
+
+/* A blob of a heap buffer, which it takes ownership of */
+Blob* Blob_fromHeap(uint8_t* data, size_t len);
+
+/* A blob of the first `len` bytes of an open file, mapped
+ *
+ * @returns NULL on failure, errno is then set
+ */
+Blob* Blob_map(int fd, size_t len);
+
+/* A blob of b->data[offset, offset + len) */
+Blob* Blob_slice(Blob* b, size_t offset, size_t len);
+
+/* Another reference to the blob, which is returned */
+Blob* Blob_retain(Blob* b);
+
+/* Drop a reference, freeing the blob after the last one */
+void Blob_release(Blob* b);
+
+#endif // BLOB_H
@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "utility.h"
+#include "vector.h"
+
+#define CACHE_MAGIC "Z80C"
+#define CACHE_VERSION 1
+#define CACHE_KEY_LEN 16 //< Hex digits of an entry name
+
+/* magic, u32 version, u64 key, u64 length of the output, little-endian */
+#define CACHE_HEADER_LEN 24
+
+typedef struct {
+  char name[CACHE_KEY_LEN + 1];
+  struct timespec used;
+  uint64_t size;
+} CacheFile;
+
+static char* entryPath(Cache const* c, char const* name);
+static void putHeader(uint8_t* out, uint64_t key, uint64_t len);
+static int writeAll(int fd, void const* data, size_t len);
+static void evict(Cache* c);
+static bool isEntryName(char const* name);
+static int compareUse(void const* a, void const* b);
+
+int Cache_open(Cache* c, char const* dir, uint64_t max_size) {
+  assert(c);
+  assert(dir);
+
+  if (mkdir(dir, 0777) == -1 && errno != EEXIST)
+    return -1;
+
+  c->dir = dsprintf("%s", dir);
+  if (!c->dir)
+    die("dsprintf() failed");
+  c->max_size = max_size;
+  return 0;
+}
+
+void Cache_close(Cache* c) {
+  assert(c);
+  free(c->dir);
+  c->dir = NULL;
+}
+
+int Cache_get(Cache* c, uint64_t key, CacheEntry* e) {
+  assert(c);
+  assert(e);
+
+  char name[CACHE_KEY_LEN + 1];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+  char* path = entryPath(c, name);
+  int const fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < CACHE_HEADER_LEN) {
+    close(fd);
+    return -1;
+  }
+  size_t const map_len = (size_t)st.st_size;
+  void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+
+  /* A stale or foreign file is a miss */
+  uint8_t expected[CACHE_HEADER_LEN];
+  putHeader(expected, key, map_len - CACHE_HEADER_LEN);
+  if (memcmp(map, expected, CACHE_HEADER_LEN) != 0) {
+    munmap(map, map_len);
+    close(fd);
+    return -1;
+  }
+
+  /* Mark it used, for the eviction; failing that only makes it older */
+  futimens(fd, NULL);
+  close(fd);
+
+  *e = (CacheEntry){
+      .data = (uint8_t const*)map + CACHE_HEADER_LEN,
+      .len = map_len - CACHE_HEADER_LEN,
+      .map = map,
+      .map_len = map_len,
+  };
+  return 0;
+}
+
+void CacheEntry_release(CacheEntry* e) {
+  assert(e);
+  if (e->map)
+    munmap(e->map, e->map_len);
+  *e = (CacheEntry){0};
+}
+
+int Cache_put(Cache* c, uint64_t key, void const* data, size_t len) {
+  assert(c);
+  assert(data || len == 0);
+
+  /* Temporary names don't look like entries, so the eviction skips them;
+   * the counter tells apart those of the threads of a batch */
+  static unsigned counter = 0;
+  static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock(&counter_lock);
+  unsigned const n = counter++;
+  pthread_mutex_unlock(&counter_lock);
+
+  char name[CACHE_KEY_LEN + 1], tmp_name[64];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+  snprintf(tmp_name, sizeof(tmp_name), "tmp-%ld-%u-%s", (long)getpid(), n, name);
+  char* path = entryPath(c, name);
+  char* tmp_path = entryPath(c, tmp_name);
+
+  int rc = -1;
+  int const fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (fd != -1) {
+    uint8_t header[CACHE_HEADER_LEN];
+    putHeader(header, key, len);
+    rc = writeAll(fd, header, sizeof(header));
+    if (rc == 0)
+      rc = writeAll(fd, data, len);
+    if (close(fd) == -1)
+      rc = -1;
+    if (rc == 0)
+      rc = rename(tmp_path, path);
+    if (rc == -1) {
+      int const saved = errno;
+      unlink(tmp_path);
+      errno = saved;
+    }
+  }
+  free(path);
+  free(tmp_path);
+
+  if (rc == 0)
+    evict(c);
+  return rc;
+}
+
+int Cache_putFile(Cache* c, uint64_t key, char const* path) {
+  assert(c);
+  assert(path);
+
+  int const fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  size_t const len = (size_t)st.st_size;
+  void* map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  int const rc = Cache_put(c, key, map, len);
+  if (map)
+    munmap(map, len);
+  return rc;
+}
+
+static char* entryPath(Cache const* c, char const* name) {
+  char* path = dsprintf("%s/%s", c->dir, name);
+  if (!path)
+    die("dsprintf() failed");
+  return path;
+}
+
+static void putHeader(uint8_t* out, uint64_t key, uint64_t len) {
+  memcpy(out, CACHE_MAGIC, 4);
+  uint64_t const fields[] = {CACHE_VERSION, key, len};
+  size_t const widths[] = {4, 8, 8};
+  size_t at = 4;
+  for (size_t i = 0; i < 3; ++i)
+    for (size_t k = 0; k < widths[i]; ++k)
+      out[at++] = (uint8_t)(fields[i] >> (8 * k));
+  assert(at == CACHE_HEADER_LEN);
+}
+
+static int writeAll(int fd, void const* data, size_t len) {
+  uint8_t const* p = data;
+  while (len > 0) {
+    ssize_t const n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/* Remove the least recently used entries until the rest fit. Other builds
+ * may be evicting too, so entries that are already gone are skipped. */
+static void evict(Cache* c) {
+  DIR* dir = opendir(c->dir);
+  if (!dir)
+    return;
+
+  Vector* files = Vector_new(sizeof(CacheFile));
+  if (!files)
+    die("Vector_new() failed");
+
+  uint64_t total = 0;
+  struct dirent* d;
+  while ((d = readdir(dir)) != NULL) {
+    struct stat st;
+    if (!isEntryName(d->d_name) || fstatat(dirfd(dir), d->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode))
+      continue;
+
+    CacheFile f = {.used = st.st_mtim, .size = (uint64_t)st.st_size};
+    memcpy(f.name, d->d_name, sizeof(f.name));
+    if (Vector_push(files, &f) == -1)
+      die("Vector_push() failed");
+    total += f.size;
+  }
+
+  if (total > c->max_size) {
+    CacheFile* f = Vector_at(files, 0);
+    size_t const n = Vector_len(files);
+    qsort(f, n, sizeof(*f), compareUse);
+    for (size_t i = 0; i < n && total > c->max_size; ++i) {
+      if (unlinkat(dirfd(dir), f[i].name, 0) == 0 || errno == ENOENT)
+        total -= f[i].size;
+    }
+  }
+
+  Vector_destroy(files);
+  closedir(dir);
+}
+
+static bool isEntryName(char const* name) {
+  size_t i = 0;
+  for (; name[i]; ++i)
+    if (i == CACHE_KEY_LEN || !((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+      return false;
+  return i == CACHE_KEY_LEN;
+}
+
+static int compareUse(void const* a, void const* b) {
+  struct timespec const *x = &((CacheFile const*)a)->used, *y = &((CacheFile const*)b)->used;
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Content-addressed cache of assembled outputs
+ *
+ * An entry is a file named after the 64-bit key of everything the output
+ * depends on (see Hash_bytes()), holding a header and the output bytes.
+ * Entries are created under a temporary name and renamed into place, which
+ * is atomic: builds sharing the directory see a whole entry or none. A hit
+ * maps the entry and marks it used by touching its modification time; once
+ * the entries take more than `max_size` bytes, the least recently used ones
+ * are removed.
+ */
+typedef struct {
+  char* dir;
+  uint64_t max_size;
+} Cache;
+
+/* A mapped entry */
+typedef struct {
+  void const* data; //< The output bytes
+  size_t len;
+  void* map;
+  size_t map_len;
+} CacheEntry;
+
+/* Use a directory as a cache, creating it if needed
+ *
+ * @returns 0 on success, -1 if it can't be created (errno is set)
+ */
+int Cache_open(Cache* c, char const* dir, uint64_t max_size);
+void Cache_close(Cache* c);
+
+/* Map the entry of a key
+ *
+ * @returns 0 on a hit, -1 on a miss
+ */
+int Cache_get(Cache* c, uint64_t key, CacheEntry* e);
+
+/* Unmap an entry */
+void CacheEntry_release(CacheEntry* e);
+
+/* Store the entry of a key, then evict entries over the size limit
+ *
+ * @returns 0 on success, -1 on failure (errno is set); the cache is left
+ *   as it was
+ */
+int Cache_put(Cache* c, uint64_t key, void const* data, size_t len);
+
+/* Cache_put() with the contents of a file */
+int Cache_putFile(Cache* c, uint64_t key, char const* path);
+
+#endif // CACHE_H
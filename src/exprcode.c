@@ -0,0 +1,524 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "lexer.h"
+#include "utility.h"
+#include "vector.h"
+
+/* GCC and Clang dispatch through a table of label addresses, every opcode
+ * jumping straight to the next one; anything else (or -DEXPRCODE_SWITCH)
+ * gets a switch */
+#if defined(__GNUC__) && !defined(EXPRCODE_SWITCH)
+#define EXPRCODE_THREADED
+#endif
+
+#define NOT_AN_OPCODE -1
+
+static int opcodeOf(Token const* tok);
+static inline int32_t binary(ExprOpcode op, int64_t x, int64_t y);
+
+uint8_t* ExprCode_compile(Vector* expr, ExprSymbolIdFn id, void* ctx) {
+  assert(expr);
+  assert(id);
+
+  /* Size the program and check the stack depth, so the evaluator doesn't
+   * have to */
+  size_t size = 1, depth = 0;
+  for (size_t i = 0; i < Vector_len(expr); ++i) {
+    Token const* tok = Vector_at(expr, i);
+    int const op = opcodeOf(tok);
+    switch (op) {
+    case NOT_AN_OPCODE:
+      return NULL;
+    case EXPR_OP_IMM:
+    case EXPR_OP_SYM:
+      size += 1 + sizeof(uint32_t);
+      depth += 1;
+      if (depth > LEXER_MAX_LINE_LEN)
+        return NULL;
+      break;
+    case EXPR_OP_END: // Unary plus
+    case EXPR_OP_NEG:
+    case EXPR_OP_NOT:
+    case EXPR_OP_CPL:
+      if (depth < 1)
+        return NULL;
+      size += op != EXPR_OP_END;
+      break;
+    default:
+      if (depth < 2)
+        return NULL;
+      depth -= 1;
+      size += 1;
+    }
+  }
+  if (depth != 1)
+    return NULL;
+
+  uint8_t* code = malloc(size);
+  if (!code)
+    die("malloc() failed");
+
+  uint8_t* pc = code;
+  for (size_t i = 0; i < Vector_len(expr); ++i) {
+    Token const* tok = Vector_at(expr, i);
+    int const op = opcodeOf(tok);
+    if (op == EXPR_OP_END)
+      continue;
+
+    *pc++ = (uint8_t)op;
+    if (op == EXPR_OP_IMM) {
+      int32_t const value = tok->folded ? tok->folded_value : (int32_t)Token_toInt(tok);
+      memcpy(pc, &value, sizeof(value));
+      pc += sizeof(value);
+    } else if (op == EXPR_OP_SYM) {
+      uint32_t const sym = id(ctx, tok);
+      memcpy(pc, &sym, sizeof(sym));
+      pc += sizeof(sym);
+    }
+  }
+  *pc++ = EXPR_OP_END;
+  assert((size_t)(pc - code) == size);
+
+  return code;
+}
+
+#ifdef EXPRCODE_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define DISPATCH goto* dispatch[*pc++]
+#define OP(NAME) L_##NAME:
+#define NEXT DISPATCH
+#else
+#define OP(NAME) case NAME:
+#define NEXT continue
+#endif
+
+#define BINARY(OP)                                                                                                     \
+  do {                                                                                                                 \
+    sp -= 1;                                                                                                           \
+    sp[-1] = binary((OP), sp[-1], sp[0]);                                                                              \
+  } while (0)
+
+int ExprCode_eval(uint8_t const* code, ExprCodeLookupFn lookup, void* ctx, int32_t* result, ExprErrorType* err,
+                  uint32_t* sym) {
+  assert(code);
+  assert(lookup);
+  assert(result);
+  assert(err);
+  assert(sym);
+
+  int32_t stack[LEXER_MAX_LINE_LEN];
+  int32_t* sp = stack; //< Past the top
+  uint8_t const* pc = code;
+
+#ifdef EXPRCODE_THREADED
+  static void* const dispatch[] = {
+      [EXPR_OP_END] = &&L_EXPR_OP_END, [EXPR_OP_IMM] = &&L_EXPR_OP_IMM, [EXPR_OP_SYM] = &&L_EXPR_OP_SYM,
+      [EXPR_OP_NEG] = &&L_EXPR_OP_NEG, [EXPR_OP_NOT] = &&L_EXPR_OP_NOT, [EXPR_OP_CPL] = &&L_EXPR_OP_CPL,
+      [EXPR_OP_ADD] = &&L_EXPR_OP_ADD, [EXPR_OP_SUB] = &&L_EXPR_OP_SUB, [EXPR_OP_MUL] = &&L_EXPR_OP_MUL,
+      [EXPR_OP_DIV] = &&L_EXPR_OP_DIV, [EXPR_OP_MOD] = &&L_EXPR_OP_MOD, [EXPR_OP_XOR] = &&L_EXPR_OP_XOR,
+      [EXPR_OP_AND] = &&L_EXPR_OP_AND, [EXPR_OP_OR] = &&L_EXPR_OP_OR,   [EXPR_OP_SHL] = &&L_EXPR_OP_SHL,
+      [EXPR_OP_SHR] = &&L_EXPR_OP_SHR, [EXPR_OP_LAND] = &&L_EXPR_OP_LAND, [EXPR_OP_LOR] = &&L_EXPR_OP_LOR,
+      [EXPR_OP_EQ] = &&L_EXPR_OP_EQ,   [EXPR_OP_NE] = &&L_EXPR_OP_NE,   [EXPR_OP_LT] = &&L_EXPR_OP_LT,
+      [EXPR_OP_GT] = &&L_EXPR_OP_GT,   [EXPR_OP_LE] = &&L_EXPR_OP_LE,   [EXPR_OP_GE] = &&L_EXPR_OP_GE,
+  };
+  DISPATCH;
+#else
+  for (;;)
+    switch ((ExprOpcode)*pc++) {
+#endif
+
+  OP(EXPR_OP_IMM) {
+    memcpy(sp++, pc, sizeof(int32_t));
+    pc += sizeof(int32_t);
+    NEXT;
+  }
+  OP(EXPR_OP_SYM) {
+    uint32_t id;
+    memcpy(&id, pc, sizeof(id));
+    pc += sizeof(id);
+    if (lookup(ctx, id, sp) == -1) {
+      *err = EXPR_ERROR_UNRESOLVED_SYMBOL;
+      *sym = id;
+      return -1;
+    }
+    sp += 1;
+    NEXT;
+  }
+  OP(EXPR_OP_NEG) {
+    sp[-1] = (int32_t)(-(int64_t)sp[-1]);
+    NEXT;
+  }
+  OP(EXPR_OP_NOT) {
+    sp[-1] = !sp[-1];
+    NEXT;
+  }
+  OP(EXPR_OP_CPL) {
+    sp[-1] = ~sp[-1];
+    NEXT;
+  }
+  OP(EXPR_OP_ADD) {
+    BINARY(EXPR_OP_ADD);
+    NEXT;
+  }
+  OP(EXPR_OP_SUB) {
+    BINARY(EXPR_OP_SUB);
+    NEXT;
+  }
+  OP(EXPR_OP_MUL) {
+    BINARY(EXPR_OP_MUL);
+    NEXT;
+  }
+  OP(EXPR_OP_DIV) {
+    if (sp[-1] == 0) {
+      *err = EXPR_ERROR_DIVISION_BY_ZERO;
+      return -1;
+    }
+    BINARY(EXPR_OP_DIV);
+    NEXT;
+  }
+  OP(EXPR_OP_MOD) {
+    if (sp[-1] == 0) {
+      *err = EXPR_ERROR_DIVISION_BY_ZERO;
+      return -1;
+    }
+    BINARY(EXPR_OP_MOD);
+    NEXT;
+  }
+  OP(EXPR_OP_XOR) {
+    BINARY(EXPR_OP_XOR);
+    NEXT;
+  }
+  OP(EXPR_OP_AND) {
+    BINARY(EXPR_OP_AND);
+    NEXT;
+  }
+  OP(EXPR_OP_OR) {
+    BINARY(EXPR_OP_OR);
+    NEXT;
+  }
+  OP(EXPR_OP_SHL) {
+    BINARY(EXPR_OP_SHL);
+    NEXT;
+  }
+  OP(EXPR_OP_SHR) {
+    BINARY(EXPR_OP_SHR);
+    NEXT;
+  }
+  OP(EXPR_OP_LAND) {
+    BINARY(EXPR_OP_LAND);
+    NEXT;
+  }
+  OP(EXPR_OP_LOR) {
+    BINARY(EXPR_OP_LOR);
+    NEXT;
+  }
+  OP(EXPR_OP_EQ) {
+    BINARY(EXPR_OP_EQ);
+    NEXT;
+  }
+  OP(EXPR_OP_NE) {
+    BINARY(EXPR_OP_NE);
+    NEXT;
+  }
+  OP(EXPR_OP_LT) {
+    BINARY(EXPR_OP_LT);
+    NEXT;
+  }
+  OP(EXPR_OP_GT) {
+    BINARY(EXPR_OP_GT);
+    NEXT;
+  }
+  OP(EXPR_OP_LE) {
+    BINARY(EXPR_OP_LE);
+    NEXT;
+  }
+  OP(EXPR_OP_GE) {
+    BINARY(EXPR_OP_GE);
+    NEXT;
+  }
+  OP(EXPR_OP_END) {
+    assert(sp == stack + 1);
+    *result = stack[0];
+    return 0;
+  }
+
+#ifndef EXPRCODE_THREADED
+  default:
+    die("ExprCode_eval(): invalid opcode");
+  }
+#endif
+}
+
+#undef BINARY
+#undef OP
+#undef NEXT
+#ifdef EXPRCODE_THREADED
+#undef DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+size_t ExprCode_size(uint8_t const* code) {
+  assert(code);
+
+  uint8_t const* pc = code;
+  while (*pc != EXPR_OP_END)
+    pc += *pc == EXPR_OP_IMM || *pc == EXPR_OP_SYM ? 1 + sizeof(uint32_t) : 1;
+  return (size_t)(pc - code) + 1;
+}
+
+void ExprCode_store(uint8_t const* code, uint8_t* out) {
+  assert(code);
+  assert(out);
+
+  for (uint8_t const* pc = code;;) {
+    uint8_t const op = *pc++;
+    *out++ = op;
+    if (op == EXPR_OP_END)
+      return;
+    if (op == EXPR_OP_IMM || op == EXPR_OP_SYM) {
+      uint32_t operand;
+      memcpy(&operand, pc, sizeof(operand));
+      pc += sizeof(operand);
+      for (size_t i = 0; i < sizeof(operand); ++i)
+        *out++ = (uint8_t)(operand >> (8 * i));
+    }
+  }
+}
+
+uint8_t* ExprCode_load(uint8_t const* data, size_t len, size_t* used) {
+  assert(data || len == 0);
+  assert(used);
+
+  /* Check the program and find its end first */
+  size_t size = 0, depth = 0;
+  for (;;) {
+    if (size == len)
+      return NULL;
+    uint8_t const op = data[size++];
+    if (op == EXPR_OP_END)
+      break;
+    switch (op) {
+    case EXPR_OP_IMM:
+    case EXPR_OP_SYM:
+      if (len - size < sizeof(uint32_t) || depth == LEXER_MAX_LINE_LEN)
+        return NULL;
+      size += sizeof(uint32_t);
+      depth += 1;
+      break;
+    case EXPR_OP_NEG:
+    case EXPR_OP_NOT:
+    case EXPR_OP_CPL:
+      if (depth < 1)
+        return NULL;
+      break;
+    default:
+      if (op > EXPR_OP_GE || depth < 2)
+        return NULL;
+      depth -= 1;
+    }
+  }
+  if (depth != 1)
+    return NULL;
+
+  uint8_t* code = malloc(size);
+  if (!code)
+    die("malloc() failed");
+
+  for (size_t i = 0; i < size;) {
+    uint8_t const op = data[i];
+    code[i++] = op;
+    if (op == EXPR_OP_IMM || op == EXPR_OP_SYM) {
+      uint32_t operand = 0;
+      for (size_t k = 0; k < sizeof(operand); ++k)
+        operand |= (uint32_t)data[i + k] << (8 * k);
+      memcpy(code + i, &operand, sizeof(operand));
+      i += sizeof(operand);
+    }
+  }
+
+  *used = size;
+  return code;
+}
+
+int ExprOpcode_apply(ExprOpcode op, int32_t x, int32_t y, int32_t* result) {
+  assert(result);
+
+  switch (op) {
+  case EXPR_OP_NEG:
+    *result = (int32_t)(-(int64_t)x);
+    return 0;
+  case EXPR_OP_NOT:
+    *result = !x;
+    return 0;
+  case EXPR_OP_CPL:
+    *result = ~x;
+    return 0;
+  case EXPR_OP_DIV:
+  case EXPR_OP_MOD:
+    if (y == 0)
+      return -1;
+    *result = binary(op, x, y);
+    return 0;
+  case EXPR_OP_ADD:
+  case EXPR_OP_SUB:
+  case EXPR_OP_MUL:
+  case EXPR_OP_XOR:
+  case EXPR_OP_AND:
+  case EXPR_OP_OR:
+  case EXPR_OP_SHL:
+  case EXPR_OP_SHR:
+  case EXPR_OP_LAND:
+  case EXPR_OP_LOR:
+  case EXPR_OP_EQ:
+  case EXPR_OP_NE:
+  case EXPR_OP_LT:
+  case EXPR_OP_GT:
+  case EXPR_OP_LE:
+  case EXPR_OP_GE:
+    *result = binary(op, x, y);
+    return 0;
+  case EXPR_OP_END:
+  case EXPR_OP_IMM:
+  case EXPR_OP_SYM:
+  default:
+    die("ExprOpcode_apply(): not an operator");
+  }
+}
+
+/* Binary operators compute in 64 bits and truncate, like Expr_eval. Called
+ * with a constant `op`, so it's folded into the handlers of ExprCode_eval. */
+static inline int32_t binary(ExprOpcode op, int64_t x, int64_t y) {
+  switch (op) {
+  case EXPR_OP_ADD:
+    return (int32_t)(x + y);
+  case EXPR_OP_SUB:
+    return (int32_t)(x - y);
+  case EXPR_OP_MUL:
+    return (int32_t)(x * y);
+  case EXPR_OP_DIV:
+    return (int32_t)(x / y);
+  case EXPR_OP_MOD:
+    return (int32_t)(x % y);
+  case EXPR_OP_XOR:
+    return (int32_t)(x ^ y);
+  case EXPR_OP_AND:
+    return (int32_t)(x & y);
+  case EXPR_OP_OR:
+    return (int32_t)(x | y);
+  case EXPR_OP_SHL:
+    return (y < 0 || y >= 32) ? 0 : (int32_t)(int64_t)((uint64_t)x << y);
+  case EXPR_OP_SHR:
+    return (y < 0 || y >= 32) ? 0 : (int32_t)(x >> y);
+  case EXPR_OP_LAND:
+    return x && y;
+  case EXPR_OP_LOR:
+    return x || y;
+  case EXPR_OP_EQ:
+    return x == y;
+  case EXPR_OP_NE:
+    return x != y;
+  case EXPR_OP_LT:
+    return x < y;
+  case EXPR_OP_GT:
+    return x > y;
+  case EXPR_OP_LE:
+    return x <= y;
+  case EXPR_OP_GE:
+    return x >= y;
+  case EXPR_OP_END:
+  case EXPR_OP_IMM:
+  case EXPR_OP_SYM:
+  case EXPR_OP_NEG:
+  case EXPR_OP_NOT:
+  case EXPR_OP_CPL:
+  default:
+    assert(false && "not a binary operator");
+    return 0;
+  }
+}
+
+static int opcodeOf(Token const* tok) {
+  if (tok->folded)
+    return EXPR_OP_IMM;
+
+  if (tok->unary) {
+    if (tok->type == TOKEN_PLUS)
+      return EXPR_OP_END;
+    if (tok->type == TOKEN_MINUS)
+      return EXPR_OP_NEG;
+    if (tok->type == TOKEN_BANG)
+      return EXPR_OP_NOT;
+    if (tok->type == TOKEN_TILDE)
+      return EXPR_OP_CPL;
+    return NOT_AN_OPCODE;
+  }
+
+  switch (tok->type) {
+  case TOKEN_DECIMAL:
+  case TOKEN_HEXADECIMAL:
+  case TOKEN_OCTAL:
+  case TOKEN_BINARY:
+  case TOKEN_CHAR:
+    return EXPR_OP_IMM;
+  case TOKEN_ID:
+    return EXPR_OP_SYM;
+  case TOKEN_PLUS:
+    return EXPR_OP_ADD;
+  case TOKEN_MINUS:
+    return EXPR_OP_SUB;
+  case TOKEN_STAR:
+    return EXPR_OP_MUL;
+  case TOKEN_SLASH:
+    return EXPR_OP_DIV;
+  case TOKEN_PERCENT:
+    return EXPR_OP_MOD;
+  case TOKEN_CAP:
+    return EXPR_OP_XOR;
+  case TOKEN_AMPERSAND:
+    return EXPR_OP_AND;
+  case TOKEN_BAR:
+    return EXPR_OP_OR;
+  case TOKEN_LEFT_SHIFT:
+    return EXPR_OP_SHL;
+  case TOKEN_RIGHT_SHIFT:
+    return EXPR_OP_SHR;
+  case TOKEN_DOUBLE_AMPERSAND:
+    return EXPR_OP_LAND;
+  case TOKEN_DOUBLE_BAR:
+    return EXPR_OP_LOR;
+  case TOKEN_EQUAL_EQUAL:
+    return EXPR_OP_EQ;
+  case TOKEN_BANG_EQUAL:
+    return EXPR_OP_NE;
+  case TOKEN_LEFT_BRACE:
+    return EXPR_OP_LT;
+  case TOKEN_RIGHT_BRACE:
+    return EXPR_OP_GT;
+  case TOKEN_LESS_EQUAL:
+    return EXPR_OP_LE;
+  case TOKEN_GREATER_EQUAL:
+    return EXPR_OP_GE;
+  case TOKEN_UNINITIALIZED:
+  case TOKEN_END:
+  case TOKEN_ERROR:
+  case TOKEN_STRING:
+  case TOKEN_LEFT_PAREN:
+  case TOKEN_RIGHT_PAREN:
+  case TOKEN_COMMA:
+  case TOKEN_TILDE:
+  case TOKEN_BANG:
+  case TOKEN_COLON:
+  case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
+  default:
+    return NOT_AN_OPCODE;
+  }
+}
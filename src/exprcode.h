@@ -0,0 +1,122 @@
+#ifndef EXPRCODE_H
+#define EXPRCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "expression.h"
+#include "lexer.h"
+#include "vector.h"
+
+/* Expression bytecode
+ *
+ * RPN expressions are compiled once into a dense program for the passes
+ * that evaluate them over and over (resolution, relayout, relaxation):
+ * 1-byte opcodes, literals as inline 32-bit immediates and symbols as
+ * 32-bit IDs handed out by the caller. The program is checked when it's
+ * compiled, so the evaluator doesn't check the stack.
+ *
+ * Immediates and IDs are stored in host byte order and read with memcpy.
+ * Objects (see object.h) store programs with little-endian operands, see
+ * ExprCode_store() and ExprCode_load().
+ */
+typedef enum {
+  EXPR_OP_END = 0,
+  EXPR_OP_IMM, //< Followed by int32_t
+  EXPR_OP_SYM, //< Followed by uint32_t symbol ID
+  EXPR_OP_NEG,
+  EXPR_OP_NOT,
+  EXPR_OP_CPL,
+  EXPR_OP_ADD, //< Binary operators from here on
+
+  EXPR_OP_SUB,
+  EXPR_OP_MUL,
+  EXPR_OP_DIV,
+  EXPR_OP_MOD,
+  EXPR_OP_XOR,
+  EXPR_OP_AND,
+  EXPR_OP_OR,
+  EXPR_OP_SHL,
+  EXPR_OP_SHR,
+  EXPR_OP_LAND,
+  EXPR_OP_LOR,
+  EXPR_OP_EQ,
+  EXPR_OP_NE,
+  EXPR_OP_LT,
+  EXPR_OP_GT,
+  EXPR_OP_LE,
+  EXPR_OP_GE,
+} ExprOpcode;
+
+/** Symbol ID callback for the compiler
+ *
+ * @param ctx User data passed to ExprCode_compile
+ * @param sym TOKEN_ID token naming the symbol
+ * @returns ID of the symbol, the same for every occurrence of the name
+ */
+typedef uint32_t (*ExprSymbolIdFn)(void* ctx, Token const* sym);
+
+/** Symbol value lookup callback for the evaluator
+ *
+ * @param ctx User data passed to ExprCode_eval
+ * @param id Symbol ID given by the ExprSymbolIdFn
+ * @param value Output value of the symbol
+ * @returns 0 if the symbol has a value, -1 otherwise
+ */
+typedef int (*ExprCodeLookupFn)(void* ctx, uint32_t id, int32_t* value);
+
+/** Compile an expression
+ *
+ * @param expr An expression produced by ExprParser (Vector[Token])
+ * @param id Symbol ID callback
+ * @param ctx User data for the callback
+ * @returns Heap-allocated program, or NULL if the expression is malformed
+ *   (Expr_eval reports why)
+ */
+uint8_t* ExprCode_compile(Vector* expr, ExprSymbolIdFn id, void* ctx);
+
+/** Evaluate a compiled expression
+ *
+ * Gives the same results as Expr_eval on the source expression.
+ *
+ * @param code Program from ExprCode_compile
+ * @param lookup Symbol lookup callback
+ * @param ctx User data for the callback
+ * @param result Output value
+ * @param err On failure, EXPR_ERROR_UNRESOLVED_SYMBOL or
+ *   EXPR_ERROR_DIVISION_BY_ZERO
+ * @param sym For EXPR_ERROR_UNRESOLVED_SYMBOL, the ID of the symbol
+ * @returns 0 on success, -1 on failure
+ */
+int ExprCode_eval(uint8_t const* code, ExprCodeLookupFn lookup, void* ctx, int32_t* result, ExprErrorType* err,
+                  uint32_t* sym);
+
+/** Size of a program in bytes, EXPR_OP_END included */
+size_t ExprCode_size(uint8_t const* code);
+
+/** Copy a program with its operands in little-endian order
+ *
+ * @param out ExprCode_size(code) bytes
+ */
+void ExprCode_store(uint8_t const* code, uint8_t* out);
+
+/** Load a program stored by ExprCode_store
+ *
+ * The data comes from a file, so it's checked as ExprCode_compile checks
+ * an expression.
+ *
+ * @param data Stored program, up to `len` bytes
+ * @param used Output number of bytes the program takes
+ * @returns Heap-allocated program, or NULL if the data is not a valid one
+ */
+uint8_t* ExprCode_load(uint8_t const* data, size_t len, size_t* used);
+
+/** Apply an operator to evaluated operands, as ExprCode_eval does
+ *
+ * @param op A unary or binary operator
+ * @param y Right operand, ignored by unary operators
+ * @returns 0 on success, -1 on division by zero
+ */
+int ExprOpcode_apply(ExprOpcode op, int32_t x, int32_t y, int32_t* result);
+
+#endif // EXPRCODE_H
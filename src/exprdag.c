@@ -0,0 +1,266 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "exprdag.h"
+#include "lexer.h"
+#include "utility.h"
+#include "vector.h"
+
+#define EXPR_DAG_INITIAL_CAPACITY 64
+
+typedef struct {
+  uint32_t user; //< Node with the operand as its operand
+  uint32_t next; //< Next edge of the operand, 0 if none
+} ExprEdge;
+
+static uint32_t* slot(ExprDag* dag, ExprNode const* key);
+static uint32_t internNode(ExprDag* dag, ExprNode key);
+static void addUser(ExprDag* dag, uint32_t operand, uint32_t user);
+static void grow(ExprDag* dag);
+static int evalNode(ExprDag* dag, uint32_t idx, ExprCodeLookupFn lookup, void* ctx, int32_t* result,
+                    ExprErrorType* err, uint32_t* sym);
+static uint32_t hashKey(ExprNode const* n);
+static bool sameKey(ExprNode const* x, ExprNode const* y);
+static bool isBinary(uint8_t op);
+
+ExprDag ExprDag_make(void) {
+  Vector* nodes = Vector_new(sizeof(ExprNode));
+  Vector* edges = Vector_new(sizeof(ExprEdge));
+  Vector* stack = Vector_new(sizeof(uint32_t));
+  if (!nodes || !edges || !stack)
+    die("Vector_new() failed");
+
+  /* Index 0 of both is reserved for "none" */
+  ExprNode const none = {0};
+  ExprEdge const no_edge = {0};
+  if (Vector_push(nodes, &none) == -1 || Vector_push(edges, &no_edge) == -1)
+    die("Vector_push() failed");
+
+  uint32_t* table = calloc(EXPR_DAG_INITIAL_CAPACITY, sizeof(*table));
+  if (!table)
+    die("calloc() failed");
+
+  return (ExprDag){
+      .nodes = nodes,
+      .edges = edges,
+      .table = table,
+      .capacity = EXPR_DAG_INITIAL_CAPACITY,
+      .stack = stack,
+  };
+}
+
+void ExprDag_deinit(ExprDag* dag) {
+  assert(dag);
+  for (size_t i = 0; i < Vector_len(dag->nodes); ++i)
+    free(((ExprNode*)Vector_at(dag->nodes, i))->code);
+  Vector_destroy(dag->nodes);
+  Vector_destroy(dag->edges);
+  Vector_destroy(dag->stack);
+  free(dag->table);
+}
+
+uint32_t ExprDag_intern(ExprDag* dag, uint8_t* code) {
+  assert(dag);
+  assert(code);
+
+  /* The program was checked by the compiler, so the stack fits */
+  uint32_t stack[LEXER_MAX_LINE_LEN];
+  size_t sp = 0;
+  for (uint8_t const* pc = code; *pc != EXPR_OP_END;) {
+    ExprNode key = {.op = *pc++};
+    if (key.op == EXPR_OP_IMM) {
+      memcpy(&key.value, pc, sizeof(key.value));
+      pc += sizeof(key.value);
+    } else if (key.op == EXPR_OP_SYM) {
+      memcpy(&key.a, pc, sizeof(key.a));
+      pc += sizeof(key.a);
+    } else if (isBinary(key.op)) {
+      assert(sp >= 2);
+      key.b = stack[--sp];
+      key.a = stack[--sp];
+    } else {
+      assert(sp >= 1);
+      key.a = stack[--sp];
+    }
+    stack[sp++] = internNode(dag, key);
+  }
+  assert(sp == 1);
+
+  ExprNode* root = Vector_at(dag->nodes, stack[0]);
+  if (root->code)
+    free(code);
+  else
+    root->code = code;
+  return stack[0];
+}
+
+int ExprDag_eval(ExprDag* dag, uint32_t root, ExprCodeLookupFn lookup, void* ctx, int32_t* result,
+                 ExprErrorType* err, uint32_t* sym) {
+  assert(dag);
+  assert(root != EXPR_DAG_NONE && root < Vector_len(dag->nodes));
+  assert(lookup);
+  assert(result);
+  assert(err);
+  assert(sym);
+
+  return evalNode(dag, root, lookup, ctx, result, err, sym);
+}
+
+void ExprDag_invalidate(ExprDag* dag, uint32_t sym) {
+  assert(dag);
+
+  ExprNode const key = {.op = EXPR_OP_SYM, .a = sym};
+  uint32_t const leaf = *slot(dag, &key);
+  if (leaf == EXPR_DAG_NONE)
+    return;
+
+  /* A valid node only has valid operands, so the walk stops at the nodes
+   * which are already invalid */
+  if (Vector_push(dag->stack, &leaf) == -1)
+    die("Vector_push() failed");
+  while (!Vector_isEmpty(dag->stack)) {
+    uint32_t idx;
+    Vector_pop(dag->stack, &idx);
+
+    uint32_t e = ((ExprNode*)Vector_at(dag->nodes, idx))->users;
+    while (e != 0) {
+      ExprEdge const* edge = Vector_at(dag->edges, e);
+      ExprNode* user = Vector_at(dag->nodes, edge->user);
+      if (user->valid) {
+        user->valid = false;
+        if (Vector_push(dag->stack, &edge->user) == -1)
+          die("Vector_push() failed");
+      }
+      e = edge->next;
+    }
+  }
+}
+
+uint8_t const* ExprDag_code(ExprDag* dag, uint32_t root) {
+  assert(dag);
+  assert(root != EXPR_DAG_NONE && root < Vector_len(dag->nodes));
+
+  ExprNode const* n = Vector_at(dag->nodes, root);
+  assert(n->code && "not a root");
+  return n->code;
+}
+
+size_t ExprDag_len(ExprDag const* dag) {
+  assert(dag);
+  return Vector_len(dag->nodes) - 1;
+}
+
+/* The slot of the table holding the node equal to `key`, or the empty slot
+ * where it would go */
+static uint32_t* slot(ExprDag* dag, ExprNode const* key) {
+  size_t const mask = dag->capacity - 1;
+  for (size_t i = hashKey(key) & mask;; i = (i + 1) & mask) {
+    uint32_t* s = &dag->table[i];
+    if (*s == EXPR_DAG_NONE || sameKey(Vector_at(dag->nodes, *s), key))
+      return s;
+  }
+}
+
+static uint32_t internNode(ExprDag* dag, ExprNode key) {
+  uint32_t* s = slot(dag, &key);
+  if (*s != EXPR_DAG_NONE)
+    return *s;
+
+  if (Vector_len(dag->nodes) == UINT32_MAX)
+    die("ExprDag_intern(): too many nodes");
+  uint32_t const idx = (uint32_t)Vector_len(dag->nodes);
+
+  /* Immediates are always valid; symbols are looked up every time, the
+   * nodes using them hold the cached values */
+  key.valid = key.op == EXPR_OP_IMM;
+  if (Vector_push(dag->nodes, &key) == -1)
+    die("Vector_push() failed");
+  *s = idx;
+
+  if (key.op != EXPR_OP_IMM && key.op != EXPR_OP_SYM) {
+    addUser(dag, key.a, idx);
+    if (isBinary(key.op) && key.b != key.a)
+      addUser(dag, key.b, idx);
+  }
+
+  /* Keep the load under 3/4 */
+  if (4 * (Vector_len(dag->nodes) - 1) > 3 * dag->capacity)
+    grow(dag);
+  return idx;
+}
+
+static void addUser(ExprDag* dag, uint32_t operand, uint32_t user) {
+  ExprNode* n = Vector_at(dag->nodes, operand);
+  ExprEdge const edge = {.user = user, .next = n->users};
+  if (Vector_len(dag->edges) == UINT32_MAX)
+    die("ExprDag_intern(): too many edges");
+  n->users = (uint32_t)Vector_len(dag->edges);
+  if (Vector_push(dag->edges, &edge) == -1)
+    die("Vector_push() failed");
+}
+
+static void grow(ExprDag* dag) {
+  free(dag->table);
+  dag->capacity *= 2;
+  dag->table = calloc(dag->capacity, sizeof(*dag->table));
+  if (!dag->table)
+    die("calloc() failed");
+
+  for (size_t i = 1; i < Vector_len(dag->nodes); ++i)
+    *slot(dag, Vector_at(dag->nodes, i)) = (uint32_t)i;
+}
+
+static int evalNode(ExprDag* dag, uint32_t idx, ExprCodeLookupFn lookup, void* ctx, int32_t* result,
+                    ExprErrorType* err, uint32_t* sym) {
+  ExprNode* n = Vector_at(dag->nodes, idx);
+  if (n->valid) {
+    *result = n->value;
+    return 0;
+  }
+
+  if (n->op == EXPR_OP_SYM) {
+    if (lookup(ctx, n->a, result) == -1) {
+      *err = EXPR_ERROR_UNRESOLVED_SYMBOL;
+      *sym = n->a;
+      return -1;
+    }
+    return 0;
+  }
+
+  /* Left to right, so the same error is reported as by ExprCode_eval */
+  int32_t x, y = 0;
+  if (evalNode(dag, n->a, lookup, ctx, &x, err, sym) == -1)
+    return -1;
+  if (isBinary(n->op) && evalNode(dag, n->b, lookup, ctx, &y, err, sym) == -1)
+    return -1;
+  if (ExprOpcode_apply((ExprOpcode)n->op, x, y, &n->value) == -1) {
+    *err = EXPR_ERROR_DIVISION_BY_ZERO;
+    return -1;
+  }
+
+  n->valid = true;
+  *result = n->value;
+  return 0;
+}
+
+static uint32_t hashKey(ExprNode const* n) {
+  uint32_t const words[] = {n->op, n->a, n->b, n->op == EXPR_OP_IMM ? (uint32_t)n->value : 0};
+  uint32_t h = 0;
+  for (size_t i = 0; i < sizeof(words) / sizeof(*words); ++i) {
+    h = (h ^ words[i]) * 0x9e3779b1u;
+    h ^= h >> 16;
+  }
+  return h;
+}
+
+/* The cached value is not part of the key, except for immediates */
+static bool sameKey(ExprNode const* x, ExprNode const* y) {
+  return x->op == y->op && x->a == y->a && x->b == y->b && (x->op != EXPR_OP_IMM || x->value == y->value);
+}
+
+static bool isBinary(uint8_t op) { return op >= EXPR_OP_ADD; }
@@ -0,0 +1,71 @@
+#ifndef EXPRDAG_H
+#define EXPRDAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "vector.h"
+
+/* Node 0 is reserved, so a zeroed reference means "not interned" */
+#define EXPR_DAG_NONE 0
+
+typedef struct {
+  uint8_t op;     //< ExprOpcode
+  bool valid;     //< `value` is up to date
+  uint32_t a;     //< EXPR_OP_SYM: the symbol ID; operators: the (left) operand
+  uint32_t b;     //< Binary operators: the right operand
+  int32_t value;  //< EXPR_OP_IMM: the immediate; operators: the cached result
+  uint32_t users; //< First edge to a node using this one, 0 if none
+  uint8_t* code;  //< Program of the first expression interned with this root
+} ExprNode;
+
+/* Hash-consed expression DAG
+ *
+ * Compiled expressions are interned node by node, so equal subexpressions,
+ * wherever they occur, are one node with one cached value, and the memory
+ * grows with the number of distinct expressions rather than with the
+ * number of operands. When a symbol changes its value, only the nodes above
+ * it are invalidated and computed again on the next evaluation.
+ *
+ * The cache assumes that the lookup callback gives the same values as long
+ * as no symbol is invalidated.
+ */
+typedef struct {
+  Vector* nodes;   //< Vector[ExprNode]
+  Vector* edges;   //< Vector[ExprEdge]: lists of users
+  uint32_t* table; //< Open addressing hash table of node indices, 0 is empty
+  size_t capacity; //< Of the table, a power of two
+  Vector* stack;   //< Scratch space for the invalidation
+} ExprDag;
+
+ExprDag ExprDag_make(void);
+void ExprDag_deinit(ExprDag* dag);
+
+/* Intern a compiled expression
+ *
+ * @param code Program from ExprCode_compile, ownership is taken: it's kept
+ *   for the root if that's new and freed otherwise
+ * @returns The root node
+ */
+uint32_t ExprDag_intern(ExprDag* dag, uint8_t* code);
+
+/* Evaluate an interned expression, reusing the values of valid nodes
+ *
+ * Same results and errors as ExprCode_eval on the program of the root.
+ */
+int ExprDag_eval(ExprDag* dag, uint32_t root, ExprCodeLookupFn lookup, void* ctx, int32_t* result,
+                 ExprErrorType* err, uint32_t* sym);
+
+/* Drop the cached values that depend on a symbol, after its value changed */
+void ExprDag_invalidate(ExprDag* dag, uint32_t sym);
+
+/* Program of an interned expression, for evaluation with other symbol values */
+uint8_t const* ExprDag_code(ExprDag* dag, uint32_t root);
+
+/* Number of distinct nodes, the reserved one excluded */
+size_t ExprDag_len(ExprDag const* dag);
+
+#endif // EXPRDAG_H
@@ -1,16 +1,30 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "expression.h"
 #include "lexer.h"
 #include "utility.h"
 
+static void* spill(void const* buf, void* heap, size_t len, size_t* cap, size_t elem_size);
+static Token* tokens(ExprTokenStack* s);
+static void pushToken(ExprTokenStack* s, Token const* tok);
+static Token popToken(ExprTokenStack* s);
+static ExprOperand* operands(ExprOperandStack* s);
+static void pushOperand(ExprOperandStack* s, ExprOperand const* op);
+static ExprOperand popOperand(ExprOperandStack* s);
+static void emitTerm(ExprParser* p, Token const* tok);
+static void emitOperator(ExprParser* p, Token const* tok);
+static Token foldedToken(Token const* at, int32_t value);
 static bool isTerm(Token const* tok);
 static bool isOp(Token const* tok);
 static int prec(Token const* tok);
+static int32_t applyUnary(TokenType type, int32_t a);
+static int applyBinary(TokenType type, int32_t a, int32_t b, int32_t* result);
 
-static inline Token const* top(Vector* v) {
-  assert(!Vector_isEmpty(v));
-  return Vector_at((Vector*)v, Vector_len(v) - 1);
+static inline Token const* top(ExprTokenStack* s) {
+  assert(s->len > 0);
+  return &tokens(s)[s->len - 1];
 }
 
 static inline void error(ExprParser* p, ExprErrorType type, Token tok) {
@@ -18,22 +32,22 @@ static inline void error(ExprParser* p, ExprErrorType type, Token tok) {
   p->has_error = true;
 }
 
-ExprParser ExprParser_make(void) {
-  Vector* expr = Vector_new(sizeof(Token));
-  if (!expr)
-    die("Vector_new() failed");
+ExprParser ExprParser_make(void) { return (ExprParser){0}; }
 
-  Vector* operators = Vector_new(sizeof(Token));
-  if (!operators)
-    die("Vector_new() failed");
-
-  return (ExprParser){.e = expr, .o = operators};
+void ExprParser_deinit(ExprParser* p) {
+  assert(p);
+  free(p->e.heap);
+  free(p->o.heap);
+  free(p->v.heap);
 }
 
-void ExprParser_deinit(ExprParser* p) {
+void ExprParser_reset(ExprParser* p) {
   assert(p);
-  Vector_destroy(p->e);
-  Vector_destroy(p->o);
+  p->e.len = p->o.len = p->v.len = 0;
+  p->prev = (Token){0};
+  p->error = (ExprError){0};
+  p->has_error = false;
+  p->malformed = false;
 }
 
 int ExprParser_get(ExprParser* p, Token tok) {
@@ -42,7 +56,7 @@ int ExprParser_get(ExprParser* p, Token tok) {
   Token* prev = &p->prev;
 
   if (isTerm(&tok)) {
-    Vector_push(p->e, &tok);
+    emitTerm(p, &tok);
 
   } else if (isOp(&tok)) {
     if (prev->type == TOKEN_UNINITIALIZED || isOp(prev) || prev->type == TOKEN_LEFT_PAREN) {
@@ -51,51 +65,48 @@ int ExprParser_get(ExprParser* p, Token tok) {
         return -1;
       }
       tok.unary = true;
-      Vector_push(p->o, &tok);
+      pushToken(&p->o, &tok);
 
-    } else if (Vector_isEmpty(p->o) || prec(&tok) > prec(top(p->o))) {
-      Vector_push(p->o, &tok);
+    } else if (p->o.len == 0 || prec(&tok) > prec(top(&p->o))) {
+      pushToken(&p->o, &tok);
 
     } else {
-      while (!Vector_isEmpty(p->o) && prec(&tok) <= prec(top(p->o))) {
-        Token tmp;
-        Vector_pop(p->o, &tmp);
-        Vector_push(p->e, &tmp);
+      while (p->o.len != 0 && prec(&tok) <= prec(top(&p->o))) {
+        Token const tmp = popToken(&p->o);
+        emitOperator(p, &tmp);
       }
-      Vector_push(p->o, &tok);
+      pushToken(&p->o, &tok);
     }
 
   } else if (tok.type == TOKEN_LEFT_PAREN) {
-    Vector_push(p->o, &tok);
+    pushToken(&p->o, &tok);
 
   } else if (tok.type == TOKEN_RIGHT_PAREN) {
     while (true) {
-      if (Vector_isEmpty(p->o)) {
+      if (p->o.len == 0) {
         error(p, EXPR_ERROR_UNBALANCED_RIGHT_PAREN, tok);
         return -1;
       }
-      if (top(p->o)->type == TOKEN_LEFT_PAREN) {
+      if (top(&p->o)->type == TOKEN_LEFT_PAREN) {
         break;
       }
-      Token tmp;
-      Vector_pop(p->o, &tmp);
-      Vector_push(p->e, &tmp);
+      Token const tmp = popToken(&p->o);
+      emitOperator(p, &tmp);
     }
-    Vector_pop(p->o, NULL);
+    popToken(&p->o);
   }
 
   else if (tok.type == TOKEN_END || tok.type == TOKEN_NEWLINE) {
-    while (!Vector_isEmpty(p->o)) {
-      if (top(p->o)->type == TOKEN_LEFT_PAREN) {
+    while (p->o.len != 0) {
+      if (top(&p->o)->type == TOKEN_LEFT_PAREN) {
         error(p, EXPR_ERROR_UNBALANCED_LEFT_PAREN, tok);
         return -1;
       }
-      Token tmp;
-      Vector_pop(p->o, &tmp);
-      Vector_push(p->e, &tmp);
+      Token const tmp = popToken(&p->o);
+      emitOperator(p, &tmp);
     }
 
-    assert(Vector_isEmpty(p->o));
+    assert(p->o.len == 0);
   }
 
   else {
@@ -108,6 +119,105 @@ int ExprParser_get(ExprParser* p, Token tok) {
   return 0;
 }
 
+bool ExprParser_isConstant(ExprParser const* p, int32_t* value) {
+  assert(p);
+  assert(value);
+
+  if (p->has_error || p->malformed || p->o.len != 0 || p->v.len != 1)
+    return false;
+  ExprOperand const* op = p->v.heap ? p->v.heap : p->v.buf;
+  if (!op->constant)
+    return false;
+  *value = op->value;
+  return true;
+}
+
+Vector* ExprParser_copyExpr(ExprParser const* p) {
+  assert(p);
+
+  Vector* expr = Vector_new(sizeof(Token));
+  if (!expr)
+    die("Vector_new() failed");
+  Token const* e = p->e.heap ? p->e.heap : p->e.buf;
+  for (size_t i = 0; i < p->e.len; ++i)
+    if (Vector_push(expr, &e[i]) == -1)
+      die("Vector_push() failed");
+  return expr;
+}
+
+Vector* Operand_toExpr(Operand const* op) {
+  assert(op);
+  if (op->expr)
+    return op->expr;
+
+  Vector* expr = Vector_new(sizeof(Token));
+  if (!expr)
+    die("Vector_new() failed");
+  Token const tok = foldedToken(&op->tok, op->value);
+  if (Vector_push(expr, &tok) == -1)
+    die("Vector_push() failed");
+  return expr;
+}
+
+int Expr_eval(Vector* expr, ExprLookupFn lookup, void* ctx, int32_t* result, ExprError* err) {
+  assert(expr);
+  assert(lookup);
+  assert(result);
+  assert(err);
+
+  /* An expression can't be longer than a source line, so neither can the
+   * stack */
+  int32_t stack[LEXER_MAX_LINE_LEN];
+  size_t sp = 0;
+
+  size_t const len = Vector_len(expr);
+  for (size_t i = 0; i < len; ++i) {
+    Token const* tok = Vector_at(expr, i);
+
+    if (tok->type == TOKEN_ID) {
+      if (sp == LEXER_MAX_LINE_LEN || lookup(ctx, tok, &stack[sp]) == -1) {
+        *err = (ExprError){.type = EXPR_ERROR_UNRESOLVED_SYMBOL, .tok = *tok};
+        return -1;
+      }
+      sp += 1;
+
+    } else if (isTerm(tok)) {
+      if (sp == LEXER_MAX_LINE_LEN) {
+        *err = (ExprError){.type = EXPR_ERROR_MALFORMED, .tok = *tok};
+        return -1;
+      }
+      stack[sp++] = tok->folded ? tok->folded_value : (int32_t)Token_toInt(tok);
+
+    } else if (tok->unary) {
+      if (sp < 1) {
+        *err = (ExprError){.type = EXPR_ERROR_MALFORMED, .tok = *tok};
+        return -1;
+      }
+      stack[sp - 1] = applyUnary(tok->type, stack[sp - 1]);
+
+    } else {
+      if (sp < 2) {
+        *err = (ExprError){.type = EXPR_ERROR_MALFORMED, .tok = *tok};
+        return -1;
+      }
+      if (applyBinary(tok->type, stack[sp - 2], stack[sp - 1], &stack[sp - 2]) == -1) {
+        *err = (ExprError){.type = EXPR_ERROR_DIVISION_BY_ZERO, .tok = *tok};
+        return -1;
+      }
+      sp -= 1;
+    }
+  }
+
+  if (sp != 1) {
+    Token const* last = len ? Vector_at(expr, len - 1) : NULL;
+    *err = (ExprError){.type = EXPR_ERROR_MALFORMED, .tok = last ? *last : (Token){0}};
+    return -1;
+  }
+
+  *result = stack[0];
+  return 0;
+}
+
 char const* ExprErrorType_toStr(ExprErrorType type) {
   switch (type) {
   case EXPR_NO_ERROR:
@@ -120,11 +230,121 @@ char const* ExprErrorType_toStr(ExprErrorType type) {
     return "unbalanced right parenthesis";
   case EXPR_ERROR_UNEXPECTED_TOKEN:
     return "unexpected token";
+  case EXPR_ERROR_UNRESOLVED_SYMBOL:
+    return "undefined symbol";
+  case EXPR_ERROR_DIVISION_BY_ZERO:
+    return "division by zero";
+  case EXPR_ERROR_MALFORMED:
+    return "malformed expression";
   default:
     return NULL;
   }
 }
 
+static void emitTerm(ExprParser* p, Token const* tok) {
+  ExprOperand op = {.start = p->e.len, .constant = tok->type != TOKEN_ID};
+  if (op.constant)
+    op.value = (int32_t)Token_toInt(tok);
+
+  pushToken(&p->e, tok);
+  pushOperand(&p->v, &op);
+}
+
+/* Append an operator to the output, folding it with its operands if they
+ * are constant */
+static void emitOperator(ExprParser* p, Token const* tok) {
+  size_t const arity = tok->unary ? 1 : 2;
+  if (p->malformed || p->v.len < arity) {
+    /* Left to Expr_eval to report */
+    p->malformed = true;
+    pushToken(&p->e, tok);
+    return;
+  }
+
+  ExprOperand a, b = {0};
+  if (arity == 2)
+    b = popOperand(&p->v);
+  a = popOperand(&p->v);
+
+  ExprOperand result = {.start = a.start};
+  if (a.constant && (arity == 1 || b.constant)) {
+    if (arity == 1) {
+      result.value = applyUnary(tok->type, a.value);
+      result.constant = true;
+    } else {
+      result.constant = applyBinary(tok->type, a.value, b.value, &result.value) == 0;
+    }
+  }
+
+  if (result.constant) {
+    Token const folded = foldedToken(&tokens(&p->e)[a.start], result.value);
+    p->e.len = a.start;
+    pushToken(&p->e, &folded);
+  } else {
+    pushToken(&p->e, tok);
+  }
+
+  pushOperand(&p->v, &result);
+}
+
+/* Move the elements of a stack out of `buf` to the heap, or grow the heap
+ * storage, whichever is due
+ *
+ * @returns The new heap storage
+ */
+static void* spill(void const* buf, void* heap, size_t len, size_t* cap, size_t elem_size) {
+  if (!heap) {
+    *cap = 2 * EXPR_PARSER_INLINE_LEN;
+    heap = malloc(*cap * elem_size);
+    if (!heap)
+      die("malloc() failed");
+    memcpy(heap, buf, len * elem_size);
+    return heap;
+  }
+
+  *cap *= 2;
+  heap = realloc(heap, *cap * elem_size);
+  if (!heap)
+    die("realloc() failed");
+  return heap;
+}
+
+static Token* tokens(ExprTokenStack* s) { return s->heap ? s->heap : s->buf; }
+
+static void pushToken(ExprTokenStack* s, Token const* tok) {
+  if (s->len == (s->heap ? s->cap : EXPR_PARSER_INLINE_LEN))
+    s->heap = spill(s->buf, s->heap, s->len, &s->cap, sizeof(Token));
+  tokens(s)[s->len++] = *tok;
+}
+
+static Token popToken(ExprTokenStack* s) {
+  assert(s->len > 0);
+  return tokens(s)[--s->len];
+}
+
+static ExprOperand* operands(ExprOperandStack* s) { return s->heap ? s->heap : s->buf; }
+
+static void pushOperand(ExprOperandStack* s, ExprOperand const* op) {
+  if (s->len == (s->heap ? s->cap : EXPR_PARSER_INLINE_LEN))
+    s->heap = spill(s->buf, s->heap, s->len, &s->cap, sizeof(ExprOperand));
+  operands(s)[s->len++] = *op;
+}
+
+static ExprOperand popOperand(ExprOperandStack* s) {
+  assert(s->len > 0);
+  return operands(s)[--s->len];
+}
+
+/* A literal standing for a folded subexpression, located at `at` */
+static Token foldedToken(Token const* at, int32_t value) {
+  Token tok = *at;
+  tok.type = TOKEN_DECIMAL;
+  tok.unary = false;
+  tok.folded = true;
+  tok.folded_value = value;
+  return tok;
+}
+
 static bool isTerm(Token const* tok) {
   switch (tok->type) {
   case TOKEN_DECIMAL:
@@ -162,6 +382,7 @@ static bool isTerm(Token const* tok) {
   case TOKEN_GREATER_EQUAL:
   case TOKEN_LESS_EQUAL:
   case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
   case TOKEN_COLON:
   default:
     return false;
@@ -205,6 +426,7 @@ static bool isOp(Token const* tok) {
   case TOKEN_RIGHT_PAREN:
   case TOKEN_COMMA:
   case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
   case TOKEN_COLON:
   default:
     return false;
@@ -258,8 +480,147 @@ static int prec(Token const* tok) {
   case TOKEN_RIGHT_PAREN:
   case TOKEN_COMMA:
   case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
   case TOKEN_COLON:
   default:
     return 0;
   }
 }
+
+static int32_t applyUnary(TokenType type, int32_t a) {
+  switch (type) {
+  case TOKEN_MINUS:
+    return (int32_t)(-(int64_t)a);
+  case TOKEN_PLUS:
+    return a;
+  case TOKEN_BANG:
+    return !a;
+  case TOKEN_TILDE:
+    return ~a;
+  case TOKEN_UNINITIALIZED:
+  case TOKEN_END:
+  case TOKEN_ERROR:
+  case TOKEN_ID:
+  case TOKEN_CHAR:
+  case TOKEN_STRING:
+  case TOKEN_DECIMAL:
+  case TOKEN_HEXADECIMAL:
+  case TOKEN_OCTAL:
+  case TOKEN_BINARY:
+  case TOKEN_LEFT_PAREN:
+  case TOKEN_RIGHT_PAREN:
+  case TOKEN_LEFT_BRACE:
+  case TOKEN_RIGHT_BRACE:
+  case TOKEN_COMMA:
+  case TOKEN_SLASH:
+  case TOKEN_STAR:
+  case TOKEN_PERCENT:
+  case TOKEN_CAP:
+  case TOKEN_AMPERSAND:
+  case TOKEN_BAR:
+  case TOKEN_LEFT_SHIFT:
+  case TOKEN_RIGHT_SHIFT:
+  case TOKEN_DOUBLE_AMPERSAND:
+  case TOKEN_DOUBLE_BAR:
+  case TOKEN_BANG_EQUAL:
+  case TOKEN_EQUAL_EQUAL:
+  case TOKEN_GREATER_EQUAL:
+  case TOKEN_LESS_EQUAL:
+  case TOKEN_COLON:
+  case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
+  default:
+    die("applyUnary(): invalid unary operator");
+  }
+}
+
+static int applyBinary(TokenType type, int32_t a, int32_t b, int32_t* result) {
+  /* Compute in 64 bits and truncate, so overflow wraps instead of being
+   * undefined */
+  int64_t const x = a, y = b;
+  int64_t r = 0;
+
+  switch (type) {
+  case TOKEN_PLUS:
+    r = x + y;
+    break;
+  case TOKEN_MINUS:
+    r = x - y;
+    break;
+  case TOKEN_STAR:
+    r = x * y;
+    break;
+  case TOKEN_SLASH:
+    if (y == 0)
+      return -1;
+    r = x / y;
+    break;
+  case TOKEN_PERCENT:
+    if (y == 0)
+      return -1;
+    r = x % y;
+    break;
+  case TOKEN_CAP:
+    r = x ^ y;
+    break;
+  case TOKEN_AMPERSAND:
+    r = x & y;
+    break;
+  case TOKEN_BAR:
+    r = x | y;
+    break;
+  case TOKEN_LEFT_SHIFT:
+    r = (y < 0 || y >= 32) ? 0 : (int64_t)((uint64_t)x << y);
+    break;
+  case TOKEN_RIGHT_SHIFT:
+    r = (y < 0 || y >= 32) ? 0 : x >> y;
+    break;
+  case TOKEN_DOUBLE_AMPERSAND:
+    r = x && y;
+    break;
+  case TOKEN_DOUBLE_BAR:
+    r = x || y;
+    break;
+  case TOKEN_EQUAL_EQUAL:
+    r = x == y;
+    break;
+  case TOKEN_BANG_EQUAL:
+    r = x != y;
+    break;
+  case TOKEN_LEFT_BRACE:
+    r = x < y;
+    break;
+  case TOKEN_RIGHT_BRACE:
+    r = x > y;
+    break;
+  case TOKEN_LESS_EQUAL:
+    r = x <= y;
+    break;
+  case TOKEN_GREATER_EQUAL:
+    r = x >= y;
+    break;
+  case TOKEN_UNINITIALIZED:
+  case TOKEN_END:
+  case TOKEN_ERROR:
+  case TOKEN_ID:
+  case TOKEN_CHAR:
+  case TOKEN_STRING:
+  case TOKEN_DECIMAL:
+  case TOKEN_HEXADECIMAL:
+  case TOKEN_OCTAL:
+  case TOKEN_BINARY:
+  case TOKEN_LEFT_PAREN:
+  case TOKEN_RIGHT_PAREN:
+  case TOKEN_COMMA:
+  case TOKEN_TILDE:
+  case TOKEN_BANG:
+  case TOKEN_COLON:
+  case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
+  default:
+    die("applyBinary(): invalid binary operator");
+  }
+
+  *result = (int32_t)r;
+  return 0;
+}
@@ -2,6 +2,7 @@
 #define EXPRESSION_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "lexer.h"
 #include "vector.h"
@@ -12,6 +13,9 @@ typedef enum {
   EXPR_ERROR_UNBALANCED_LEFT_PAREN,
   EXPR_ERROR_UNBALANCED_RIGHT_PAREN,
   EXPR_ERROR_UNEXPECTED_TOKEN,
+  EXPR_ERROR_UNRESOLVED_SYMBOL,
+  EXPR_ERROR_DIVISION_BY_ZERO,
+  EXPR_ERROR_MALFORMED,
 } ExprErrorType;
 
 typedef struct {
@@ -19,19 +23,104 @@ typedef struct {
   ExprErrorType type;
 } ExprError;
 
+/* Operand of an instruction or a directive: an expression to evaluate, or
+ * a value folded at parse time when `expr` is NULL */
 typedef struct {
-  Vector* e; //< An expression
-  Vector* o; //< A stack of operators
+  Vector* expr;
+  int32_t value;
+  Token tok; //< First token of the operand, for diagnostics
+} Operand;
+
+/* Operands rarely have more tokens than this */
+#define EXPR_PARSER_INLINE_LEN 8
+
+/* A subexpression of the output, starting at e[start] */
+typedef struct {
+  size_t start;
+  int32_t value;
+  bool constant;
+} ExprOperand;
+
+/* The stacks of the parser keep EXPR_PARSER_INLINE_LEN elements in place.
+ * Past that they move to the heap and stay there, so a reused parser
+ * allocates only for the longest expressions it sees. */
+typedef struct {
+  Token buf[EXPR_PARSER_INLINE_LEN];
+  Token* heap; //< NULL until buf overflows
+  size_t len;
+  size_t cap; //< Of heap
+} ExprTokenStack;
+
+typedef struct {
+  ExprOperand buf[EXPR_PARSER_INLINE_LEN];
+  ExprOperand* heap; //< NULL until buf overflows
+  size_t len;
+  size_t cap; //< Of heap
+} ExprOperandStack;
+
+typedef struct {
+  ExprTokenStack e;   //< An expression
+  ExprTokenStack o;   //< A stack of operators
+  ExprOperandStack v; //< One per subexpression in e
   Token prev;
   ExprError error;
   bool has_error;
+  bool malformed; //< An operator lacked operands; nothing is folded
 } ExprParser;
 
+/* Doesn't allocate; short expressions are parsed in place */
 ExprParser ExprParser_make(void);
 void ExprParser_deinit(ExprParser* p);
 
+/* Get ready for the next expression, keeping the heap storage */
+void ExprParser_reset(ExprParser* p);
+
+/* Feed the next token of an expression
+ *
+ * Subexpressions whose terms are all literals are folded as operators are
+ * emitted: their tokens in `e` are replaced with a single folded token.
+ * Division by zero isn't folded, so it's reported on evaluation.
+ */
 int ExprParser_get(ExprParser* p, Token tok);
 
+/* Whether the whole expression folded to a constant
+ *
+ * Only meaningful once the expression was flushed with TOKEN_NEWLINE or
+ * TOKEN_END.
+ */
+bool ExprParser_isConstant(ExprParser const* p, int32_t* value);
+
+/* Copy of the parsed expression (Vector[Token]), owned by the caller */
+Vector* ExprParser_copyExpr(ExprParser const* p);
+
+/* Expression vector for an operand, made up of a single folded token if the
+ * operand was folded */
+Vector* Operand_toExpr(Operand const* op);
+
+/** Symbol value lookup callback
+ *
+ * @param ctx User data passed to Expr_eval
+ * @param sym TOKEN_ID token naming the symbol
+ * @param value Output value of the symbol
+ * @returns 0 if the symbol has a value, -1 otherwise
+ */
+typedef int (*ExprLookupFn)(void* ctx, Token const* sym, int32_t* value);
+
+/** Evaluate an expression in reverse polish notation
+ *
+ * Operators follow C semantics: comparisons and logical operators yield 0
+ * or 1, shifts by a negative count or by 32 and more yield 0.
+ *
+ * @param expr An expression produced by ExprParser (Vector[Token])
+ * @param lookup Symbol lookup callback
+ * @param ctx User data for the callback
+ * @param result Output value
+ * @param err On failure, the error and the offending token. A symbol without
+ *   a value is reported as EXPR_ERROR_UNRESOLVED_SYMBOL.
+ * @returns 0 on success, -1 on failure
+ */
+int Expr_eval(Vector* expr, ExprLookupFn lookup, void* ctx, int32_t* result, ExprError* err);
+
 char const* ExprErrorType_toStr(ExprErrorType type);
 
 #endif // EXPRESSION_H
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fixup.h"
+#include "instruction.h"
+#include "utility.h"
+
+#define FIXUP_BATCH_MIN_CAPACITY 64
+
+static void* grow(void* array, size_t cap, size_t elem_size);
+
+FixupBatch FixupBatch_make(void) { return (FixupBatch){0}; }
+
+void FixupBatch_deinit(FixupBatch* b) {
+  assert(b);
+  free(b->node);
+  free(b->item);
+  free(b->kind);
+  free(b->value);
+  free(b->status);
+}
+
+void FixupBatch_clear(FixupBatch* b) {
+  assert(b);
+  b->len = 0;
+}
+
+size_t FixupBatch_push(FixupBatch* b, size_t node, size_t item, EncodedItemKind kind) {
+  assert(b);
+  assert(item <= UINT8_MAX);
+  assert(kind == EI_EXPR || kind == EI_ADDR || kind == EI_REL);
+
+  if (b->len == b->cap) {
+    b->cap = b->cap ? 2 * b->cap : FIXUP_BATCH_MIN_CAPACITY;
+    b->node = grow(b->node, b->cap, sizeof(*b->node));
+    b->item = grow(b->item, b->cap, sizeof(*b->item));
+    b->kind = grow(b->kind, b->cap, sizeof(*b->kind));
+    b->value = grow(b->value, b->cap, sizeof(*b->value));
+    b->status = grow(b->status, b->cap, sizeof(*b->status));
+  }
+
+  size_t const i = b->len++;
+  b->node[i] = node;
+  b->item[i] = (uint8_t)item;
+  b->kind[i] = (uint8_t)kind;
+  b->value[i] = 0;
+  b->status[i] = FIXUP_UNRESOLVED;
+  return i;
+}
+
+size_t FixupBatch_checkRanges(FixupBatch* b) {
+  assert(b);
+
+  /* Bounds are selected rather than branched on and the flags are combined
+   * with bitwise operators, so the loop has no branches. The arrays are
+   * read into locals: status bytes could otherwise alias the batch. */
+  size_t const len = b->len;
+  uint8_t const* kind = b->kind;
+  int32_t const* value = b->value;
+  uint8_t* status = b->status;
+  size_t out_of_range = 0;
+  for (size_t i = 0; i < len; ++i) {
+    int32_t const v = value[i];
+    int const word = kind[i] == EI_ADDR;
+    int const checked = kind[i] != EI_REL;
+    int32_t const min = word ? INT16_MIN : INT8_MIN;
+    int32_t const max = word ? UINT16_MAX : UINT8_MAX;
+    int const bad = checked & (status[i] == FIXUP_OK) & ((v < min) | (v > max));
+    status[i] = (uint8_t)(status[i] | (bad << 1));
+    out_of_range += (size_t)bad;
+  }
+  return out_of_range;
+}
+
+static void* grow(void* array, size_t cap, size_t elem_size) {
+  array = realloc(array, cap * elem_size);
+  if (!array)
+    die("realloc() failed");
+  return array;
+}
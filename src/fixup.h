@@ -0,0 +1,53 @@
+#ifndef FIXUP_H
+#define FIXUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+typedef enum {
+  FIXUP_OK = 0,
+  FIXUP_UNRESOLVED = 1,   //< Not evaluated, the value is meaningless
+  FIXUP_OUT_OF_RANGE = 2, //< Evaluated, but doesn't fit in the item
+} FixupStatus;
+
+/* Expression items of the whole IR in struct-of-arrays form
+ *
+ * Resolver_relayout evaluates every item again. Rather than checking and
+ * patching them one at a time, it collects them here, fills in the
+ * values, and checks the ranges of all of them in one branch-free loop over
+ * flat arrays, which the compiler can vectorize.
+ */
+typedef struct {
+  size_t len;
+  size_t cap;
+  size_t* node;    //< Index of the instruction in the IR
+  uint8_t* item;   //< Index of the item in the instruction
+  uint8_t* kind;   //< EncodedItemKind: EI_EXPR, EI_ADDR or EI_REL
+  int32_t* value;  //< Filled in by the caller; EI_REL: the displacement
+  uint8_t* status; //< FixupStatus, FIXUP_UNRESOLVED until the value is set
+} FixupBatch;
+
+FixupBatch FixupBatch_make(void);
+void FixupBatch_deinit(FixupBatch* b);
+
+/* Empty the batch, keeping the storage */
+void FixupBatch_clear(FixupBatch* b);
+
+/* Append an item whose value is yet to be filled in
+ *
+ * @returns Index of the item in the batch
+ */
+size_t FixupBatch_push(FixupBatch* b, size_t node, size_t item, EncodedItemKind kind);
+
+/* Mark the evaluated items whose values don't fit as FIXUP_OUT_OF_RANGE
+ *
+ * Bytes take -128..255 and words -32768..65535. Displacements aren't
+ * checked: the relaxation pass lengthens the branches that are too short.
+ *
+ * @returns Number of items out of range
+ */
+size_t FixupBatch_checkRanges(FixupBatch* b);
+
+#endif // FIXUP_H
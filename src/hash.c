@@ -0,0 +1,71 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hash.h"
+
+#define PRIME1 0x9e3779b185ebca87ull
+#define PRIME2 0xc2b2ae3d27d4eb4full
+#define PRIME3 0x165667b19e3779f9ull
+#define PRIME4 0x85ebca77c2b2ae63ull
+#define PRIME5 0x27d4eb2f165667c5ull
+
+static inline uint64_t rotl(uint64_t x, unsigned r) { return x << r | x >> (64 - r); }
+static inline uint64_t read64(uint8_t const* p);
+static inline uint32_t read32(uint8_t const* p);
+static inline uint64_t round64(uint64_t acc, uint64_t input);
+static inline uint64_t merge(uint64_t acc, uint64_t lane);
+
+uint64_t Hash_bytes(void const* data, size_t len, uint64_t seed) {
+  assert(data || len == 0);
+
+  uint8_t const* p = data;
+  uint8_t const* const end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1};
+    for (uint8_t const* const limit = end - 32; p <= limit; p += 32)
+      for (size_t i = 0; i < 4; ++i)
+        v[i] = round64(v[i], read64(p + 8 * i));
+
+    h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    for (size_t i = 0; i < 4; ++i)
+      h = merge(h, v[i]);
+  } else {
+    h = seed + PRIME5;
+  }
+  h += (uint64_t)len;
+
+  for (; end - p >= 8; p += 8)
+    h = rotl(h ^ round64(0, read64(p)), 27) * PRIME1 + PRIME4;
+  if (end - p >= 4) {
+    h = rotl(h ^ read32(p) * PRIME1, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    h = rotl(h ^ *p * PRIME5, 11) * PRIME1;
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* Little-endian whatever the host, so hashes can be kept on disk */
+static inline uint64_t read64(uint8_t const* p) {
+  uint64_t x = 0;
+  for (size_t i = 0; i < 8; ++i)
+    x |= (uint64_t)p[i] << (8 * i);
+  return x;
+}
+
+static inline uint32_t read32(uint8_t const* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) { return rotl(acc + input * PRIME2, 31) * PRIME1; }
+
+static inline uint64_t merge(uint64_t acc, uint64_t lane) { return (acc ^ round64(0, lane)) * PRIME1 + PRIME4; }
@@ -0,0 +1,15 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 64-bit hash of a byte string (XXH64)
+ *
+ * The input is consumed 32 bytes at a time by four independent lanes, so
+ * their multiplications overlap and the loop runs at memory speed. Not for
+ * security: only to tell inputs apart.
+ */
+uint64_t Hash_bytes(void const* data, size_t len, uint64_t seed);
+
+#endif // HASH_H
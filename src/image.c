@@ -0,0 +1,186 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "image.h"
+#include "instruction.h"
+#include "pool.h"
+#include "utility.h"
+#include "vector.h"
+
+/* Nodes [first, end) between two ORG nodes */
+typedef struct {
+  size_t first, end;
+  uint16_t bank;
+} Segment;
+
+typedef struct {
+  Image* img;
+  Vector* nodes;
+  Segment const* segments; //< Sorted by bank
+  size_t const* jobs;      //< Segments of job j: [jobs[j], jobs[j + 1])
+} EmitContext;
+
+static void emitBank(void* ctx, size_t j);
+static int compareRegions(void const* a, void const* b);
+static int compareSegments(void const* a, void const* b);
+
+Image Image_layout(Vector* nodes) {
+  assert(nodes);
+
+  Vector* regions = Vector_new(sizeof(ImageRegion));
+  if (!regions)
+    die("Vector_new() failed");
+
+  /* Consecutive instructions extend the last region, so only an ORG
+   * starts a new one */
+  for (size_t i = 0; i < Vector_len(nodes); ++i) {
+    IRNode* n = Vector_at(nodes, i);
+    if (n->kind != IR_INSTRUCTION)
+      continue;
+    uint32_t const start = IR_physical(n->data.instruction.bank, n->data.instruction.addr);
+    uint32_t const len = (uint32_t)IRInstruction_size(&n->data.instruction);
+    if (len == 0)
+      continue;
+
+    ImageRegion* last = Vector_isEmpty(regions) ? NULL : Vector_at(regions, Vector_len(regions) - 1);
+    if (last && last->start + last->len == start) {
+      last->len += len;
+      continue;
+    }
+    ImageRegion const region = {.start = start, .len = len};
+    if (Vector_push(regions, &region) == -1)
+      die("Vector_push() failed");
+  }
+
+  return Image_fromRegions(regions);
+}
+
+Image Image_fromRegions(Vector* regions) {
+  assert(regions);
+
+  /* Only an ORG going backwards makes them unsorted */
+  ImageRegion* r = Vector_isEmpty(regions) ? NULL : Vector_at(regions, 0);
+  size_t const n = Vector_len(regions);
+  bool sorted = true;
+  for (size_t i = 1; i < n && sorted; ++i)
+    sorted = r[i].start >= r[i - 1].start + r[i - 1].len;
+
+  if (!sorted) {
+    qsort(r, n, sizeof(*r), compareRegions);
+
+    size_t out = 0;
+    for (size_t i = 1; i < n; ++i) {
+      uint32_t const end = r[out].start + r[out].len;
+      if (r[i].start <= end) {
+        uint32_t const i_end = r[i].start + r[i].len;
+        if (i_end > end)
+          r[out].len = i_end - r[out].start;
+      } else {
+        r[++out] = r[i];
+      }
+    }
+    while (Vector_len(regions) > out + 1)
+      Vector_pop(regions, NULL);
+  }
+
+  if (Vector_isEmpty(regions))
+    return (Image){.regions = regions};
+
+  ImageRegion const* first = Vector_at(regions, 0);
+  ImageRegion const* last = Vector_at(regions, Vector_len(regions) - 1);
+  return (Image){.base = first->start, .len = last->start + last->len - first->start, .regions = regions};
+}
+
+void Image_emit(Image* img, Vector* nodes) {
+  assert(img);
+  assert(img->data || img->len == 0);
+  assert(nodes);
+
+  Vector* segments = Vector_new(sizeof(Segment));
+  if (!segments)
+    die("Vector_new() failed");
+
+  Segment s = {0};
+  for (size_t i = 0; i < Vector_len(nodes); ++i) {
+    IRNode const* n = Vector_at(nodes, i);
+    if (n->kind != IR_ORG)
+      continue;
+    s.end = i;
+    if (s.end > s.first && Vector_push(segments, &s) == -1)
+      die("Vector_push() failed");
+    s = (Segment){.first = i + 1, .bank = n->data.org.bank};
+  }
+  s.end = Vector_len(nodes);
+  if (s.end > s.first && Vector_push(segments, &s) == -1)
+    die("Vector_push() failed");
+
+  /* Banks don't overlap, so each one is a job. The segments of a bank are
+   * kept in source order, for overlapping ORG regions. */
+  size_t const n_segments = Vector_len(segments);
+  Segment* sorted = n_segments ? Vector_at(segments, 0) : NULL;
+  if (n_segments > 1)
+    qsort(sorted, n_segments, sizeof(*sorted), compareSegments);
+
+  size_t* jobs = malloc((n_segments + 1) * sizeof(*jobs));
+  if (!jobs)
+    die("malloc() failed");
+  size_t n_jobs = 0;
+  for (size_t i = 0; i < n_segments; ++i)
+    if (i == 0 || sorted[i].bank != sorted[i - 1].bank)
+      jobs[n_jobs++] = i;
+  jobs[n_jobs] = n_segments;
+
+  EmitContext ctx = {.img = img, .nodes = nodes, .segments = sorted, .jobs = jobs};
+  Pool_run(n_jobs, emitBank, &ctx);
+
+  free(jobs);
+  Vector_destroy(segments);
+}
+
+Image Image_fromIR(Vector* nodes) {
+  assert(nodes);
+
+  Image img = Image_layout(nodes);
+
+  /* One byte more, so an empty program is not a zero-sized allocation */
+  img.data = calloc(img.len + 1, 1);
+  if (!img.data)
+    die("calloc() failed");
+
+  Image_emit(&img, nodes);
+  return img;
+}
+
+void Image_deinit(Image* img) {
+  assert(img);
+  free(img->data);
+  CALL_NON_NULL(img->regions, Vector_destroy);
+}
+
+static void emitBank(void* ctx, size_t j) {
+  EmitContext const* c = ctx;
+  for (size_t k = c->jobs[j]; k < c->jobs[j + 1]; ++k) {
+    for (size_t i = c->segments[k].first; i < c->segments[k].end; ++i) {
+      IRNode const* n = Vector_at(c->nodes, i);
+      if (n->kind != IR_INSTRUCTION || Vector_isEmpty(n->data.instruction.encoded_items))
+        continue;
+      IRInstruction const* iri = &n->data.instruction;
+      IRInstruction_encode(iri, c->img->data + (IR_physical(iri->bank, iri->addr) - c->img->base));
+    }
+  }
+}
+
+static int compareRegions(void const* a, void const* b) {
+  uint32_t const x = ((ImageRegion const*)a)->start, y = ((ImageRegion const*)b)->start;
+  return (x > y) - (x < y);
+}
+
+static int compareSegments(void const* a, void const* b) {
+  Segment const *x = a, *y = b;
+  if (x->bank != y->bank)
+    return x->bank < y->bank ? -1 : 1;
+  return (x->first > y->first) - (x->first < y->first);
+}
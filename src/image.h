@@ -0,0 +1,57 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+/* A written range of output offsets (see IR_physical()) */
+typedef struct {
+  uint32_t start;
+  uint32_t len;
+} ImageRegion;
+
+/* The assembled bytes, as they are laid out in memory
+ *
+ * ORG may leave gaps between the written regions. They are zero in `data`,
+ * but the regions are kept so the text formats can skip them.
+ */
+typedef struct {
+  uint8_t* data;   //< Bytes of [base, base + len)
+  uint32_t base;   //< Lowest written address
+  size_t len;      //< Up to the highest written address
+  Vector* regions; //< Vector[ImageRegion], sorted and disjoint; NULL means [base, base + len)
+} Image;
+
+/* Compute the regions and extent of a resolved IR, without any data
+ *
+ * Every expression item must be resolved, i.e. the program assembled
+ * without errors.
+ */
+Image Image_layout(Vector* nodes);
+
+/* Compute the extent of written regions, without any data
+ *
+ * The regions are sorted and the overlapping ones merged. Ownership of
+ * `regions` (Vector[ImageRegion]) is taken.
+ */
+Image Image_fromRegions(Vector* regions);
+
+/* Store the bytes of the IR at their offsets in `img->data`
+ *
+ * The image must come from Image_layout() of the same IR, and `data` must
+ * be zeroed memory of `len` bytes: a heap buffer or a mapped output file.
+ * Where ORG regions overlap, the later instruction wins. Banks are emitted
+ * in parallel (see pool.h), so they must not overlap: see
+ * Resolver_checkBanks().
+ */
+void Image_emit(Image* img, Vector* nodes);
+
+/* Image_layout() and Image_emit() into a heap buffer */
+Image Image_fromIR(Vector* nodes);
+
+/* Free the regions, and the data unless it's NULL */
+void Image_deinit(Image* img);
+
+#endif // IMAGE_H
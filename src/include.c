@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "include.h"
+#include "lexer.h"
+#include "parser.h"
+#include "utility.h"
+#include "vector.h"
+
+/* Called with each file an INCLUDE or INCBIN names, at the depth of the
+ * file naming it
+ *
+ * @returns 0 to go on, -1 to stop
+ */
+typedef int (*IncludedVisitor)(char const* path, bool binary, unsigned depth, void* ctx);
+
+static IncludeFile* get(IncludeCache* c, char const* path, bool binary, int* error);
+static IncludeFile* findFile(IncludeCache* c, char const* path, bool binary);
+static IncludeFile* addFile(IncludeCache* c, char const* path, bool binary);
+static void* help(void* arg);
+static void load(IncludeFile* f);
+static int readAll(int fd, size_t len, char** src, size_t* n_read);
+static int visitIncluded(Lexer* lex, unsigned depth, IncludedVisitor visit, void* ctx);
+static int hashFile(char const* path, bool binary, unsigned depth, void* ctx);
+static void waitLoading(IncludeCache* c);
+static bool isDirective(Token const* tok, char const* name);
+static void finishLoading(IncludeFile* f);
+static bool sameVersion(IncludeFile const* f, struct stat const* st);
+static void IncludeFile_destroy(IncludeFile* f);
+
+int Include_hash(char const* src, uint64_t* hash) {
+  assert(src);
+  assert(hash);
+
+  Lexer lex = Lexer_make(src);
+  return visitIncluded(&lex, 0, hashFile, hash);
+}
+
+void IncludeCache_init(IncludeCache* c) {
+  assert(c);
+
+  Vector* files = Vector_new(sizeof(IncludeFile*));
+  if (!files)
+    die("Vector_new() failed");
+  Vector* queue = Vector_new(sizeof(IncludeFile*));
+  if (!queue)
+    die("Vector_new() failed");
+  *c = (IncludeCache){.files = files, .queue = queue};
+  if (pthread_mutex_init(&c->lock, NULL) != 0)
+    die("pthread_mutex_init() failed");
+  if (pthread_cond_init(&c->loaded, NULL) != 0 || pthread_cond_init(&c->queued, NULL) != 0)
+    die("pthread_cond_init() failed");
+}
+
+void IncludeCache_deinit(IncludeCache* c) {
+  assert(c);
+
+  if (c->has_helper) {
+    pthread_mutex_lock(&c->lock);
+    c->stopping = true;
+    pthread_cond_signal(&c->queued);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->helper, NULL);
+  }
+  waitLoading(c);
+
+  for (size_t i = 0; i < Vector_len(c->files); ++i)
+    IncludeFile_destroy(*(IncludeFile**)Vector_at(c->files, i));
+  Vector_destroy(c->files);
+  Vector_destroy(c->queue);
+  pthread_cond_destroy(&c->queued);
+  pthread_cond_destroy(&c->loaded);
+  pthread_mutex_destroy(&c->lock);
+}
+
+void IncludeCache_prefetch(IncludeCache* c, char const* path) {
+  assert(c);
+  assert(path);
+
+  pthread_mutex_lock(&c->lock);
+  IncludeFile* f = findFile(c, path, false) ? NULL : addFile(c, path, false);
+  if (f && !c->has_helper)
+    c->has_helper = pthread_create(&c->helper, NULL, help, c) == 0;
+  if (f && c->has_helper) {
+    f->queued = true;
+    if (Vector_push(c->queue, &f) == -1)
+      die("Vector_push() failed");
+    pthread_cond_signal(&c->queued);
+    f = NULL;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  if (f) {
+    load(f);
+    finishLoading(f);
+  }
+}
+
+IncludeFile const* IncludeCache_get(IncludeCache* c, char const* path, int* error) {
+  assert(c);
+  assert(path);
+  assert(error);
+  return get(c, path, false, error);
+}
+
+Blob* IncludeCache_getBlob(IncludeCache* c, char const* path, int* error) {
+  assert(c);
+  assert(path);
+  assert(error);
+
+  IncludeFile* f = get(c, path, true, error);
+  return f ? f->blob : NULL;
+}
+
+static IncludeFile* get(IncludeCache* c, char const* path, bool binary, int* error) {
+  pthread_mutex_lock(&c->lock);
+  IncludeFile* f;
+  while ((f = findFile(c, path, binary)) && !f->ready) {
+    /* Rather than wait for the helper to get to it */
+    if (f->queued) {
+      f->queued = false;
+      pthread_mutex_unlock(&c->lock);
+      load(f);
+      finishLoading(f);
+      pthread_mutex_lock(&c->lock);
+    } else {
+      pthread_cond_wait(&c->loaded, &c->lock);
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    *error = errno;
+    return NULL;
+  }
+  if (f && !f->error && sameVersion(f, &st))
+    return f;
+
+  /* New or changed since: the old version stays, as programs may still
+   * hold its tokens */
+  pthread_mutex_lock(&c->lock);
+  f = addFile(c, path, binary);
+  pthread_mutex_unlock(&c->lock);
+  load(f);
+  finishLoading(f);
+  if (f->error) {
+    *error = f->error;
+    return NULL;
+  }
+  return f;
+}
+
+/* The latest version of a file, with the lock held */
+static IncludeFile* findFile(IncludeCache* c, char const* path, bool binary) {
+  for (size_t i = Vector_len(c->files); i > 0; --i) {
+    IncludeFile* f = *(IncludeFile**)Vector_at(c->files, i - 1);
+    if (f->binary == binary && strcmp(f->path, path) == 0)
+      return f;
+  }
+  return NULL;
+}
+
+/* A file to load, with the lock held */
+static IncludeFile* addFile(IncludeCache* c, char const* path, bool binary) {
+  IncludeFile* f = malloc(sizeof(IncludeFile));
+  if (!f)
+    die("malloc() failed");
+  *f = (IncludeFile){.path = dsprintf("%s", path), .binary = binary, .cache = c};
+  if (!f->path)
+    die("dsprintf() failed");
+  if (Vector_push(c->files, &f) == -1)
+    die("Vector_push() failed");
+  c->n_loading += 1;
+  return f;
+}
+
+/* The helper thread: load the queued files in turn, until stopped */
+static void* help(void* arg) {
+  IncludeCache* c = arg;
+  pthread_mutex_lock(&c->lock);
+  for (;;) {
+    while (Vector_isEmpty(c->queue) && !c->stopping)
+      pthread_cond_wait(&c->queued, &c->lock);
+    IncludeFile* f;
+    if (Vector_popFront(c->queue, &f) == -1)
+      break;
+    if (!f->queued)
+      continue;
+    f->queued = false;
+    pthread_mutex_unlock(&c->lock);
+    load(f);
+    finishLoading(f);
+    pthread_mutex_lock(&c->lock);
+  }
+  pthread_mutex_unlock(&c->lock);
+  return NULL;
+}
+
+/* Read and parse a file, or map it for INCBIN, without the lock: nothing
+ * else reads it until it's ready */
+static void load(IncludeFile* f) {
+  int const fd = open(f->path, O_RDONLY);
+  if (fd == -1) {
+    f->error = errno;
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    f->error = errno;
+    close(fd);
+    return;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    f->error = EISDIR;
+    close(fd);
+    return;
+  }
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->size = st.st_size;
+  f->mtime = st.st_mtim;
+  if (f->binary) {
+    f->blob = Blob_map(fd, (size_t)st.st_size);
+    f->error = f->blob ? 0 : errno;
+    close(fd);
+    return;
+  }
+  size_t n_read;
+  f->error = readAll(fd, (size_t)st.st_size, &f->src, &n_read);
+  close(fd);
+  if (f->error)
+    return;
+
+  f->lex = Lexer_make(f->src);
+  f->lex.name = f->path;
+  f->statements = Vector_new(sizeof(Statement));
+  if (!f->statements)
+    die("Vector_new() failed");
+  Parser q = Parser_make(&f->lex);
+  q.includes = f->cache;
+  Parser_parseStatements(&q, f->statements);
+  Parser_deinit(&q);
+}
+
+/* @returns 0 on success, an errno on failure */
+static int readAll(int fd, size_t len, char** src, size_t* n_read) {
+  *src = malloc(len + 1);
+  if (!*src)
+    die("malloc() failed");
+  size_t got = 0;
+  while (got < len) {
+    ssize_t const n = read(fd, *src + got, len - got);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return errno;
+    if (n == 0)
+      break; // Truncated since
+    got += (size_t)n;
+  }
+  (*src)[got] = '\0';
+  *n_read = got;
+  return 0;
+}
+
+/* Visit the files named by the INCLUDE and INCBIN directives of the
+ * tokens, followed into conditional blocks */
+static int visitIncluded(Lexer* lex, unsigned depth, IncludedVisitor visit, void* ctx) {
+  Token directive = {0};
+  for (Token tok = Lexer_next(lex); tok.type != TOKEN_END; tok = Lexer_next(lex)) {
+    if (directive.type != TOKEN_UNINITIALIZED) {
+      bool const binary = isDirective(&directive, "incbin");
+      directive.type = TOKEN_UNINITIALIZED;
+      /* A name the assembler would only know from a macro argument */
+      if (tok.type == TOKEN_ID)
+        return -1;
+      if (tok.type != TOKEN_CHAR)
+        continue;
+      char* path = Token_str(&tok);
+      if (!path)
+        die("Token_str() failed");
+      int const stopped = visit(path, binary, depth, ctx);
+      free(path);
+      if (stopped)
+        return -1;
+    } else if (tok.type == TOKEN_BLOCK) {
+      Lexer block = Lexer_makeBlock(&tok);
+      if (visitIncluded(&block, depth, visit, ctx) == -1)
+        return -1;
+    } else if (isDirective(&tok, "include") || isDirective(&tok, "incbin")) {
+      directive = tok;
+    }
+  }
+  return 0;
+}
+
+/* Hash the path and contents of a file into the uint64_t at `ctx`, and
+ * those it includes */
+static int hashFile(char const* path, bool binary, unsigned depth, void* ctx) {
+  uint64_t* hash = ctx;
+  if (depth >= INCLUDE_MAX_DEPTH)
+    return -1;
+  int const fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  struct stat st;
+  char* src = NULL;
+  size_t len = 0;
+  int const failed = fstat(fd, &st) == -1 || S_ISDIR(st.st_mode) || readAll(fd, (size_t)st.st_size, &src, &len) != 0;
+  close(fd);
+  if (failed) {
+    free(src);
+    return -1;
+  }
+
+  *hash = Hash_bytes(path, strlen(path) + 1, *hash);
+  *hash = Hash_bytes(src, len, *hash);
+  int result = 0;
+  if (!binary) {
+    Lexer lex = Lexer_make(src);
+    result = visitIncluded(&lex, depth + 1, hashFile, hash);
+  }
+  free(src);
+  return result;
+}
+
+static void waitLoading(IncludeCache* c) {
+  pthread_mutex_lock(&c->lock);
+  while (c->n_loading > 0)
+    pthread_cond_wait(&c->loaded, &c->lock);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static bool isDirective(Token const* tok, char const* name) {
+  return tok->type == TOKEN_ID && tok->len == strlen(name) && strncasecmp(tok->value, name, tok->len) == 0;
+}
+
+static void finishLoading(IncludeFile* f) {
+  IncludeCache* c = f->cache;
+  pthread_mutex_lock(&c->lock);
+  f->ready = true;
+  c->n_loading -= 1;
+  pthread_cond_broadcast(&c->loaded);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static bool sameVersion(IncludeFile const* f, struct stat const* st) {
+  return f->dev == st->st_dev && f->ino == st->st_ino && f->size == st->st_size &&
+         f->mtime.tv_sec == st->st_mtim.tv_sec && f->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void IncludeFile_destroy(IncludeFile* f) {
+  for (size_t i = 0; f->statements && i < Vector_len(f->statements); ++i)
+    Statement_deinit(Vector_at(f->statements, i));
+  if (f->statements)
+    Vector_destroy(f->statements);
+  if (f->blob)
+    Blob_release(f->blob);
+  free(f->src);
+  free(f->path);
+  free(f);
+}
@@ -0,0 +1,101 @@
+#ifndef INCLUDE_H
+#define INCLUDE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "blob.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vector.h"
+
+/* Files for INCLUDE, each read, lexed and parsed once per process
+ *
+ * A file is cached along with the statements parsed from it, under its
+ * path and the device, inode, size and modification time it had; an
+ * INCLUDE then resolves copies of the statements in place of its own. A
+ * file that changes on disk is parsed again the next time it is included,
+ * and both versions stay until the cache goes. The tokens of the statements
+ * point back at the lexer of their file, for the errors found in them.
+ *
+ * The parser asks for a file as soon as it sees the directive, and it is
+ * then queued for a helper thread, which loads the files one at a time
+ * while the parser goes on. A file needed before the helper got to it is
+ * loaded by the thread needing it. The cache may be shared by parsers on
+ * any number of threads.
+ *
+ * The files of INCBIN are cached the same way, mapped rather than parsed.
+ */
+struct IncludeCache {
+  pthread_mutex_t lock;
+  pthread_cond_t loaded; //< Signalled as each file finishes loading
+  pthread_cond_t queued; //< Signalled as a file is queued for the helper, or it is to stop
+  Vector* files;         //< Vector[IncludeFile*]
+  Vector* queue;         //< Vector[IncludeFile*]: prefetched files, oldest first
+  pthread_t helper;
+  bool has_helper;  //< `helper` runs, started by the first prefetch
+  bool stopping;    //< The helper is to stop once the queue is empty
+  size_t n_loading; //< Files added but not loaded yet
+};
+
+typedef struct {
+  char* path;
+  bool binary; //< For INCBIN, mapped into `blob`; otherwise parsed
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  char* src;          //< The contents, NUL-terminated
+  Lexer lex;          //< Over `src`, named after the path
+  Vector* statements; //< Vector[Statement] parsed from `src`
+  Blob* blob;         //< The contents, for INCBIN
+  int error;          //< The errno of a failed load, 0 if none
+  bool ready;         //< Loaded; until then, only `path` may be read without the lock
+  bool queued;        //< Waiting for the helper, which skips it once a thread needing it takes it
+  IncludeCache* cache;
+} IncludeFile;
+
+/* Files may include one another this deep, as far as Include_hash() goes */
+#define INCLUDE_MAX_DEPTH 64
+
+void IncludeCache_init(IncludeCache* c);
+
+/* Stop the helper thread, once done with the queue, then free every file */
+void IncludeCache_deinit(IncludeCache* c);
+
+/* Queue a file for the helper thread, unless it is cached already or
+ * being loaded; if the helper can't be started, it is loaded right away */
+void IncludeCache_prefetch(IncludeCache* c, char const* path);
+
+/* The current version of a file, loading it if it isn't cached
+ *
+ * @param error Set to the errno of the failure, if any
+ * @returns The file, which lasts as long as the cache; NULL on failure
+ */
+IncludeFile const* IncludeCache_get(IncludeCache* c, char const* path, int* error);
+
+/* The current version of a file for INCBIN, mapping it if it isn't cached
+ *
+ * @param error Set to the errno of the failure, if any
+ * @returns The contents, which last as long as the cache unless retained;
+ *   NULL on failure
+ */
+Blob* IncludeCache_getBlob(IncludeCache* c, char const* path, int* error);
+
+/* Hash the path and contents of every file named by an INCLUDE or INCBIN of
+ * `src` into `*hash`, and of those the included files name in turn
+ *
+ * The directives are found by their tokens, in conditional blocks and macro
+ * bodies too, whether or not they would be assembled. Paths are taken as
+ * written, as the directives do.
+ *
+ * @returns 0 on success, -1 if a file can't be read or is named by a macro
+ *   parameter
+ */
+int Include_hash(char const* src, uint64_t* hash);
+
+#endif // INCLUDE_H
@@ -0,0 +1,517 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hash.h"
+#include "incremental.h"
+#include "instruction.h"
+#include "parser.h"
+#include "utility.h"
+#include "vector.h"
+
+typedef struct {
+  uint64_t hash;
+  size_t len;         //< Including the newline, if any
+  bool continues;     //< In the body of a macro or a conditional opened on a line above
+  char* text;         //< Copy of the line and the lines it continues into, which the tokens of the statements
+                      //< point into; NULL if no statements
+  Vector* statements; //< Vector[Statement] parsed from the line, NULL if none
+  size_t n_nodes;     //< IR nodes the statements gave the program
+} IncrementalLine;
+
+/* What a line starts with, as the lexer and the parser tell blocks apart */
+typedef enum {
+  LINE_OTHER,
+  LINE_IF, //< IF, IFDEF or IFNDEF
+  LINE_ELSE,
+  LINE_ENDIF,
+  LINE_MACRO, //< NAME [:] MACRO
+  LINE_ENDM,
+} LineKind;
+
+static Vector* splitLines(char const* src);
+static LineKind lineKind(char const* line, size_t len);
+static char const* skipBlanks(char const* at, char const* end);
+static char const* skipWord(char const* at, char const* end);
+static bool isWord(char const* word, char const* end, char const* name);
+static bool sameLine(IncrementalLine const* a, IncrementalLine const* b);
+static void parseLines(Incremental* inc, size_t first, size_t end, size_t offset);
+static bool isPlain(IncrementalLine const* lines, size_t first, size_t end, bool constants);
+static bool splice(Incremental* inc, size_t first, size_t end, size_t node_first, size_t node_end);
+static bool hasLabel(Vector* labels, char const* name);
+static void shiftProgram(Resolver* r, size_t node_first, size_t line_first, size_t line_shift);
+static void applyAll(Incremental* inc);
+static void IncrementalLine_deinit(IncrementalLine* line);
+static void relocate(Statement* s, char const* from, size_t len, char const* to, size_t line_shift);
+static void relocateTokens(Vector* tokens, char const* from, size_t len, char const* to, size_t line_shift);
+static void relocateToken(Token* tok, char const* from, size_t len, char const* to, size_t line_shift);
+static char* copyString(char const* s);
+
+void Incremental_init(Incremental* inc) {
+  assert(inc);
+
+  Vector* lines = Vector_new(sizeof(IncrementalLine));
+  if (!lines)
+    die("Vector_new() failed");
+  *inc = (Incremental){.lines = lines};
+}
+
+void Incremental_deinit(Incremental* inc) {
+  assert(inc);
+
+  if (inc->has_program)
+    Parser_deinit(&inc->parser);
+  for (size_t i = 0; i < Vector_len(inc->lines); ++i)
+    IncrementalLine_deinit(Vector_at(inc->lines, i));
+  Vector_destroy(inc->lines);
+  free(inc->src);
+}
+
+void Incremental_update(Incremental* inc, char const* src) {
+  assert(inc);
+  assert(src);
+
+  Vector* lines = splitLines(src);
+  size_t const n_old = Vector_len(inc->lines), n_new = Vector_len(lines);
+  IncrementalLine* old = n_old ? Vector_at(inc->lines, 0) : NULL;
+  IncrementalLine* new = n_new ? Vector_at(lines, 0) : NULL;
+
+  size_t prefix = 0, suffix = 0;
+  while (prefix < n_old && prefix < n_new && sameLine(&old[prefix], &new[prefix]))
+    ++prefix;
+  while (suffix < n_old - prefix && suffix < n_new - prefix &&
+         sameLine(&old[n_old - 1 - suffix], &new[n_new - 1 - suffix]))
+    ++suffix;
+
+  /* A change within a macro or a conditional takes the whole of it, before
+   * and after the change */
+  size_t first = prefix;
+  while (first > 0 && ((first < n_new && new[first].continues) || (first < n_old && old[first].continues)))
+    --first;
+  while (suffix > 0 && (new[n_new - suffix].continues || old[n_old - suffix].continues))
+    --suffix;
+
+  /* The program is kept if it is as the last update left it, and nothing
+   * from the change on was fixed where it was given */
+  size_t const old_end = n_old - suffix;
+  bool kept = inc->has_program && !Parser_hasErrors(&inc->parser) && !inc->parser.included &&
+              inc->parser.resolver.n_relayouts == inc->n_relayouts && isPlain(old, first, old_end, false) &&
+              isPlain(old, old_end, n_old, true);
+  size_t node_first = 0, node_end = 0;
+  for (size_t i = 0; kept && i < old_end; ++i) {
+    node_first += i < first ? old[i].n_nodes : 0;
+    node_end += old[i].n_nodes;
+  }
+
+  /* Unchanged lines keep their statements, renumbered after the change */
+  for (size_t i = 0; i < first; ++i)
+    new[i] = old[i];
+  size_t const shift = n_new - n_old;
+  for (size_t i = 1; i <= suffix; ++i) {
+    IncrementalLine* line = &new[n_new - i];
+    *line = old[n_old - i];
+    for (size_t j = 0; line->statements && j < Vector_len(line->statements); ++j)
+      relocate(Vector_at(line->statements, j), NULL, 0, NULL, shift);
+  }
+  if (kept)
+    shiftProgram(&inc->parser.resolver, node_end, old_end + 1, shift);
+  for (size_t i = first; i < old_end; ++i)
+    IncrementalLine_deinit(&old[i]);
+  Vector_destroy(inc->lines);
+  inc->lines = lines;
+
+  free(inc->src);
+  inc->src = copyString(src);
+  inc->lex = Lexer_make(inc->src);
+
+  size_t offset = 0;
+  for (size_t i = 0; i < first; ++i)
+    offset += new[i].len;
+  parseLines(inc, first, n_new - suffix, offset);
+  inc->n_reparsed = n_new - suffix - first;
+
+  if (!kept || !splice(inc, first, n_new - suffix, node_first, node_end)) {
+    if (inc->has_program)
+      Parser_deinit(&inc->parser);
+    applyAll(inc);
+  }
+  inc->n_relayouts = inc->parser.resolver.n_relayouts;
+}
+
+static Vector* splitLines(char const* src) {
+  Vector* lines = Vector_new(sizeof(IncrementalLine));
+  if (!lines)
+    die("Vector_new() failed");
+
+  /* A conditional runs to its ENDIF, nested ones included, and a macro to
+   * the first ENDM outside a conditional; a stray ELSE takes the lines up
+   * to the next ELSE or ENDIF, as the lexer has it */
+  size_t depth = 0;
+  bool in_macro = false;
+  for (char const* p = src; *p;) {
+    char const* nl = strchr(p, '\n');
+    size_t const len = nl ? (size_t)(nl - p) + 1 : strlen(p);
+    IncrementalLine const line = {.hash = Hash_bytes(p, len, 0), .len = len, .continues = in_macro || depth > 0};
+    if (Vector_push(lines, &line) == -1)
+      die("Vector_push() failed");
+
+    switch (lineKind(p, len)) {
+    case LINE_IF:
+      ++depth;
+      break;
+    case LINE_ELSE:
+      if (depth == 0)
+        depth = 1;
+      break;
+    case LINE_ENDIF:
+      if (depth > 0)
+        --depth;
+      break;
+    case LINE_MACRO:
+      if (!line.continues)
+        in_macro = true;
+      break;
+    case LINE_ENDM:
+      if (depth == 0)
+        in_macro = false;
+      break;
+    case LINE_OTHER:
+      break;
+    }
+    p += len;
+  }
+  return lines;
+}
+
+/* By the first word of the line, after blanks, as a directive; comments
+ * and identifiers that merely contain one are other lines */
+static LineKind lineKind(char const* line, size_t len) {
+  char const* const end = line + len;
+  char const* const word = skipBlanks(line, end);
+  char const* const word_end = skipWord(word, end);
+  if (isWord(word, word_end, "if") || isWord(word, word_end, "ifdef") || isWord(word, word_end, "ifndef"))
+    return LINE_IF;
+  if (isWord(word, word_end, "else"))
+    return LINE_ELSE;
+  if (isWord(word, word_end, "endif"))
+    return LINE_ENDIF;
+  if (isWord(word, word_end, "endm"))
+    return LINE_ENDM;
+  if (word == word_end || isdigit((unsigned char)*word))
+    return LINE_OTHER;
+
+  char const* at = skipBlanks(word_end, end);
+  if (at < end && *at == ':')
+    at = skipBlanks(at + 1, end);
+  return isWord(at, skipWord(at, end), "macro") ? LINE_MACRO : LINE_OTHER;
+}
+
+static char const* skipBlanks(char const* at, char const* end) {
+  while (at < end && (*at == ' ' || *at == '\t' || *at == '\r'))
+    ++at;
+  return at;
+}
+
+static char const* skipWord(char const* at, char const* end) {
+  while (at < end && (isalnum((unsigned char)*at) || *at == '_'))
+    ++at;
+  return at;
+}
+
+static bool isWord(char const* word, char const* end, char const* name) {
+  size_t const len = strlen(name);
+  return (size_t)(end - word) == len && strncasecmp(word, name, len) == 0;
+}
+
+static bool sameLine(IncrementalLine const* a, IncrementalLine const* b) { return a->hash == b->hash && a->len == b->len; }
+
+/* Parse lines [first, end) of the source, starting at `offset`, into their
+ * records */
+static void parseLines(Incremental* inc, size_t first, size_t end, size_t offset) {
+  IncrementalLine* lines = Vector_len(inc->lines) ? Vector_at(inc->lines, 0) : NULL;
+  size_t len = 0;
+  for (size_t i = first; i < end; ++i)
+    len += lines[i].len;
+  if (len == 0)
+    return;
+
+  Vector* statements = Vector_new(sizeof(Statement));
+  if (!statements)
+    die("Vector_new() failed");
+  Lexer lex = Lexer_makeRange(inc->src, offset, offset + len, first + 1);
+  Parser p = Parser_make(&lex);
+  p.includes = inc->includes;
+  Parser_parseStatements(&p, statements);
+  Parser_deinit(&p);
+
+  for (size_t i = 0; i < Vector_len(statements); ++i) {
+    Statement* s = Vector_at(statements, i);
+    assert(s->line > first && s->line <= end);
+    IncrementalLine* line = &lines[s->line - 1];
+    if (!line->statements) {
+      line->statements = Vector_new(sizeof(Statement));
+      if (!line->statements)
+        die("Vector_new() failed");
+    }
+    if (Vector_push(line->statements, s) == -1)
+      die("Vector_push() failed");
+  }
+  Vector_destroy(statements);
+
+  /* The statements move to a copy of their line, and of the body of the
+   * block they open, which stays when the source around it changes */
+  for (size_t i = first; i < end; offset += lines[i].len, ++i) {
+    IncrementalLine* line = &lines[i];
+    if (!line->statements)
+      continue;
+    size_t text_len = line->len;
+    for (size_t j = i + 1; j < end && lines[j].continues; ++j)
+      text_len += lines[j].len;
+    line->text = malloc(text_len + 1);
+    if (!line->text)
+      die("malloc() failed");
+    memcpy(line->text, inc->src + offset, text_len);
+    line->text[text_len] = '\0';
+    for (size_t j = 0; j < Vector_len(line->statements); ++j)
+      relocate(Vector_at(line->statements, j), inc->src + offset, text_len, line->text, 0);
+  }
+}
+
+/* Whether the statements of lines [first, end) are only labels and
+ * instructions, and EQU constants too if `constants` */
+static bool isPlain(IncrementalLine const* lines, size_t first, size_t end, bool constants) {
+  for (size_t i = first; i < end; ++i) {
+    for (size_t j = 0; lines[i].statements && j < Vector_len(lines[i].statements); ++j) {
+      Statement const* s = Vector_at(lines[i].statements, j);
+      bool const equ = s->kind == STATEMENT_CONSTANT && s->data.constant.kind == SYMBOL_EQU;
+      if (s->kind != STATEMENT_LABEL && s->kind != STATEMENT_INSTRUCTION && !(constants && equ))
+        return false;
+    }
+  }
+  return true;
+}
+
+/* Put the statements of the new lines [first, end) in place of the nodes
+ * [node_first, node_end) of the old ones, if they are plain, and every
+ * label is one of the old lines or new to the program
+ *
+ * @returns false if the program is to be built again: it was left as it
+ *   was, or it now has errors, which a full build reports in its own order
+ */
+static bool splice(Incremental* inc, size_t first, size_t end, size_t node_first, size_t node_end) {
+  IncrementalLine* lines = Vector_len(inc->lines) ? Vector_at(inc->lines, 0) : NULL;
+  Resolver* r = &inc->parser.resolver;
+  if (!isPlain(lines, first, end, false))
+    return false;
+
+  Vector* labels = Vector_new(sizeof(Token));
+  if (!labels)
+    die("Vector_new() failed");
+  bool fits = true;
+  for (size_t i = first; i < end && fits; ++i) {
+    for (size_t j = 0; lines[i].statements && j < Vector_len(lines[i].statements) && fits; ++j) {
+      Statement const* s = Vector_at(lines[i].statements, j);
+      if (s->kind != STATEMENT_LABEL)
+        continue;
+      Symbol const* sym = Resolver_find(r, &s->data.label.tok);
+      fits = (!sym || (sym->kind == SYMBOL_LABEL && sym->node >= node_first && sym->node < node_end)) &&
+             !hasLabel(labels, s->data.label.node.data.label.name);
+      if (Vector_push(labels, &s->data.label.tok) == -1)
+        die("Vector_push() failed");
+    }
+  }
+  for (size_t i = node_first; i < node_end && fits; ++i) {
+    IRNode const* n = Vector_at(inc->parser.nodes, i);
+    fits = n->kind != IR_LABEL || hasLabel(labels, n->data.label.name);
+  }
+  if (!fits) {
+    Vector_destroy(labels);
+    return false;
+  }
+
+  Vector* with = Vector_new(sizeof(IRNode));
+  if (!with)
+    die("Vector_new() failed");
+  for (size_t i = first; i < end; ++i) {
+    lines[i].n_nodes = lines[i].statements ? Vector_len(lines[i].statements) : 0;
+    for (size_t j = 0; j < lines[i].n_nodes; ++j) {
+      Statement copy = Statement_copy(Vector_at(lines[i].statements, j));
+      IRNode const* n = copy.kind == STATEMENT_LABEL ? &copy.data.label.node : &copy.data.instruction;
+      if (Vector_push(with, n) == -1)
+        die("Vector_push() failed");
+    }
+  }
+  inc->n_applied = Vector_len(with);
+  Resolver_splice(r, node_first, node_end, with, labels);
+  Vector_destroy(with);
+  Vector_destroy(labels);
+
+  Resolver_finish(r);
+  return !Parser_hasErrors(&inc->parser);
+}
+
+static bool hasLabel(Vector* labels, char const* name) {
+  size_t const len = strlen(name);
+  for (size_t i = 0; i < Vector_len(labels); ++i) {
+    Token const* tok = Vector_at(labels, i);
+    if (tok->len == len && strncmp(tok->value, name, len) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Move the nodes from `node_first` on, and the symbols defined from line
+ * `line_first` on, `line_shift` lines down (see relocate()) */
+static void shiftProgram(Resolver* r, size_t node_first, size_t line_first, size_t line_shift) {
+  for (size_t i = node_first; i < Vector_len(r->nodes); ++i) {
+    IRNode* n = Vector_at(r->nodes, i);
+    if (n->kind == IR_LABEL) {
+      n->data.label.line += line_shift;
+    } else if (n->kind == IR_ORG) {
+      n->data.org.tok.line += line_shift;
+    } else {
+      IRInstruction* iri = &n->data.instruction;
+      iri->line += line_shift;
+      for (size_t j = 0; j < Vector_len(iri->encoded_items); ++j) {
+        EncodedItem* item = Vector_at(iri->encoded_items, j);
+        if (EncodedItem_isExpr(item))
+          relocateTokens(item->data.expr, NULL, 0, NULL, line_shift);
+      }
+    }
+  }
+
+  MapIter it = MapIter_init(r->symbols);
+  while (MapIter_next(&it)) {
+    Symbol* sym = it.value;
+    if (sym->tok.origin || sym->tok.line < line_first)
+      continue;
+    sym->tok.line += line_shift;
+    if (sym->expr)
+      relocateTokens(sym->expr, NULL, 0, NULL, line_shift);
+  }
+}
+
+/* Resolve the statements of every line into a new program, as
+ * Parser_parse() does */
+static void applyAll(Incremental* inc) {
+  inc->parser = Parser_make(&inc->lex);
+  inc->parser.includes = inc->includes;
+  inc->has_program = true;
+  inc->n_applied = 0;
+  for (size_t i = 0; i < Vector_len(inc->lines); ++i) {
+    IncrementalLine* line = Vector_at(inc->lines, i);
+    size_t const n_nodes = Vector_len(inc->parser.nodes);
+    for (size_t j = 0; line->statements && j < Vector_len(line->statements); ++j) {
+      Statement s = Statement_copy(Vector_at(line->statements, j));
+      Parser_apply(&inc->parser, &s);
+      inc->n_applied += 1;
+    }
+    line->n_nodes = Vector_len(inc->parser.nodes) - n_nodes;
+  }
+  Resolver_finish(&inc->parser.resolver);
+}
+
+static void IncrementalLine_deinit(IncrementalLine* line) {
+  for (size_t i = 0; line->statements && i < Vector_len(line->statements); ++i)
+    Statement_deinit(Vector_at(line->statements, i));
+  if (line->statements)
+    Vector_destroy(line->statements);
+  free(line->text);
+}
+
+/* Point the tokens into [from, from + len) at `to` instead, and move the
+ * statement `line_shift` lines down (modulo SIZE_MAX + 1, so up too) */
+static void relocate(Statement* s, char const* from, size_t len, char const* to, size_t line_shift) {
+  s->line += line_shift;
+  switch (s->kind) {
+  case STATEMENT_LABEL:
+    relocateToken(&s->data.label.tok, from, len, to, line_shift);
+    s->data.label.node.data.label.line += line_shift;
+    break;
+  case STATEMENT_CONSTANT:
+    relocateToken(&s->data.constant.tok, from, len, to, line_shift);
+    relocateTokens(s->data.constant.expr, from, len, to, line_shift);
+    break;
+  case STATEMENT_INSTRUCTION: {
+    IRInstruction* iri = &s->data.instruction.data.instruction;
+    iri->line += line_shift;
+    for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i) {
+      EncodedItem* item = Vector_at(iri->encoded_items, i);
+      if (EncodedItem_isExpr(item))
+        relocateTokens(item->data.expr, from, len, to, line_shift);
+    }
+    break;
+  }
+  case STATEMENT_ORG:
+  case STATEMENT_BANK:
+    relocateToken(&s->data.org.tok, from, len, to, line_shift);
+    relocateTokens(s->data.org.expr, from, len, to, line_shift);
+    break;
+  case STATEMENT_CYCLES:
+    relocateToken(&s->data.cycles.tok, from, len, to, line_shift);
+    relocateToken(&s->data.cycles.start, from, len, to, line_shift);
+    relocateToken(&s->data.cycles.end, from, len, to, line_shift);
+    relocateTokens(s->data.cycles.max, from, len, to, line_shift);
+    break;
+  case STATEMENT_INCLUDE:
+    relocateToken(&s->data.include.tok, from, len, to, line_shift);
+    break;
+  case STATEMENT_FILL:
+    relocateToken(&s->data.fill.tok, from, len, to, line_shift);
+    relocateTokens(s->data.fill.count, from, len, to, line_shift);
+    if (s->data.fill.value)
+      relocateTokens(s->data.fill.value, from, len, to, line_shift);
+    break;
+  case STATEMENT_INCBIN:
+    relocateToken(&s->data.incbin.tok, from, len, to, line_shift);
+    if (s->data.incbin.offset)
+      relocateTokens(s->data.incbin.offset, from, len, to, line_shift);
+    if (s->data.incbin.len)
+      relocateTokens(s->data.incbin.len, from, len, to, line_shift);
+    break;
+  case STATEMENT_MACRO:
+    relocateToken(&s->data.macro.tok, from, len, to, line_shift);
+    relocateTokens(s->data.macro.params, from, len, to, line_shift);
+    relocateTokens(s->data.macro.locals, from, len, to, line_shift);
+    relocateTokens(s->data.macro.body, from, len, to, line_shift);
+    break;
+  case STATEMENT_EXPAND:
+    relocateToken(&s->data.expand.tok, from, len, to, line_shift);
+    relocateTokens(s->data.expand.args, from, len, to, line_shift);
+    break;
+  case STATEMENT_CONDITIONAL:
+    relocateToken(&s->data.cond.tok, from, len, to, line_shift);
+    relocateTokens(s->data.cond.expr, from, len, to, line_shift);
+    relocateTokens(s->data.cond.then_body, from, len, to, line_shift);
+    if (s->data.cond.else_body)
+      relocateTokens(s->data.cond.else_body, from, len, to, line_shift);
+    break;
+  case STATEMENT_ERROR:
+    s->data.error.lineno += line_shift;
+    break;
+  }
+}
+
+static void relocateTokens(Vector* tokens, char const* from, size_t len, char const* to, size_t line_shift) {
+  for (size_t i = 0; i < Vector_len(tokens); ++i)
+    relocateToken(Vector_at(tokens, i), from, len, to, line_shift);
+}
+
+static void relocateToken(Token* tok, char const* from, size_t len, char const* to, size_t line_shift) {
+  tok->line += line_shift;
+  /* Up to the end, where END is; error tokens hold a message instead */
+  if (len && tok->value >= from && tok->value <= from + len)
+    tok->value = to + (tok->value - from);
+}
+
+static char* copyString(char const* s) {
+  char* copy = dsprintf("%s", s);
+  if (!copy)
+    die("dsprintf() failed");
+  return copy;
+}
@@ -0,0 +1,52 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "vector.h"
+
+/* Reassembly of a source that changes a little at a time
+ *
+ * The statements parsed from every line are kept along with a hash of the
+ * line. A new version of the source is compared with the last one by these
+ * hashes: the lines before the first difference and after the last one
+ * keep their statements, and only the lines in between are lexed and
+ * parsed again. A change within the body of a macro or a conditional takes
+ * the whole of it, which is told by the directive each line starts with,
+ * as the lexer and the parser tell it.
+ *
+ * When those lines hold only labels and instructions, and the lines after
+ * them nothing whose value is fixed where it is given (ORG, DEFL, DS and
+ * the like), their nodes are replaced in the program of the last update
+ * (see Resolver_splice()), and only the expressions over symbols whose
+ * values change are computed again. Otherwise the statements of all lines
+ * are resolved into a new program, as is one that included files: these
+ * are looked up again on each update, so the program sees their changes.
+ */
+typedef struct {
+  char* src;              //< The source of the last update
+  Lexer lex;              //< Over `src`, for the diagnostics of the resolver
+  Vector* lines;          //< Vector[IncrementalLine]: the lines of `src`
+  Parser parser;          //< The program of the last update, if `has_program`; it points into the struct
+  bool has_program;
+  size_t n_reparsed;      //< Lines the last update parsed again
+  size_t n_applied;       //< Statements the last update resolved
+  size_t n_relayouts;     //< Of the resolver as the last update left it; the program was changed since if it differs
+  IncludeCache* includes; //< For INCLUDE, see Parser; NULL unless set after Incremental_init()
+} Incremental;
+
+void Incremental_init(Incremental* inc);
+void Incremental_deinit(Incremental* inc);
+
+/* Assemble a new version of the source
+ *
+ * The program, in `inc->parser`, is the one Parser_parse() would give, and
+ * is changed or replaced by the next update. Passes may change it in the
+ * meantime, only then it is built anew.
+ */
+void Incremental_update(Incremental* inc, char const* src);
+
+#endif // INCREMENTAL_H
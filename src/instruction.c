@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "instruction.h"
@@ -28,23 +29,47 @@ IRNode IRNode_createInstruction(char const* fmt, ...) {
   va_start(ap, fmt);
   size_t const fmt_len = strlen(fmt);
   EncodedItem item = {0};
+  Operand op;
   int tmp;
   for (size_t i = 0; i < fmt_len; ++i) {
     switch (fmt[i]) {
     case 'b':
       item.kind = EI_BYTE;
       tmp = va_arg(ap, int);
-      if (tmp < 0 || tmp >= UINT8_MAX)
+      if (tmp < 0 || tmp > UINT8_MAX)
         die("IRNode_createInstruction(): invalid byte value");
       item.data.byte = (uint8_t)tmp;
       break;
     case 'e':
-      item.kind = EI_EXPR;
-      item.data.expr = va_arg(ap, Vector*);
+      op = va_arg(ap, Operand);
+      if (op.expr) {
+        item.kind = EI_EXPR;
+        item.data.expr = op.expr;
+      } else {
+        item.kind = EI_BYTE;
+        item.data.byte = (uint8_t)op.value;
+      }
       break;
     case 'a':
-      item.kind = EI_ADDR;
-      item.data.addr = va_arg(ap, Vector*);
+      op = va_arg(ap, Operand);
+      if (op.expr) {
+        item.kind = EI_ADDR;
+        item.data.addr = op.expr;
+      } else {
+        /* Little-endian, the high byte is pushed below */
+        item.kind = EI_BYTE;
+        item.data.byte = (uint8_t)op.value;
+        if (Vector_push(items, &item) == -1)
+          die("Vector_push() failed");
+        item.data.byte = (uint8_t)((uint32_t)op.value >> 8);
+      }
+      break;
+    case 'r':
+      /* The displacement depends on the address, so even a constant target
+       * stays an expression */
+      op = va_arg(ap, Operand);
+      item.kind = EI_REL;
+      item.data.expr = Operand_toExpr(&op);
       break;
     default:
       die("IRNode_createInstruction(): incorrect format specifier");
@@ -58,6 +83,89 @@ IRNode IRNode_createInstruction(char const* fmt, ...) {
   return node;
 }
 
+void EncodedItem_deinit(EncodedItem* item) {
+  assert(item);
+  if (item->kind == EI_BYTES)
+    Blob_release(item->data.bytes);
+  if (!EncodedItem_isExpr(item))
+    return;
+  Vector_destroy(item->data.expr);
+}
+
+bool EncodedItem_isExpr(EncodedItem const* item) {
+  assert(item);
+  return item->kind == EI_EXPR || item->kind == EI_ADDR || item->kind == EI_REL;
+}
+
+size_t EncodedItem_size(EncodedItem const* item) {
+  assert(item);
+
+  switch (item->kind) {
+  case EI_BYTE:
+  case EI_EXPR:
+  case EI_REL:
+    return 1;
+  case EI_ADDR:
+    return 2;
+  case EI_BYTES:
+    return item->data.bytes->len;
+  case EI_FILL:
+    return item->data.fill.len;
+  default:
+    die("EncodedItem_size(): invalid kind");
+  }
+}
+
+size_t IRInstruction_size(IRInstruction const* iri) {
+  assert(iri);
+
+  size_t size = 0;
+  for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i)
+    size += EncodedItem_size(Vector_at(iri->encoded_items, i));
+  return size;
+}
+
+void IRInstruction_encode(IRInstruction const* iri, uint8_t* out) {
+  assert(iri);
+  assert(out);
+
+  for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i) {
+    EncodedItem const* item = Vector_at(iri->encoded_items, i);
+    switch (item->kind) {
+    case EI_BYTE:
+      *out++ = item->data.byte;
+      break;
+    case EI_EXPR:
+    case EI_REL:
+      if (item->resolved)
+        *out = (uint8_t)item->value;
+      out += 1;
+      break;
+    case EI_ADDR:
+      if (item->resolved) {
+        out[0] = (uint8_t)item->value;
+        out[1] = (uint8_t)((uint32_t)item->value >> 8);
+      }
+      out += 2;
+      break;
+    case EI_BYTES:
+      memcpy(out, item->data.bytes->data, item->data.bytes->len);
+      out += item->data.bytes->len;
+      break;
+    case EI_FILL:
+      memset(out, item->data.fill.byte, item->data.fill.len);
+      out += item->data.fill.len;
+      break;
+    default:
+      die("IRInstruction_encode(): invalid kind");
+    }
+  }
+}
+
+uint32_t IR_physical(uint16_t bank, uint16_t addr) {
+  return bank ? bank * IR_BANK_SIZE + addr % IR_BANK_SIZE : addr;
+}
+
 void IRNode_print(FILE* fout, IRNode* n) {
   assert(fout);
   assert(n);
@@ -69,6 +177,9 @@ void IRNode_print(FILE* fout, IRNode* n) {
     case IR_LABEL:
       IRLabel_print(fout, &n->data.label);
       break;
+    case IR_ORG:
+      fprintf(fout, "ORG line=%zu bank=%u addr=0x%04x", n->data.org.tok.line, n->data.org.bank, n->data.org.addr);
+      break;
     default:
       die("IRNode_print(): invalid kind");
   }
@@ -77,7 +188,10 @@ void IRNode_print(FILE* fout, IRNode* n) {
 }
 
 static void IRInstruction_print(FILE* fout, IRInstruction* iri) {
-  fprintf(fout, "INSTRUCTION ");
+  if (iri->bank)
+    fprintf(fout, "INSTRUCTION addr=%u:0x%04x ", iri->bank, iri->addr);
+  else
+    fprintf(fout, "INSTRUCTION addr=0x%04x ", iri->addr);
   size_t const len = Vector_len(iri->encoded_items);
   for (size_t i = 0; i < len; ++i) {
     EncodedItem_print(fout, Vector_at(iri->encoded_items, i));
@@ -87,7 +201,10 @@ static void IRInstruction_print(FILE* fout, IRInstruction* iri) {
 }
 
 static void IRLabel_print(FILE* fout, IRLabel* irl) {
-  fprintf(fout, "LABEL name=%s line=%zu addr=0x%04x", irl->name, irl->line, irl->addr);
+  if (irl->bank)
+    fprintf(fout, "LABEL name=%s line=%zu addr=%u:0x%04x", irl->name, irl->line, irl->bank, irl->addr);
+  else
+    fprintf(fout, "LABEL name=%s line=%zu addr=0x%04x", irl->name, irl->line, irl->addr);
 }
 
 static void EncodedItem_print(FILE* fout, EncodedItem* item) {
@@ -98,13 +215,30 @@ static void EncodedItem_print(FILE* fout, EncodedItem* item) {
     case EI_EXPR:
       fprintf(fout, "(EXPR ");
       EncodedItem_printExpr(fout, item->data.expr);
+      if (item->resolved)
+        fprintf(fout, " = %02x", (uint8_t)item->value);
       fprintf(fout, ")");
       break;
     case EI_ADDR:
       fprintf(fout, "(ADDR ");
       EncodedItem_printExpr(fout, item->data.expr);
+      if (item->resolved)
+        fprintf(fout, " = %04x", (uint16_t)item->value);
+      fprintf(fout, ")");
+      break;
+    case EI_REL:
+      fprintf(fout, "(REL ");
+      EncodedItem_printExpr(fout, item->data.expr);
+      if (item->resolved)
+        fprintf(fout, " = %02x", (uint8_t)item->value);
       fprintf(fout, ")");
       break;
+    case EI_BYTES:
+      fprintf(fout, "(BYTES %zu)", item->data.bytes->len);
+      break;
+    case EI_FILL:
+      fprintf(fout, "(FILL %u x %02x)", item->data.fill.len, item->data.fill.byte);
+      break;
     default:
       die("EncodedItem_print(): invalid kind");
   }
@@ -115,6 +249,7 @@ static void EncodedItem_printExpr(FILE* fout, Vector* expr) {
   for (size_t i = 0; i < len; ++i) {
     char* tok_str = Token_format(Vector_at(expr, i));
     fprintf(fout, "%s", tok_str);
+    free(tok_str);
     if (i != len - 1)
       fprintf(fout, ", ");
   }
@@ -1,47 +1,97 @@
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "blob.h"
+#include "expression.h"
 #include "vector.h"
 
 typedef enum {
   EI_BYTE,
   EI_EXPR,
   EI_ADDR,
+  EI_REL,
+  EI_BYTES, //< Constant bytes in a blob, of data directives
+  EI_FILL,  //< A byte repeated, of DS
 } EncodedItemKind;
 
+/* Branches that the relaxation pass may lengthen */
+typedef enum {
+  BRANCH_NONE = 0,
+  BRANCH_JR,   //< JR [cc,] e; becomes JP [cc,] nn
+  BRANCH_DJNZ, //< DJNZ e; becomes DEC B; JP NZ, nn
+} BranchKind;
+
 typedef enum {
   IR_INSTRUCTION,
   IR_LABEL,
+  IR_ORG, //< Sets the location counter, ORG or BANK
 } IRNodeKind;
 
+/* ROM banks
+ *
+ * Every bank is a separate 16-bit address space, holding IR_BANK_SIZE bytes
+ * of ROM at IR_BANK_SIZE * bank. Bank 0 is the flat address space of
+ * programs which don't use banks; in a banked program it's the home bank
+ * and holds the first IR_BANK_SIZE bytes.
+ */
+#define IR_BANK_SIZE 0x4000u
+
+/* Expression items (EI_EXPR is a byte, EI_ADDR is a little-endian word,
+ * EI_REL is a byte displacement from the end of the instruction) keep their
+ * expression and are patched in place by the resolver: once the expression
+ * is evaluated, `value` holds the result and `resolved` is set. The resolver
+ * also interns the expression into its DAG (see exprdag.h) as `node`. */
 typedef struct {
   EncodedItemKind kind;
   union {
     uint8_t byte;
     Vector* expr;
     Vector* addr;
+    Blob* bytes; //< EI_BYTES, a reference of the item's own
+    struct {
+      uint32_t len;
+      uint8_t byte;
+    } fill; //< EI_FILL
   } data;
+  uint32_t node; //< Root in the resolver's ExprDag, EXPR_DAG_NONE until first evaluated
+  int32_t value;
+  bool resolved;
 } EncodedItem;
 
 typedef struct {
   Vector* encoded_items;
+  size_t line; //< Source line of the mnemonic
+  uint16_t bank;
+  uint16_t addr;
+  BranchKind branch;
+  bool is_data; //< From DB, DW, DS or INCBIN: bytes, not code to time or rewrite
 } IRInstruction;
 
 typedef struct {
   char* name;
   size_t line;
+  uint16_t bank;
   uint16_t addr;
   bool has_addr;
 } IRLabel;
 
+typedef struct {
+  Token tok; //< The directive
+  uint16_t bank;
+  uint16_t addr;
+} IROrg;
+
 typedef struct {
   IRNodeKind kind;
   union {
     IRInstruction instruction;
     IRLabel label;
+    IROrg org;
   } data;
 } IRNode;
 
@@ -55,11 +105,37 @@ typedef struct {
  * argument:
  *
  *   - b: byte (uint8_t)
- *   - w: word (uint16_t)
- *   - e: expression (Vector[Token])
+ *   - e: byte operand (Operand)
+ *   - a: word operand (Operand)
+ *   - r: relative displacement operand (Operand)
+ *
+ * Operands folded at parse time become plain bytes, except for displacements
+ * which depend on the address of the instruction. Their range must have
+ * been checked.
  */
 IRNode IRNode_createInstruction(char const* fmt, ...);
 
+/* Free the expression of an item, if any, or drop its blob */
+void EncodedItem_deinit(EncodedItem* item);
+
+/* Whether the item holds an expression */
+bool EncodedItem_isExpr(EncodedItem const* item);
+
+/* Number of bytes the item occupies in the output */
+size_t EncodedItem_size(EncodedItem const* item);
+
+/* Number of bytes the instruction occupies in the output */
+size_t IRInstruction_size(IRInstruction const* iri);
+
+/* Store the bytes of the instruction, IRInstruction_size() of them
+ *
+ * The bytes of items without a value are left as they are.
+ */
+void IRInstruction_encode(IRInstruction const* iri, uint8_t* out);
+
+/* Offset of a bank address in the output */
+uint32_t IR_physical(uint16_t bank, uint16_t addr);
+
 void IRNode_print(FILE* fout, IRNode* n);
 
 #endif // INSTRUCTION_H
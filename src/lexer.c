@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <ctype.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -9,6 +10,14 @@
 #include "lexer.h"
 #include "utility.h"
 
+/* What the first word of a line does to conditional blocks */
+typedef enum {
+  COND_NONE,
+  COND_IF, //< IF, IFDEF or IFNDEF
+  COND_ELSE,
+  COND_ENDIF,
+} Conditional;
+
 static bool isAtEnd(Lexer* lex);
 static char peek(Lexer* lex);
 static char advance(Lexer* lex);
@@ -22,6 +31,9 @@ static Token parseLiteral(Lexer* lex);
 static Token parseChar(Lexer* lex);
 static Token parseString(Lexer* lex);
 static Token makeErrorToken(Lexer* lex, char const* msg);
+static Token scanBlock(Lexer* lex);
+static Conditional conditional(char const* word, size_t len);
+static bool startsLine(Lexer const* lex);
 static Token makeToken(Lexer* lex, TokenType type);
 static Token makeTokenIdx(Lexer* lex, TokenType type, size_t start, size_t end);
 static int escToInt(char const* ch);
@@ -33,6 +45,8 @@ char* Token_format(Token* tok) {
   char* buf = NULL;
   if (tok->type == TOKEN_ERROR) {
     buf = dsprintf("%zu:%zu:%s:%s", tok->line, tok->col, TokenType_str(tok->type), tok->value);
+  } else if (tok->folded) {
+    buf = dsprintf("%zu:%zu:folded:%d", tok->line, tok->col, (int)tok->folded_value);
   } else {
     assert(tok->len < INT_MAX);
     char const* unary_str = tok->unary ? "u:" : "";
@@ -44,7 +58,7 @@ char* Token_format(Token* tok) {
   return buf;
 }
 
-char* Token_str(Token* tok) {
+char* Token_str(Token const* tok) {
   assert(tok);
 
   char* str = malloc(tok->len + 1);
@@ -129,12 +143,14 @@ char const* TokenType_str(TokenType type) {
     return "TOKEN_RIGHT_SHIFT";
   case TOKEN_COLON:
     return "TOKEN_COLON";
+  case TOKEN_BLOCK:
+    return "TOKEN_BLOCK";
   default:
     die("TokenType_str: unknown token type");
   }
 }
 
-unsigned long Token_toInt(Token* tok) {
+unsigned long Token_toInt(Token const* tok) {
   assert(tok);
   char* end = NULL;
   long value = 0;
@@ -185,6 +201,7 @@ unsigned long Token_toInt(Token* tok) {
   case TOKEN_LESS_EQUAL:
   case TOKEN_COLON:
   case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
   default:
     die("Token_toInt(): could not convert to integer");
   }
@@ -195,15 +212,50 @@ unsigned long Token_toInt(Token* tok) {
   return (unsigned)value;
 }
 
+size_t Token_decode(Token const* tok, uint8_t* out) {
+  assert(tok && tok->type == TOKEN_CHAR);
+  assert(out);
+
+  /* Most strings have no escapes, and are copied as they are */
+  if (!memchr(tok->value, '\\', tok->len)) {
+    memcpy(out, tok->value, tok->len);
+    return tok->len;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < tok->len; i += tok->value[i] == '\\' ? 2 : 1)
+    out[n++] = (uint8_t)escToInt(tok->value + i);
+  return n;
+}
+
 Lexer Lexer_make(char const* buf) {
   assert(buf);
-  Lexer lex = {.buf = buf};
+  Lexer lex = {.buf = buf, .end = SIZE_MAX};
+  return lex;
+}
+
+Lexer Lexer_makeRange(char const* buf, size_t start, size_t end, size_t line) {
+  assert(buf);
+  assert(start <= end);
+  assert(line > 0);
+  Lexer lex = {.buf = buf, .start = start, .cur = start, .line = line - 1, .bol = start, .end = end};
+  return lex;
+}
+
+Lexer Lexer_makeBlock(Token const* block) {
+  assert(block && block->type == TOKEN_BLOCK);
+  Lexer lex = Lexer_makeRange(block->value, 0, block->len, block->line);
+  lex.origin = block->origin;
   return lex;
 }
 
 Token Lexer_next(Lexer* lex) {
   assert(lex);
 
+  if (lex->block_next) {
+    lex->block_next = false;
+    return scanBlock(lex);
+  }
+
   while (eatWhitespace(lex))
     ;
 
@@ -214,8 +266,12 @@ Token Lexer_next(Lexer* lex) {
 
   Token result;
   if ((result = parseNumber(lex)).type != TOKEN_UNINITIALIZED ||
-      (result = parseLiteral(lex)).type != TOKEN_UNINITIALIZED)
+      (result = parseLiteral(lex)).type != TOKEN_UNINITIALIZED) {
+    Conditional const c = result.type == TOKEN_ID ? conditional(result.value, result.len) : COND_NONE;
+    if ((c == COND_IF || c == COND_ELSE) && startsLine(lex))
+      lex->opens_block = true;
     return result;
+  }
 
   char c = advance(lex);
   switch (c) {
@@ -292,13 +348,15 @@ Token Lexer_next(Lexer* lex) {
   case ':':
     return makeToken(lex, TOKEN_COLON);
   case '\n':
+    lex->block_next = lex->opens_block;
+    lex->opens_block = false;
     return makeToken(lex, TOKEN_NEWLINE);
   }
 
   return makeErrorToken(lex, "unknown token");
 }
 
-char* Lexer_line(Lexer* lex, size_t line) {
+char* Lexer_line(Lexer const* lex, size_t line) {
   assert(lex);
   assert(line > 0);
 
@@ -336,9 +394,9 @@ char* Lexer_line(Lexer* lex, size_t line) {
   return buf;
 }
 
-static bool isAtEnd(Lexer* lex) { return lex->buf[lex->cur] == '\0'; }
+static bool isAtEnd(Lexer* lex) { return lex->cur == lex->end || lex->buf[lex->cur] == '\0'; }
 
-static char peek(Lexer* lex) { return lex->buf[lex->cur]; }
+static char peek(Lexer* lex) { return isAtEnd(lex) ? '\0' : lex->buf[lex->cur]; }
 
 static char advance(Lexer* lex) {
   if (isAtEnd(lex))
@@ -366,10 +424,18 @@ static bool eatWhitespace(Lexer* lex) {
   case '\t':
     advance(lex);
     break;
-  case ';':
-    while (!isAtEnd(lex) && advance(lex) != '\n')
-      ;
+  case ';': {
+    /* A comment ends the line of a statement, so the newline is left to
+     * end it too; a line of nothing but a comment goes as a whole */
+    bool only_comment = true;
+    for (size_t i = lex->bol; i < lex->cur && only_comment; ++i)
+      only_comment = lex->buf[i] == ' ' || lex->buf[i] == '\t' || lex->buf[i] == '\r';
+    while (!isAtEnd(lex) && peek(lex) != '\n')
+      advance(lex);
+    if (only_comment)
+      advance(lex);
     return true;
+  }
   default:
     return false;
   }
@@ -500,6 +566,14 @@ static Token parseNumber(Lexer* lex) {
     return tok;
   }
 
+  // '0'
+  if (matchChar(lex, '0')) {
+    tok = makeToken(lex, TOKEN_DECIMAL);
+    if (peek(lex) == 'd' || peek(lex) == 'D')
+      advance(lex);
+    return tok;
+  }
+
   return tok;
 }
 
@@ -549,9 +623,83 @@ static Token makeErrorToken(Lexer* lex, char const* msg) {
       .line = lex->line + 1,
       .len = lex->cur - lex->start,
       .value = msg,
+      .origin = lex->name ? lex : lex->origin,
   };
 }
 
+/* The lines up to the ELSE or ENDIF closing the block, nested blocks
+ * included
+ *
+ * Only the first word of each line is looked at, and the next line is
+ * found with memchr(), so the lines are never lexed unless the block turns
+ * out to be assembled (see Lexer_makeBlock()).
+ */
+static Token scanBlock(Lexer* lex) {
+  if (lex->end == SIZE_MAX)
+    lex->end = lex->cur + strlen(lex->buf + lex->cur);
+  char const* const end = lex->buf + lex->end;
+  char const* at = lex->buf + lex->cur;
+  size_t depth = 0, lines = 0;
+  while (at < end) {
+    char const* word = at;
+    while (word < end && (*word == ' ' || *word == '\t' || *word == '\r'))
+      ++word;
+    char const* word_end = word;
+    while (word_end < end && (isalnum((unsigned char)*word_end) || *word_end == '_'))
+      ++word_end;
+    Conditional const c = conditional(word, (size_t)(word_end - word));
+    if (c == COND_IF)
+      ++depth;
+    else if ((c == COND_ELSE || c == COND_ENDIF) && depth == 0)
+      break;
+    else if (c == COND_ENDIF)
+      --depth;
+
+    char const* nl = memchr(word_end, '\n', (size_t)(end - word_end));
+    if (!nl)
+      at = end;
+    else {
+      at = nl + 1;
+      ++lines;
+    }
+  }
+
+  size_t const start = lex->cur;
+  lex->cur = (size_t)(at - lex->buf);
+  Token tok = makeTokenIdx(lex, TOKEN_BLOCK, start, lex->cur);
+  tok.col = 0;
+  lex->line += lines;
+  lex->start = lex->bol = lex->cur;
+  return tok;
+}
+
+static Conditional conditional(char const* word, size_t len) {
+  static struct {
+    char const* name;
+    Conditional c;
+  } const words[] = {
+      {"if", COND_IF}, {"ifdef", COND_IF}, {"ifndef", COND_IF}, {"else", COND_ELSE}, {"endif", COND_ENDIF},
+  };
+  char lower[sizeof("ifndef")];
+  if (len < 2 || len >= sizeof(lower))
+    return COND_NONE;
+  for (size_t i = 0; i < len; ++i)
+    lower[i] = (char)tolower((unsigned char)word[i]);
+  lower[len] = '\0';
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+    if (strcmp(lower, words[i].name) == 0)
+      return words[i].c;
+  return COND_NONE;
+}
+
+/* Whether the token just lexed is the first of its line */
+static bool startsLine(Lexer const* lex) {
+  for (size_t i = lex->bol; i < lex->start; ++i)
+    if (lex->buf[i] != ' ' && lex->buf[i] != '\t' && lex->buf[i] != '\r')
+      return false;
+  return true;
+}
+
 static Token makeToken(Lexer* lex, TokenType type) { return makeTokenIdx(lex, type, lex->start, lex->cur); }
 
 static Token makeTokenIdx(Lexer* lex, TokenType type, size_t start, size_t end) {
@@ -561,6 +709,7 @@ static Token makeTokenIdx(Lexer* lex, TokenType type, size_t start, size_t end)
       .line = lex->line + 1,
       .len = end - start,
       .value = lex->buf + start,
+      .origin = lex->name ? lex : lex->origin,
   };
 }
 
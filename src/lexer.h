@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define LEXER_MAX_LINE_LEN 256
@@ -43,6 +44,7 @@ typedef enum {
   TOKEN_LESS_EQUAL,
   TOKEN_COLON,
   TOKEN_NEWLINE,
+  TOKEN_BLOCK, //< The lines of a conditional block, after its IF, IFDEF, IFNDEF or ELSE line
 } TokenType;
 
 typedef struct {
@@ -51,23 +53,57 @@ typedef struct {
   size_t line;
   size_t col;
   TokenType type;
-  bool unary;  //< Used by ExprParser
+  bool unary;                 //< Used by ExprParser
+  bool folded;                //< Used by ExprParser: a constant subexpression, evaluated to `folded_value`
+  int32_t folded_value;       //< Used by ExprParser
+  struct Lexer const* origin; //< The lexer of the included file it comes from, NULL for the main source
 } Token;
 
-typedef struct {
+typedef struct Lexer {
   char const* buf;
   size_t start;
   size_t cur;
   size_t line;
   size_t bol;
+  size_t end;       //< Offset where the input ends, if before the NUL
+  char const* name; //< Of an included file, whose tokens then point back here; NULL for the main source
+  struct Lexer const* origin; //< Given to the tokens instead, when lexing a TOKEN_BLOCK
+  bool opens_block;           //< The line starts with IF, IFDEF, IFNDEF or ELSE
+  bool block_next;            //< The next token is the TOKEN_BLOCK of the line before
 } Lexer;
 
 char* Token_format(Token* tok);
-char* Token_str(Token* tok);
+char* Token_str(Token const* tok);
 char const* TokenType_str(TokenType type);
-unsigned long Token_toInt(Token* tok);
+unsigned long Token_toInt(Token const* tok);
+
+/* The characters of a TOKEN_CHAR, a string or a character literal, with
+ * their escapes decoded
+ *
+ * @param out Room for tok->len bytes, which is always enough
+ * @returns The number of bytes
+ */
+size_t Token_decode(Token const* tok, uint8_t* out);
 
 Lexer Lexer_make(char const* buf);
+
+/* Lex only buf[start, end), where `start` begins the source line `line`
+ * (counting from 1)
+ *
+ * Tokens are numbered and Lexer_line() finds lines as in the whole buffer.
+ */
+Lexer Lexer_makeRange(char const* buf, size_t start, size_t end, size_t line);
+
+/* Lex the lines of a TOKEN_BLOCK, into the tokens they would have been had
+ * they been lexed in place */
+Lexer Lexer_makeBlock(Token const* block);
+
+/* The next token
+ *
+ * A line starting with IF, IFDEF, IFNDEF or ELSE is followed by a
+ * TOKEN_BLOCK of the lines up to the matching ELSE or ENDIF line, which is
+ * lexed as usual.
+ */
 Token Lexer_next(Lexer* lex);
 
 /** Get a source line from number
@@ -78,6 +114,6 @@ Token Lexer_next(Lexer* lex);
  * @param line Source line number
  * @returns Null-terminated source code line
  */
-char* Lexer_line(Lexer* lex, size_t line);
+char* Lexer_line(Lexer const* lex, size_t line);
 
 #endif
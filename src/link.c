@@ -0,0 +1,604 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "fixup.h"
+#include "image.h"
+#include "instruction.h"
+#include "link.h"
+#include "map.h"
+#include "object.h"
+#include "utility.h"
+#include "vector.h"
+
+enum {
+  MARK_NONE = 0,
+  MARK_ACTIVE,
+  MARK_DONE,
+};
+
+typedef struct LinkObject LinkObject;
+
+typedef struct {
+  uint8_t flags; //< ObjectSectionFlags
+  uint16_t bank;
+  uint16_t addr; //< Of a relocatable section, where the linker placed it
+  uint32_t size;
+  uint8_t const* data; //< In the mapping
+} LinkSection;
+
+typedef struct {
+  LinkObject const* obj;
+  uint32_t name;
+  ObjectSymbolKind kind;
+  uint32_t section; //< OBJECT_SYMBOL_LABEL
+  uint32_t offset;  //< OBJECT_SYMBOL_LABEL
+  int32_t value;    //< OBJECT_SYMBOL_VALUE, and OBJECT_SYMBOL_EXPR once evaluated
+  uint8_t* code;    //< OBJECT_SYMBOL_EXPR
+  uint8_t mark;     //< OBJECT_SYMBOL_EXPR: evaluation state, for cycles
+  bool failed;      //< OBJECT_SYMBOL_EXPR: the evaluation failed and was reported
+  bool duplicate;   //< Another object defines the name too
+} LinkSymbol;
+
+typedef struct {
+  uint32_t section;
+  uint32_t offset;
+  EncodedItemKind kind;
+  uint32_t end; //< Offset of the end of the instruction in the section
+  uint8_t* code;
+} LinkRelocation;
+
+struct LinkObject {
+  char const* path;
+  void* map;
+  size_t map_len;
+  uint32_t n_names;
+  char** names;
+  LinkSymbol** by_name; //< Definitions by name ID, NULL for external names
+  uint32_t n_sections;
+  LinkSection* sections;
+  uint32_t n_symbols;
+  LinkSymbol* symbols;
+  uint32_t n_relocations;
+  LinkRelocation* relocations;
+};
+
+typedef struct {
+  FILE* ferr;
+  LinkObject* objects;
+  size_t n_objects;
+  Map* symbols; //< name -> LinkSymbol*, the first definition
+  bool failed;
+} Linker;
+
+/* Where a program is evaluated */
+typedef struct {
+  Linker* l;
+  LinkObject const* obj;
+} LookupContext;
+
+/* A written region and the object it comes from */
+typedef struct {
+  ImageRegion region;
+  LinkObject const* obj;
+} Placement;
+
+/* Bounds-checked reading of a mapped object */
+typedef struct {
+  uint8_t const* p;
+  uint8_t const* end;
+  bool bad; //< Ran past the end or found invalid data
+} Reader;
+
+static int load(Linker* l, LinkObject* obj);
+static void unload(LinkObject* obj);
+static void define(Linker* l, LinkObject* obj);
+static uint32_t freeAddress(Vector* placed, size_t n_absolute, uint32_t base, uint32_t size);
+static void checkOverlaps(Linker* l, Vector* placed);
+static int comparePlacements(void const* a, void const* b);
+static int evaluate(Linker* l, LinkObject const* obj, uint8_t const* code, int32_t* value);
+static int symbolValue(Linker* l, LinkSymbol* s, int32_t* value);
+static int lookupLinked(void* ctx, uint32_t id, int32_t* value);
+static uint8_t getU8(Reader* rd);
+static uint16_t getU16(Reader* rd);
+static uint32_t getU32(Reader* rd);
+static uint8_t const* getBytes(Reader* rd, size_t n);
+static uint8_t* getCode(Reader* rd);
+static uint32_t getCount(Reader* rd);
+static void error(Linker* l, LinkObject const* obj, char const* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static void map_keep_symbol(void* value);
+
+int Link_objects(char const* const* paths, size_t n_paths, FILE* ferr, Image* img) {
+  assert(paths || n_paths == 0);
+  assert(ferr);
+  assert(img);
+
+  Linker l = {.ferr = ferr, .n_objects = n_paths};
+  l.objects = calloc(n_paths + 1, sizeof(*l.objects));
+  if (!l.objects)
+    die("calloc() failed");
+  l.symbols = Map_new(sizeof(LinkSymbol), map_keep_symbol);
+  if (!l.symbols)
+    die("Map_new() failed");
+
+  for (size_t i = 0; i < n_paths; ++i) {
+    l.objects[i].path = paths[i];
+    if (load(&l, &l.objects[i]) == -1)
+      l.failed = true;
+  }
+
+  Image result = {0};
+  if (l.failed)
+    goto cleanup;
+
+  /* The absolute sections stay where they are, the relocatable ones are
+   * placed around them */
+  Vector* placed = Vector_new(sizeof(Placement));
+  if (!placed)
+    die("Vector_new() failed");
+  for (size_t i = 0; i < n_paths; ++i) {
+    LinkObject const* obj = &l.objects[i];
+    for (uint32_t k = 0; k < obj->n_sections; ++k) {
+      LinkSection const* sec = &obj->sections[k];
+      Placement const pl = {.region = {.start = IR_physical(sec->bank, sec->addr), .len = sec->size}, .obj = obj};
+      if ((sec->flags & OBJECT_SECTION_ABSOLUTE) && pl.region.len && Vector_push(placed, &pl) == -1)
+        die("Vector_push() failed");
+    }
+  }
+  size_t const n_absolute = Vector_len(placed);
+  if (n_absolute)
+    qsort(Vector_at(placed, 0), n_absolute, sizeof(Placement), comparePlacements);
+
+  uint32_t base = 0;
+  for (size_t i = 0; i < n_paths; ++i) {
+    LinkObject* obj = &l.objects[i];
+    for (uint32_t k = 0; k < obj->n_sections; ++k) {
+      LinkSection* sec = &obj->sections[k];
+      if (sec->flags & OBJECT_SECTION_ABSOLUTE)
+        continue;
+      if (sec->size)
+        base = freeAddress(placed, n_absolute, base, sec->size);
+      if (base + sec->size > UINT16_MAX + 1u) {
+        error(&l, obj, "relocatable code runs past address 0x%04x", UINT16_MAX);
+        continue;
+      }
+      sec->addr = (uint16_t)base;
+      base += sec->size;
+      Placement const pl = {.region = {.start = IR_physical(sec->bank, sec->addr), .len = sec->size}, .obj = obj};
+      if (pl.region.len && Vector_push(placed, &pl) == -1)
+        die("Vector_push() failed");
+    }
+    define(&l, obj);
+  }
+  checkOverlaps(&l, placed);
+  if (l.failed) {
+    Vector_destroy(placed);
+    goto cleanup;
+  }
+
+  Vector* regions = Vector_new(sizeof(ImageRegion));
+  if (!regions)
+    die("Vector_new() failed");
+  for (size_t i = 0; i < Vector_len(placed); ++i)
+    if (Vector_push(regions, &((Placement*)Vector_at(placed, i))->region) == -1)
+      die("Vector_push() failed");
+  Vector_destroy(placed);
+
+  result = Image_fromRegions(regions);
+  result.data = calloc(result.len + 1, 1);
+  if (!result.data)
+    die("calloc() failed");
+  for (size_t i = 0; i < n_paths; ++i) {
+    LinkObject const* obj = &l.objects[i];
+    for (uint32_t k = 0; k < obj->n_sections; ++k) {
+      LinkSection const* sec = &obj->sections[k];
+      if (sec->size)
+        memcpy(result.data + (IR_physical(sec->bank, sec->addr) - result.base), sec->data, sec->size);
+    }
+  }
+
+  /* Evaluate every relocation, check the ranges in one pass, then store */
+  FixupBatch b = FixupBatch_make();
+  for (size_t i = 0; i < n_paths; ++i) {
+    LinkObject const* obj = &l.objects[i];
+    for (uint32_t k = 0; k < obj->n_relocations; ++k) {
+      LinkRelocation const* rel = &obj->relocations[k];
+      size_t const idx = FixupBatch_push(&b, b.len, 0, rel->kind);
+      int32_t value;
+      if (evaluate(&l, obj, rel->code, &value) == -1)
+        continue;
+      if (rel->kind == EI_REL)
+        value -= (int32_t)(obj->sections[rel->section].addr + rel->end);
+      b.value[idx] = value;
+      b.status[idx] = FIXUP_OK;
+    }
+  }
+
+  FixupBatch_checkRanges(&b);
+  size_t idx = 0;
+  for (size_t i = 0; i < n_paths; ++i) {
+    LinkObject const* obj = &l.objects[i];
+    for (uint32_t k = 0; k < obj->n_relocations; ++k, ++idx) {
+      LinkRelocation const* rel = &obj->relocations[k];
+      int32_t const value = b.value[idx];
+      if (b.status[idx] == FIXUP_UNRESOLVED)
+        continue;
+      if (b.status[idx] == FIXUP_OUT_OF_RANGE) {
+        error(&l, obj, "value %d does not fit in %zu byte(s)", (int)value, rel->kind == EI_ADDR ? (size_t)2 : 1);
+        continue;
+      }
+      if (rel->kind == EI_REL && (value < INT8_MIN || value > INT8_MAX)) {
+        error(&l, obj, "displacement %d does not fit in a signed byte", (int)value);
+        continue;
+      }
+
+      LinkSection const* sec = &obj->sections[rel->section];
+      uint8_t* out = result.data + (IR_physical(sec->bank, sec->addr) + rel->offset - result.base);
+      out[0] = (uint8_t)value;
+      if (rel->kind == EI_ADDR)
+        out[1] = (uint8_t)((uint32_t)value >> 8);
+    }
+  }
+  FixupBatch_deinit(&b);
+
+cleanup:
+  for (size_t i = 0; i < n_paths; ++i)
+    unload(&l.objects[i]);
+  free(l.objects);
+  Map_destroy(l.symbols);
+
+  if (l.failed) {
+    Image_deinit(&result);
+    return -1;
+  }
+  *img = result;
+  return 0;
+}
+
+/* Map an object and read its tables; the section data stays in the
+ * mapping */
+static int load(Linker* l, LinkObject* obj) {
+  int const fd = open(obj->path, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    error(l, obj, "%s", strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  if (st.st_size < OBJECT_MAGIC_LEN) {
+    error(l, obj, "not an object file");
+    close(fd);
+    return -1;
+  }
+
+  obj->map_len = (size_t)st.st_size;
+  obj->map = mmap(NULL, obj->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (obj->map == MAP_FAILED) {
+    obj->map = NULL;
+    error(l, obj, "%s", strerror(errno));
+    return -1;
+  }
+  if (!Object_isObject(obj->map, obj->map_len)) {
+    error(l, obj, "not an object file");
+    return -1;
+  }
+
+  Reader rd = {.p = (uint8_t const*)obj->map + OBJECT_MAGIC_LEN, .end = (uint8_t const*)obj->map + obj->map_len};
+  uint32_t const version = getU32(&rd);
+  if (!rd.bad && version != OBJECT_VERSION) {
+    error(l, obj, "unsupported object version %u", (unsigned)version);
+    return -1;
+  }
+
+  /* Every entry takes a byte at least, which bounds the allocations */
+  obj->n_names = getCount(&rd);
+  obj->n_sections = getCount(&rd);
+  obj->n_symbols = getCount(&rd);
+  obj->n_relocations = getCount(&rd);
+  obj->names = calloc(obj->n_names + 1, sizeof(*obj->names));
+  obj->by_name = calloc(obj->n_names + 1, sizeof(*obj->by_name));
+  obj->sections = calloc(obj->n_sections + 1, sizeof(*obj->sections));
+  obj->symbols = calloc(obj->n_symbols + 1, sizeof(*obj->symbols));
+  obj->relocations = calloc(obj->n_relocations + 1, sizeof(*obj->relocations));
+  if (!obj->names || !obj->by_name || !obj->sections || !obj->symbols || !obj->relocations)
+    die("calloc() failed");
+
+  for (uint32_t i = 0; i < obj->n_names && !rd.bad; ++i) {
+    uint16_t const len = getU16(&rd);
+    uint8_t const* name = getBytes(&rd, len);
+    if (!name)
+      break;
+    obj->names[i] = malloc((size_t)len + 1);
+    if (!obj->names[i])
+      die("malloc() failed");
+    memcpy(obj->names[i], name, len);
+    obj->names[i][len] = '\0';
+  }
+
+  for (uint32_t i = 0; i < obj->n_sections && !rd.bad; ++i) {
+    LinkSection* sec = &obj->sections[i];
+    sec->flags = getU8(&rd);
+    sec->bank = getU16(&rd);
+    sec->addr = getU16(&rd);
+    sec->size = getU32(&rd);
+    sec->data = getBytes(&rd, sec->size);
+    rd.bad |= (sec->flags & ~OBJECT_SECTION_ABSOLUTE) != 0;
+  }
+
+  for (uint32_t i = 0; i < obj->n_symbols && !rd.bad; ++i) {
+    LinkSymbol* s = &obj->symbols[i];
+    s->obj = obj;
+    s->name = getU32(&rd);
+    uint8_t const kind = getU8(&rd);
+    if (rd.bad || s->name >= obj->n_names || obj->by_name[s->name]) {
+      rd.bad = true;
+      break;
+    }
+    obj->by_name[s->name] = s;
+
+    switch (kind) {
+    case OBJECT_SYMBOL_LABEL:
+      s->kind = OBJECT_SYMBOL_LABEL;
+      s->section = getU32(&rd);
+      s->offset = getU32(&rd);
+      rd.bad |= s->section >= obj->n_sections || s->offset > obj->sections[s->section].size;
+      break;
+    case OBJECT_SYMBOL_VALUE:
+      s->kind = OBJECT_SYMBOL_VALUE;
+      s->value = (int32_t)getU32(&rd);
+      break;
+    case OBJECT_SYMBOL_EXPR:
+      s->kind = OBJECT_SYMBOL_EXPR;
+      s->code = getCode(&rd);
+      break;
+    default:
+      rd.bad = true;
+    }
+  }
+
+  for (uint32_t i = 0; i < obj->n_relocations && !rd.bad; ++i) {
+    LinkRelocation* rel = &obj->relocations[i];
+    rel->section = getU32(&rd);
+    rel->offset = getU32(&rd);
+    uint8_t const kind = getU8(&rd);
+    rel->end = getU32(&rd);
+    rel->code = getCode(&rd);
+    if (rd.bad || rel->section >= obj->n_sections || (kind != EI_EXPR && kind != EI_ADDR && kind != EI_REL)) {
+      rd.bad = true;
+      break;
+    }
+    rel->kind = (EncodedItemKind)kind;
+    uint64_t const item_end = (uint64_t)rel->offset + (rel->kind == EI_ADDR ? 2 : 1);
+    rd.bad |= item_end > rel->end || rel->end > obj->sections[rel->section].size;
+  }
+
+  if (rd.bad) {
+    error(l, obj, "malformed object");
+    return -1;
+  }
+  return 0;
+}
+
+static void unload(LinkObject* obj) {
+  if (obj->names)
+    for (uint32_t i = 0; i < obj->n_names; ++i)
+      free(obj->names[i]);
+  if (obj->symbols)
+    for (uint32_t i = 0; i < obj->n_symbols; ++i)
+      free(obj->symbols[i].code);
+  if (obj->relocations)
+    for (uint32_t i = 0; i < obj->n_relocations; ++i)
+      free(obj->relocations[i].code);
+  free(obj->names);
+  free(obj->by_name);
+  free(obj->sections);
+  free(obj->symbols);
+  free(obj->relocations);
+  if (obj->map)
+    munmap(obj->map, obj->map_len);
+}
+
+/* Make the definitions of an object visible to the others; a name may be
+ * defined by one object only. The LOCAL labels of macros, which no source
+ * can name (see macro.h), stay in their object. */
+static void define(Linker* l, LinkObject* obj) {
+  for (uint32_t i = 0; i < obj->n_symbols; ++i) {
+    LinkSymbol* s = &obj->symbols[i];
+    char const* name = obj->names[s->name];
+    if (strchr(name, '?'))
+      continue;
+    LinkSymbol* first = Map_get(l->symbols, name);
+    if (first) {
+      error(l, obj, "%s is already defined in %s", name, first->obj->path);
+      first->duplicate = true;
+    } else if (!Map_set(l->symbols, name, s)) {
+      die("Map_set() failed");
+    }
+  }
+}
+
+/* The lowest address from `base` on where `size` bytes miss the absolute
+ * sections, placed[0, n_absolute) sorted by address */
+static uint32_t freeAddress(Vector* placed, size_t n_absolute, uint32_t base, uint32_t size) {
+  for (size_t i = 0; i < n_absolute; ++i) {
+    ImageRegion const* r = &((Placement const*)Vector_at(placed, i))->region;
+    if (r->start >= base + size)
+      break;
+    if (r->start + r->len > base)
+      base = r->start + r->len;
+  }
+  return base;
+}
+
+/* Report sections of different objects written over one another */
+static void checkOverlaps(Linker* l, Vector* placed) {
+  size_t const n = Vector_len(placed);
+  if (n < 2)
+    return;
+  qsort(Vector_at(placed, 0), n, sizeof(Placement), comparePlacements);
+
+  /* Each region against the one reaching furthest before it */
+  Placement const* furthest = Vector_at(placed, 0);
+  for (size_t i = 1; i < n; ++i) {
+    Placement const* pl = Vector_at(placed, i);
+    uint32_t const end = furthest->region.start + furthest->region.len;
+    if (pl->region.start < end && pl->obj != furthest->obj)
+      error(l, pl->obj, "code at 0x%04x overlaps code of %s", (unsigned)pl->region.start, furthest->obj->path);
+    if (pl->region.start + pl->region.len > end)
+      furthest = pl;
+  }
+}
+
+static int comparePlacements(void const* a, void const* b) {
+  uint32_t const x = ((Placement const*)a)->region.start, y = ((Placement const*)b)->region.start;
+  return (x > y) - (x < y);
+}
+
+static int evaluate(Linker* l, LinkObject const* obj, uint8_t const* code, int32_t* value) {
+  LookupContext ctx = {.l = l, .obj = obj};
+  ExprErrorType err;
+  uint32_t sym;
+  if (ExprCode_eval(code, lookupLinked, &ctx, value, &err, &sym) == 0)
+    return 0;
+
+  /* A missing value was reported by the lookup */
+  if (err != EXPR_ERROR_UNRESOLVED_SYMBOL)
+    error(l, obj, "%s", ExprErrorType_toStr(err));
+  return -1;
+}
+
+static int symbolValue(Linker* l, LinkSymbol* s, int32_t* value) {
+  switch (s->kind) {
+  case OBJECT_SYMBOL_LABEL:
+    *value = (int32_t)(s->obj->sections[s->section].addr + s->offset);
+    return 0;
+  case OBJECT_SYMBOL_VALUE:
+    *value = s->value;
+    return 0;
+  case OBJECT_SYMBOL_EXPR:
+    if (s->mark == MARK_ACTIVE) {
+      error(l, s->obj, "circular definition of %s", s->obj->names[s->name]);
+      s->failed = true;
+      return -1;
+    }
+    if (s->mark == MARK_NONE) {
+      /* Evaluated once, in the object defining it */
+      s->mark = MARK_ACTIVE;
+      int32_t v = 0;
+      bool const failed = evaluate(l, s->obj, s->code, &v) == -1;
+      s->failed |= failed;
+      s->value = v;
+      s->mark = MARK_DONE;
+    }
+    *value = s->value;
+    return s->failed ? -1 : 0;
+  default:
+    die("symbolValue(): invalid kind");
+  }
+}
+
+static int lookupLinked(void* ctx, uint32_t id, int32_t* value) {
+  LookupContext const* c = ctx;
+  LinkObject const* obj = c->obj;
+  if (id >= obj->n_names) {
+    error(c->l, obj, "malformed object");
+    return -1;
+  }
+
+  char const* name = obj->names[id];
+  LinkSymbol* s = obj->by_name[id];
+  if (!s) {
+    s = Map_get(c->l->symbols, name);
+    if (!s) {
+      error(c->l, obj, "undefined symbol: %s", name);
+      return -1;
+    }
+    /* Reported by define() */
+    if (s->duplicate)
+      return -1;
+  }
+  return symbolValue(c->l, s, value);
+}
+
+static uint8_t getU8(Reader* rd) {
+  uint8_t const* p = getBytes(rd, 1);
+  return p ? p[0] : 0;
+}
+
+static uint16_t getU16(Reader* rd) {
+  uint8_t const* p = getBytes(rd, 2);
+  if (!p)
+    return 0;
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t getU32(Reader* rd) {
+  uint8_t const* p = getBytes(rd, 4);
+  return p ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24 : 0;
+}
+
+/* @returns The bytes in the mapping, NULL if they run past the end */
+static uint8_t const* getBytes(Reader* rd, size_t n) {
+  if (rd->bad || (size_t)(rd->end - rd->p) < n) {
+    rd->bad = true;
+    return NULL;
+  }
+  uint8_t const* p = rd->p;
+  rd->p += n;
+  return p;
+}
+
+static uint8_t* getCode(Reader* rd) {
+  if (rd->bad)
+    return NULL;
+  size_t used;
+  uint8_t* code = ExprCode_load(rd->p, (size_t)(rd->end - rd->p), &used);
+  if (!code) {
+    rd->bad = true;
+    return NULL;
+  }
+  rd->p += used;
+  return code;
+}
+
+/* A number of entries, which can't be more than the bytes left */
+static uint32_t getCount(Reader* rd) {
+  uint32_t const n = getU32(rd);
+  if (n > (size_t)(rd->end - rd->p))
+    rd->bad = true;
+  return rd->bad ? 0 : n;
+}
+
+static void error(Linker* l, LinkObject const* obj, char const* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* str = vdsprintf(fmt, ap);
+  va_end(ap);
+
+  if (!str)
+    die("vdsprintf() failed");
+
+  fprintf(l->ferr, "%s: error: %s\n", obj->path, str);
+  free(str);
+  l->failed = true;
+}
+
+/* The symbols belong to their objects */
+static void map_keep_symbol(void* value) { (void)value; }
@@ -0,0 +1,25 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "image.h"
+
+/* Link objects (see object.h) into an image
+ *
+ * The objects are mapped rather than read. Their absolute sections stay
+ * where they are; the relocatable ones are placed one after the other from
+ * address 0 of bank 0, in the order they are given, skipping over the
+ * absolute ones. Sections of different objects mustn't overlap. A name
+ * must be defined by one object only, and is looked up among the
+ * definitions of the object using it first. Every relocation is then
+ * evaluated, checked and stored in one pass (see fixup.h).
+ *
+ * @param ferr Diagnostics, each starting with the path of an object
+ * @param img Output image (see Image_deinit()), when the link succeeds
+ * @returns 0 on success, -1 on errors
+ */
+int Link_objects(char const* const* paths, size_t n_paths, FILE* ferr, Image* img);
+
+#endif // LINK_H
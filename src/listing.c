@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "instruction.h"
+#include "listing.h"
+#include "vector.h"
+#include "writer.h"
+
+#define LISTING_LINE_WIDTH 6
+#define LISTING_ROW_BYTES 4 //< Bytes per row
+
+/* Everything before the source: line, address and bytes columns. Also
+ * room for a continuation row with its newline. Line numbers grow past
+ * LISTING_LINE_WIDTH digits, up to WRITER_MAX_DECIMAL. */
+#define LISTING_MAX_PREFIX (WRITER_MAX_DECIMAL + 2 + 4 + 2 + 3 * LISTING_ROW_BYTES + 1)
+
+static size_t nodeLine(IRNode const* n);
+static void putRow(Writer* w, size_t line, bool has_addr, uint16_t addr, uint8_t const* bytes, size_t n, bool pad);
+static void putContinuation(Writer* w, IRInstruction const* iri, Image const* img, size_t offset);
+
+int Listing_write(FILE* fout, char const* src, Vector* nodes) {
+  assert(fout);
+  assert(src);
+  assert(nodes);
+
+  Image img = Image_fromIR(nodes);
+  Writer w = Writer_make(fout);
+
+  /* Nodes are in source order, so lines and nodes are walked side by side
+   * and every source line is found by scanning on from the previous one */
+  size_t node = 0, line = 1;
+  for (char const* start = src; *start != '\0'; ++line) {
+    char const* end = strchr(start, '\n');
+    if (!end)
+      end = start + strlen(start);
+
+    /* Nodes of this line are [first, node) */
+    size_t const first = node;
+    while (node < Vector_len(nodes) && nodeLine(Vector_at(nodes, node)) <= line)
+      node += 1;
+
+    IRInstruction const* iri = NULL;
+    bool has_addr = false;
+    uint16_t addr = 0;
+    for (size_t i = first; i < node && !iri; ++i) {
+      IRNode const* n = Vector_at(nodes, i);
+      if (n->kind == IR_INSTRUCTION) {
+        iri = &n->data.instruction;
+        has_addr = true;
+        addr = iri->addr;
+      } else if (n->kind == IR_LABEL && n->data.label.has_addr && !has_addr) {
+        has_addr = true;
+        addr = n->data.label.addr;
+      } else if (n->kind == IR_ORG && !has_addr) {
+        has_addr = true;
+        addr = n->data.org.addr;
+      }
+    }
+
+    size_t const size = iri ? IRInstruction_size(iri) : 0;
+    size_t const n_bytes = size < LISTING_ROW_BYTES ? size : LISTING_ROW_BYTES;
+    uint8_t const* bytes = n_bytes ? img.data + (IR_physical(iri->bank, iri->addr) - img.base) : NULL;
+    putRow(&w, line, has_addr, addr, bytes, n_bytes, true);
+    Writer_write(&w, start, (size_t)(end - start));
+    Writer_reserve(&w, 1);
+    Writer_putChar(&w, '\n');
+
+    /* The rest of the bytes, and any further instruction on the same line */
+    for (size_t i = first; i < node; ++i) {
+      IRNode const* n = Vector_at(nodes, i);
+      if (n->kind == IR_INSTRUCTION)
+        putContinuation(&w, &n->data.instruction, &img, &n->data.instruction == iri ? n_bytes : 0);
+    }
+
+    start = *end == '\n' ? end + 1 : end;
+  }
+
+  Image_deinit(&img);
+  return Writer_finish(&w);
+}
+
+static size_t nodeLine(IRNode const* n) {
+  switch (n->kind) {
+  case IR_INSTRUCTION:
+    return n->data.instruction.line;
+  case IR_LABEL:
+    return n->data.label.line;
+  case IR_ORG:
+    return n->data.org.tok.line;
+  default:
+    assert(false);
+    return 0;
+  }
+}
+
+/* A row up to the source column; a zero line leaves the line column blank
+ * and without `pad` the row ends after the last byte */
+static void putRow(Writer* w, size_t line, bool has_addr, uint16_t addr, uint8_t const* bytes, size_t n, bool pad) {
+  assert(n <= LISTING_ROW_BYTES);
+
+  Writer_reserve(w, LISTING_MAX_PREFIX);
+  if (line)
+    Writer_putDecimal(w, line, LISTING_LINE_WIDTH);
+  else
+    for (size_t i = 0; i < LISTING_LINE_WIDTH; ++i)
+      Writer_putChar(w, ' ');
+  Writer_putChar(w, ' ');
+  Writer_putChar(w, ' ');
+
+  if (has_addr) {
+    Writer_putHex(w, (uint8_t)(addr >> 8));
+    Writer_putHex(w, (uint8_t)addr);
+  } else {
+    for (size_t i = 0; i < 4; ++i)
+      Writer_putChar(w, ' ');
+  }
+  Writer_putChar(w, ' ');
+  Writer_putChar(w, ' ');
+
+  for (size_t i = 0; i < n; ++i) {
+    if (i)
+      Writer_putChar(w, ' ');
+    Writer_putHex(w, bytes[i]);
+  }
+  if (!pad)
+    return;
+
+  /* The source column starts after room for every byte and two spaces */
+  size_t const written = n ? 3 * n - 1 : 0;
+  for (size_t i = written; i < 3 * LISTING_ROW_BYTES + 1; ++i)
+    Writer_putChar(w, ' ');
+}
+
+/* Rows for the bytes of an instruction from `offset` on */
+static void putContinuation(Writer* w, IRInstruction const* iri, Image const* img, size_t offset) {
+  size_t const size = IRInstruction_size(iri);
+  for (; offset < size; offset += LISTING_ROW_BYTES) {
+    size_t const n = size - offset < LISTING_ROW_BYTES ? size - offset : LISTING_ROW_BYTES;
+    uint16_t const addr = (uint16_t)(iri->addr + offset);
+    uint8_t const* bytes = img->data + (IR_physical(iri->bank, iri->addr) + offset - img->base);
+    putRow(w, 0, true, addr, bytes, n, false);
+    Writer_putChar(w, '\n');
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdio.h>
+
+#include "vector.h"
+
+/* Write a listing: every source line with its address and emitted bytes
+ *
+ *   line  addr  bytes        source
+ *      3  0002  3A 07 00     ld a, (data)
+ *
+ * Instructions longer than four bytes continue on the following rows. Like
+ * Image_fromIR(), the IR must be resolved.
+ *
+ * @param src The source the nodes were parsed from
+ * @returns 0 on success, -1 on a write error (errno is set)
+ */
+int Listing_write(FILE* fout, char const* src, Vector* nodes);
+
+#endif // LISTING_H
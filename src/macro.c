@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "macro.h"
+#include "map.h"
+#include "parser.h"
+#include "utility.h"
+#include "vector.h"
+
+static void addToken(Vector* tokens, Token const* tok, Vector* params, Vector* locals);
+static bool isConstant(TokenType type);
+static void map_destroy_expansion(void* value);
+
+Macro Macro_make(Token const* name, Vector* params, Vector* locals, Vector* body) {
+  assert(name);
+  assert(params);
+  assert(locals);
+  assert(body);
+
+  char* name_str = Token_str(name);
+  if (!name_str)
+    die("Token_str() failed");
+  Vector* tokens = Vector_new(sizeof(MacroToken));
+  Vector* local_toks = Vector_new(sizeof(Token));
+  Vector* names = Vector_new(sizeof(char*));
+  Map* expansions = Map_new(sizeof(MacroExpansion), map_destroy_expansion);
+  if (!tokens || !local_toks || !names || !expansions)
+    die("Vector_new() failed");
+
+  for (size_t i = 0; i < Vector_len(locals); ++i)
+    if (Vector_push(local_toks, Vector_at(locals, i)) == -1)
+      die("Vector_push() failed");
+  for (size_t i = 0; i < Vector_len(body); ++i)
+    addToken(tokens, Vector_at(body, i), params, locals);
+
+  return (Macro){.name = name_str,
+                 .tok = *name,
+                 .n_params = Vector_len(params),
+                 .locals = local_toks,
+                 .body = tokens,
+                 .expansions = expansions,
+                 .names = names};
+}
+
+void Macro_deinit(Macro* m) {
+  assert(m);
+
+  free(m->name);
+  Vector_destroy(m->locals);
+  Vector_destroy(m->body);
+  Map_destroy(m->expansions);
+  for (size_t i = 0; i < Vector_len(m->names); ++i)
+    free(*(char**)Vector_at(m->names, i));
+  Vector_destroy(m->names);
+}
+
+Vector* Macro_splitArgs(Vector* args) {
+  assert(args);
+
+  Vector* split = Vector_new(sizeof(MacroArg));
+  if (!split)
+    die("Vector_new() failed");
+  if (Vector_isEmpty(args))
+    return split;
+
+  Token const* tokens = Vector_at(args, 0);
+  size_t const len = Vector_len(args);
+  size_t depth = 0, start = 0;
+  for (size_t i = 0; i <= len; ++i) {
+    if (i < len && tokens[i].type == TOKEN_LEFT_PAREN)
+      ++depth;
+    else if (i < len && tokens[i].type == TOKEN_RIGHT_PAREN && depth > 0)
+      --depth;
+    else if (i == len || (tokens[i].type == TOKEN_COMMA && depth == 0)) {
+      MacroArg const arg = {.tokens = tokens + start, .len = i - start};
+      if (Vector_push(split, &arg) == -1)
+        die("Vector_push() failed");
+      start = i + 1;
+    }
+  }
+  return split;
+}
+
+char* Macro_key(MacroArg const* args, size_t n_args) {
+  assert(args || n_args == 0);
+
+  /* Each token as its type, length and text, so no two lists of tokens
+   * share a key */
+  size_t size = 1;
+  for (size_t i = 0; i < n_args; ++i)
+    for (size_t j = 0; j < args[i].len; ++j) {
+      if (!isConstant(args[i].tokens[j].type))
+        return NULL;
+      size += args[i].tokens[j].len + 2 * 3 * sizeof(size_t) + 3;
+    }
+  size += n_args;
+
+  char* key = malloc(size);
+  if (!key)
+    die("malloc() failed");
+  size_t len = 0;
+  for (size_t i = 0; i < n_args; ++i) {
+    for (size_t j = 0; j < args[i].len; ++j) {
+      Token const* tok = &args[i].tokens[j];
+      int const n = snprintf(key + len, size - len, "%d:%zu:%.*s", (int)tok->type, tok->len, (int)tok->len, tok->value);
+      assert(n > 0 && (size_t)n < size - len);
+      len += (size_t)n;
+    }
+    key[len++] = ',';
+  }
+  key[len] = '\0';
+  return key;
+}
+
+size_t Macro_nameLocals(Macro* m) {
+  assert(m);
+
+  size_t const n_locals = Vector_len(m->locals), first = Vector_len(m->names);
+  size_t const n = n_locals ? first / n_locals + 1 : 0;
+  for (size_t i = 0; i < n_locals; ++i) {
+    Token const* local = Vector_at(m->locals, i);
+    char* name = dsprintf("%.*s?%s?%zu", (int)local->len, local->value, m->name, n);
+    if (!name)
+      die("dsprintf() failed");
+    if (Vector_push(m->names, &name) == -1)
+      die("Vector_push() failed");
+  }
+  return first;
+}
+
+MacroReader MacroReader_make(Macro const* m, MacroArg const* args, size_t names) {
+  assert(m);
+  assert(args || m->n_params == 0);
+
+  return (MacroReader){.macro = m, .args = args, .names = names};
+}
+
+Token MacroReader_next(MacroReader* r) {
+  assert(r);
+
+  while (r->splicing.len == 0) {
+    if (r->at == Vector_len(r->macro->body)) {
+      Token const* last = r->at ? &((MacroToken*)Vector_at(r->macro->body, r->at - 1))->tok : &r->macro->tok;
+      return (Token){.type = TOKEN_END, .value = last->value + last->len, .line = last->line, .origin = last->origin};
+    }
+    MacroToken const* t = Vector_at(r->macro->body, r->at++);
+    if (t->param == MACRO_NO_PARAM)
+      return t->tok;
+    if (t->param >= r->macro->n_params) {
+      Token tok = t->tok;
+      tok.value = *(char**)Vector_at(r->macro->names, r->names + t->param - r->macro->n_params);
+      tok.len = strlen(tok.value);
+      return tok;
+    }
+    r->splicing = r->args[t->param];
+  }
+  r->splicing.len -= 1;
+  return *r->splicing.tokens++;
+}
+
+/* Append the token, marked if it names a parameter
+ *
+ * The lines of a conditional are lexed here, once, for the parameters in
+ * them to be spliced too.
+ */
+static void addToken(Vector* tokens, Token const* tok, Vector* params, Vector* locals) {
+  if (tok->type == TOKEN_BLOCK) {
+    Lexer lex = Lexer_makeBlock(tok);
+    for (Token t = Lexer_next(&lex); t.type != TOKEN_END; t = Lexer_next(&lex))
+      addToken(tokens, &t, params, locals);
+    return;
+  }
+
+  /* Parameters are few, so each identifier is compared with all of them,
+   * then with the LOCAL labels */
+  size_t const n_params = Vector_len(params), n_names = n_params + Vector_len(locals);
+  MacroToken t = {.tok = *tok, .param = MACRO_NO_PARAM};
+  for (size_t i = 0; t.tok.type == TOKEN_ID && i < n_names && t.param == MACRO_NO_PARAM; ++i) {
+    Token const* param = i < n_params ? Vector_at(params, i) : Vector_at(locals, i - n_params);
+    if (param->len == t.tok.len && memcmp(param->value, t.tok.value, t.tok.len) == 0)
+      t.param = i;
+  }
+  if (Vector_push(tokens, &t) == -1)
+    die("Vector_push() failed");
+}
+
+/* Numbers, strings and operators: what parses the same wherever it is */
+static bool isConstant(TokenType type) {
+  switch (type) {
+  case TOKEN_CHAR:
+  case TOKEN_STRING:
+  case TOKEN_DECIMAL:
+  case TOKEN_HEXADECIMAL:
+  case TOKEN_OCTAL:
+  case TOKEN_BINARY:
+  case TOKEN_LEFT_PAREN:
+  case TOKEN_RIGHT_PAREN:
+  case TOKEN_MINUS:
+  case TOKEN_PLUS:
+  case TOKEN_SLASH:
+  case TOKEN_STAR:
+  case TOKEN_PERCENT:
+  case TOKEN_CAP:
+  case TOKEN_TILDE:
+  case TOKEN_AMPERSAND:
+  case TOKEN_BAR:
+  case TOKEN_LEFT_SHIFT:
+  case TOKEN_RIGHT_SHIFT:
+  case TOKEN_DOUBLE_AMPERSAND:
+  case TOKEN_DOUBLE_BAR:
+  case TOKEN_BANG:
+  case TOKEN_BANG_EQUAL:
+  case TOKEN_EQUAL_EQUAL:
+  case TOKEN_GREATER_EQUAL:
+  case TOKEN_LESS_EQUAL:
+    return true;
+  case TOKEN_UNINITIALIZED:
+  case TOKEN_END:
+  case TOKEN_ERROR:
+  case TOKEN_ID:
+  case TOKEN_LEFT_BRACE:
+  case TOKEN_RIGHT_BRACE:
+  case TOKEN_COMMA:
+  case TOKEN_COLON:
+  case TOKEN_NEWLINE:
+  case TOKEN_BLOCK:
+    return false;
+  }
+  return false;
+}
+
+static void map_destroy_expansion(void* value) {
+  MacroExpansion* e = value;
+  free(e->key);
+  for (size_t i = 0; i < Vector_len(e->statements); ++i)
+    Statement_deinit(Vector_at(e->statements, i));
+  Vector_destroy(e->statements);
+}
@@ -0,0 +1,101 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lexer.h"
+#include "map.h"
+#include "vector.h"
+
+/* Macros, defined by MACRO ... ENDM and expanded where their name stands
+ * for an instruction
+ *
+ * A body is kept as the tokens lexed from its definition, still pointing
+ * into the source, with each token naming a parameter marked with the
+ * index of the parameter. An expansion is read straight off the body,
+ * the tokens of an argument spliced in where its parameter is marked, so
+ * nothing is lexed again.
+ *
+ * The labels a LOCAL directive of the body names are marked too, and take
+ * a name of their own in each expansion, NAME?MACRO?N for the Nth one: no
+ * label of the source can be spelled so.
+ *
+ * The statements parsed from an expansion whose arguments are constants
+ * are kept under the text of the arguments, and the next expansion with
+ * the same arguments replays them instead of being parsed (see parser.c).
+ * Those of a macro with LOCAL labels never are, as each defines others.
+ */
+#define MACRO_NO_PARAM SIZE_MAX
+
+/* How deep expansions may nest, which stops a macro expanding itself forever */
+#define MACRO_MAX_DEPTH 64
+
+typedef struct {
+  Token tok;
+  size_t param; //< Index of the parameter the token names, or the number of parameters plus that of the LOCAL
+                //< label; MACRO_NO_PARAM if none
+} MacroToken;
+
+typedef struct {
+  char* name;
+  Token tok;         //< The name, where the macro is defined
+  size_t n_params;
+  Vector* locals;    //< Vector[Token], the labels named by LOCAL
+  Vector* body;      //< Vector[MacroToken], each line ending in TOKEN_NEWLINE
+  Map* expansions;   //< Map[MacroExpansion], of constant arguments by their key
+  Vector* names;     //< Vector[char*]: the names the LOCAL labels took, those of each expansion in turn
+} Macro;
+
+typedef struct {
+  char* key;          //< See Macro_key()
+  Vector* statements; //< Vector[Statement] parsed from the expansion
+} MacroExpansion;
+
+/* The tokens of an argument, within the statement invoking the macro */
+typedef struct {
+  Token const* tokens;
+  size_t len;
+} MacroArg;
+
+/* Reads the tokens of an expansion, as a ParserStream does */
+typedef struct {
+  Macro const* macro;
+  MacroArg const* args;
+  size_t at;         //< The next token of the body
+  MacroArg splicing; //< What's left of the argument being spliced in
+  size_t names;      //< Where the names of the LOCAL labels of the expansion start, see Macro_nameLocals()
+} MacroReader;
+
+/* @param params Vector[Token], the parameter names
+ * @param locals Vector[Token], the labels named by LOCAL
+ * @param body Vector[Token], as parsed */
+Macro Macro_make(Token const* name, Vector* params, Vector* locals, Vector* body);
+void Macro_deinit(Macro* m);
+
+/* Split the tokens after the name of a macro into its arguments, at the
+ * commas outside parentheses
+ *
+ * @param args Vector[Token]
+ * @returns Vector[MacroArg], pointing into `args`
+ */
+Vector* Macro_splitArgs(Vector* args);
+
+/* A key telling expansions apart by the text of their arguments
+ *
+ * @returns A heap string, NULL if an argument is not made of constants
+ */
+char* Macro_key(MacroArg const* args, size_t n_args);
+
+/* Name the LOCAL labels for a new expansion
+ *
+ * @returns Where the names start in `m->names`, for MacroReader_make()
+ */
+size_t Macro_nameLocals(Macro* m);
+
+MacroReader MacroReader_make(Macro const* m, MacroArg const* args, size_t names);
+
+/* The next token of the expansion, TOKEN_END over and over at the end */
+Token MacroReader_next(MacroReader* r);
+
+#endif // MACRO_H
@@ -1,46 +1,832 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cache.h"
+#include "hash.h"
+#include "image.h"
+#include "include.h"
+#include "incremental.h"
 #include "instruction.h"
-#include "utility.h"
+#include "link.h"
+#include "listing.h"
+#include "map.h"
+#include "object.h"
+#include "output.h"
 #include "parser.h"
+#include "peephole.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "relax.h"
+#include "server.h"
+#include "timing.h"
+#include "utility.h"
+
+#define USAGE "usage: %s [-O] [-t] [-c] [-C CACHE] [-o OUTPUT [-f bin|ihex|srec]] [-l LISTING] [--pipeline] FILE\n" \
+              "       %s [-O] [-c] [-C CACHE] [-f bin|ihex|srec] FILE|@LIST...\n"                        \
+              "       %s [-O] --watch -o OUTPUT [-f bin|ihex|srec] FILE\n"                               \
+              "       %s -o OUTPUT [-f bin|ihex|srec] OBJECT...\n"                                          \
+              "       %s --server SOCKET\n"
+
+#define OPTIONS "OtcC:o:f:l:"
+
+/* Bytes the entries of a cache may take, unless Z80ASMC_CACHE_SIZE says otherwise */
+#define CACHE_DEFAULT_MAX_SIZE (256ull << 20)
+
+/* A source of a batch */
+typedef struct {
+  char const* path;
+  char* output;    //< Next to the source, with the extension of the output
+  uint64_t size;   //< Of the source, so the biggest go first
+  char* report;    //< The diagnostics, printed in order once all are done
+  size_t report_len;
+  int exitcode;
+} BatchFile;
+
+/* What a thread of a batch keeps from one source to the next */
+typedef struct {
+  char* src;  //< The last source it read
+  size_t cap; //< Bytes allocated for `src`
+} BatchWorker;
+
+typedef struct {
+  BatchFile** order;    //< The files, biggest first
+  BatchWorker* workers; //< By pool worker
+  bool optimize;
+  bool relocatable;
+  OutputFormat format;
+  Cache* cache;           //< NULL without -C
+  IncludeCache* includes; //< Shared by the sources
+} Batch;
+
+static struct option const long_options[] = {
+    {"watch", no_argument, NULL, 'w'},
+    {"pipeline", no_argument, NULL, 'p'},
+    {NULL, 0, NULL, 0},
+};
+
+/* The files included by the requests a worker of a server answered, kept
+ * for the requests after; NULL but in a server */
+static IncludeCache* resident = NULL;
+
+static int run(int argc, char** argv);
+static bool isWatching(int argc, char** argv);
+static char* readFile(FILE* fin);
+static void readInto(FILE* fin, char** data, size_t* cap);
+static int assembleBatch(char const* const* args, size_t n_args, Batch* b);
+static int collectSources(char const* const* args, size_t n_args, Vector* paths, Vector* lists);
+static char* outputPath(char const* source, bool relocatable, OutputFormat format);
+static int checkOutputs(BatchFile* files, size_t n_files);
+static char* resolveOutput(char const* output);
+static void map_keep_file(void* value);
+static int compareSize(void const* a, void const* b);
+static void assembleJob(void* ctx, size_t worker, size_t i);
+static int assembleFile(Batch const* b, BatchFile const* f, BatchWorker* w, FILE* ferr);
+static void reportErrno(FILE* ferr, char const* path);
+static int cacheKey(char const* src, bool optimize, bool relocatable, OutputFormat format, uint64_t* key);
+static int openCache(Cache* cache, char const* dir);
+static int writeCached(char const* path, CacheEntry const* e, FILE* ferr);
+static bool isObject(char const* path);
+static int linkObjects(char const* const* paths, size_t n_paths, char const* output, OutputFormat format);
+static int writeObject(char const* path, Resolver* r, FILE* ferr);
+static int writeOutput(char const* path, Vector* nodes, OutputFormat format, FILE* ferr);
+static int writeListing(char const* path, char const* src, Vector* nodes);
+static int check(Parser* p, bool optimize, char const* path, FILE* ferr);
+static int watch(char const* path, char const* output, OutputFormat format, bool optimize);
+static void rebuild(Incremental* inc, char const* path, char const* output, OutputFormat format, bool optimize);
 
 int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+    IncludeCache includes;
+    IncludeCache_init(&includes);
+    resident = &includes;
+    int const rc = Server_run(argv[2], Pool_size(SIZE_MAX), run);
+    IncludeCache_deinit(&includes);
+    return rc == -1;
+  }
+
+  /* With a server around, it runs the command; failing that, we do. Watching
+   * would keep a worker of the server to itself, until killed. */
+  char const* server = isWatching(argc, argv) ? NULL : getenv("Z80ASMC_SERVER");
+  int const fds[] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  int exitcode;
+  if (server && Server_forward(server, argc, (char const* const*)argv, fds, &exitcode) == 0)
+    return exitcode;
+
+  return run(argc, argv);
+}
+
+/* Assemble, or link, as the command line says
+ *
+ * @returns The exit code
+ */
+static int run(int argc, char** argv) {
   int exitcode = 0;
+  bool optimize = false, timing_report = false, relocatable = false, watching = false, pipelined = false;
+  char const *output = NULL, *listing = NULL, *cache_dir = NULL;
+  OutputFormat format = OUTPUT_BIN;
 
-  FILE* fin = fopen(argv[1], "r");
+  int opt;
+  while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'w':
+      watching = true;
+      break;
+    case 'p':
+      pipelined = true;
+      break;
+    case 'c':
+      relocatable = true;
+      break;
+    case 'C':
+      cache_dir = optarg;
+      break;
+    case 'O':
+      optimize = true;
+      break;
+    case 't':
+      timing_report = true;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'l':
+      listing = optarg;
+      break;
+    case 'f':
+      if (OutputFormat_parse(optarg, &format) == -1) {
+        fprintf(stderr, "unknown output format: %s (expected bin, ihex or srec)\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  /* Objects are linked; a source is assembled, into an object with -c */
+  if (isObject(argv[optind])) {
+    if (!output || relocatable || listing || pipelined) {
+      fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+      return 1;
+    }
+    return linkObjects((char const* const*)&argv[optind], (size_t)(argc - optind), output, format);
+  }
+  /* Several sources, or lists of them, are assembled side by side */
+  if (optind + 1 < argc || argv[optind][0] == '@') {
+    if (output || listing || timing_report || watching || pipelined) {
+      fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+      return 1;
+    }
+    Cache cache = {0};
+    if (cache_dir && openCache(&cache, cache_dir) == -1)
+      return 1;
+    IncludeCache own;
+    IncludeCache* includes = resident;
+    if (!includes) {
+      IncludeCache_init(&own);
+      includes = &own;
+    }
+    Batch b = {.optimize = optimize,
+               .relocatable = relocatable,
+               .format = format,
+               .cache = cache_dir ? &cache : NULL,
+               .includes = includes};
+    exitcode = assembleBatch((char const* const*)&argv[optind], (size_t)(argc - optind), &b);
+    if (includes == &own)
+      IncludeCache_deinit(&own);
+    if (cache.dir)
+      Cache_close(&cache);
+    return exitcode;
+  }
+  if (relocatable && (!output || listing)) {
+    fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+  }
+  if (watching) {
+    if (!output || relocatable || listing || timing_report || cache_dir || pipelined) {
+      fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+      return 1;
+    }
+    return watch(argv[optind], output, format, optimize);
+  }
+
+  FILE* fin = fopen(argv[optind], "r");
   if (!fin)
     die("fopen() failed");
 
-  char data[100];
-  size_t n_read = fread(data, 1, 100, fin);
-  data[n_read] = '\0';
+  char* data = readFile(fin);
+
+  /* Only the output is cached: a listing or a report needs the program */
+  Cache cache = {0};
+  uint64_t key = 0;
+  if (cache_dir && output && !listing && !timing_report && cacheKey(data, optimize, relocatable, format, &key) == 0) {
+    if (openCache(&cache, cache_dir) == -1) {
+      free(data);
+      fclose(fin);
+      return 1;
+    }
+
+    CacheEntry e;
+    if (Cache_get(&cache, key, &e) == 0) {
+      exitcode = writeCached(output, &e, stderr);
+      CacheEntry_release(&e);
+      Cache_close(&cache);
+      free(data);
+      fclose(fin);
+      return exitcode;
+    }
+  }
 
   Lexer lex = Lexer_make(data);
+  IncludeCache own;
+  IncludeCache* includes = resident;
+  if (!includes) {
+    IncludeCache_init(&own);
+    includes = &own;
+  }
 
   Parser p = Parser_make(&lex);
-  Parser_parse(&p);
+  p.resolver.relocatable = relocatable;
+  p.includes = includes;
+  if (pipelined)
+    Pipeline_parse(&p);
+  else
+    Parser_parse(&p);
+  exitcode = check(&p, optimize, NULL, stderr);
 
-  if (Parser_hasErrors(&p)) {
-    for (size_t i = 0; i < Vector_len(p.errors); ++i)
-      ParserError_print(Vector_at(p.errors, i), stderr);
-    exitcode = 1;
-  }
+  if (output || listing) {
+    /* Only a program without errors is written out */
+    if (!exitcode && output)
+      exitcode = relocatable ? writeObject(output, &p.resolver, stderr) : writeOutput(output, p.nodes, format, stderr);
+    /* The cache only saves time, so failing to fill it isn't an error */
+    if (!exitcode && cache.dir)
+      Cache_putFile(&cache, key, output);
+    if (!exitcode && listing)
+      exitcode = writeListing(listing, data, p.nodes);
+  } else {
+    MapIter it = MapIter_init(p.resolver.symbols);
+    while (MapIter_next(&it)) {
+      printf("Label %s\n", it.key);
+    }
 
-  MapIter it = MapIter_init(p.labels);
-  while (MapIter_next(&it)) {
-    printf("Label %s\n", it.key);
+    for (size_t i = 0; i < Vector_len(p.nodes); ++i)
+      IRNode_print(stdout, Vector_at(p.nodes, i));
   }
 
-  for (size_t i = 0; i < Vector_len(p.nodes); ++i)
-    IRNode_print(stdout, Vector_at(p.nodes, i));
+  if (timing_report)
+    Timing_printReport(stdout, p.nodes);
 
   Parser_deinit(&p);
+  if (includes == &own)
+    IncludeCache_deinit(&own);
+  if (cache.dir)
+    Cache_close(&cache);
+  free(data);
+  fclose(fin);
+
+  return exitcode;
+}
+
+/* Whether the command line has --watch, or an abbreviation getopt_long()
+ * would take for it, before any "--" */
+static bool isWatching(int argc, char** argv) {
+  for (int i = 1; i < argc && strcmp(argv[i], "--") != 0; ++i) {
+    size_t const len = strlen(argv[i]);
+    if (len > 2 && strncmp(argv[i], "--watch", len) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Run the passes over a parsed program and report its errors to `ferr`,
+ * after the path of the source unless it's NULL (those in included files
+ * come after the path of theirs)
+ *
+ * @returns The exit code
+ */
+static int check(Parser* p, bool optimize, char const* path, FILE* ferr) {
+  if (!Parser_hasErrors(p)) {
+    if (optimize)
+      Peephole_optimize(&p->resolver);
+    Relax_branches(&p->resolver);
+    Resolver_checkBanks(&p->resolver);
+    Timing_checkAssertions(&p->resolver, p->cycle_assertions);
+  }
+
+  if (!Parser_hasErrors(p))
+    return 0;
+  for (size_t i = 0; i < Vector_len(p->errors); ++i) {
+    ParserError const* err = Vector_at(p->errors, i);
+    if (path && !err->file)
+      fprintf(ferr, "%s:", path);
+    ParserError_print(err, ferr);
+  }
+  return 1;
+}
+
+/* Assemble now and whenever the source is saved, until killed
+ *
+ * @returns The exit code, if the source can't be watched
+ */
+static int watch(char const* path, char const* output, OutputFormat format, bool optimize) {
+  /* Editors often save by renaming a new file over the source, so its
+   * directory is watched for either way of saving */
+  char* dir_buf = dsprintf("%s", path);
+  char* name_buf = dsprintf("%s", path);
+  if (!dir_buf || !name_buf)
+    die("dsprintf() failed");
+  char const* dir = dirname(dir_buf);
+  char const* name = basename(name_buf);
+
+  int const fd = inotify_init();
+  if (fd == -1 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+    perror(dir);
+    if (fd != -1)
+      close(fd);
+    free(dir_buf);
+    free(name_buf);
+    return 1;
+  }
+
+  IncludeCache includes;
+  IncludeCache_init(&includes);
+  Incremental inc;
+  Incremental_init(&inc);
+  inc.includes = &includes;
+  rebuild(&inc, path, output, format, optimize);
+
+  /* A save may come as several events, read at once */
+  char events[4096];
+  for (;;) {
+    ssize_t const len = read(fd, events, sizeof(events));
+    if (len == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("inotify");
+      break;
+    }
+
+    bool saved = false;
+    struct inotify_event e;
+    for (size_t at = 0; at + sizeof(e) <= (size_t)len; at += sizeof(e) + e.len) {
+      memcpy(&e, events + at, sizeof(e));
+      if (e.len && strcmp(events + at + sizeof(e), name) == 0)
+        saved = true;
+    }
+    if (saved)
+      rebuild(&inc, path, output, format, optimize);
+  }
+
+  Incremental_deinit(&inc);
+  IncludeCache_deinit(&includes);
+  close(fd);
+  free(dir_buf);
+  free(name_buf);
+  return 1;
+}
+
+/* Assemble the source as it is now and report how it went */
+static void rebuild(Incremental* inc, char const* path, char const* output, OutputFormat format, bool optimize) {
+  FILE* fin = fopen(path, "r");
+  if (!fin) {
+    perror(path);
+    return;
+  }
+  char* data = readFile(fin);
+  fclose(fin);
+
+  Incremental_update(inc, data);
+  free(data);
+  if (check(&inc->parser, optimize, NULL, stderr) == 0 && writeOutput(output, inc->parser.nodes, format, stderr) == 0)
+    fprintf(stderr, "%s: assembled, %zu of %zu lines parsed again\n", path, inc->n_reparsed, Vector_len(inc->lines));
+}
+
+/* Assemble every source the arguments name, each into its own output
+ *
+ * The sources are handed to the pool biggest first, so that a big one
+ * doesn't start last and keep a single thread busy at the end. Their
+ * diagnostics are collected and printed in the order of the arguments.
+ *
+ * @returns The exit code
+ */
+static int assembleBatch(char const* const* args, size_t n_args, Batch* b) {
+  Vector* paths = Vector_new(sizeof(char const*));
+  Vector* lists = Vector_new(sizeof(char*));
+  if (!paths || !lists)
+    die("Vector_new() failed");
+
+  int exitcode = collectSources(args, n_args, paths, lists) == -1;
+  size_t const n_files = exitcode ? 0 : Vector_len(paths);
+  BatchFile* files = calloc(n_files ? n_files : 1, sizeof(BatchFile));
+  b->order = malloc((n_files ? n_files : 1) * sizeof(BatchFile*));
+  b->workers = calloc(Pool_size(n_files), sizeof(BatchWorker));
+  if (!files || !b->order || !b->workers)
+    die("malloc() failed");
+
+  for (size_t i = 0; i < n_files; ++i) {
+    BatchFile* f = &files[i];
+    f->path = *(char const**)Vector_at(paths, i);
+    f->output = outputPath(f->path, b->relocatable, b->format);
+    struct stat st;
+    f->size = stat(f->path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    b->order[i] = f;
+  }
+
+  /* Jobs writing the same output would race for it */
+  exitcode = exitcode || checkOutputs(files, n_files);
+  if (!exitcode) {
+    qsort(b->order, n_files, sizeof(BatchFile*), compareSize);
+    Pool_runWorkers(n_files, assembleJob, b);
+  }
+
+  for (size_t i = 0; i < n_files; ++i) {
+    BatchFile* f = &files[i];
+    if (f->report)
+      fwrite(f->report, 1, f->report_len, stderr);
+    exitcode |= f->exitcode;
+    free(f->report);
+    free(f->output);
+  }
+  for (size_t i = 0; i < Pool_size(n_files); ++i)
+    free(b->workers[i].src);
+  for (size_t i = 0; i < Vector_len(lists); ++i)
+    free(*(char**)Vector_at(lists, i));
+  free(b->workers);
+  free(b->order);
+  free(files);
+  Vector_destroy(lists);
+  Vector_destroy(paths);
+  return exitcode;
+}
+
+/* Append the sources the arguments name to `paths`: an argument is a
+ * source, or `@LIST` for a file listing sources one per line. The lists
+ * are read into `lists`, which the paths point into.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int collectSources(char const* const* args, size_t n_args, Vector* paths, Vector* lists) {
+  for (size_t i = 0; i < n_args; ++i) {
+    if (args[i][0] != '@') {
+      if (Vector_push(paths, &args[i]) == -1)
+        die("Vector_push() failed");
+      continue;
+    }
+
+    FILE* fin = fopen(args[i] + 1, "r");
+    if (!fin) {
+      perror(args[i] + 1);
+      return -1;
+    }
+    char* list = readFile(fin);
+    fclose(fin);
+    if (Vector_push(lists, &list) == -1)
+      die("Vector_push() failed");
+
+    /* Surrounding blanks and empty lines are ignored */
+    for (char* line = list; *line;) {
+      char* end = strchr(line, '\n');
+      char* next = end ? end + 1 : line + strlen(line);
+      if (!end)
+        end = next;
+      while (line < end && isspace((unsigned char)*line))
+        ++line;
+      while (end > line && isspace((unsigned char)end[-1]))
+        --end;
+      if (end > line) {
+        *end = '\0';
+        char const* path = line;
+        if (Vector_push(paths, &path) == -1)
+          die("Vector_push() failed");
+      }
+      line = next;
+    }
+  }
+  return 0;
+}
+
+/* The source with the extension of the output instead of its own */
+static char* outputPath(char const* source, bool relocatable, OutputFormat format) {
+  char const* ext = "o";
+  if (!relocatable) {
+    switch (format) {
+    case OUTPUT_BIN:
+      ext = "bin";
+      break;
+    case OUTPUT_IHEX:
+      ext = "hex";
+      break;
+    case OUTPUT_SREC:
+      ext = "srec";
+      break;
+    }
+  }
+
+  char const* slash = strrchr(source, '/');
+  char const* name = slash ? slash + 1 : source;
+  char const* dot = strrchr(name, '.');
+  size_t const stem = dot && dot != name ? (size_t)(dot - source) : strlen(source);
+  char* path = dsprintf("%.*s.%s", (int)stem, source, ext);
+  if (!path)
+    die("dsprintf() failed");
+  return path;
+}
+
+/* Report the sources whose output is that of a source before them
+ *
+ * @returns The exit code
+ */
+static int checkOutputs(BatchFile* files, size_t n_files) {
+  Map* outputs = Map_new(sizeof(BatchFile), map_keep_file);
+  char** keys = calloc(n_files ? n_files : 1, sizeof(char*));
+  if (!outputs || !keys)
+    die("malloc() failed");
+
+  int exitcode = 0;
+  for (size_t i = 0; i < n_files; ++i) {
+    keys[i] = resolveOutput(files[i].output);
+    BatchFile const* first = Map_get(outputs, keys[i]);
+    if (first) {
+      fprintf(stderr, "%s: the output %s would overwrite that of %s\n", files[i].path, files[i].output, first->path);
+      exitcode = 1;
+    } else if (!Map_set(outputs, keys[i], &files[i])) {
+      die("Map_set() failed");
+    }
+  }
+
+  Map_destroy(outputs);
+  for (size_t i = 0; i < n_files; ++i)
+    free(keys[i]);
+  free(keys);
+  return exitcode;
+}
+
+/* The output by the device and inode of its directory, so that two ways of
+ * naming a file come out the same; as it is if the directory isn't there */
+static char* resolveOutput(char const* output) {
+  char const* slash = strrchr(output, '/');
+  char* dir = slash ? dsprintf("%.*s", (int)(slash - output) + 1, output) : dsprintf(".");
+  if (!dir)
+    die("dsprintf() failed");
+  struct stat st;
+  bool const found = stat(dir, &st) == 0;
+  free(dir);
+
+  char const* name = slash ? slash + 1 : output;
+  char* resolved = found ? dsprintf("%ju:%ju/%s", (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, name)
+                         : dsprintf("%s", output);
+  if (!resolved)
+    die("dsprintf() failed");
+  return resolved;
+}
+
+/* The files belong to the batch */
+static void map_keep_file(void* value) { (void)value; }
+
+/* Biggest first, for qsort() */
+static int compareSize(void const* a, void const* b) {
+  uint64_t const x = (*(BatchFile* const*)a)->size, y = (*(BatchFile* const*)b)->size;
+  return (x < y) - (x > y);
+}
+
+static void assembleJob(void* ctx, size_t worker, size_t i) {
+  Batch const* b = ctx;
+  BatchFile* f = b->order[i];
+  FILE* ferr = open_memstream(&f->report, &f->report_len);
+  if (!ferr)
+    die("open_memstream() failed");
+
+  if (strcmp(f->output, f->path) == 0) {
+    fprintf(ferr, "%s: the output would overwrite the source\n", f->path);
+    f->exitcode = 1;
+  } else {
+    f->exitcode = assembleFile(b, f, &b->workers[worker], ferr);
+  }
+  if (fclose(ferr) != 0)
+    die("fclose() failed");
+}
+
+/* Assemble a source of a batch into its output, as a single one would be
+ *
+ * @returns The exit code
+ */
+static int assembleFile(Batch const* b, BatchFile const* f, BatchWorker* w, FILE* ferr) {
+  FILE* fin = fopen(f->path, "r");
+  if (!fin) {
+    reportErrno(ferr, f->path);
+    return 1;
+  }
+  readInto(fin, &w->src, &w->cap);
   fclose(fin);
 
+  uint64_t key = 0;
+  bool const cached = b->cache && cacheKey(w->src, b->optimize, b->relocatable, b->format, &key) == 0;
+  if (cached) {
+    CacheEntry e;
+    if (Cache_get(b->cache, key, &e) == 0) {
+      int const exitcode = writeCached(f->output, &e, ferr);
+      CacheEntry_release(&e);
+      return exitcode;
+    }
+  }
+
+  Lexer lex = Lexer_make(w->src);
+  Parser p = Parser_make(&lex);
+  p.resolver.relocatable = b->relocatable;
+  p.includes = b->includes;
+  Parser_parse(&p);
+  int exitcode = check(&p, b->optimize, f->path, ferr);
+  if (!exitcode)
+    exitcode = b->relocatable ? writeObject(f->output, &p.resolver, ferr)
+                              : writeOutput(f->output, p.nodes, b->format, ferr);
+  if (!exitcode && cached)
+    Cache_putFile(b->cache, key, f->output);
+  Parser_deinit(&p);
   return exitcode;
 }
+
+/* perror(), to any stream */
+static void reportErrno(FILE* ferr, char const* path) { fprintf(ferr, "%s: %s\n", path, strerror(errno)); }
+
+/* The key of everything the output depends on: the source and the files
+ * it includes, the options shaping the output and the assembler itself, as
+ * a rebuilt one may assemble differently
+ *
+ * @returns 0 on success, -1 if the included files can't all be told, the
+ *   output then going uncached
+ */
+static int cacheKey(char const* src, bool optimize, bool relocatable, OutputFormat format, uint64_t* key) {
+  char options[128];
+  int const len = snprintf(options, sizeof(options), "z80asmc %s %s O%d c%d f%d", __DATE__, __TIME__, optimize,
+                           relocatable, (int)format);
+  assert(len > 0 && (size_t)len < sizeof(options));
+  uint64_t const seed = Hash_bytes(options, (size_t)len, 0);
+  *key = Hash_bytes(src, strlen(src), seed);
+  return Include_hash(src, key);
+}
+
+/* @returns 0 on success, -1 on failure (reported) */
+static int openCache(Cache* cache, char const* dir) {
+  uint64_t max_size = CACHE_DEFAULT_MAX_SIZE;
+  char const* env = getenv("Z80ASMC_CACHE_SIZE");
+  if (env) {
+    char* end;
+    errno = 0;
+    unsigned long long const size = strtoull(env, &end, 10);
+    if (errno || end == env || *end) {
+      fprintf(stderr, "invalid Z80ASMC_CACHE_SIZE: %s (expected a size in bytes)\n", env);
+      return -1;
+    }
+    max_size = size;
+  }
+
+  if (Cache_open(cache, dir, max_size) == -1) {
+    perror(dir);
+    return -1;
+  }
+  return 0;
+}
+
+/* @returns The exit code */
+static int writeCached(char const* path, CacheEntry const* e, FILE* ferr) {
+  FILE* fout = fopen(path, "wb");
+  if (!fout) {
+    reportErrno(ferr, path);
+    return 1;
+  }
+
+  int failed = fwrite(e->data, 1, e->len, fout) != e->len;
+  failed |= fclose(fout) != 0;
+  if (failed)
+    reportErrno(ferr, path);
+  return failed;
+}
+
+/* Whether the file starts like an object, rather than a source */
+static bool isObject(char const* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return false;
+  char magic[OBJECT_MAGIC_LEN];
+  size_t const len = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  return Object_isObject(magic, len);
+}
+
+/* @returns The exit code */
+static int linkObjects(char const* const* paths, size_t n_paths, char const* output, OutputFormat format) {
+  Image img;
+  if (Link_objects(paths, n_paths, stderr, &img) == -1)
+    return 1;
+
+  FILE* fout = fopen(output, format == OUTPUT_BIN ? "wb" : "w");
+  if (!fout) {
+    perror(output);
+    Image_deinit(&img);
+    return 1;
+  }
+
+  int failed = Output_write(fout, &img, format) == -1;
+  failed |= fclose(fout) != 0;
+  if (failed)
+    perror(output);
+  Image_deinit(&img);
+  return failed;
+}
+
+/* @returns The exit code */
+static int writeObject(char const* path, Resolver* r, FILE* ferr) {
+  FILE* fout = fopen(path, "wb");
+  if (!fout) {
+    reportErrno(ferr, path);
+    return 1;
+  }
+
+  int failed = Object_write(fout, r) == -1;
+  failed |= fclose(fout) != 0;
+  if (failed)
+    reportErrno(ferr, path);
+  return failed;
+}
+
+/* @returns The exit code */
+static int writeOutput(char const* path, Vector* nodes, OutputFormat format, FILE* ferr) {
+  FILE* fout = fopen(path, format == OUTPUT_BIN ? "wb" : "w");
+  if (!fout) {
+    reportErrno(ferr, path);
+    return 1;
+  }
+
+  int failed = Output_writeIR(fout, nodes, format) == -1;
+  failed |= fclose(fout) != 0;
+  if (failed)
+    reportErrno(ferr, path);
+  return failed;
+}
+
+/* @returns The exit code */
+static int writeListing(char const* path, char const* src, Vector* nodes) {
+  FILE* fout = fopen(path, "w");
+  if (!fout) {
+    perror(path);
+    return 1;
+  }
+
+  int failed = Listing_write(fout, src, nodes) == -1;
+  failed |= fclose(fout) != 0;
+  if (failed)
+    perror(path);
+  return failed;
+}
+
+static char* readFile(FILE* fin) {
+  char* data = NULL;
+  size_t cap = 0;
+  readInto(fin, &data, &cap);
+  return data;
+}
+
+/* Read the rest of a file into `*data`, NUL-terminated, growing it from
+ * `*cap` bytes as needed */
+static void readInto(FILE* fin, char** data, size_t* cap) {
+  if (*cap == 0) {
+    *cap = 4096;
+    *data = malloc(*cap);
+    if (!*data)
+      die("malloc() failed");
+  }
+
+  size_t len = 0, n_read;
+  while ((n_read = fread(*data + len, 1, *cap - len - 1, fin)) > 0) {
+    len += n_read;
+    if (*cap - len - 1 == 0) {
+      *cap *= 2;
+      *data = realloc(*data, *cap);
+      if (!*data)
+        die("realloc() failed");
+    }
+  }
+  if (ferror(fin))
+    die("fread() failed");
+
+  (*data)[len] = '\0';
+}
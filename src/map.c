@@ -21,6 +21,7 @@ typedef struct {
   void* value;
   uint64_t hash;
   MapEntryType type;
+  bool owned; //< The value was allocated by Map_setCopy and is freed by the map
 } MapEntry;
 
 struct Map {
@@ -34,9 +35,10 @@ struct Map {
 
 static int Map_expand(Map* m);
 static int Map_shrink(Map* m);
-static void* Map_setEntry(Map* m, void const* key, void* value);
+static int Map_rehash(Map* m, size_t new_capacity);
+static void* Map_setEntry(Map* m, void const* key, void* value, bool owned);
 
-static int MapEntry_set(MapEntry* e, char const* key, void* value, uint64_t hash);
+static int MapEntry_set(MapEntry* e, char const* key, void* value, uint64_t hash, bool owned);
 static void MapEntry_del(MapEntry* e, Map_value_destructor_fn dtor);
 
 static uint64_t fnv1a(char const* s);
@@ -69,7 +71,8 @@ void Map_destroy(Map* m) {
   assert(m);
 
   for (size_t i = 0; i < m->capacity; ++i)
-    m->dtor(m->entries[i].value);
+    if (m->entries[i].type == ENTRY_VALUE)
+      MapEntry_del(&m->entries[i], m->dtor);
 
   free(m->entries);
   free(m);
@@ -84,7 +87,29 @@ void* Map_set(Map* m, char const* key, void* value) {
     if (Map_expand(m) == -1)
       return NULL;
 
-  return Map_setEntry(m, key, value);
+  return Map_setEntry(m, key, value, false);
+}
+
+void* Map_setCopy(Map* m, char const* key, void const* value) {
+  assert(m);
+  assert(key);
+  assert(value);
+
+  if (m->len >= m->capacity / 2)
+    if (Map_expand(m) == -1)
+      return NULL;
+
+  void* copy = malloc(m->value_size);
+  if (!copy) {
+    perror("malloc() failed");
+    return NULL;
+  }
+  memcpy(copy, value, m->value_size);
+
+  void* result = Map_setEntry(m, key, copy, true);
+  if (!result)
+    free(copy);
+  return result;
 }
 
 void* Map_get(Map const* m, char const* key) {
@@ -116,16 +141,20 @@ int Map_del(Map* m, char const* key) {
   uint64_t hash = fnv1a(key);
   size_t idx = (size_t)(hash & (uint64_t)(m->capacity - 1));
 
-  while (m->entries[idx].type == ENTRY_VALUE) {
-    if (strcmp(m->entries[idx].key, key) == 0) {
+  while (m->entries[idx].type != ENTRY_UNINITIALIZED) {
+    if (m->entries[idx].type == ENTRY_VALUE && strcmp(m->entries[idx].key, key) == 0) {
       MapEntry_del(&m->entries[idx], m->dtor);
+      m->len -= 1;
+      if (m->len < m->capacity / 4)
+        if (Map_shrink(m) == -1)
+          return -1;
       return 0;
     }
-  }
 
-  if (m->len < m->capacity / 2)
-    if (Map_shrink(m) == -1)
-      return -1;
+    idx += 1;
+    if (idx >= m->capacity)
+      idx = 0;
+  }
 
   return -1;
 }
@@ -157,35 +186,29 @@ bool MapIter_next(MapIter* it) {
   return false;
 }
 
-static int Map_expand(Map* m) {
-  size_t new_capacity = m->capacity * 2;
-
-  m->entries = realloc(m->entries, new_capacity);
-  if (!m->entries) {
-    perror("realloc() failed");
-    return -1;
-  }
-
-  return 0;
-}
+static int Map_expand(Map* m) { return Map_rehash(m, m->capacity * 2); }
 
 static int Map_shrink(Map* m) {
   size_t new_capacity = m->capacity / 2;
   if (new_capacity < MAP_INITIAL_CAPACITY)
     return 0;
+  return Map_rehash(m, new_capacity);
+}
 
+static int Map_rehash(Map* m, size_t new_capacity) {
   MapEntry* new_entries = calloc(new_capacity, sizeof(MapEntry));
   if (!new_entries) {
     perror("calloc() failed");
     return -1;
   }
 
+  /* Deleted entries are dropped here, so the probe chains become short again */
   for (size_t i = 0; i < m->capacity; ++i) {
     if (m->entries[i].type != ENTRY_VALUE)
       continue;
 
     size_t new_idx = (size_t)(m->entries[i].hash & (uint64_t)(new_capacity - 1));
-    while (m->entries[new_idx].type == ENTRY_VALUE) {
+    while (new_entries[new_idx].type == ENTRY_VALUE) {
       new_idx += 1;
 
       if (new_idx >= new_capacity)
@@ -196,25 +219,25 @@ static int Map_shrink(Map* m) {
 
   free(m->entries);
   m->entries = new_entries;
+  m->capacity = new_capacity;
 
   return 0;
 }
 
-static void* Map_setEntry(Map* m, void const* key, void* value) {
+static void* Map_setEntry(Map* m, void const* key, void* value, bool owned) {
   uint64_t hash = fnv1a(key);
   size_t idx = (size_t)(hash & (m->capacity - 1));
+  size_t free_idx = SIZE_MAX;
 
   while (m->entries[idx].type != ENTRY_UNINITIALIZED) {
-    if (m->entries[idx].type == ENTRY_DELETED) {
-      if (MapEntry_set(&m->entries[idx], key, value, hash) == -1)
-        return NULL;
-      break;
-    }
+    if (m->entries[idx].type == ENTRY_DELETED && free_idx == SIZE_MAX)
+      free_idx = idx;
 
     if (m->entries[idx].type == ENTRY_VALUE && strcmp(m->entries[idx].key, key) == 0) {
-      m->dtor(m->entries[idx].value);
-      memcpy(m->entries[idx].value, value, m->value_size);
-      break;
+      MapEntry_del(&m->entries[idx], m->dtor);
+      if (MapEntry_set(&m->entries[idx], key, value, hash, owned) == -1)
+        return NULL;
+      return m->entries[idx].value;
     }
 
     idx += 1;
@@ -222,7 +245,10 @@ static void* Map_setEntry(Map* m, void const* key, void* value) {
       idx = 0;
   }
 
-  if (MapEntry_set(&m->entries[idx], key, value, hash) == -1)
+  if (free_idx != SIZE_MAX)
+    idx = free_idx;
+
+  if (MapEntry_set(&m->entries[idx], key, value, hash, owned) == -1)
     return NULL;
 
   m->len += 1;
@@ -230,19 +256,23 @@ static void* Map_setEntry(Map* m, void const* key, void* value) {
   return m->entries[idx].value;
 }
 
-static int MapEntry_set(MapEntry* e, char const* key, void* value, uint64_t hash) {
+static int MapEntry_set(MapEntry* e, char const* key, void* value, uint64_t hash, bool owned) {
   e->key = key;
   e->value = value;
   e->hash = hash;
   e->type = ENTRY_VALUE;
+  e->owned = owned;
   return 0;
 }
 
 static void MapEntry_del(MapEntry* e, Map_value_destructor_fn dtor) {
   dtor(e->value);
+  if (e->owned)
+    free(e->value);
   e->key = NULL;
   e->value = NULL;
   e->type = ENTRY_DELETED;
+  e->owned = false;
 }
 
 static uint64_t fnv1a(char const* s) {
@@ -0,0 +1,296 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exprcode.h"
+#include "exprdag.h"
+#include "instruction.h"
+#include "object.h"
+#include "resolver.h"
+#include "utility.h"
+#include "vector.h"
+#include "writer.h"
+
+typedef struct {
+  size_t first, end; //< Nodes [first, end)
+  uint8_t flags;     //< ObjectSectionFlags
+  uint16_t bank;
+  uint16_t addr;
+  uint32_t size;
+} Section;
+
+/* Where a node is in the object */
+typedef struct {
+  uint32_t section;
+  uint32_t offset;
+} Place;
+
+typedef struct {
+  uint32_t name;
+  ObjectSymbolKind kind;
+  Place place;           //< OBJECT_SYMBOL_LABEL
+  int32_t value;         //< OBJECT_SYMBOL_VALUE
+  uint8_t const* code;   //< OBJECT_SYMBOL_EXPR
+  uint8_t* owned;        //< `code` if it was compiled for the object
+} ObjectSymbol;
+
+typedef struct {
+  Place place;
+  EncodedItemKind kind;
+  uint32_t end; //< Offset of the end of the instruction in the section
+  uint8_t const* code;
+} Relocation;
+
+/* Symbol lookup noting whether the value depends on where section 0 goes */
+typedef struct {
+  Resolver* r;
+  size_t first_org; //< Nodes before it are in section 0
+  bool moves;
+} MoveLookup;
+
+static bool isRelocation(MoveLookup* l, uint8_t const* code);
+static int lookupMoves(void* ctx, uint32_t id, int32_t* value);
+static void putU8(Writer* w, uint8_t value);
+static void putU16(Writer* w, uint16_t value);
+static void putU32(Writer* w, uint32_t value);
+static void putCode(Writer* w, uint8_t const* code);
+
+int Object_write(FILE* fout, Resolver* r) {
+  assert(fout);
+  assert(r);
+
+  Vector* nodes = r->nodes;
+  size_t const n_nodes = Vector_len(nodes);
+  Vector* sections = Vector_new(sizeof(Section));
+  Vector* symbols = Vector_new(sizeof(ObjectSymbol));
+  Vector* relocations = Vector_new(sizeof(Relocation));
+  if (!sections || !symbols || !relocations)
+    die("Vector_new() failed");
+  Place* places = calloc(n_nodes + 1, sizeof(*places));
+  if (!places)
+    die("calloc() failed");
+
+  /* Lay out the sections */
+  Section s = {0};
+  for (size_t i = 0; i < n_nodes; ++i) {
+    IRNode const* n = Vector_at(nodes, i);
+    if (n->kind == IR_ORG) {
+      s.end = i;
+      if (Vector_push(sections, &s) == -1)
+        die("Vector_push() failed");
+      s = (Section){
+          .first = i + 1, .flags = OBJECT_SECTION_ABSOLUTE, .bank = n->data.org.bank, .addr = n->data.org.addr};
+      continue;
+    }
+    places[i] = (Place){.section = (uint32_t)Vector_len(sections), .offset = s.size};
+    if (n->kind == IR_INSTRUCTION)
+      s.size += (uint32_t)IRInstruction_size(&n->data.instruction);
+  }
+  s.end = n_nodes;
+  if (Vector_push(sections, &s) == -1)
+    die("Vector_push() failed");
+
+  MoveLookup moves = {.r = r, .first_org = ((Section*)Vector_at(sections, 0))->end};
+
+  /* Every defined symbol, with the constants depending on section 0 or on
+   * external symbols left to the linker */
+  for (size_t id = 0; id < Vector_len(r->by_id); ++id) {
+    Symbol const* sym = Resolver_symbolById(r, (uint32_t)id);
+    ObjectSymbol o = {.name = (uint32_t)id, .kind = OBJECT_SYMBOL_VALUE, .value = sym->value};
+    switch (sym->kind) {
+    case SYMBOL_UNKNOWN:
+      continue;
+    case SYMBOL_LABEL:
+      o.kind = OBJECT_SYMBOL_LABEL;
+      o.place = places[sym->node];
+      break;
+    case SYMBOL_EQU:
+      if (sym->defined) {
+        assert(sym->root != EXPR_DAG_NONE);
+        o.code = ExprDag_code(&r->dag, sym->root);
+      } else {
+        o.code = o.owned = Resolver_compile(r, sym->expr);
+        if (!o.owned)
+          die("Object_write(): malformed constant");
+      }
+      if (!sym->defined || isRelocation(&moves, o.code))
+        o.kind = OBJECT_SYMBOL_EXPR;
+      break;
+    case SYMBOL_DEFL:
+    default:
+      break;
+    }
+    if (Vector_push(symbols, &o) == -1)
+      die("Vector_push() failed");
+  }
+
+  /* Displacements from section 0 are always left to the linker */
+  for (size_t i = 0; i < n_nodes; ++i) {
+    IRNode const* n = Vector_at(nodes, i);
+    if (n->kind != IR_INSTRUCTION)
+      continue;
+    IRInstruction const* iri = &n->data.instruction;
+    uint32_t offset = places[i].offset;
+    uint32_t const end = offset + (uint32_t)IRInstruction_size(iri);
+    for (size_t j = 0; j < Vector_len(iri->encoded_items); ++j) {
+      EncodedItem const* item = Vector_at(iri->encoded_items, j);
+      Place const place = {.section = places[i].section, .offset = offset};
+      offset += (uint32_t)EncodedItem_size(item);
+      if (!EncodedItem_isExpr(item))
+        continue;
+
+      assert(item->node != EXPR_DAG_NONE);
+      uint8_t const* code = ExprDag_code(&r->dag, item->node);
+      if (!isRelocation(&moves, code) && !(item->kind == EI_REL && i < moves.first_org))
+        continue;
+
+      Relocation const rel = {.place = place, .kind = item->kind, .end = end, .code = code};
+      if (Vector_push(relocations, &rel) == -1)
+        die("Vector_push() failed");
+    }
+  }
+
+  Writer w = Writer_make(fout);
+  Writer_write(&w, OBJECT_MAGIC, OBJECT_MAGIC_LEN);
+  putU32(&w, OBJECT_VERSION);
+  putU32(&w, (uint32_t)Vector_len(r->by_id));
+  putU32(&w, (uint32_t)Vector_len(sections));
+  putU32(&w, (uint32_t)Vector_len(symbols));
+  putU32(&w, (uint32_t)Vector_len(relocations));
+
+  for (size_t id = 0; id < Vector_len(r->by_id); ++id) {
+    char const* name = Resolver_symbolById(r, (uint32_t)id)->name;
+    size_t const len = strlen(name);
+    assert(len <= UINT16_MAX);
+    putU16(&w, (uint16_t)len);
+    Writer_write(&w, name, len);
+  }
+
+  for (size_t k = 0; k < Vector_len(sections); ++k) {
+    Section const* sec = Vector_at(sections, k);
+    putU8(&w, sec->flags);
+    putU16(&w, sec->bank);
+    putU16(&w, sec->addr);
+    putU32(&w, sec->size);
+
+    uint8_t* data = calloc(sec->size + 1, 1);
+    if (!data)
+      die("calloc() failed");
+    for (size_t i = sec->first; i < sec->end; ++i) {
+      IRNode const* n = Vector_at(nodes, i);
+      if (n->kind == IR_INSTRUCTION)
+        IRInstruction_encode(&n->data.instruction, data + places[i].offset);
+    }
+    Writer_write(&w, (char const*)data, sec->size);
+    free(data);
+  }
+
+  for (size_t k = 0; k < Vector_len(symbols); ++k) {
+    ObjectSymbol* o = Vector_at(symbols, k);
+    putU32(&w, o->name);
+    putU8(&w, (uint8_t)o->kind);
+    switch (o->kind) {
+    case OBJECT_SYMBOL_LABEL:
+      putU32(&w, o->place.section);
+      putU32(&w, o->place.offset);
+      break;
+    case OBJECT_SYMBOL_VALUE:
+      putU32(&w, (uint32_t)o->value);
+      break;
+    case OBJECT_SYMBOL_EXPR:
+      putCode(&w, o->code);
+      break;
+    default:
+      die("Object_write(): invalid symbol kind");
+    }
+    free(o->owned);
+  }
+
+  for (size_t k = 0; k < Vector_len(relocations); ++k) {
+    Relocation const* rel = Vector_at(relocations, k);
+    putU32(&w, rel->place.section);
+    putU32(&w, rel->place.offset);
+    putU8(&w, (uint8_t)rel->kind);
+    putU32(&w, rel->end);
+    putCode(&w, rel->code);
+  }
+
+  free(places);
+  Vector_destroy(sections);
+  Vector_destroy(symbols);
+  Vector_destroy(relocations);
+  return Writer_finish(&w);
+}
+
+bool Object_isObject(char const* data, size_t len) {
+  assert(data || len == 0);
+  return len >= OBJECT_MAGIC_LEN && memcmp(data, OBJECT_MAGIC, OBJECT_MAGIC_LEN) == 0;
+}
+
+/* Whether the value of a program is left to the linker: it uses external
+ * symbols, or labels of section 0, directly or through constants */
+static bool isRelocation(MoveLookup* l, uint8_t const* code) {
+  int32_t value;
+  ExprErrorType err;
+  uint32_t missing;
+  l->moves = false;
+  return ExprCode_eval(code, lookupMoves, l, &value, &err, &missing) == -1 || l->moves;
+}
+
+static int lookupMoves(void* ctx, uint32_t id, int32_t* value) {
+  MoveLookup* l = ctx;
+  Symbol const* s = Resolver_symbolById(l->r, id);
+  if (!s->defined)
+    return -1;
+
+  switch (s->kind) {
+  case SYMBOL_LABEL:
+    l->moves |= s->node < l->first_org;
+    break;
+  case SYMBOL_EQU: {
+    /* The chain is known to be acyclic and to evaluate */
+    int32_t unused;
+    ExprErrorType err;
+    uint32_t missing;
+    ExprCode_eval(ExprDag_code(&l->r->dag, s->root), lookupMoves, ctx, &unused, &err, &missing);
+    break;
+  }
+  case SYMBOL_UNKNOWN:
+  case SYMBOL_DEFL:
+  default:
+    break;
+  }
+  *value = s->value;
+  return 0;
+}
+
+static void putU8(Writer* w, uint8_t value) {
+  Writer_reserve(w, 1);
+  Writer_putChar(w, (char)value);
+}
+
+static void putU16(Writer* w, uint16_t value) {
+  Writer_reserve(w, 2);
+  Writer_putChar(w, (char)(value & 0xff));
+  Writer_putChar(w, (char)(value >> 8));
+}
+
+static void putU32(Writer* w, uint32_t value) {
+  Writer_reserve(w, 4);
+  for (size_t i = 0; i < 4; ++i)
+    Writer_putChar(w, (char)((value >> (8 * i)) & 0xff));
+}
+
+static void putCode(Writer* w, uint8_t const* code) {
+  size_t const size = ExprCode_size(code);
+  uint8_t* out = malloc(size);
+  if (!out)
+    die("malloc() failed");
+  ExprCode_store(code, out);
+  Writer_write(w, (char const*)out, size);
+  free(out);
+}
@@ -0,0 +1,60 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "resolver.h"
+
+/* Relocatable objects
+ *
+ * A module assembled with Resolver.relocatable set is written out as an
+ * object for the linker (see link.h). Integers are little-endian:
+ *
+ *   header   "Z80O", then u32 version, and u32 numbers of names, sections,
+ *            symbols and relocations
+ *   name     u16 length, then the characters
+ *   section  u8 ObjectSectionFlags, u16 bank, u16 address, u32 size, then
+ *            the bytes
+ *   symbol   u32 name, u8 ObjectSymbolKind, then u32 section and u32 offset
+ *            (OBJECT_SYMBOL_LABEL), i32 value (OBJECT_SYMBOL_VALUE) or a
+ *            program (OBJECT_SYMBOL_EXPR)
+ *   reloc    u32 section, u32 offset of the item, u8 EncodedItemKind, u32
+ *            offset of the end of the instruction, then a program
+ *
+ * The names are the symbols of the module by ID, so the programs (see
+ * ExprCode_store()) refer to them directly. Every defined symbol is listed;
+ * the other names are external.
+ *
+ * Section 0 holds the code before the first ORG or BANK. It's relocatable:
+ * the linker decides where it goes, and the address of its labels is an
+ * offset in it. The others hold the code from an ORG or BANK on and stay
+ * where they are. Expression items depending on where section 0 goes or on
+ * external symbols are relocations, evaluated by the linker; their bytes
+ * in the section are placeholders, as are the displacements of section 0.
+ */
+#define OBJECT_MAGIC "Z80O"
+#define OBJECT_MAGIC_LEN 4
+#define OBJECT_VERSION 1
+
+typedef enum {
+  OBJECT_SECTION_ABSOLUTE = 1, //< Stays at its bank and address
+} ObjectSectionFlags;
+
+typedef enum {
+  OBJECT_SYMBOL_LABEL, //< Offset in a section
+  OBJECT_SYMBOL_VALUE, //< Absolute value
+  OBJECT_SYMBOL_EXPR,  //< Computed by the linker
+} ObjectSymbolKind;
+
+/* Write the IR of a relocatable module without errors as an object
+ *
+ * @returns 0 on success, -1 on a write error (errno is set)
+ */
+int Object_write(FILE* fout, Resolver* r);
+
+/* Whether the data starts like an object */
+bool Object_isObject(char const* data, size_t len);
+
+#endif // OBJECT_H
@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "instruction.h"
+#include "output.h"
+#include "pool.h"
+#include "utility.h"
+#include "writer.h"
+
+#define OUTPUT_RECORD_LEN 16 //< Data bytes per record
+
+/* Longest record: start code, type, count, 4 address bytes, data, checksum */
+#define OUTPUT_MAX_RECORD (2 + 2 * (1 + 4 + OUTPUT_RECORD_LEN + 1) + 1)
+
+/* Records of the written pieces in one IR_BANK_SIZE slice of the image */
+typedef struct {
+  size_t first, end; //< Pieces [first, end)
+  uint32_t upper;    //< Intel HEX: upper address bits in effect before the slice
+  char* text;
+  size_t text_len;
+  bool failed;
+} Slice;
+
+typedef struct {
+  Image const* img;
+  OutputFormat format;
+  size_t addr_len; //< S-record address bytes
+  ImageRegion const* pieces;
+  Slice* slices;
+} EncodeContext;
+
+static int writeText(FILE* fout, Image const* img, OutputFormat format);
+static void encodeSlice(void* ctx, size_t i);
+static void intelHexRecord(Writer* w, uint8_t type, uint16_t addr, uint8_t const* data, size_t n);
+static void sRecord(Writer* w, char type, size_t addr_len, uint32_t addr, uint8_t const* data, size_t n);
+static size_t regionCount(Image const* img);
+static ImageRegion regionAt(Image const* img, size_t i);
+static int writeMapped(FILE* fout, Vector* nodes);
+
+int OutputFormat_parse(char const* name, OutputFormat* format) {
+  assert(name);
+  assert(format);
+
+  if (strcmp(name, "bin") == 0)
+    *format = OUTPUT_BIN;
+  else if (strcmp(name, "ihex") == 0)
+    *format = OUTPUT_IHEX;
+  else if (strcmp(name, "srec") == 0)
+    *format = OUTPUT_SREC;
+  else
+    return -1;
+  return 0;
+}
+
+int Output_write(FILE* fout, Image const* img, OutputFormat format) {
+  assert(fout);
+  assert(img);
+
+  switch (format) {
+  case OUTPUT_BIN:
+    if (img->len && fwrite(img->data, 1, img->len, fout) != img->len)
+      return -1;
+    return fflush(fout) == 0 ? 0 : -1;
+  case OUTPUT_IHEX:
+  case OUTPUT_SREC:
+    return writeText(fout, img, format);
+  default:
+    die("Output_write(): invalid format");
+  }
+}
+
+int Output_writeIR(FILE* fout, Vector* nodes, OutputFormat format) {
+  assert(fout);
+  assert(nodes);
+
+  if (format == OUTPUT_BIN) {
+    int const rc = writeMapped(fout, nodes);
+    if (rc != 1)
+      return rc;
+  }
+
+  Image img = Image_fromIR(nodes);
+  int const rc = Output_write(fout, &img, format);
+  Image_deinit(&img);
+  return rc;
+}
+
+/* The slices are encoded in parallel (see pool.h) into memory, then
+ * written out in order. Records don't cross slices, so the output doesn't
+ * depend on the number of threads. */
+static int writeText(FILE* fout, Image const* img, OutputFormat format) {
+  Vector* pieces = Vector_new(sizeof(ImageRegion));
+  Vector* slices = Vector_new(sizeof(Slice));
+  if (!pieces || !slices)
+    die("Vector_new() failed");
+
+  uint32_t upper = 0;
+  for (size_t i = 0; i < regionCount(img); ++i) {
+    ImageRegion const region = regionAt(img, i);
+    for (uint32_t start = region.start, end = region.start + region.len; start < end;) {
+      uint32_t const slice_end = (start / IR_BANK_SIZE + 1) * IR_BANK_SIZE;
+      ImageRegion const piece = {.start = start, .len = (slice_end < end ? slice_end : end) - start};
+
+      /* A new slice unless the last piece is in the same one */
+      Slice* last = Vector_isEmpty(slices) ? NULL : Vector_at(slices, Vector_len(slices) - 1);
+      ImageRegion const* prev = last ? Vector_at(pieces, last->end - 1) : NULL;
+      if (!prev || prev->start / IR_BANK_SIZE != start / IR_BANK_SIZE) {
+        Slice const slice = {.first = Vector_len(pieces), .upper = upper};
+        if (Vector_push(slices, &slice) == -1)
+          die("Vector_push() failed");
+        last = Vector_at(slices, Vector_len(slices) - 1);
+      }
+      if (Vector_push(pieces, &piece) == -1)
+        die("Vector_push() failed");
+      last->end = Vector_len(pieces);
+
+      /* Records don't cross 64K, so the last one sets the upper bits */
+      upper = (piece.start + piece.len - 1) >> 16;
+      start += piece.len;
+    }
+  }
+
+  uint32_t const last_addr = img->base + (uint32_t)(img->len ? img->len - 1 : 0);
+  EncodeContext ctx = {
+      .img = img,
+      .format = format,
+      .addr_len = last_addr > 0xffffff ? 4 : last_addr > 0xffff ? 3 : 2,
+      .pieces = Vector_isEmpty(pieces) ? NULL : Vector_at(pieces, 0),
+      .slices = Vector_isEmpty(slices) ? NULL : Vector_at(slices, 0),
+  };
+  Pool_run(Vector_len(slices), encodeSlice, &ctx);
+
+  /* S1/S2/S3 data records end with S9/S8/S7 */
+  Writer w = Writer_make(fout);
+  if (format == OUTPUT_SREC)
+    sRecord(&w, '0', 2, 0, NULL, 0);
+  for (size_t i = 0; i < Vector_len(slices); ++i) {
+    Slice* slice = Vector_at(slices, i);
+    w.failed |= slice->failed;
+    Writer_write(&w, slice->text, slice->text_len);
+    free(slice->text);
+  }
+  if (format == OUTPUT_SREC)
+    sRecord(&w, (char)('9' - (ctx.addr_len - 2)), ctx.addr_len, 0, NULL, 0);
+  else
+    intelHexRecord(&w, 0x01, 0, NULL, 0);
+
+  Vector_destroy(pieces);
+  Vector_destroy(slices);
+  return Writer_finish(&w);
+}
+
+static void encodeSlice(void* ctx, size_t i) {
+  EncodeContext const* c = ctx;
+  Slice* slice = &c->slices[i];
+
+  FILE* mem = open_memstream(&slice->text, &slice->text_len);
+  if (!mem)
+    die("open_memstream() failed");
+  Writer w = Writer_make(mem);
+
+  uint32_t upper = slice->upper;
+  for (size_t k = slice->first; k < slice->end; ++k) {
+    ImageRegion const piece = c->pieces[k];
+    for (uint32_t addr = piece.start; addr < piece.start + piece.len;) {
+      uint32_t const n = piece.start + piece.len - addr < OUTPUT_RECORD_LEN ? piece.start + piece.len - addr
+                                                                             : OUTPUT_RECORD_LEN;
+      uint8_t const* data = c->img->data + (addr - c->img->base);
+      if (c->format == OUTPUT_SREC) {
+        sRecord(&w, (char)('1' + c->addr_len - 2), c->addr_len, addr, data, n);
+      } else {
+        if (addr >> 16 != upper) {
+          upper = addr >> 16;
+          uint8_t const ext[] = {(uint8_t)(upper >> 8), (uint8_t)upper};
+          intelHexRecord(&w, 0x04, 0, ext, sizeof(ext));
+        }
+        intelHexRecord(&w, 0x00, (uint16_t)addr, data, n);
+      }
+      addr += n;
+    }
+  }
+
+  slice->failed = Writer_finish(&w) == -1;
+  slice->failed |= fclose(mem) != 0;
+}
+
+/* :LLAAAATT<data>CC, the checksum being the two's complement of the sum of
+ * the other bytes */
+static void intelHexRecord(Writer* w, uint8_t type, uint16_t addr, uint8_t const* data, size_t n) {
+  Writer_reserve(w, OUTPUT_MAX_RECORD);
+
+  uint8_t sum = (uint8_t)(n + (addr >> 8) + addr + type);
+  Writer_putChar(w, ':');
+  Writer_putHex(w, (uint8_t)n);
+  Writer_putHex(w, (uint8_t)(addr >> 8));
+  Writer_putHex(w, (uint8_t)addr);
+  Writer_putHex(w, type);
+  for (size_t i = 0; i < n; ++i) {
+    Writer_putHex(w, data[i]);
+    sum = (uint8_t)(sum + data[i]);
+  }
+  Writer_putHex(w, (uint8_t)-sum);
+  Writer_putChar(w, '\n');
+}
+
+/* S<type><count><address><data><checksum>, the count covering the address,
+ * the data and the checksum, and the checksum being the one's complement
+ * of the sum of the count, address and data bytes */
+static void sRecord(Writer* w, char type, size_t addr_len, uint32_t addr, uint8_t const* data, size_t n) {
+  Writer_reserve(w, OUTPUT_MAX_RECORD);
+
+  uint8_t const count = (uint8_t)(addr_len + n + 1);
+  uint8_t sum = count;
+  Writer_putChar(w, 'S');
+  Writer_putChar(w, type);
+  Writer_putHex(w, count);
+  for (size_t i = addr_len; i-- > 0;) {
+    uint8_t const byte = (uint8_t)(addr >> (8 * i));
+    Writer_putHex(w, byte);
+    sum = (uint8_t)(sum + byte);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    Writer_putHex(w, data[i]);
+    sum = (uint8_t)(sum + data[i]);
+  }
+  Writer_putHex(w, (uint8_t)~sum);
+  Writer_putChar(w, '\n');
+}
+
+static size_t regionCount(Image const* img) {
+  if (img->regions)
+    return Vector_len(img->regions);
+  return img->len ? 1 : 0;
+}
+
+static ImageRegion regionAt(Image const* img, size_t i) {
+  if (img->regions)
+    return *(ImageRegion*)Vector_at(img->regions, i);
+  return (ImageRegion){.start = img->base, .len = (uint32_t)img->len};
+}
+
+/* Size the output file and store the bytes straight into a mapping of it,
+ * the gaps left as holes
+ *
+ * @returns 0 on success, -1 on a write error, 1 if the file can't be mapped
+ * (e.g. it's a pipe) and has been left untouched
+ */
+static int writeMapped(FILE* fout, Vector* nodes) {
+  if (fflush(fout) != 0)
+    return -1;
+
+  Image img = Image_layout(nodes);
+  if (img.len == 0) {
+    Image_deinit(&img);
+    return 0;
+  }
+
+  int const fd = fileno(fout);
+  off_t const start = ftello(fout);
+  if (fd == -1 || start == -1 || ftruncate(fd, start + (off_t)img.len) == -1) {
+    Image_deinit(&img);
+    return 1;
+  }
+
+  /* Mappings start at a page boundary */
+  long const page = sysconf(_SC_PAGESIZE);
+  off_t const map_start = page > 0 ? start - start % page : start;
+  size_t const map_len = (size_t)(start - map_start) + img.len;
+  void* map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_start);
+  if (map == MAP_FAILED) {
+    Image_deinit(&img);
+    return ftruncate(fd, start) == -1 ? -1 : 1;
+  }
+
+  img.data = (uint8_t*)map + (start - map_start);
+  Image_emit(&img, nodes);
+  img.data = NULL;
+  Image_deinit(&img);
+
+  int rc = munmap(map, map_len);
+  if (rc == 0 && fseeko(fout, 0, SEEK_END) == -1)
+    rc = -1;
+  return rc;
+}
@@ -0,0 +1,43 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+#include "image.h"
+#include "vector.h"
+
+typedef enum {
+  OUTPUT_BIN,  //< Raw bytes from the lowest address on
+  OUTPUT_IHEX, //< Intel HEX
+  OUTPUT_SREC, //< Motorola S-record
+} OutputFormat;
+
+/* Format by name: "bin", "ihex" or "srec"
+ *
+ * @returns 0 on success, -1 if the name is unknown
+ */
+int OutputFormat_parse(char const* name, OutputFormat* format);
+
+/* Write an image in the given format
+ *
+ * The text formats are encoded into a large buffer which is written out
+ * whenever it fills up; raw binaries are written straight from the image.
+ * Intel HEX uses extended linear address records and S-records use wider
+ * addresses only for images past 64K. Only the written regions are encoded
+ * in the text formats; gaps are zero in a raw binary.
+ *
+ * @returns 0 on success, -1 on a write error (errno is set)
+ */
+int Output_write(FILE* fout, Image const* img, OutputFormat format);
+
+/* Write a resolved IR in the given format
+ *
+ * A raw binary going to a regular file is emitted straight into a mapping
+ * of the file, sized up front: the bytes are never held twice and the ORG
+ * gaps are left as holes. Otherwise the IR is laid out with Image_fromIR().
+ *
+ * @returns 0 on success, -1 on a write error (errno is set)
+ */
+int Output_writeIR(FILE* fout, Vector* nodes, OutputFormat format);
+
+#endif // OUTPUT_H
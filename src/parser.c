@@ -2,13 +2,18 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "expression.h"
+#include "include.h"
 #include "instruction.h"
 #include "lexer.h"
+#include "macro.h"
 #include "map.h"
 #include "parser.h"
+#include "resolver.h"
 #include "utility.h"
 #include "vector.h"
 
@@ -28,7 +33,7 @@
   (Result) { .success = false }
 
 typedef union {
-  Vector* expr;
+  Operand operand;
   uint8_t byte;
 } Value;
 
@@ -37,26 +42,89 @@ typedef struct {
   Value value;
 } Result;
 
+/* The tokens of a macro expansion, and the statements parsed from them */
+typedef struct {
+  MacroReader reader;
+  Vector* statements; //< Vector[Statement]
+} Expansion;
+
+/* The tokens of a branch of a conditional, its TOKEN_BLOCKs lexed as they
+ * come, and the statements parsed from them */
+typedef struct {
+  Vector* tokens; //< Vector[Token]
+  size_t at;      //< The next token
+  Lexer block;    //< Lexing the TOKEN_BLOCK before `at`, if `in_block`
+  bool in_block;
+  Vector* statements; //< Vector[Statement]
+} Branch;
+
+/* An INCLUDE being resolved, on the stack of the resolver */
+struct IncludeFrame {
+  char const* path;
+  IncludeFrame const* outer;
+};
+
 static Result tokenType(Parser* p, TokenType type);
 static Result tokenTypeValue(Parser* p, TokenType type, char const* val);
 static Result tokenId(Parser* p, char const* val);
 
 static Result reg8Bit(Parser* p);
+static Result reg16Stack(Parser* p);
+static Result condition(Parser* p);
+static Result aluOperation(Parser* p);
 static Result comma(Parser* p);
 Result expression(Parser* p);
+static Result listExpression(Parser* p);
+static Result expressionTo(Parser* p, bool in_list);
+static Result operandList(Parser* p, Operand* ops, size_t max, size_t* n);
+static Result dataList(Parser* p, size_t size, IRNode* node);
 Result address(Parser* p);
+static Result finishOperand(ExprParser* ep, Token const* first);
 
 static void advance(Parser* p);
 static Token peek(Parser* p);
 static Token* cur(Parser* p);
 static Token* tokAt(Parser* p, size_t idx);
 static void skip(Parser* p);
+static bool parseConditional(Parser* p);
+static Vector* parseCondition(Parser* p, ConditionKind kind);
+static Vector* parseBranch(Parser* p);
+static bool parseMacro(Parser* p);
+static bool parseParams(Parser* p, Vector* params, Vector* taken, char const* what);
+static bool parseConstant(Parser* p);
 static void parseLabel(Parser* p);
 static void parseInstruction(Parser* p);
+static void parseExpand(Parser* p);
 
+static void parseAll(Parser* p);
+static Token nextToken(Parser* p);
+static void checkRange(Parser* p, Operand const* op, size_t size);
 static void error(Parser* p, const char* fmt, ...);
-
-static void map_destroy_ir_label(void* value);
+static void emit(Parser* p, Statement s);
+static void emitInstruction(Parser* p, IRNode* node);
+static void emitOrigin(Parser* p, StatementKind kind, Token const* directive, Operand const* op);
+static void emitInclude(Parser* p, Token const* directive, Token const* path);
+static void include(Parser* p, Statement* s);
+static void emitFill(Parser* p, Token const* directive, Operand const* ops, size_t n);
+static void emitIncbin(Parser* p, Token const* directive, Token const* path, Operand const* ops, size_t n);
+static void incbin(Parser* p, Statement* s);
+static void flushRun(Vector* items, uint8_t** run, size_t* len, size_t* cap);
+static void defineMacro(Parser* p, Statement* s);
+static void expand(Parser* p, Statement* s);
+static Vector* parseExpansion(Parser* p, Macro* m, MacroArg const* args);
+static void parseWith(Parser* p, ParserStream const* stream);
+static void conditional(Parser* p, Statement* s);
+static Token nextInBranch(void* ctx);
+static void keepInBranch(void* ctx, Statement* s);
+static Token nextExpanded(void* ctx);
+static void keepExpanded(void* ctx, Statement* s);
+static void replay(Parser* p, Vector* statements, size_t line);
+static void moveToLine(Statement* s, size_t line);
+static void map_destroy_macro(void* value);
+static void applyError(Parser* p, Token const* tok, char* reason);
+static Vector* copyTokens(Vector* tokens);
+static Vector* copyTokensOrNull(Vector* tokens);
+static char* copyString(char const* s);
 
 Parser Parser_make(Lexer* lex) {
   assert(lex);
@@ -65,10 +133,6 @@ Parser Parser_make(Lexer* lex) {
   if (!errors)
     die("Vector_new() failed");
 
-  Map* labels = Map_new(sizeof(int32_t), map_destroy_ir_label);
-  if (!labels)
-    die("Map_new() failed");
-
   Vector* nodes = Vector_new(sizeof(IRNode));
   if (!nodes)
     die("Vector_new() failed");
@@ -79,12 +143,18 @@ Parser Parser_make(Lexer* lex) {
   Token dummy = {0};
   Vector_push(buf, &dummy);
 
+  Vector* cycle_assertions = Vector_new(sizeof(CycleAssertion));
+  if (!cycle_assertions)
+    die("Vector_new() failed");
+
   return (Parser){
       .lex = lex,
       .errors = errors,
-      .labels = labels,
       .nodes = nodes,
+      .cycle_assertions = cycle_assertions,
       .buf = buf,
+      .ep = ExprParser_make(),
+      .resolver = Resolver_make(lex, nodes, errors),
   };
 }
 
@@ -99,18 +169,34 @@ void Parser_deinit(Parser* p) {
   }
 
   Vector_destroy(p->errors);
-  Map_destroy(p->labels);
+  Resolver_deinit(&p->resolver);
 
   for (size_t i = 0; i < Vector_len(p->nodes); ++i) {
     IRNode* n = Vector_at(p->nodes, i);
-    if (n->kind == IR_INSTRUCTION)
-      Vector_destroy(n->data.instruction.encoded_items);
-    else if (n->kind == IR_LABEL)
+    /* A parse that died may have left an instruction unencoded */
+    if (n->kind == IR_INSTRUCTION && n->data.instruction.encoded_items) {
+      IRInstruction* iri = &n->data.instruction;
+      for (size_t j = 0; j < Vector_len(iri->encoded_items); ++j)
+        EncodedItem_deinit(Vector_at(iri->encoded_items, j));
+      Vector_destroy(iri->encoded_items);
+    } else if (n->kind == IR_LABEL)
       free(n->data.label.name);
   }
   Vector_destroy(p->nodes);
 
+  for (size_t i = 0; i < Vector_len(p->cycle_assertions); ++i)
+    Vector_destroy(((CycleAssertion*)Vector_at(p->cycle_assertions, i))->max);
+  Vector_destroy(p->cycle_assertions);
+
   Vector_destroy(p->buf);
+  ExprParser_deinit(&p->ep);
+
+  if (p->macros)
+    Map_destroy(p->macros);
+  if (p->expander) {
+    Parser_deinit(p->expander);
+    free(p->expander);
+  }
 }
 
 static inline bool match_save(Parser* p, Result r, size_t* n_results, Result arr[]) {
@@ -133,9 +219,225 @@ static inline bool match_discard(Parser* p, Result r) {
 void Parser_parse(Parser* p) {
   assert(p);
 
+  parseAll(p);
+  Resolver_finish(&p->resolver);
+}
+
+void Parser_parseStatements(Parser* p, Vector* out) {
+  assert(p);
+  assert(out);
+
+  p->statements = out;
+  parseAll(p);
+  p->statements = NULL;
+}
+
+void Parser_parseStream(Parser* p, ParserStream const* stream) {
+  assert(p);
+  assert(stream);
+
+  p->stream = stream;
+  parseAll(p);
+  p->stream = NULL;
+}
+
+void Parser_apply(Parser* p, Statement* s) {
+  assert(p);
+  assert(s);
+
+  switch (s->kind) {
+  case STATEMENT_LABEL: {
+    /* Each expansion defines the labels of the body again, but those LOCAL names */
+    Symbol const* sym = p->expanding ? Resolver_find(&p->resolver, &s->data.label.tok) : NULL;
+    if (sym && sym->kind != SYMBOL_UNKNOWN) {
+      char* reason = dsprintf("redefinition of %s in a macro expansion (previously defined on line %zu); "
+                              "name it with LOCAL",
+                              sym->name, sym->tok.line);
+      applyError(p, &s->data.label.tok, reason);
+      free(s->data.label.node.data.label.name);
+    } else {
+      Resolver_addLabel(&p->resolver, &s->data.label.node, &s->data.label.tok);
+    }
+    break;
+  }
+  case STATEMENT_CONSTANT:
+    Resolver_defineConstant(&p->resolver, &s->data.constant.tok, s->data.constant.expr, s->data.constant.kind);
+    break;
+  case STATEMENT_INSTRUCTION:
+    Resolver_addInstruction(&p->resolver, &s->data.instruction);
+    break;
+  case STATEMENT_ORG:
+    Resolver_setOrigin(&p->resolver, &s->data.org.tok, s->data.org.expr);
+    break;
+  case STATEMENT_BANK:
+    Resolver_setBank(&p->resolver, &s->data.org.tok, s->data.org.expr);
+    break;
+  case STATEMENT_CYCLES:
+    if (Vector_push(p->cycle_assertions, &s->data.cycles) == -1)
+      die("Vector_push() failed");
+    break;
+  case STATEMENT_INCLUDE:
+    include(p, s);
+    break;
+  case STATEMENT_FILL:
+    Resolver_addFill(&p->resolver, &s->data.fill.tok, s->line, s->data.fill.count, s->data.fill.value);
+    break;
+  case STATEMENT_INCBIN:
+    incbin(p, s);
+    break;
+  case STATEMENT_MACRO:
+    defineMacro(p, s);
+    break;
+  case STATEMENT_EXPAND:
+    expand(p, s);
+    break;
+  case STATEMENT_CONDITIONAL:
+    conditional(p, s);
+    break;
+  case STATEMENT_ERROR:
+    if (Vector_push(p->errors, &s->data.error) == -1)
+      die("Vector_push() failed");
+    break;
+  }
+}
+
+Statement Statement_copy(Statement const* s) {
+  assert(s);
+
+  Statement copy = *s;
+  switch (s->kind) {
+  case STATEMENT_LABEL:
+    copy.data.label.node.data.label.name = copyString(s->data.label.node.data.label.name);
+    break;
+  case STATEMENT_CONSTANT:
+    copy.data.constant.expr = copyTokens(s->data.constant.expr);
+    break;
+  case STATEMENT_INSTRUCTION: {
+    Vector* items = s->data.instruction.data.instruction.encoded_items;
+    Vector* items_copy = Vector_new(sizeof(EncodedItem));
+    if (!items_copy)
+      die("Vector_new() failed");
+    for (size_t i = 0; i < Vector_len(items); ++i) {
+      EncodedItem item = *(EncodedItem*)Vector_at(items, i);
+      if (EncodedItem_isExpr(&item))
+        item.data.expr = copyTokens(item.data.expr);
+      else if (item.kind == EI_BYTES)
+        Blob_retain(item.data.bytes);
+      if (Vector_push(items_copy, &item) == -1)
+        die("Vector_push() failed");
+    }
+    copy.data.instruction.data.instruction.encoded_items = items_copy;
+    break;
+  }
+  case STATEMENT_ORG:
+  case STATEMENT_BANK:
+    copy.data.org.expr = copyTokens(s->data.org.expr);
+    break;
+  case STATEMENT_CYCLES:
+    copy.data.cycles.max = copyTokens(s->data.cycles.max);
+    break;
+  case STATEMENT_INCLUDE:
+    copy.data.include.path = copyString(s->data.include.path);
+    break;
+  case STATEMENT_FILL:
+    copy.data.fill.count = copyTokens(s->data.fill.count);
+    copy.data.fill.value = copyTokensOrNull(s->data.fill.value);
+    break;
+  case STATEMENT_INCBIN:
+    copy.data.incbin.path = copyString(s->data.incbin.path);
+    copy.data.incbin.offset = copyTokensOrNull(s->data.incbin.offset);
+    copy.data.incbin.len = copyTokensOrNull(s->data.incbin.len);
+    break;
+  case STATEMENT_MACRO:
+    copy.data.macro.params = copyTokens(s->data.macro.params);
+    copy.data.macro.locals = copyTokens(s->data.macro.locals);
+    copy.data.macro.body = copyTokens(s->data.macro.body);
+    break;
+  case STATEMENT_EXPAND:
+    copy.data.expand.args = copyTokens(s->data.expand.args);
+    break;
+  case STATEMENT_CONDITIONAL:
+    copy.data.cond.expr = copyTokens(s->data.cond.expr);
+    copy.data.cond.then_body = copyTokens(s->data.cond.then_body);
+    copy.data.cond.else_body = copyTokensOrNull(s->data.cond.else_body);
+    break;
+  case STATEMENT_ERROR:
+    copy.data.error.reason = copyString(s->data.error.reason);
+    copy.data.error.line = s->data.error.line ? copyString(s->data.error.line) : NULL;
+    break;
+  }
+  return copy;
+}
+
+void Statement_deinit(Statement* s) {
+  assert(s);
+
+  switch (s->kind) {
+  case STATEMENT_LABEL:
+    free(s->data.label.node.data.label.name);
+    break;
+  case STATEMENT_CONSTANT:
+    Vector_destroy(s->data.constant.expr);
+    break;
+  case STATEMENT_INSTRUCTION: {
+    IRInstruction* iri = &s->data.instruction.data.instruction;
+    for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i)
+      EncodedItem_deinit(Vector_at(iri->encoded_items, i));
+    Vector_destroy(iri->encoded_items);
+    break;
+  }
+  case STATEMENT_ORG:
+  case STATEMENT_BANK:
+    Vector_destroy(s->data.org.expr);
+    break;
+  case STATEMENT_CYCLES:
+    Vector_destroy(s->data.cycles.max);
+    break;
+  case STATEMENT_INCLUDE:
+    free(s->data.include.path);
+    break;
+  case STATEMENT_FILL:
+    Vector_destroy(s->data.fill.count);
+    if (s->data.fill.value)
+      Vector_destroy(s->data.fill.value);
+    break;
+  case STATEMENT_INCBIN:
+    free(s->data.incbin.path);
+    if (s->data.incbin.offset)
+      Vector_destroy(s->data.incbin.offset);
+    if (s->data.incbin.len)
+      Vector_destroy(s->data.incbin.len);
+    break;
+  case STATEMENT_MACRO:
+    Vector_destroy(s->data.macro.params);
+    Vector_destroy(s->data.macro.locals);
+    Vector_destroy(s->data.macro.body);
+    break;
+  case STATEMENT_EXPAND:
+    Vector_destroy(s->data.expand.args);
+    break;
+  case STATEMENT_CONDITIONAL:
+    Vector_destroy(s->data.cond.expr);
+    Vector_destroy(s->data.cond.then_body);
+    if (s->data.cond.else_body)
+      Vector_destroy(s->data.cond.else_body);
+    break;
+  case STATEMENT_ERROR:
+    free(s->data.error.reason);
+    free(s->data.error.line);
+    break;
+  }
+}
+
+/* Parse statements up to the end of the input, one line at a time */
+static void parseAll(Parser* p) {
   while (true) {
-    parseLabel(p);
-    parseInstruction(p);
+    /* Statements keep to their line, which is the line of their first token */
+    p->line = peek(p).line;
+    if (!parseConditional(p) && !parseMacro(p) && !parseConstant(p)) {
+      parseLabel(p);
+      parseInstruction(p);
+    }
     if (cur(p)->type == TOKEN_END)
       break;
 
@@ -153,10 +455,28 @@ bool Parser_hasErrors(Parser const* p) {
   return !Vector_isEmpty(p->errors);
 }
 
+ParserError ParserError_make(Lexer* lex, Token const* tok, char* reason) {
+  assert(lex);
+  assert(tok);
+  assert(reason);
+
+  /* A token of an included file finds its line there */
+  Lexer const* from = tok->origin ? tok->origin : lex;
+  return (ParserError){
+      .reason = reason,
+      .line = tok->line ? Lexer_line(from, tok->line) : NULL,
+      .col = tok->col,
+      .lineno = tok->line,
+      .file = from->name,
+  };
+}
+
 void ParserError_print(ParserError const* err, FILE* fout) {
   assert(err);
   assert(fout);
 
+  if (err->file)
+    fprintf(fout, "%s:", err->file);
   fprintf(fout, "%zu:%zu: error: %s\n", err->lineno, err->col, err->reason);
   if (err->line)
     fprintf(fout, "%s\n%*s", err->line, (int)err->col + 1, "^\n");
@@ -166,7 +486,7 @@ Result tokenType(Parser* p, TokenType type) { return (Result){.success = cur(p)-
 
 Result tokenTypeValue(Parser* p, TokenType type, char const* val) {
   Token t = *cur(p);
-  bool success = t.type == type && strncasecmp(t.value, val, t.len) == 0;
+  bool success = t.type == type && t.len == strlen(val) && strncasecmp(t.value, val, t.len) == 0;
   return (Result){.success = success};
 }
 
@@ -185,45 +505,187 @@ Result reg8Bit(Parser* p) {
   else if (tokenId(p, "e").success)
     return SUCCESS(.byte = 0x03);
   else if (tokenId(p, "h").success)
-    return SUCCESS(.byte = 0x08);
+    return SUCCESS(.byte = 0x04);
   else if (tokenId(p, "l").success)
-    return SUCCESS(.byte = 0x09);
+    return SUCCESS(.byte = 0x05);
+  return FAILURE;
+}
+
+/* Register pairs of PUSH and POP */
+Result reg16Stack(Parser* p) {
+  if (tokenId(p, "bc").success)
+    return SUCCESS(.byte = 0x00);
+  else if (tokenId(p, "de").success)
+    return SUCCESS(.byte = 0x01);
+  else if (tokenId(p, "hl").success)
+    return SUCCESS(.byte = 0x02);
+  else if (tokenId(p, "af").success)
+    return SUCCESS(.byte = 0x03);
+  return FAILURE;
+}
+
+/* 8-bit arithmetic and logic mnemonics in the order of their encoding */
+Result aluOperation(Parser* p) {
+  static char const* const operations[] = {"add", "adc", "sub", "sbc", "and", "xor", "or", "cp"};
+  for (uint8_t i = 0; i < sizeof(operations) / sizeof(*operations); ++i)
+    if (tokenId(p, operations[i]).success)
+      return SUCCESS(.byte = i);
+  return FAILURE;
+}
+
+/* Condition codes in the order of their encoding; JR accepts the first four */
+Result condition(Parser* p) {
+  static char const* const conditions[] = {"nz", "z", "nc", "c", "po", "pe", "p", "m"};
+  for (uint8_t i = 0; i < sizeof(conditions) / sizeof(*conditions); ++i)
+    if (tokenId(p, conditions[i]).success)
+      return SUCCESS(.byte = i);
   return FAILURE;
 }
 
 Result comma(Parser* p) { return tokenType(p, TOKEN_COMMA); }
 
-Result expression(Parser* p) {
-  ExprParser ep = ExprParser_make();
+/* (HL) as an operand, which otherwise reads as an address expression */
+static Result indirectHL(Parser* p) {
+  if (!tokenType(p, TOKEN_LEFT_PAREN).success)
+    return FAILURE;
+  advance(p);
+  if (!tokenId(p, "hl").success)
+    return FAILURE;
+  advance(p);
+  return tokenType(p, TOKEN_RIGHT_PAREN);
+}
+
+Result expression(Parser* p) { return expressionTo(p, false); }
+
+/* An expression ending before a comma, an item of a list */
+static Result listExpression(Parser* p) {
+  TokenType const type = cur(p)->type;
+  if (type == TOKEN_COMMA || type == TOKEN_NEWLINE || type == TOKEN_END)
+    return FAILURE;
+  return expressionTo(p, true);
+}
+
+static Result expressionTo(Parser* p, bool in_list) {
+  ExprParser* ep = &p->ep;
+  ExprParser_reset(ep);
+  Token const first = *cur(p);
   while (true) {
     Token tok = *cur(p);
-    if (ExprParser_get(&ep, tok) == -1) {
-      Vector_destroy(ep.o);
-      Vector_destroy(ep.e);
+    if (ExprParser_get(ep, tok) == -1)
       return FAILURE;
-    }
 
     tok = peek(p);
-    if (tok.type == TOKEN_END || tok.type == TOKEN_NEWLINE)
+    if (in_list && tok.type == TOKEN_COMMA)
+      tok.type = TOKEN_NEWLINE;
+    if (tok.type == TOKEN_END || tok.type == TOKEN_NEWLINE) {
+      /* Flush the operator stack */
+      if (ExprParser_get(ep, tok) == -1)
+        return FAILURE;
+      break;
+    }
+    advance(p);
+  }
+  return finishOperand(ep, &first);
+}
+
+/* One to `max` expressions separated by commas; a comma after the last is
+ * left for the caller */
+static Result operandList(Parser* p, Operand* ops, size_t max, size_t* n) {
+  for (*n = 0; *n < max;) {
+    Result const r = listExpression(p);
+    if (!r.success)
       break;
+    ops[(*n)++] = r.value.operand;
+    if (*n == max || peek(p).type != TOKEN_COMMA)
+      return SUCCESS(.byte = 0);
+    advance(p);
     advance(p);
   }
-  Vector_destroy(ep.o);
-  return SUCCESS(.expr = ep.e);
+  for (size_t i = 0; i < *n; ++i)
+    if (ops[i].expr)
+      Vector_destroy(ops[i].expr);
+  return FAILURE;
+}
+
+/* The operands of DB (`size` 1) or DW (`size` 2) as one data node
+ *
+ * Constants are gathered into runs of bytes, each a single blob item rather
+ * than an item per byte; a number standing alone and a string skip the
+ * expression parser. Other expressions are items of their own.
+ */
+static Result dataList(Parser* p, size_t size, IRNode* node) {
+  Vector* items = Vector_new(sizeof(EncodedItem));
+  if (!items)
+    die("Vector_new() failed");
+  uint8_t* run = NULL;
+  size_t len = 0, cap = 0;
+
+  while (true) {
+    Token const tok = *cur(p);
+    if (tok.type == TOKEN_COMMA || tok.type == TOKEN_NEWLINE || tok.type == TOKEN_END)
+      break;
+    TokenType const next = peek(p).type;
+    bool const alone = next == TOKEN_COMMA || next == TOKEN_NEWLINE || next == TOKEN_END;
+
+    Operand op = {.tok = tok};
+    if (alone && tok.type == TOKEN_CHAR && size == 1 && tok.len > 1) {
+      if (cap - len < tok.len && !(run = realloc(run, cap = 2 * cap + tok.len)))
+        die("realloc() failed");
+      len += Token_decode(&tok, run + len);
+    } else {
+      if (alone && (tok.type == TOKEN_DECIMAL || tok.type == TOKEN_HEXADECIMAL || tok.type == TOKEN_OCTAL ||
+                    tok.type == TOKEN_BINARY)) {
+        op.value = (int32_t)Token_toInt(&tok);
+      } else {
+        Result const r = listExpression(p);
+        if (!r.success)
+          break;
+        op = r.value.operand;
+      }
+
+      if (op.expr) {
+        flushRun(items, &run, &len, &cap);
+        EncodedItem const item = {.kind = size == 1 ? EI_EXPR : EI_ADDR, .data.expr = op.expr};
+        if (Vector_push(items, &item) == -1)
+          die("Vector_push() failed");
+      } else {
+        checkRange(p, &op, size);
+        if (cap - len < size && !(run = realloc(run, cap = 2 * cap + size)))
+          die("realloc() failed");
+        run[len++] = (uint8_t)op.value;
+        if (size == 2)
+          run[len++] = (uint8_t)((uint32_t)op.value >> 8);
+      }
+    }
+
+    if (peek(p).type != TOKEN_COMMA) {
+      flushRun(items, &run, &len, &cap);
+      free(run);
+      *node = (IRNode){.kind = IR_INSTRUCTION, .data.instruction = {.encoded_items = items, .is_data = true}};
+      return SUCCESS(.byte = 0);
+    }
+    advance(p);
+    advance(p);
+  }
+
+  free(run);
+  for (size_t i = 0; i < Vector_len(items); ++i)
+    EncodedItem_deinit(Vector_at(items, i));
+  Vector_destroy(items);
+  return FAILURE;
 }
 
 Result address(Parser *p) {
-  ExprParser ep = ExprParser_make();
+  ExprParser* ep = &p->ep;
+  ExprParser_reset(ep);
+  Token const first = *cur(p);
 
   bool starts_with_paren = false, ends_with_paren = false;
   Token prev_tok = {0};
   while (true) {
     Token tok = *cur(p);
-    if (ExprParser_get(&ep, tok) == -1) {
-      Vector_destroy(ep.o);
-      Vector_destroy(ep.e);
+    if (ExprParser_get(ep, tok) == -1)
       return FAILURE;
-    }
 
     if (prev_tok.type == TOKEN_UNINITIALIZED && tok.type == TOKEN_LEFT_PAREN)
       starts_with_paren = true;
@@ -233,29 +695,35 @@ Result address(Parser *p) {
     if (tok.type == TOKEN_END || tok.type == TOKEN_NEWLINE) {
       if (prev_tok.type == TOKEN_RIGHT_PAREN)
         ends_with_paren = true;
+      if (ExprParser_get(ep, tok) == -1)
+        return FAILURE;
       break;
     }
     advance(p);
   }
 
-  if (starts_with_paren && ends_with_paren) {
-    Vector_destroy(ep.o);
-    return SUCCESS(.expr = ep.e);
-  }
-
-  Vector_destroy(ep.o);
-  Vector_destroy(ep.e);
+  if (starts_with_paren && ends_with_paren)
+    return finishOperand(ep, &first);
   return FAILURE;
 }
 
+/* Take the parsed expression as an operand, dropping it if it folded to a
+ * constant */
+static Result finishOperand(ExprParser* ep, Token const* first) {
+  Operand op = {.tok = *first};
+  if (!ExprParser_isConstant(ep, &op.value))
+    op.expr = ExprParser_copyExpr(ep);
+  return SUCCESS(.operand = op);
+}
+
 void advance(Parser* p) {
   p->ptr += 1;
   if (p->ptr == Vector_len(p->buf)) {
-    Token tok = Lexer_next(p->lex);
+    Token tok = nextToken(p);
     Vector_push(p->buf, &tok);
   }
   if (cur(p)->type == TOKEN_UNINITIALIZED) {
-    Token tok = Lexer_next(p->lex);
+    Token tok = nextToken(p);
     memcpy(cur(p), &tok, sizeof(tok));
   }
 }
@@ -264,7 +732,7 @@ Token peek(Parser* p) {
   Token tok;
   size_t idx = p->ptr + 1;
   if (idx == Vector_len(p->buf)) {
-    tok = Lexer_next(p->lex);
+    tok = nextToken(p);
     Vector_push(p->buf, &tok);
     return tok;
   }
@@ -272,11 +740,13 @@ Token peek(Parser* p) {
   if (ptr->type != TOKEN_UNINITIALIZED) {
     return *ptr;
   }
-  tok = Lexer_next(p->lex);
+  tok = nextToken(p);
   memcpy(ptr, &tok, sizeof(tok));
   return tok;
 }
 
+static Token nextToken(Parser* p) { return p->stream ? p->stream->next(p->stream->ctx) : Lexer_next(p->lex); }
+
 Token* cur(Parser* p) {
   Token* tok = Vector_at(p->buf, p->ptr);
   assert(tok);
@@ -296,7 +766,341 @@ void skip(Parser* p) {
       return;
   Token tok = *cur(p);
   while (tok.type != TOKEN_NEWLINE && tok.type != TOKEN_END)
-    tok = Lexer_next(p->lex);
+    tok = nextToken(p);
+}
+
+/* (IF expression | IFDEF NAME | IFNDEF NAME) NEWLINE {line} [ELSE NEWLINE {line}] ENDIF
+ *
+ * The lines of a branch come from the lexer as one TOKEN_BLOCK, or from a
+ * macro body as its tokens. They are parsed when the statement is resolved,
+ * and only those of the branch taken. */
+static bool parseConditional(Parser* p) {
+  static char const* const names[] = {
+      [CONDITION_IF] = "IF", [CONDITION_IFDEF] = "IFDEF", [CONDITION_IFNDEF] = "IFNDEF"};
+  size_t const ptr_save = p->ptr;
+
+  advance(p);
+  Token const directive = *cur(p);
+  ConditionKind kind;
+  if (tokenId(p, "if").success) {
+    kind = CONDITION_IF;
+  } else if (tokenId(p, "ifdef").success) {
+    kind = CONDITION_IFDEF;
+  } else if (tokenId(p, "ifndef").success) {
+    kind = CONDITION_IFNDEF;
+  } else if (tokenId(p, "else").success || tokenId(p, "endif").success) {
+    bool const is_else = tokenId(p, "else").success;
+    error(p, "%s without IF", is_else ? "ELSE" : "ENDIF");
+    while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+      advance(p);
+    if (is_else && peek(p).type == TOKEN_BLOCK)
+      advance(p);
+    return true;
+  } else {
+    p->ptr = ptr_save;
+    return false;
+  }
+
+  advance(p);
+  Vector* expr = parseCondition(p, kind);
+  Vector* then_body = parseBranch(p);
+  Vector* else_body = NULL;
+  bool ok = expr != NULL;
+
+  if (tokenId(p, "else").success) {
+    advance(p);
+    if (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success) {
+      error(p, "excessive characters after ELSE: %.*s", (int)cur(p)->len, cur(p)->value);
+      ok = false;
+      while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+        advance(p);
+    }
+    else_body = parseBranch(p);
+
+    /* Further ELSEs are reported, and their lines dropped */
+    while (tokenId(p, "else").success) {
+      error(p, "ELSE after ELSE");
+      ok = false;
+      while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+        advance(p);
+      Vector_destroy(parseBranch(p));
+    }
+  }
+
+  if (tokenType(p, TOKEN_END).success) {
+    char* reason = dsprintf("%s without ENDIF", names[kind]);
+    if (!reason)
+      die("dsprintf() failed");
+    emit(p, (Statement){.kind = STATEMENT_ERROR, .data = {.error = ParserError_make(p->lex, &directive, reason)}});
+    ok = false;
+  } else {
+    advance(p);
+    if (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success) {
+      error(p, "excessive characters after ENDIF: %.*s", (int)cur(p)->len, cur(p)->value);
+      ok = false;
+      while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+        advance(p);
+    }
+  }
+
+  if (ok) {
+    Statement s = {.kind = STATEMENT_CONDITIONAL};
+    s.data.cond.tok = directive;
+    s.data.cond.kind = kind;
+    s.data.cond.expr = expr;
+    s.data.cond.then_body = then_body;
+    s.data.cond.else_body = else_body;
+    emit(p, s);
+  } else {
+    if (expr)
+      Vector_destroy(expr);
+    Vector_destroy(then_body);
+    if (else_body)
+      Vector_destroy(else_body);
+  }
+  return true;
+}
+
+/* The condition of IF, or the symbol of IFDEF and IFNDEF; reported and NULL
+ * if wrong, the rest of the line skipped either way */
+static Vector* parseCondition(Parser* p, ConditionKind kind) {
+  Vector* expr = NULL;
+  if (kind == CONDITION_IF && (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success)) {
+    error(p, "expected an expression");
+  } else if (kind == CONDITION_IF) {
+    Result r = expression(p);
+    if (r.success) {
+      expr = Operand_toExpr(&r.value.operand);
+      advance(p);
+    } else {
+      error(p, "invalid expression");
+    }
+  } else if (!tokenType(p, TOKEN_ID).success) {
+    error(p, "expected a symbol name");
+  } else {
+    if (!(expr = Vector_new(sizeof(Token))))
+      die("Vector_new() failed");
+    if (Vector_push(expr, cur(p)) == -1)
+      die("Vector_push() failed");
+    advance(p);
+  }
+
+  if (expr && !tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success) {
+    error(p, "excessive characters after the condition: %.*s", (int)cur(p)->len, cur(p)->value);
+    Vector_destroy(expr);
+    expr = NULL;
+  }
+  while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+    advance(p);
+  return expr;
+}
+
+/* The lines of a branch, up to the ELSE or ENDIF line closing it, whose
+ * first token is left the current one; or up to the end of the input */
+static Vector* parseBranch(Parser* p) {
+  Vector* body = Vector_new(sizeof(Token));
+  if (!body)
+    die("Vector_new() failed");
+
+  /* Nested conditionals only show in the tokens of a macro body */
+  size_t depth = 0;
+  while (true) {
+    advance(p);
+    if (tokenType(p, TOKEN_END).success)
+      break;
+    if (tokenId(p, "if").success || tokenId(p, "ifdef").success || tokenId(p, "ifndef").success)
+      ++depth;
+    else if ((tokenId(p, "else").success || tokenId(p, "endif").success) && depth == 0)
+      break;
+    else if (tokenId(p, "endif").success)
+      --depth;
+
+    /* A TOKEN_BLOCK is whole lines, and the next line follows right away */
+    if (tokenType(p, TOKEN_BLOCK).success) {
+      if (Vector_push(body, cur(p)) == -1)
+        die("Vector_push() failed");
+      continue;
+    }
+    while (!tokenType(p, TOKEN_END).success) {
+      if (Vector_push(body, cur(p)) == -1)
+        die("Vector_push() failed");
+      if (tokenType(p, TOKEN_NEWLINE).success)
+        break;
+      advance(p);
+    }
+  }
+  return body;
+}
+
+/* NAME [:] MACRO [PARAM {, PARAM}] NEWLINE {line} ENDM
+ *
+ * The lines of the body are only lexed; they are parsed where the macro is
+ * expanded. A line LOCAL LABEL {, LABEL} names labels that take a name of
+ * their own in each expansion (see macro.h). */
+static bool parseMacro(Parser* p) {
+  size_t const ptr_save = p->ptr;
+
+  advance(p);
+  if (cur(p)->type != TOKEN_ID) {
+    p->ptr = ptr_save;
+    return false;
+  }
+  Token const name = *cur(p);
+
+  advance(p);
+  if (cur(p)->type == TOKEN_COLON)
+    advance(p);
+  if (!tokenId(p, "macro").success) {
+    p->ptr = ptr_save;
+    return false;
+  }
+
+  Vector* params = Vector_new(sizeof(Token));
+  Vector* locals = Vector_new(sizeof(Token));
+  Vector* body = Vector_new(sizeof(Token));
+  if (!params || !locals || !body)
+    die("Vector_new() failed");
+
+  /* A bad parameter list is reported, and the body is still skipped */
+  advance(p);
+  bool ok = parseParams(p, params, NULL, "parameter");
+  while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+    advance(p);
+
+  /* Every line is the body up to one starting with ENDM */
+  while (true) {
+    if (tokenType(p, TOKEN_END).success) {
+      char* reason = dsprintf("MACRO without ENDM: %.*s", (int)name.len, name.value);
+      if (!reason)
+        die("dsprintf() failed");
+      emit(p, (Statement){.kind = STATEMENT_ERROR, .data = {.error = ParserError_make(p->lex, &name, reason)}});
+      ok = false;
+      break;
+    }
+    advance(p);
+    if (tokenId(p, "endm").success) {
+      advance(p);
+      if (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success) {
+        error(p, "excessive characters after ENDM: %.*s", (int)cur(p)->len, cur(p)->value);
+        ok = false;
+        skip(p);
+      }
+      break;
+    }
+    if (tokenId(p, "local").success) {
+      Token const local = *cur(p);
+      advance(p);
+      if (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success) {
+        char* reason = dsprintf("expected local label names");
+        if (!reason)
+          die("dsprintf() failed");
+        emit(p, (Statement){.kind = STATEMENT_ERROR, .data = {.error = ParserError_make(p->lex, &local, reason)}});
+        ok = false;
+      } else {
+        ok &= parseParams(p, locals, params, "local label");
+      }
+      while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success)
+        advance(p);
+      continue;
+    }
+    while (true) {
+      if (Vector_push(body, cur(p)) == -1)
+        die("Vector_push() failed");
+      if (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success)
+        break;
+      advance(p);
+    }
+  }
+
+  if (ok) {
+    emit(p, (Statement){.kind = STATEMENT_MACRO,
+                        .data = {.macro = {.tok = name, .params = params, .locals = locals, .body = body}}});
+  } else {
+    Vector_destroy(params);
+    Vector_destroy(locals);
+    Vector_destroy(body);
+  }
+  return true;
+}
+
+/* [PARAM {, PARAM}], reported if wrong */
+static bool parseParams(Parser* p, Vector* params, Vector* taken, char const* what) {
+  if (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success)
+    return true;
+
+  size_t const n_taken = taken ? Vector_len(taken) : 0;
+  while (true) {
+    Token const* tok = cur(p);
+    if (tok->type != TOKEN_ID) {
+      error(p, "expected %s names", what);
+      return false;
+    }
+    for (size_t i = 0; i < n_taken + Vector_len(params); ++i) {
+      Token const* param = i < n_taken ? Vector_at(taken, i) : Vector_at(params, i - n_taken);
+      if (param->len == tok->len && memcmp(param->value, tok->value, tok->len) == 0) {
+        error(p, "duplicate %s: %.*s", what, (int)tok->len, tok->value);
+        return false;
+      }
+    }
+    if (Vector_push(params, tok) == -1)
+      die("Vector_push() failed");
+
+    advance(p);
+    if (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success)
+      return true;
+    if (!tokenType(p, TOKEN_COMMA).success) {
+      error(p, "expected %s names", what);
+      return false;
+    }
+    advance(p);
+  }
+}
+
+/* NAME [:] (EQU | DEFL) expression */
+static bool parseConstant(Parser* p) {
+  size_t const ptr_save = p->ptr;
+
+  advance(p);
+  if (cur(p)->type != TOKEN_ID) {
+    p->ptr = ptr_save;
+    return false;
+  }
+  size_t const name_idx = p->ptr;
+
+  advance(p);
+  if (cur(p)->type == TOKEN_COLON)
+    advance(p);
+
+  SymbolKind kind;
+  if (tokenId(p, "equ").success) {
+    kind = SYMBOL_EQU;
+  } else if (tokenId(p, "defl").success) {
+    kind = SYMBOL_DEFL;
+  } else {
+    p->ptr = ptr_save;
+    return false;
+  }
+
+  advance(p);
+  if (tokenType(p, TOKEN_NEWLINE).success || tokenType(p, TOKEN_END).success) {
+    error(p, "expected an expression");
+    return true;
+  }
+
+  Result r = expression(p);
+  if (!r.success) {
+    error(p, "invalid expression");
+    skip(p);
+    return true;
+  }
+  advance(p);
+
+  Statement const s = {
+      .kind = STATEMENT_CONSTANT,
+      .data = {.constant = {.tok = *tokAt(p, name_idx), .expr = Operand_toExpr(&r.value.operand), .kind = kind}},
+  };
+  emit(p, s);
+  return true;
 }
 
 static void parseLabel(Parser* p) {
@@ -317,12 +1121,11 @@ static void parseLabel(Parser* p) {
   if (!label_name)
     die("Token_str() failed");
 
-  IRNode node = {
+  IRNode const node = {
       .kind = IR_LABEL,
       .data = {.label = {.name = label_name, .line = label_tok->line}},
   };
-  Vector_push(p->nodes, &node);
-  Map_set(p->labels, node.data.label.name, &node.data.label);
+  emit(p, (Statement){.kind = STATEMENT_LABEL, .data = {.label = {.node = node, .tok = *label_tok}}});
 }
 
 void parseInstruction(Parser* p) {
@@ -361,47 +1164,277 @@ void parseInstruction(Parser* p) {
   if (tokenId(p, "ld").success) {
     advance(p);
     ALT(MATCH_SAVE(reg8Bit(p)) && MATCH(comma(p)) && MATCH_SAVE(reg8Bit(p)), {
-      IRNode node = IRNode_createInstruction("bb", results[0].value.byte, results[1].value.byte);
-      Vector_push(p->nodes, &node);
+      uint8_t opcode = (uint8_t)(0x40 | results[0].value.byte << 3 | results[1].value.byte);
+      IRNode node = IRNode_createInstruction("b", opcode);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(reg8Bit(p)) && MATCH(comma(p)) && MATCH(indirectHL(p)), {
+      uint8_t opcode = (uint8_t)(0x46 | results[0].value.byte << 3);
+      IRNode node = IRNode_createInstruction("b", opcode);
+      emitInstruction(p, &node);
     });
-    ALT(MATCH_SAVE(reg8Bit(p)) && MATCH(comma(p)) && MATCH_SAVE(address(p)), {
-      IRNode node = IRNode_createInstruction("ba", results[0].value.byte, results[1].value.expr);
-      Vector_push(p->nodes, &node);
+    ALT(MATCH(tokenId(p, "a")) && MATCH(comma(p)) && MATCH_SAVE(address(p)), {
+      checkRange(p, &results[0].value.operand, 2);
+      IRNode node = IRNode_createInstruction("ba", 0x3a, results[0].value.operand);
+      emitInstruction(p, &node);
     });
     ALT(MATCH_SAVE(reg8Bit(p)) && MATCH(comma(p)) && MATCH_SAVE(expression(p)), {
-      IRNode node = IRNode_createInstruction("be", results[0].value.byte, results[1].value.expr);
-      Vector_push(p->nodes, &node);
+      uint8_t opcode = (uint8_t)(0x06 | results[0].value.byte << 3);
+      checkRange(p, &results[1].value.operand, 1);
+      IRNode node = IRNode_createInstruction("be", opcode, results[1].value.operand);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "jr").success) {
+    advance(p);
+    ALT(MATCH_SAVE(condition(p)) && results[0].value.byte < 4 && MATCH(comma(p)) && MATCH_SAVE(expression(p)), {
+      uint8_t opcode = (uint8_t)(0x20 | results[0].value.byte << 3);
+      IRNode node = IRNode_createInstruction("br", opcode, results[1].value.operand);
+      node.data.instruction.branch = BRANCH_JR;
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(expression(p)), {
+      IRNode node = IRNode_createInstruction("br", 0x18, results[0].value.operand);
+      node.data.instruction.branch = BRANCH_JR;
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "djnz").success) {
+    advance(p);
+    ALT(MATCH_SAVE(expression(p)), {
+      IRNode node = IRNode_createInstruction("br", 0x10, results[0].value.operand);
+      node.data.instruction.branch = BRANCH_DJNZ;
+      emitInstruction(p, &node);
     });
     error(p, "wrong operands to instruction");
     skip(p);
     goto error;
+  } else if (tokenId(p, "jp").success) {
+    advance(p);
+    ALT(MATCH(indirectHL(p)), {
+      IRNode node = IRNode_createInstruction("b", 0xe9);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(condition(p)) && MATCH(comma(p)) && MATCH_SAVE(expression(p)), {
+      uint8_t opcode = (uint8_t)(0xc2 | results[0].value.byte << 3);
+      checkRange(p, &results[1].value.operand, 2);
+      IRNode node = IRNode_createInstruction("ba", opcode, results[1].value.operand);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(expression(p)), {
+      checkRange(p, &results[0].value.operand, 2);
+      IRNode node = IRNode_createInstruction("ba", 0xc3, results[0].value.operand);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "call").success) {
+    advance(p);
+    ALT(MATCH_SAVE(condition(p)) && MATCH(comma(p)) && MATCH_SAVE(expression(p)), {
+      uint8_t opcode = (uint8_t)(0xc4 | results[0].value.byte << 3);
+      checkRange(p, &results[1].value.operand, 2);
+      IRNode node = IRNode_createInstruction("ba", opcode, results[1].value.operand);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(expression(p)), {
+      checkRange(p, &results[0].value.operand, 2);
+      IRNode node = IRNode_createInstruction("ba", 0xcd, results[0].value.operand);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "ret").success) {
+    advance(p);
+    ALT(MATCH_SAVE(condition(p)), {
+      IRNode node = IRNode_createInstruction("b", 0xc0 | results[0].value.byte << 3);
+      emitInstruction(p, &node);
+    });
+    ALT(true, {
+      IRNode node = IRNode_createInstruction("b", 0xc9);
+      emitInstruction(p, &node);
+    });
   } else if (tokenId(p, "push").success) {
     advance(p);
-    ALT(MATCH(tokenId(p, "bc")), printf("push bc\n"));
-    ALT(MATCH(tokenId(p, "de")), printf("push de\n"));
-    ALT(MATCH(tokenId(p, "hl")), printf("push hl"));
+    ALT(MATCH_SAVE(reg16Stack(p)), {
+      IRNode node = IRNode_createInstruction("b", 0xc5 | results[0].value.byte << 4);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
   } else if (tokenId(p, "pop").success) {
     advance(p);
-    ALT(MATCH(tokenId(p, "bc")), printf("pop bc\n"));
+    ALT(MATCH_SAVE(reg16Stack(p)), {
+      IRNode node = IRNode_createInstruction("b", 0xc1 | results[0].value.byte << 4);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (MATCH_SAVE(aluOperation(p))) {
+    uint8_t const op = results[0].value.byte;
+    n_results_save = n_results;
+    ALT(MATCH(tokenId(p, "a")) && MATCH(comma(p)) && MATCH_SAVE(reg8Bit(p)), {
+      IRNode node = IRNode_createInstruction("b", 0x80 | op << 3 | results[1].value.byte);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH(tokenId(p, "a")) && MATCH(comma(p)) && MATCH(indirectHL(p)), {
+      IRNode node = IRNode_createInstruction("b", 0x86 | op << 3);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH(tokenId(p, "a")) && MATCH(comma(p)) && MATCH_SAVE(expression(p)), {
+      checkRange(p, &results[1].value.operand, 1);
+      IRNode node = IRNode_createInstruction("be", 0xc6 | op << 3, results[1].value.operand);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(reg8Bit(p)), {
+      IRNode node = IRNode_createInstruction("b", 0x80 | op << 3 | results[1].value.byte);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH(indirectHL(p)), {
+      IRNode node = IRNode_createInstruction("b", 0x86 | op << 3);
+      emitInstruction(p, &node);
+    });
+    ALT(MATCH_SAVE(expression(p)), {
+      checkRange(p, &results[1].value.operand, 1);
+      IRNode node = IRNode_createInstruction("be", 0xc6 | op << 3, results[1].value.operand);
+      emitInstruction(p, &node);
+    });
+    error(p, "wrong operands to instruction");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "nop").success) {
+    advance(p);
+    ALT(true, {
+      IRNode node = IRNode_createInstruction("b", 0x00);
+      emitInstruction(p, &node);
+    });
+  } else if (tokenId(p, "org").success) {
+    Token const directive = *cur(p);
+    advance(p);
+    ALT(MATCH_SAVE(expression(p)), { emitOrigin(p, STATEMENT_ORG, &directive, &results[0].value.operand); });
+    error(p, "expected an address");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "bank").success) {
+    Token const directive = *cur(p);
+    advance(p);
+    ALT(MATCH_SAVE(expression(p)), { emitOrigin(p, STATEMENT_BANK, &directive, &results[0].value.operand); });
+    error(p, "expected a bank number");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "assert_cycles").success) {
+    Token const directive = *cur(p);
+    advance(p);
+    ALT(MATCH(tokenType(p, TOKEN_ID)) && MATCH(comma(p)) && MATCH(tokenType(p, TOKEN_ID)) && MATCH(comma(p)) &&
+            MATCH_SAVE(expression(p)),
+        {
+          Statement s = {.kind = STATEMENT_CYCLES};
+          s.data.cycles.tok = directive;
+          s.data.cycles.start = *tokAt(p, ptr_save);
+          s.data.cycles.end = *tokAt(p, ptr_save + 2);
+          s.data.cycles.max = Operand_toExpr(&results[0].value.operand);
+          emit(p, s);
+        });
+    error(p, "expected start label, end label and a budget in T-states");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "include").success) {
+    Token const directive = *cur(p);
+    advance(p);
+    ALT(MATCH(tokenType(p, TOKEN_CHAR)), { emitInclude(p, &directive, tokAt(p, ptr_save)); });
+    error(p, "expected a file name in quotes");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "db").success || tokenId(p, "defb").success) {
+    IRNode node;
+    advance(p);
+    ALT(MATCH(dataList(p, 1, &node)), { emitInstruction(p, &node); });
+    error(p, "expected a list of bytes and strings");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "dw").success || tokenId(p, "defw").success) {
+    IRNode node;
+    advance(p);
+    ALT(MATCH(dataList(p, 2, &node)), { emitInstruction(p, &node); });
+    error(p, "expected a list of words");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "ds").success || tokenId(p, "defs").success) {
+    Token const directive = *cur(p);
+    Operand ops[2];
+    size_t n = 0;
+    advance(p);
+    ALT(MATCH(operandList(p, ops, 2, &n)), { emitFill(p, &directive, ops, n); });
+    error(p, "expected a byte count and an optional value");
+    skip(p);
+    goto error;
+  } else if (tokenId(p, "incbin").success) {
+    Token const directive = *cur(p);
+    Operand ops[2];
+    size_t n = 0;
+    advance(p);
+    ALT(MATCH(tokenType(p, TOKEN_CHAR)) && MATCH(comma(p)) && MATCH(operandList(p, ops, 2, &n)),
+        { emitIncbin(p, &directive, tokAt(p, ptr_save), ops, n); });
+    ALT(MATCH(tokenType(p, TOKEN_CHAR)), { emitIncbin(p, &directive, tokAt(p, ptr_save), ops, 0); });
+    error(p, "expected a file name in quotes, and an optional offset and length");
+    skip(p);
+    goto error;
   } else if (cur(p)->type != TOKEN_ID) {
     error(p, "expected instruction name");
     skip(p);
   } else {
-    error(p, "unknown instruction: %.*s", (int)cur(p)->len, cur(p)->value);
-    skip(p);
+    parseExpand(p);
   }
 
 error:
-  return;
-
 success:
-
 #undef ALT
 #undef MATCH_SAVE
 #undef MATCH
   return;
 }
 
+/* NAME [ARG {, ARG}], where NAME is no instruction: the tokens are kept as
+ * they are, for a macro of the name defined by the time the statement is
+ * resolved */
+static void parseExpand(Parser* p) {
+  Token const name = *cur(p);
+  Vector* args = Vector_new(sizeof(Token));
+  if (!args)
+    die("Vector_new() failed");
+
+  advance(p);
+  while (!tokenType(p, TOKEN_NEWLINE).success && !tokenType(p, TOKEN_END).success) {
+    if (Vector_push(args, cur(p)) == -1)
+      die("Vector_push() failed");
+    advance(p);
+  }
+  emit(p, (Statement){.kind = STATEMENT_EXPAND, .data = {.expand = {.tok = name, .args = args}}});
+}
+
+/* Operands folded at parse time skip the resolver, so they are checked here */
+static void checkRange(Parser* p, Operand const* op, size_t size) {
+  if (op->expr)
+    return;
+
+  int32_t const min = size == 1 ? INT8_MIN : INT16_MIN;
+  int32_t const max = size == 1 ? UINT8_MAX : UINT16_MAX;
+  if (op->value >= min && op->value <= max)
+    return;
+
+  char* str = dsprintf("value %d does not fit in %zu byte(s)", (int)op->value, size);
+  if (!str)
+    die("dsprintf() failed");
+  emit(p, (Statement){.kind = STATEMENT_ERROR, .data = {.error = ParserError_make(p->lex, &op->tok, str)}});
+}
+
 static void error(Parser* p, const char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
@@ -411,17 +1444,342 @@ static void error(Parser* p, const char* fmt, ...) {
   if (!str)
     die("vdsprintf() failed");
 
-  Token* last = cur(p);
-  char* source_line = Lexer_line(p->lex, last->line);
+  emit(p, (Statement){.kind = STATEMENT_ERROR, .data = {.error = ParserError_make(p->lex, cur(p), str)}});
+}
 
-  ParserError e = {
-      .reason = str,
-      .line = source_line,
-      .col = last->col,
-      .lineno = last->line,
-  };
+/* Resolve the statement right away, or keep or send it for Parser_apply() */
+static void emit(Parser* p, Statement s) {
+  s.line = p->line;
+  if (p->stream)
+    p->stream->emit(p->stream->ctx, &s);
+  else if (!p->statements)
+    Parser_apply(p, &s);
+  else if (Vector_push(p->statements, &s) == -1)
+    die("Vector_push() failed");
+}
+
+static void emitInstruction(Parser* p, IRNode* node) {
+  node->data.instruction.line = p->line;
+  emit(p, (Statement){.kind = STATEMENT_INSTRUCTION, .data = {.instruction = *node}});
+}
+
+static void emitOrigin(Parser* p, StatementKind kind, Token const* directive, Operand const* op) {
+  emit(p, (Statement){.kind = kind, .data = {.org = {.tok = *directive, .expr = Operand_toExpr(op)}}});
+}
 
-  Vector_push(p->errors, &e);
+/* The file starts loading now, so it's likely there by the time the
+ * statement is resolved */
+static void emitInclude(Parser* p, Token const* directive, Token const* path) {
+  char* path_str = Token_str(path);
+  if (!path_str)
+    die("Token_str() failed");
+  if (p->includes)
+    IncludeCache_prefetch(p->includes, path_str);
+  emit(p, (Statement){.kind = STATEMENT_INCLUDE, .data = {.include = {.tok = *directive, .path = path_str}}});
+}
+
+/* Replay the statements of the file, as if they stood on the line of the
+ * directive; their tokens keep their own lines, for the errors */
+static void include(Parser* p, Statement* s) {
+  char* path = s->data.include.path;
+  Token const* directive = &s->data.include.tok;
+  IncludeFile const* f = NULL;
+  int err = 0;
+
+  bool cycle = false;
+  for (IncludeFrame const* frame = p->including; frame && !cycle; frame = frame->outer)
+    cycle = strcmp(frame->path, path) == 0;
+
+  p->included |= p->includes != NULL;
+  if (!p->includes)
+    applyError(p, directive, dsprintf("cannot include files here: %s", path));
+  else if (cycle)
+    applyError(p, directive, dsprintf("%s includes itself", path));
+  else if (!(f = IncludeCache_get(p->includes, path, &err)))
+    applyError(p, directive, dsprintf("cannot include %s: %s", path, strerror(err)));
+
+  IncludeFrame const frame = {.path = path, .outer = p->including};
+  p->including = &frame;
+  if (f)
+    replay(p, f->statements, s->line);
+  p->including = frame.outer;
+  free(path);
+}
+
+static void emitFill(Parser* p, Token const* directive, Operand const* ops, size_t n) {
+  Vector* value = n > 1 ? Operand_toExpr(&ops[1]) : NULL;
+  emit(p, (Statement){.kind = STATEMENT_FILL,
+                      .data = {.fill = {.tok = *directive, .count = Operand_toExpr(&ops[0]), .value = value}}});
+}
+
+static void emitIncbin(Parser* p, Token const* directive, Token const* path, Operand const* ops, size_t n) {
+  char* path_str = Token_str(path);
+  if (!path_str)
+    die("Token_str() failed");
+  Statement s = {.kind = STATEMENT_INCBIN};
+  s.data.incbin.tok = *directive;
+  s.data.incbin.path = path_str;
+  s.data.incbin.offset = n > 0 ? Operand_toExpr(&ops[0]) : NULL;
+  s.data.incbin.len = n > 1 ? Operand_toExpr(&ops[1]) : NULL;
+  emit(p, s);
+}
+
+/* The bytes are those of the mapped file, shared by every INCBIN of it */
+static void incbin(Parser* p, Statement* s) {
+  char* path = s->data.incbin.path;
+  Token const* directive = &s->data.incbin.tok;
+  Blob* blob = NULL;
+  int err = 0;
+
+  p->included |= p->includes != NULL;
+  if (!p->includes)
+    applyError(p, directive, dsprintf("cannot include files here: %s", path));
+  else if (!(blob = IncludeCache_getBlob(p->includes, path, &err)))
+    applyError(p, directive, dsprintf("cannot include %s: %s", path, strerror(err)));
+
+  if (blob) {
+    Resolver_addBlob(&p->resolver, directive, s->line, blob, s->data.incbin.offset, s->data.incbin.len);
+  } else {
+    if (s->data.incbin.offset)
+      Vector_destroy(s->data.incbin.offset);
+    if (s->data.incbin.len)
+      Vector_destroy(s->data.incbin.len);
+  }
+  free(path);
+}
+
+/* Make the bytes gathered so far an item, a lone byte an EI_BYTE */
+static void flushRun(Vector* items, uint8_t** run, size_t* len, size_t* cap) {
+  if (*len == 0)
+    return;
+  EncodedItem item = {.kind = EI_BYTE, .data.byte = (*run)[0]};
+  if (*len > 1) {
+    item = (EncodedItem){.kind = EI_BYTES, .data.bytes = Blob_fromHeap(*run, *len)};
+    *run = NULL;
+    *cap = 0;
+  }
+  *len = 0;
+  if (Vector_push(items, &item) == -1)
+    die("Vector_push() failed");
+}
+
+static void defineMacro(Parser* p, Statement* s) {
+  Token const* name = &s->data.macro.tok;
+  if (!p->macros && !(p->macros = Map_new(sizeof(Macro), map_destroy_macro)))
+    die("Map_new() failed");
+
+  char* name_str = Token_str(name);
+  if (!name_str)
+    die("Token_str() failed");
+  Macro const* defined = Map_get(p->macros, name_str);
+  if (defined) {
+    applyError(p, name, dsprintf("redefinition of macro %s (previously defined on line %zu)", name_str,
+                                 defined->tok.line));
+  } else {
+    Macro m = Macro_make(name, s->data.macro.params, s->data.macro.locals, s->data.macro.body);
+    if (!Map_setCopy(p->macros, m.name, &m))
+      die("Map_setCopy() failed");
+  }
+  free(name_str);
+  Vector_destroy(s->data.macro.params);
+  Vector_destroy(s->data.macro.locals);
+  Vector_destroy(s->data.macro.body);
 }
 
-static void map_destroy_ir_label(void* value) {}
+/* Resolve the statements of the expansion in place of this one, as INCLUDE
+ * does; those of constant arguments are parsed once per macro, unless it
+ * has LOCAL labels */
+static void expand(Parser* p, Statement* s) {
+  Token const* name = &s->data.expand.tok;
+  char* name_str = Token_str(name);
+  if (!name_str)
+    die("Token_str() failed");
+  Macro* m = p->macros ? Map_get(p->macros, name_str) : NULL;
+  Vector* split = Macro_splitArgs(s->data.expand.args);
+  size_t const n_args = Vector_len(split);
+  MacroArg const* args = n_args ? Vector_at(split, 0) : NULL;
+
+  if (!m) {
+    applyError(p, name, dsprintf("unknown instruction: %s", name_str));
+  } else if (n_args != m->n_params) {
+    applyError(p, name, dsprintf("macro %s takes %zu argument(s), given %zu", name_str, m->n_params, n_args));
+  } else if (p->expanding == MACRO_MAX_DEPTH) {
+    applyError(p, name, dsprintf("macro expansions nest deeper than %d: %s", MACRO_MAX_DEPTH, name_str));
+  } else {
+    p->expanding += 1;
+    char* key = Vector_isEmpty(m->locals) ? Macro_key(args, n_args) : NULL;
+    MacroExpansion const* e = key ? Map_get(m->expansions, key) : NULL;
+    if (e) {
+      free(key);
+      replay(p, e->statements, s->line);
+    } else {
+      Vector* statements = parseExpansion(p, m, args);
+
+      /* Errors point at the arguments, so they aren't replayed elsewhere */
+      bool has_errors = false;
+      for (size_t i = 0; i < Vector_len(statements) && !has_errors; ++i)
+        has_errors = ((Statement*)Vector_at(statements, i))->kind == STATEMENT_ERROR;
+      if (key && !has_errors) {
+        MacroExpansion const new_e = {.key = key, .statements = statements};
+        if (!Map_setCopy(m->expansions, key, &new_e))
+          die("Map_setCopy() failed");
+        replay(p, statements, s->line);
+      } else {
+        free(key);
+        for (size_t i = 0; i < Vector_len(statements); ++i) {
+          moveToLine(Vector_at(statements, i), s->line);
+          Parser_apply(p, Vector_at(statements, i));
+        }
+        Vector_destroy(statements);
+      }
+    }
+    p->expanding -= 1;
+  }
+
+  free(name_str);
+  Vector_destroy(split);
+  Vector_destroy(s->data.expand.args);
+}
+
+static Vector* parseExpansion(Parser* p, Macro* m, MacroArg const* args) {
+  Expansion e = {.reader = MacroReader_make(m, args, Macro_nameLocals(m)), .statements = Vector_new(sizeof(Statement))};
+  if (!e.statements)
+    die("Vector_new() failed");
+  ParserStream const stream = {.next = nextExpanded, .emit = keepExpanded, .ctx = &e};
+  parseWith(p, &stream);
+  return e.statements;
+}
+
+/* Parse with the parser kept for expansions and branches, which starts
+ * over each time; its statements only come back here, so it is never
+ * parsing another */
+static void parseWith(Parser* p, ParserStream const* stream) {
+  if (!p->expander) {
+    p->expander = malloc(sizeof(Parser));
+    if (!p->expander)
+      die("malloc() failed");
+    *p->expander = Parser_make(p->lex);
+  }
+  Parser* q = p->expander;
+  q->includes = p->includes;
+  q->ptr = 0;
+  for (size_t i = 0; i < Vector_len(q->buf); ++i)
+    ((Token*)Vector_at(q->buf, i))->type = TOKEN_UNINITIALIZED;
+  Parser_parseStream(q, stream);
+}
+
+static Token nextExpanded(void* ctx) { return MacroReader_next(&((Expansion*)ctx)->reader); }
+
+static void keepExpanded(void* ctx, Statement* s) {
+  if (Vector_push(((Expansion*)ctx)->statements, s) == -1)
+    die("Vector_push() failed");
+}
+
+/* Parse the branch taken, if any, and resolve its statements in place of
+ * this one; they keep their own lines, unless this one was moved */
+static void conditional(Parser* p, Statement* s) {
+  Vector* expr = s->data.cond.expr;
+  bool known = true, taken = false;
+  if (s->data.cond.kind == CONDITION_IF) {
+    int32_t value;
+    known = Resolver_evaluateCondition(&p->resolver, expr, &value) == 0;
+    taken = known && value != 0;
+  } else {
+    taken = Resolver_isDefined(&p->resolver, Vector_at(expr, 0)) == (s->data.cond.kind == CONDITION_IFDEF);
+    Vector_destroy(expr);
+  }
+
+  Vector* body = taken ? s->data.cond.then_body : s->data.cond.else_body;
+  if (known && body && !Vector_isEmpty(body)) {
+    Branch b = {.tokens = body, .statements = Vector_new(sizeof(Statement))};
+    if (!b.statements)
+      die("Vector_new() failed");
+    ParserStream const stream = {.next = nextInBranch, .emit = keepInBranch, .ctx = &b};
+    parseWith(p, &stream);
+    for (size_t i = 0; i < Vector_len(b.statements); ++i) {
+      if (s->data.cond.moved)
+        moveToLine(Vector_at(b.statements, i), s->line);
+      Parser_apply(p, Vector_at(b.statements, i));
+    }
+    Vector_destroy(b.statements);
+  }
+
+  Vector_destroy(s->data.cond.then_body);
+  if (s->data.cond.else_body)
+    Vector_destroy(s->data.cond.else_body);
+}
+
+static Token nextInBranch(void* ctx) {
+  Branch* b = ctx;
+  while (true) {
+    if (b->in_block) {
+      Token const tok = Lexer_next(&b->block);
+      if (tok.type != TOKEN_END)
+        return tok;
+      b->in_block = false;
+    }
+    if (b->at == Vector_len(b->tokens)) {
+      Token const* last = Vector_at(b->tokens, b->at - 1);
+      return (Token){.type = TOKEN_END, .value = last->value + last->len, .line = last->line, .origin = last->origin};
+    }
+    Token const* tok = Vector_at(b->tokens, b->at++);
+    if (tok->type != TOKEN_BLOCK)
+      return *tok;
+    b->block = Lexer_makeBlock(tok);
+    b->in_block = true;
+  }
+}
+
+static void keepInBranch(void* ctx, Statement* s) {
+  if (Vector_push(((Branch*)ctx)->statements, s) == -1)
+    die("Vector_push() failed");
+}
+
+/* Resolve copies of the statements, as if they stood on `line`; their
+ * tokens keep their own lines, for the errors */
+static void replay(Parser* p, Vector* statements, size_t line) {
+  for (size_t i = 0; i < Vector_len(statements); ++i) {
+    Statement copy = Statement_copy(Vector_at(statements, i));
+    moveToLine(&copy, line);
+    Parser_apply(p, &copy);
+  }
+}
+
+static void moveToLine(Statement* s, size_t line) {
+  s->line = line;
+  if (s->kind == STATEMENT_INSTRUCTION)
+    s->data.instruction.data.instruction.line = line;
+  else if (s->kind == STATEMENT_LABEL)
+    s->data.label.node.data.label.line = line;
+  else if (s->kind == STATEMENT_CONDITIONAL)
+    s->data.cond.moved = true;
+}
+
+static void map_destroy_macro(void* value) { Macro_deinit(value); }
+
+static void applyError(Parser* p, Token const* tok, char* reason) {
+  if (!reason)
+    die("dsprintf() failed");
+  ParserError e = ParserError_make(p->lex, tok, reason);
+  if (Vector_push(p->errors, &e) == -1)
+    die("Vector_push() failed");
+}
+
+static Vector* copyTokens(Vector* tokens) {
+  Vector* copy = Vector_new(sizeof(Token));
+  if (!copy)
+    die("Vector_new() failed");
+  for (size_t i = 0; i < Vector_len(tokens); ++i)
+    if (Vector_push(copy, Vector_at(tokens, i)) == -1)
+      die("Vector_push() failed");
+  return copy;
+}
+
+static Vector* copyTokensOrNull(Vector* tokens) { return tokens ? copyTokens(tokens) : NULL; }
+
+static char* copyString(char const* s) {
+  char* copy = dsprintf("%s", s);
+  if (!copy)
+    die("dsprintf() failed");
+  return copy;
+}
@@ -1,20 +1,38 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "expression.h"
 #include "lexer.h"
 #include "map.h"
+#include "resolver.h"
+#include "timing.h"
 #include "vector.h"
 #include <stdbool.h>
 #include <stdio.h>
 
-typedef struct {
+typedef struct ParserStream ParserStream;
+typedef struct IncludeCache IncludeCache;
+typedef struct IncludeFrame IncludeFrame;
+
+typedef struct Parser {
   Lexer* lex;
   Vector* buf;
   size_t ptr;
   bool error;
   Vector* errors;
-  Map* labels;
   Vector* nodes;
+  Vector* cycle_assertions; //< Vector[CycleAssertion], checked by Timing_checkAssertions
+  ExprParser ep;            //< Reset and reused for every operand
+  Resolver resolver;
+  size_t line;                //< Source line of the statement being parsed
+  Vector* statements;         //< Vector[Statement]: parsed statements are kept here rather than resolved, NULL if not
+  ParserStream const* stream; //< Where tokens come from and statements go instead, NULL if from `lex`
+  IncludeCache* includes;     //< Where INCLUDE finds its files, NULL if it can't (see include.h)
+  IncludeFrame const* including; //< The INCLUDEs being resolved, innermost first
+  Map* macros;                   //< Map[Macro] defined so far, by name; NULL until the first one
+  struct Parser* expander;       //< Parses the expansions of macros, NULL until the first one
+  size_t expanding;              //< Depth of the macro expansions being resolved
+  bool included;                 //< A file was read for INCLUDE or INCBIN, which may change on disk since
 } Parser;
 
 typedef struct {
@@ -22,14 +40,128 @@ typedef struct {
   char* line;
   size_t col;
   size_t lineno;
+  char const* file; //< Of an included file, NULL for the main source
 } ParserError;
 
+typedef enum {
+  STATEMENT_LABEL,
+  STATEMENT_CONSTANT,
+  STATEMENT_INSTRUCTION,
+  STATEMENT_ORG,
+  STATEMENT_BANK,
+  STATEMENT_CYCLES,
+  STATEMENT_INCLUDE,
+  STATEMENT_FILL,
+  STATEMENT_INCBIN,
+  STATEMENT_MACRO,
+  STATEMENT_EXPAND,
+  STATEMENT_CONDITIONAL,
+  STATEMENT_ERROR,
+} StatementKind;
+
+typedef enum {
+  CONDITION_IF,
+  CONDITION_IFDEF,
+  CONDITION_IFNDEF,
+} ConditionKind;
+
+/* What the parser hands to the resolver, in source order
+ *
+ * A line yields any number of them: a label and an instruction, say, or an
+ * error. Their tokens point into the source.
+ */
+typedef struct {
+  StatementKind kind;
+  size_t line; //< Source line
+  union {
+    struct {
+      IRNode node;
+      Token tok;
+    } label;
+    struct {
+      Token tok;
+      Vector* expr;
+      SymbolKind kind; //< SYMBOL_EQU or SYMBOL_DEFL
+    } constant;
+    IRNode instruction;
+    struct {
+      Token tok; //< The directive
+      Vector* expr;
+    } org; //< STATEMENT_ORG and STATEMENT_BANK
+    CycleAssertion cycles;
+    struct {
+      Token tok;  //< The directive
+      char* path; //< Of the file, whose statements the resolver replays in place of this one
+    } include;
+    struct {
+      Token tok;     //< The directive
+      Vector* count;
+      Vector* value; //< NULL for 0
+    } fill;          //< DS
+    struct {
+      Token tok;      //< The directive
+      char* path;     //< Found as INCLUDE finds it
+      Vector* offset; //< NULL for 0
+      Vector* len;    //< NULL for the rest of the file
+    } incbin;
+    struct {
+      Token tok;      //< The name
+      Vector* params; //< Vector[Token], the names of the parameters
+      Vector* locals; //< Vector[Token], the labels named by LOCAL
+      Vector* body;   //< Vector[Token], the lines up to ENDM, but those of LOCAL
+    } macro;
+    struct {
+      Token tok;    //< The name of the macro
+      Vector* args; //< Vector[Token], everything after the name
+    } expand;
+    struct {
+      Token tok; //< The directive
+      ConditionKind kind;
+      Vector* expr;      //< CONDITION_IF: the condition; otherwise the name of the symbol, a lone token
+      Vector* then_body; //< Vector[Token], the lines up to ELSE or ENDIF
+      Vector* else_body; //< Vector[Token], the lines from ELSE to ENDIF; NULL if no ELSE
+      bool moved;        //< Stands on the line of the statement it was replayed for (see replay())
+    } cond;
+    ParserError error;
+  } data;
+} Statement;
+
+/* A source of tokens and a sink of statements, for a parser running
+ * alongside its lexer and resolver (see pipeline.h) */
+struct ParserStream {
+  Token (*next)(void* ctx);              //< As Lexer_next() would give them, TOKEN_END over and over at the end
+  void (*emit)(void* ctx, Statement* s); //< Takes ownership, as Parser_apply() does
+  void* ctx;
+};
+
 Parser Parser_make(Lexer* lex);
 void Parser_deinit(Parser* p);
 
 void Parser_parse(Parser* p);
 bool Parser_hasErrors(Parser const* p);
 
+/* Parse without resolving: the statements are appended to `out`, and
+ * Parser_apply() on each of them, followed by Resolver_finish(), gives the
+ * program Parser_parse() would */
+void Parser_parseStatements(Parser* p, Vector* out);
+
+/* Parse the tokens of a stream into its statements, as
+ * Parser_parseStatements() would; `lex` is still used for the source lines
+ * of errors */
+void Parser_parseStream(Parser* p, ParserStream const* stream);
+
+/* Resolve a statement, taking ownership of what it holds */
+void Parser_apply(Parser* p, Statement* s);
+
+/* A copy that can be applied while the original is kept */
+Statement Statement_copy(Statement const* s);
+void Statement_deinit(Statement* s);
+
+/* Create an error pointing at the token
+ *
+ * @param reason Heap-allocated message, owned by the error
+ */
+ParserError ParserError_make(Lexer* lex, Token const* tok, char* reason);
 void ParserError_print(ParserError const* err, FILE* fout);
 
 #endif // PARSER_H
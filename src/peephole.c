@@ -0,0 +1,230 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "lexer.h"
+#include "peephole.h"
+#include "resolver.h"
+#include "utility.h"
+#include "vector.h"
+
+#define PEEPHOLE_MAX_WINDOW 2
+
+typedef enum {
+  OPERAND_NONE, //< Just the opcode
+  OPERAND_ANY,  //< Opcode and an operand
+  OPERAND_ZERO, //< Opcode and an operand which is always 0
+} OperandPattern;
+
+typedef enum {
+  ACTION_DELETE,  //< Drop the whole window
+  ACTION_REPLACE, //< Replace the window with the single-byte instruction `opcode`
+  ACTION_RETARGET //< Keep the first instruction with its opcode set to `opcode`, drop the rest
+} RewriteAction;
+
+typedef struct {
+  uint8_t opcode;
+  OperandPattern operand;
+} InstructionPattern;
+
+typedef struct {
+  size_t len;
+  InstructionPattern match[PEEPHOLE_MAX_WINDOW];
+  RewriteAction action;
+  uint8_t opcode;
+} Rule;
+
+#define ONE(OP, OPERAND) .len = 1, .match = {{(OP), (OPERAND)}}
+#define TWO(OP1, OPERAND1, OP2, OPERAND2) .len = 2, .match = {{(OP1), (OPERAND1)}, {(OP2), (OPERAND2)}}
+
+static Rule const rules[] = {
+    {ONE(0x3e, OPERAND_ZERO), .action = ACTION_REPLACE, .opcode = 0xaf},                     // ld a, 0
+    {ONE(0xfe, OPERAND_ZERO), .action = ACTION_REPLACE, .opcode = 0xb7},                     // cp 0
+    {TWO(0xcd, OPERAND_ANY, 0xc9, OPERAND_NONE), .action = ACTION_RETARGET, .opcode = 0xc3}, // call nn; ret
+    {ONE(0x40, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld b, b
+    {ONE(0x49, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld c, c
+    {ONE(0x52, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld d, d
+    {ONE(0x5b, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld e, e
+    {ONE(0x64, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld h, h
+    {ONE(0x6d, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld l, l
+    {ONE(0x7f, OPERAND_NONE), .action = ACTION_DELETE},                                      // ld a, a
+    {TWO(0xc5, OPERAND_NONE, 0xc1, OPERAND_NONE), .action = ACTION_DELETE},                  // push bc; pop bc
+    {TWO(0xd5, OPERAND_NONE, 0xd1, OPERAND_NONE), .action = ACTION_DELETE},                  // push de; pop de
+    {TWO(0xe5, OPERAND_NONE, 0xe1, OPERAND_NONE), .action = ACTION_DELETE},                  // push hl; pop hl
+    {TWO(0xf5, OPERAND_NONE, 0xf1, OPERAND_NONE), .action = ACTION_DELETE},                  // push af; pop af
+};
+
+#undef ONE
+#undef TWO
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+/* Rules bucketed by the opcode of their last instruction: the rules ending
+ * in opcode `op` are by_last[start[op]] .. by_last[start[op + 1] - 1] */
+typedef struct {
+  uint16_t start[UINT8_MAX + 2];
+  uint8_t by_last[N_RULES];
+} Matcher;
+
+static void Matcher_compile(Matcher* m);
+static bool rewriteTail(Resolver* r, Matcher const* m, size_t* out);
+static bool matches(Resolver* r, IRNode const* n, InstructionPattern const* pat);
+static bool isConstant(Resolver* r, Vector* expr);
+static void destroyInstruction(IRInstruction* iri);
+
+bool Peephole_optimize(Resolver* r) {
+  assert(r);
+
+  Matcher m;
+  Matcher_compile(&m);
+
+  /* Nodes [0, out) are the optimized prefix */
+  Vector* nodes = r->nodes;
+  size_t out = 0;
+  bool changed = false;
+  for (size_t i = 0; i < Vector_len(nodes); ++i) {
+    IRNode* n = Vector_at(nodes, i);
+    if (out != i)
+      *(IRNode*)Vector_at(nodes, out) = *n;
+    out += 1;
+
+    while (rewriteTail(r, &m, &out))
+      changed = true;
+  }
+
+  while (Vector_len(nodes) > out)
+    Vector_pop(nodes, NULL);
+
+  if (changed)
+    Resolver_relayout(r);
+  return changed;
+}
+
+static void Matcher_compile(Matcher* m) {
+  uint16_t count[UINT8_MAX + 1] = {0};
+  for (size_t i = 0; i < N_RULES; ++i)
+    count[rules[i].match[rules[i].len - 1].opcode] += 1;
+
+  m->start[0] = 0;
+  for (size_t op = 0; op <= UINT8_MAX; ++op)
+    m->start[op + 1] = (uint16_t)(m->start[op] + count[op]);
+
+  uint16_t fill[UINT8_MAX + 1];
+  for (size_t op = 0; op <= UINT8_MAX; ++op)
+    fill[op] = m->start[op];
+  for (size_t i = 0; i < N_RULES; ++i)
+    m->by_last[fill[rules[i].match[rules[i].len - 1].opcode]++] = (uint8_t)i;
+}
+
+/* Apply the first rule matching the instructions ending at nodes[*out - 1]
+ *
+ * @returns true if a rule was applied, *out is then the new output length
+ */
+static bool rewriteTail(Resolver* r, Matcher const* m, size_t* out) {
+  if (*out == 0)
+    return false;
+
+  IRNode* last = Vector_at(r->nodes, *out - 1);
+  if (last->kind != IR_INSTRUCTION || last->data.instruction.is_data)
+    return false;
+  EncodedItem const* opcode = Vector_at(last->data.instruction.encoded_items, 0);
+  if (opcode->kind != EI_BYTE)
+    return false;
+
+  for (uint16_t k = m->start[opcode->data.byte]; k < m->start[opcode->data.byte + 1]; ++k) {
+    Rule const* rule = &rules[m->by_last[k]];
+    if (rule->len > *out)
+      continue;
+
+    size_t const first = *out - rule->len;
+    bool matched = true;
+    for (size_t j = 0; j < rule->len && matched; ++j)
+      matched = matches(r, Vector_at(r->nodes, first + j), &rule->match[j]);
+    if (!matched)
+      continue;
+
+    IRNode* head = Vector_at(r->nodes, first);
+    switch (rule->action) {
+    case ACTION_DELETE:
+      for (size_t j = first; j < *out; ++j)
+        destroyInstruction(&((IRNode*)Vector_at(r->nodes, j))->data.instruction);
+      *out = first;
+      break;
+    case ACTION_REPLACE: {
+      /* The replacement stands where the first instruction did */
+      IRInstruction const replaced = head->data.instruction;
+      for (size_t j = first; j < *out; ++j)
+        destroyInstruction(&((IRNode*)Vector_at(r->nodes, j))->data.instruction);
+      *head = IRNode_createInstruction("b", rule->opcode);
+      head->data.instruction.line = replaced.line;
+      head->data.instruction.bank = replaced.bank;
+      head->data.instruction.addr = replaced.addr;
+      *out = first + 1;
+      break;
+    }
+    case ACTION_RETARGET:
+      ((EncodedItem*)Vector_at(head->data.instruction.encoded_items, 0))->data.byte = rule->opcode;
+      for (size_t j = first + 1; j < *out; ++j)
+        destroyInstruction(&((IRNode*)Vector_at(r->nodes, j))->data.instruction);
+      *out = first + 1;
+      break;
+    default:
+      assert(false && "unknown rewrite action");
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool matches(Resolver* r, IRNode const* n, InstructionPattern const* pat) {
+  if (n->kind != IR_INSTRUCTION || n->data.instruction.branch != BRANCH_NONE || n->data.instruction.is_data)
+    return false;
+
+  Vector* items = n->data.instruction.encoded_items;
+  EncodedItem const* opcode = Vector_at(items, 0);
+  if (opcode->kind != EI_BYTE || opcode->data.byte != pat->opcode)
+    return false;
+
+  /* Operands folded at parse time are plain bytes */
+  switch (pat->operand) {
+  case OPERAND_NONE:
+    return Vector_len(items) == 1;
+  case OPERAND_ANY:
+    return Vector_len(items) >= 2;
+  case OPERAND_ZERO:
+    if (Vector_len(items) < 2)
+      return false;
+    for (size_t i = 1; i < Vector_len(items); ++i) {
+      EncodedItem const* operand = Vector_at(items, i);
+      if (operand->kind == EI_BYTE ? operand->data.byte != 0
+                                   : !operand->resolved || operand->value != 0 || !isConstant(r, operand->data.expr))
+        return false;
+    }
+    return true;
+  default:
+    assert(false && "unknown operand pattern");
+    return false;
+  }
+}
+
+/* Whether the value of the expression stays the same when code moves,
+ * i.e. it only refers to EQU constants which don't refer to labels */
+static bool isConstant(Resolver* r, Vector* expr) {
+  for (size_t i = 0; i < Vector_len(expr); ++i) {
+    Token const* tok = Vector_at(expr, i);
+    if (tok->type != TOKEN_ID)
+      continue;
+    Symbol* sym = Resolver_find(r, tok);
+    if (!sym || sym->kind != SYMBOL_EQU || !isConstant(r, sym->expr))
+      return false;
+  }
+  return true;
+}
+
+static void destroyInstruction(IRInstruction* iri) {
+  for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i)
+    EncodedItem_deinit(Vector_at(iri->encoded_items, i));
+  Vector_destroy(iri->encoded_items);
+}
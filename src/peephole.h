@@ -0,0 +1,31 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdbool.h>
+
+#include "resolver.h"
+
+/* Peephole optimization
+ *
+ * Rewrites short runs of instructions into cheaper equivalents:
+ *
+ *   - LD A, 0        -> XOR A   (flags are changed)
+ *   - CP 0           -> OR A    (same C, Z and S; H, N and P/V differ)
+ *   - CALL nn; RET   -> JP nn
+ *   - LD r, r        -> nothing
+ *   - PUSH rr; POP rr -> nothing
+ *
+ * The rules live in a table which is bucketed by the opcode of the last
+ * instruction of every pattern. The IR is compacted in place in one sweep and
+ * after every instruction only the rules ending in its opcode are tried at
+ * the tail of the output, so a rewrite may enable another one before it (e.g.
+ * PUSH BC; LD B, B; POP BC). Patterns never span a label, and constant
+ * operands only match if they don't depend on addresses.
+ *
+ * Must be run on an IR without errors, before branch relaxation.
+ *
+ * @returns true if anything was rewritten
+ */
+bool Peephole_optimize(Resolver* r);
+
+#endif // PEEPHOLE_H
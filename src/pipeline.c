@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "utility.h"
+
+#define PIPELINE_TOKENS 512     //< Per batch from the lexer
+#define PIPELINE_STATEMENTS 128 //< Per batch from the parser
+#define PIPELINE_SLOTS 8        //< Batches in flight between two stages
+
+typedef struct {
+  size_t len;
+  Token tokens[PIPELINE_TOKENS];
+} TokenBatch;
+
+typedef struct {
+  size_t len;
+  bool last; //< Nothing follows
+  Statement statements[PIPELINE_STATEMENTS];
+} StatementBatch;
+
+typedef struct {
+  Lexer lex;           //< Of the lexer thread
+  Ring tokens;         //< Ring[TokenBatch]
+  Ring statements;     //< Ring[StatementBatch]
+  Parser* resolving;   //< The program, resolved as the statements come
+  TokenBatch* in;      //< Being parsed, NULL until the next one is taken
+  size_t in_at;        //< Next token of `in`
+  Token end;           //< Once it's been seen, TOKEN_END, as it's given again and again
+  StatementBatch* out; //< Being filled, if the parser has a thread
+} Pipeline;
+
+static void* lexAll(void* arg);
+static void* parseAll(void* arg);
+static Token takeToken(void* ctx);
+static void sendStatement(void* ctx, Statement* s);
+static void applyStatement(void* ctx, Statement* s);
+
+void Pipeline_parse(Parser* p) {
+  assert(p);
+
+  Pipeline pl = {.lex = *p->lex, .resolving = p};
+  Ring_init(&pl.tokens, PIPELINE_SLOTS, sizeof(TokenBatch));
+  Ring_init(&pl.statements, PIPELINE_SLOTS, sizeof(StatementBatch));
+
+  pthread_t lexer, parser;
+  if (pthread_create(&lexer, NULL, lexAll, &pl) != 0) {
+    Ring_deinit(&pl.tokens);
+    Ring_deinit(&pl.statements);
+    Parser_parse(p);
+    return;
+  }
+
+  if (pthread_create(&parser, NULL, parseAll, &pl) == 0) {
+    for (bool last = false; !last;) {
+      StatementBatch* b = Ring_front(&pl.statements);
+      for (size_t i = 0; i < b->len; ++i)
+        Parser_apply(p, &b->statements[i]);
+      last = b->last;
+      Ring_pop(&pl.statements);
+    }
+    if (pthread_join(parser, NULL) != 0)
+      die("pthread_join() failed");
+  } else {
+    /* Parse here, resolving each statement as it comes */
+    Parser q = Parser_make(p->lex);
+    q.includes = p->includes;
+    ParserStream const stream = {.next = takeToken, .emit = applyStatement, .ctx = &pl};
+    Parser_parseStream(&q, &stream);
+    Parser_deinit(&q);
+  }
+  if (pthread_join(lexer, NULL) != 0)
+    die("pthread_join() failed");
+
+  Ring_deinit(&pl.tokens);
+  Ring_deinit(&pl.statements);
+  Resolver_finish(&p->resolver);
+}
+
+static void* lexAll(void* arg) {
+  Pipeline* pl = arg;
+  for (bool done = false; !done;) {
+    TokenBatch* b = Ring_reserve(&pl->tokens);
+    for (b->len = 0; b->len < PIPELINE_TOKENS && !done; ++b->len) {
+      b->tokens[b->len] = Lexer_next(&pl->lex);
+      done = b->tokens[b->len].type == TOKEN_END;
+    }
+    Ring_push(&pl->tokens);
+  }
+  return NULL;
+}
+
+/* Its own parser parses, as its statements only go to the resolver */
+static void* parseAll(void* arg) {
+  Pipeline* pl = arg;
+  pl->out = Ring_reserve(&pl->statements);
+  pl->out->len = 0;
+  pl->out->last = false;
+
+  Parser q = Parser_make(pl->resolving->lex);
+  q.includes = pl->resolving->includes;
+  ParserStream const stream = {.next = takeToken, .emit = sendStatement, .ctx = pl};
+  Parser_parseStream(&q, &stream);
+  Parser_deinit(&q);
+
+  pl->out->last = true;
+  Ring_push(&pl->statements);
+  return NULL;
+}
+
+static Token takeToken(void* ctx) {
+  Pipeline* pl = ctx;
+  if (pl->end.type == TOKEN_END)
+    return pl->end;
+
+  if (!pl->in) {
+    pl->in = Ring_front(&pl->tokens);
+    pl->in_at = 0;
+  }
+  Token const tok = pl->in->tokens[pl->in_at++];
+  if (pl->in_at == pl->in->len) {
+    Ring_pop(&pl->tokens);
+    pl->in = NULL;
+  }
+  if (tok.type == TOKEN_END)
+    pl->end = tok;
+  return tok;
+}
+
+static void sendStatement(void* ctx, Statement* s) {
+  Pipeline* pl = ctx;
+  pl->out->statements[pl->out->len++] = *s;
+  if (pl->out->len == PIPELINE_STATEMENTS) {
+    Ring_push(&pl->statements);
+    pl->out = Ring_reserve(&pl->statements);
+    pl->out->len = 0;
+    pl->out->last = false;
+  }
+}
+
+static void applyStatement(void* ctx, Statement* s) {
+  Pipeline* pl = ctx;
+  Parser_apply(pl->resolving, s);
+}
@@ -0,0 +1,16 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "parser.h"
+
+/* Parser_parse(), with lexing, parsing and resolving overlapped
+ *
+ * The lexer runs on a thread of its own and sends batches of tokens over a
+ * Ring to a second thread, which parses them into statements and sends
+ * batches of those over another Ring to the calling thread, which resolves
+ * them into `p`. The program is the one Parser_parse() would give. Should
+ * a thread fail to start, its stage runs in the calling thread instead.
+ */
+void Pipeline_parse(Parser* p);
+
+#endif // PIPELINE_H
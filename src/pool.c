@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "utility.h"
+
+#define POOL_MAX_THREADS 64
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t next; //< Next job to hand out
+  size_t n_jobs;
+  void (*job)(void* ctx, size_t worker, size_t i);
+  void* ctx;
+  char const* fatal; //< What the first job to die() gave it
+} Pool;
+
+typedef struct {
+  Pool* pool;
+  size_t id; //< Of the worker, in [0, Pool_size())
+} PoolWorker;
+
+/* What Pool_run() hands to Pool_runWorkers() */
+typedef struct {
+  void (*job)(void* ctx, size_t i);
+  void* ctx;
+} PlainJob;
+
+static void* worker(void* arg);
+static void runPlainJob(void* ctx, size_t worker, size_t i);
+
+void Pool_run(size_t n_jobs, void (*job)(void* ctx, size_t i), void* ctx) {
+  assert(job);
+
+  PlainJob plain = {.job = job, .ctx = ctx};
+  Pool_runWorkers(n_jobs, runPlainJob, &plain);
+}
+
+size_t Pool_size(size_t n_jobs) {
+  long const n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t n_threads = n_cpus > 1 ? (size_t)n_cpus : 1;
+  if (n_threads > n_jobs)
+    n_threads = n_jobs;
+  if (n_threads > POOL_MAX_THREADS)
+    n_threads = POOL_MAX_THREADS;
+  return n_threads ? n_threads : 1;
+}
+
+void Pool_runWorkers(size_t n_jobs, void (*job)(void* ctx, size_t worker, size_t i), void* ctx) {
+  assert(job);
+
+  size_t const n_threads = Pool_size(n_jobs);
+  if (n_threads <= 1) {
+    for (size_t i = 0; i < n_jobs; ++i)
+      job(ctx, 0, i);
+    return;
+  }
+
+  Pool pool = {.n_jobs = n_jobs, .job = job, .ctx = ctx};
+  if (pthread_mutex_init(&pool.lock, NULL) != 0)
+    die("pthread_mutex_init() failed");
+
+  /* The calling thread is worker 0; failing to start more only makes it
+   * do a bigger share */
+  pthread_t threads[POOL_MAX_THREADS];
+  PoolWorker workers[POOL_MAX_THREADS];
+  size_t n_started = 0;
+  for (; n_started < n_threads - 1; ++n_started) {
+    workers[n_started] = (PoolWorker){.pool = &pool, .id = n_started + 1};
+    if (pthread_create(&threads[n_started], NULL, worker, &workers[n_started]) != 0)
+      break;
+  }
+
+  PoolWorker self = {.pool = &pool, .id = 0};
+  worker(&self);
+  for (size_t i = 0; i < n_started; ++i)
+    if (pthread_join(threads[i], NULL) != 0)
+      die("pthread_join() failed");
+  pthread_mutex_destroy(&pool.lock);
+  if (pool.fatal)
+    die(pool.fatal);
+}
+
+/* A job that dies stops the pool, and the calling thread dies in its place
+ * once every worker is done, so that its own trap, if any, catches it */
+static void* worker(void* arg) {
+  PoolWorker const* w = arg;
+  Pool* pool = w->pool;
+
+  DieTrap trap;
+  if (setjmp(trap.env)) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->fatal)
+      pool->fatal = trap.message;
+    pool->next = pool->n_jobs;
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+  }
+  DieTrap_push(&trap);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    size_t const i = pool->next < pool->n_jobs ? pool->next++ : pool->n_jobs;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (i == pool->n_jobs) {
+      DieTrap_pop(&trap);
+      return NULL;
+    }
+    pool->job(pool->ctx, w->id, i);
+  }
+}
+
+static void runPlainJob(void* ctx, size_t worker, size_t i) {
+  (void)worker;
+  PlainJob const* plain = ctx;
+  plain->job(plain->ctx, i);
+}
@@ -0,0 +1,24 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* Run job(ctx, i) for every i in [0, n_jobs) on a pool of threads
+ *
+ * Up to one thread per online CPU takes the jobs in order from a shared
+ * counter, the calling thread being one of them, and the call returns once
+ * every job is done. Jobs must not touch the same data. With a single CPU
+ * or job, or if no thread can be started, the jobs just run in the calling
+ * thread. A job that calls die() stops the others from starting, and the
+ * calling thread dies with its message once they are done.
+ */
+void Pool_run(size_t n_jobs, void (*job)(void* ctx, size_t i), void* ctx);
+
+/* How many workers Pool_run() would give `n_jobs` jobs, at least 1 */
+size_t Pool_size(size_t n_jobs);
+
+/* Pool_run(), also telling each job which of the Pool_size(n_jobs)
+ * workers runs it, so a worker can keep state from one job to the next */
+void Pool_runWorkers(size_t n_jobs, void (*job)(void* ctx, size_t worker, size_t i), void* ctx);
+
+#endif // POOL_H
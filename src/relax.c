@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "exprdag.h"
+#include "instruction.h"
+#include "relax.h"
+#include "resolver.h"
+#include "utility.h"
+#include "vector.h"
+
+/* Size deltas of IR nodes, 1-based internally */
+typedef struct {
+  int32_t* tree;
+  size_t len;
+} Fenwick;
+
+typedef struct {
+  Resolver* r;
+  Fenwick* deltas;
+  Vector* origins; //< Vector[size_t]: indices of the ORG nodes, ascending
+} ShiftedLookup;
+
+static Fenwick Fenwick_make(size_t len);
+static void Fenwick_deinit(Fenwick* f);
+static void Fenwick_add(Fenwick* f, size_t idx, int32_t delta);
+static int32_t Fenwick_prefix(Fenwick const* f, size_t idx);
+
+static int32_t shift(ShiftedLookup const* l, size_t idx);
+static int lookupShifted(void* ctx, uint32_t id, int32_t* value);
+static void lengthen(IRInstruction* iri);
+
+bool Relax_branches(Resolver* r) {
+  assert(r);
+
+  Vector* branches = Vector_new(sizeof(size_t));
+  Vector* origins = Vector_new(sizeof(size_t));
+  if (!branches || !origins)
+    die("Vector_new() failed");
+
+  for (size_t i = 0; i < Vector_len(r->nodes); ++i) {
+    IRNode* n = Vector_at(r->nodes, i);
+    if (n->kind == IR_INSTRUCTION && n->data.instruction.branch != BRANCH_NONE)
+      if (Vector_push(branches, &i) == -1)
+        die("Vector_push() failed");
+    if (n->kind == IR_ORG)
+      if (Vector_push(origins, &i) == -1)
+        die("Vector_push() failed");
+  }
+
+  Fenwick deltas = Fenwick_make(Vector_len(r->nodes));
+  ShiftedLookup ctx = {.r = r, .deltas = &deltas, .origins = origins};
+
+  /* Lengthened branches are removed from the list by swapping in the last
+   * one, so every pass only visits branches that are still short */
+  bool changed = true, any_changed = false;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < Vector_len(branches);) {
+      size_t const idx = *(size_t*)Vector_at(branches, i);
+      IRInstruction* iri = &((IRNode*)Vector_at(r->nodes, idx))->data.instruction;
+      EncodedItem const* item = Vector_at(iri->encoded_items, Vector_len(iri->encoded_items) - 1);
+      assert(item->kind == EI_REL);
+
+      /* Evaluated before, so the item is interned. Only the linker knows
+       * where an external target is, so those branches are always long. */
+      int32_t target;
+      ExprErrorType err;
+      uint32_t missing;
+      uint8_t const* code = ExprDag_code(&r->dag, item->node);
+      bool fits = false;
+      if (ExprCode_eval(code, lookupShifted, &ctx, &target, &err, &missing) == 0) {
+        int32_t const end = iri->addr + shift(&ctx, idx) + (int32_t)IRInstruction_size(iri);
+        int32_t const disp = target - end;
+        fits = disp >= INT8_MIN && disp <= INT8_MAX;
+      } else if (!r->relocatable) {
+        die("Relax_branches(): unresolved branch target");
+      }
+      if (fits) {
+        i += 1;
+        continue;
+      }
+
+      Fenwick_add(&deltas, idx, iri->branch == BRANCH_DJNZ ? 2 : 1);
+      lengthen(iri);
+      changed = any_changed = true;
+
+      size_t last;
+      Vector_pop(branches, &last);
+      if (i < Vector_len(branches))
+        *(size_t*)Vector_at(branches, i) = last;
+    }
+  }
+
+  Fenwick_deinit(&deltas);
+  Vector_destroy(branches);
+  Vector_destroy(origins);
+
+  if (any_changed)
+    Resolver_relayout(r);
+  return any_changed;
+}
+
+static Fenwick Fenwick_make(size_t len) {
+  int32_t* tree = calloc(len + 1, sizeof(*tree));
+  if (!tree)
+    die("calloc() failed");
+  return (Fenwick){.tree = tree, .len = len};
+}
+
+static void Fenwick_deinit(Fenwick* f) { free(f->tree); }
+
+static void Fenwick_add(Fenwick* f, size_t idx, int32_t delta) {
+  for (size_t i = idx + 1; i <= f->len; i += i & (~i + 1))
+    f->tree[i] += delta;
+}
+
+/* Sum of the deltas of the nodes before idx */
+static int32_t Fenwick_prefix(Fenwick const* f, size_t idx) {
+  int32_t sum = 0;
+  for (size_t i = idx; i > 0; i -= i & (~i + 1))
+    sum += f->tree[i];
+  return sum;
+}
+
+/* Address change of node idx: the deltas since the last ORG before it,
+ * which pins the addresses that follow */
+static int32_t shift(ShiftedLookup const* l, size_t idx) {
+  size_t lo = 0, hi = Vector_len(l->origins);
+  while (lo < hi) {
+    size_t const mid = lo + (hi - lo) / 2;
+    if (*(size_t*)Vector_at(l->origins, mid) < idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  int32_t const delta = Fenwick_prefix(l->deltas, idx);
+  return lo ? delta - Fenwick_prefix(l->deltas, *(size_t*)Vector_at(l->origins, lo - 1)) : delta;
+}
+
+/* Symbol values as they would be with the current size changes applied */
+static int lookupShifted(void* ctx, uint32_t id, int32_t* value) {
+  ShiftedLookup* l = ctx;
+  Symbol const* s = Resolver_symbolById(l->r, id);
+  if (!s->defined)
+    return -1;
+
+  switch (s->kind) {
+  case SYMBOL_LABEL:
+    *value = s->value + shift(l, s->node);
+    return 0;
+  case SYMBOL_EQU: {
+    /* The chain is known to be acyclic and to evaluate */
+    ExprErrorType err;
+    uint32_t missing;
+    return ExprCode_eval(ExprDag_code(&l->r->dag, s->root), lookupShifted, ctx, value, &err, &missing);
+  }
+  case SYMBOL_UNKNOWN:
+  case SYMBOL_DEFL:
+  default:
+    *value = s->value;
+    return 0;
+  }
+}
+
+static void lengthen(IRInstruction* iri) {
+  Vector* items = iri->encoded_items;
+  EncodedItem target;
+  EncodedItem opcode;
+  Vector_pop(items, &target);
+  Vector_pop(items, &opcode);
+  assert(Vector_isEmpty(items));
+
+  target.kind = EI_ADDR;
+  target.resolved = false;
+
+  if (iri->branch == BRANCH_DJNZ) {
+    EncodedItem dec_b = {.kind = EI_BYTE, .data.byte = 0x05};
+    if (Vector_push(items, &dec_b) == -1)
+      die("Vector_push() failed");
+    opcode.data.byte = 0xc2;
+  } else if (opcode.data.byte == 0x18) {
+    opcode.data.byte = 0xc3;
+  } else {
+    /* JR cc is 0x20 | cc << 3, JP cc is 0xc2 | cc << 3 */
+    opcode.data.byte = (uint8_t)(0xc2 | (opcode.data.byte & 0x18));
+  }
+
+  if (Vector_push(items, &opcode) == -1 || Vector_push(items, &target) == -1)
+    die("Vector_push() failed");
+  iri->branch = BRANCH_NONE;
+}
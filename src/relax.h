@@ -0,0 +1,29 @@
+#ifndef RELAX_H
+#define RELAX_H
+
+#include <stdbool.h>
+
+#include "resolver.h"
+
+/* Branch relaxation
+ *
+ * Every JR and DJNZ starts in its 2-byte form. Branches whose displacement
+ * doesn't fit in a signed byte are lengthened to JP (DJNZ to DEC B; JP NZ),
+ * which may push other branches out of range, until nothing changes. Since
+ * branches only grow, this converges.
+ *
+ * Size changes are kept in a Fenwick tree indexed by IR node, so the
+ * address of a node under the current changes is an O(log n) prefix sum and
+ * the IR is relaid out only once, after convergence. An ORG pins the
+ * addresses after it, so only changes since the last ORG are summed.
+ *
+ * In a relocatable module, branches to external symbols are lengthened
+ * too, as the linker can't move code.
+ *
+ * Must be run on an IR without errors.
+ *
+ * @returns true if any branch was lengthened
+ */
+bool Relax_branches(Resolver* r);
+
+#endif // RELAX_H
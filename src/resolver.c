@@ -0,0 +1,841 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression.h"
+#include "exprcode.h"
+#include "exprdag.h"
+#include "fixup.h"
+#include "instruction.h"
+#include "lexer.h"
+#include "map.h"
+#include "parser.h"
+#include "resolver.h"
+#include "utility.h"
+#include "vector.h"
+
+enum {
+  MARK_NONE = 0,
+  MARK_ACTIVE,
+  MARK_DONE,
+};
+
+static Symbol* intern(Resolver* r, Token const* tok);
+static void define(Resolver* r, Symbol* sym, int32_t value);
+static void addDependency(Resolver* r, Symbol* constant, Token const* tok);
+static int32_t evaluateConstant(Resolver* r, Symbol* sym);
+static int evaluate(Resolver* r, Vector* expr, uint32_t* root, int32_t* value, Symbol** missing);
+static int evaluateNow(Resolver* r, Vector* expr, char const* what, int32_t* value);
+static void setOrg(Resolver* r, Token const* tok, uint16_t bank, uint16_t addr);
+static void addData(Resolver* r, size_t line, EncodedItem const* item);
+static void setValue(Resolver* r, Symbol* sym, int32_t value);
+static void reportConstant(Resolver* r, Symbol* sym, Vector* stack);
+static int compareSymbolLines(void const* a, void const* b);
+static void resolveItem(Resolver* r, Fixup f);
+static void resolveAll(Resolver* r);
+static void waitFor(Symbol* sym, Fixup f);
+static void patch(Resolver* r, EncodedItem* item, int32_t value);
+static void reportRange(Resolver* r, EncodedItem const* item, int32_t value);
+static int lookup(void* ctx, Token const* sym, int32_t* value);
+static int lookupId(void* ctx, uint32_t id, int32_t* value);
+static uint32_t symbolId(void* ctx, Token const* sym);
+static void error(Resolver* r, Token const* tok, char const* fmt, ...);
+static void destroyNode(IRNode* n);
+
+static void map_destroy_symbol(void* value);
+
+Resolver Resolver_make(Lexer* lex, Vector* nodes, Vector* errors) {
+  assert(lex);
+  assert(nodes);
+  assert(errors);
+
+  Map* symbols = Map_new(sizeof(Symbol), map_destroy_symbol);
+  if (!symbols)
+    die("Map_new() failed");
+
+  Vector* by_id = Vector_new(sizeof(Symbol*));
+  Vector* work = Vector_new(sizeof(Symbol*));
+  Vector* constants = Vector_new(sizeof(Symbol*));
+  if (!by_id || !work || !constants)
+    die("Vector_new() failed");
+
+  return (Resolver){
+      .lex = lex,
+      .nodes = nodes,
+      .errors = errors,
+      .symbols = symbols,
+      .by_id = by_id,
+      .work = work,
+      .constants = constants,
+      .dag = ExprDag_make(),
+      .batch = FixupBatch_make(),
+  };
+}
+
+void Resolver_deinit(Resolver* r) {
+  assert(r);
+  Map_destroy(r->symbols);
+  Vector_destroy(r->by_id);
+  Vector_destroy(r->work);
+  Vector_destroy(r->constants);
+  ExprDag_deinit(&r->dag);
+  FixupBatch_deinit(&r->batch);
+}
+
+void Resolver_addLabel(Resolver* r, IRNode* node, Token const* tok) {
+  assert(r);
+  assert(node && node->kind == IR_LABEL);
+  assert(tok);
+
+  Symbol* sym = intern(r, tok);
+  if (sym->kind != SYMBOL_UNKNOWN) {
+    error(r, tok, "redefinition of %s (previously defined on line %zu)", sym->name, sym->tok.line);
+    free(node->data.label.name);
+    return;
+  }
+
+  node->data.label.bank = r->bank;
+  node->data.label.addr = r->pc;
+  node->data.label.has_addr = true;
+  if (Vector_push(r->nodes, node) == -1)
+    die("Vector_push() failed");
+
+  sym->tok = *tok;
+  sym->kind = SYMBOL_LABEL;
+  sym->node = Vector_len(r->nodes) - 1;
+  define(r, sym, r->pc);
+}
+
+void Resolver_defineConstant(Resolver* r, Token const* tok, Vector* expr, SymbolKind kind) {
+  assert(r);
+  assert(tok);
+  assert(expr);
+  assert(kind == SYMBOL_EQU || kind == SYMBOL_DEFL);
+
+  Symbol* sym = intern(r, tok);
+  if (sym->kind != SYMBOL_UNKNOWN && !(kind == SYMBOL_DEFL && sym->kind == SYMBOL_DEFL)) {
+    error(r, tok, "redefinition of %s (previously defined on line %zu)", sym->name, sym->tok.line);
+    Vector_destroy(expr);
+    return;
+  }
+
+  if (kind == SYMBOL_DEFL) {
+    int32_t value;
+    if (evaluateNow(r, expr, "DEFL value", &value) == -1)
+      return;
+
+    sym->tok = *tok;
+    if (sym->kind == SYMBOL_DEFL) {
+      setValue(r, sym, value);
+    } else {
+      sym->kind = SYMBOL_DEFL;
+      define(r, sym, value);
+    }
+    return;
+  }
+
+  sym->tok = *tok;
+  sym->kind = SYMBOL_EQU;
+  sym->expr = expr;
+
+  for (size_t i = 0; i < Vector_len(expr); ++i) {
+    Token const* dep = Vector_at(expr, i);
+    if (dep->type == TOKEN_ID)
+      addDependency(r, sym, dep);
+  }
+
+  if (sym->n_deps == 0) {
+    if (Vector_push(r->constants, &sym) == -1)
+      die("Vector_push() failed");
+    define(r, sym, evaluateConstant(r, sym));
+  }
+}
+
+void Resolver_setOrigin(Resolver* r, Token const* tok, Vector* expr) {
+  assert(r);
+  assert(tok);
+  assert(expr);
+
+  int32_t value;
+  if (evaluateNow(r, expr, "ORG address", &value) == -1)
+    return;
+  if (value < 0 || value > UINT16_MAX) {
+    error(r, tok, "ORG address %d is out of range", (int)value);
+    return;
+  }
+  setOrg(r, tok, r->bank, (uint16_t)value);
+}
+
+void Resolver_setBank(Resolver* r, Token const* tok, Vector* expr) {
+  assert(r);
+  assert(tok);
+  assert(expr);
+
+  int32_t value;
+  if (evaluateNow(r, expr, "BANK number", &value) == -1)
+    return;
+  if (value < 0 || value > UINT16_MAX) {
+    error(r, tok, "BANK number %d is out of range", (int)value);
+    return;
+  }
+  r->banked |= value != 0;
+  setOrg(r, tok, (uint16_t)value, 0);
+}
+
+void Resolver_relayout(Resolver* r) {
+  assert(r);
+
+  uint16_t pc = 0, bank = 0;
+  for (size_t i = 0; i < Vector_len(r->nodes); ++i) {
+    IRNode* n = Vector_at(r->nodes, i);
+    if (n->kind == IR_LABEL) {
+      n->data.label.bank = bank;
+      n->data.label.addr = pc;
+      Symbol* sym = Map_get(r->symbols, n->data.label.name);
+      assert(sym && sym->kind == SYMBOL_LABEL);
+      setValue(r, sym, pc);
+      sym->node = i;
+    } else if (n->kind == IR_ORG) {
+      bank = n->data.org.bank;
+      pc = n->data.org.addr;
+    } else {
+      n->data.instruction.bank = bank;
+      n->data.instruction.addr = pc;
+      pc = (uint16_t)(pc + IRInstruction_size(&n->data.instruction));
+    }
+  }
+  r->pc = pc;
+  r->n_relayouts += 1;
+
+  for (size_t i = 0; i < Vector_len(r->constants); ++i) {
+    Symbol* sym = *(Symbol**)Vector_at(r->constants, i);
+    setValue(r, sym, evaluateConstant(r, sym));
+  }
+
+  resolveAll(r);
+}
+
+void Resolver_splice(Resolver* r, size_t first, size_t end, Vector* with, Vector* labels) {
+  assert(r);
+  assert(first <= end && end <= Vector_len(r->nodes));
+  assert(with);
+  assert(labels);
+
+  for (size_t i = first; i < end; ++i)
+    destroyNode(Vector_at(r->nodes, i));
+
+  /* The nodes after the range move to where the new ones end */
+  size_t const n_with = Vector_len(with), n_tail = Vector_len(r->nodes) - end;
+  IRNode const blank = {0};
+  for (size_t i = end - first; i < n_with; ++i)
+    if (Vector_push(r->nodes, &blank) == -1)
+      die("Vector_push() failed");
+  if (n_tail)
+    memmove(Vector_at(r->nodes, first + n_with), Vector_at(r->nodes, end), n_tail * sizeof(IRNode));
+  while (Vector_len(r->nodes) > first + n_with + n_tail)
+    Vector_pop(r->nodes, NULL);
+
+  size_t label = 0;
+  for (size_t i = 0; i < n_with; ++i) {
+    IRNode* n = Vector_at(r->nodes, first + i);
+    *n = *(IRNode*)Vector_at(with, i);
+    if (n->kind != IR_LABEL)
+      continue;
+
+    Token const* tok = Vector_at(labels, label++);
+    Symbol* sym = Resolver_find(r, tok);
+    if (!sym) {
+      sym = intern(r, tok);
+      sym->kind = SYMBOL_LABEL;
+      define(r, sym, 0); // The relayout gives the address
+    }
+    assert(sym->kind == SYMBOL_LABEL);
+    sym->tok = *tok;
+    n->data.label.has_addr = true;
+  }
+  assert(label == Vector_len(labels));
+
+  Resolver_relayout(r);
+}
+
+void Resolver_addInstruction(Resolver* r, IRNode* node) {
+  assert(r);
+  assert(node && node->kind == IR_INSTRUCTION);
+
+  IRInstruction* iri = &node->data.instruction;
+  iri->bank = r->bank;
+  iri->addr = r->pc;
+  r->pc = (uint16_t)(r->pc + IRInstruction_size(iri));
+
+  size_t const idx = Vector_len(r->nodes);
+  if (Vector_push(r->nodes, node) == -1)
+    die("Vector_push() failed");
+
+  for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i)
+    if (EncodedItem_isExpr(Vector_at(iri->encoded_items, i)))
+      resolveItem(r, (Fixup){.node = idx, .item = i});
+}
+
+void Resolver_addFill(Resolver* r, Token const* tok, size_t line, Vector* count, Vector* value) {
+  assert(r);
+  assert(tok);
+  assert(count);
+
+  int32_t n, byte = 0;
+  int const rc = evaluateNow(r, count, "DS count", &n);
+  if (value && evaluateNow(r, value, "DS value", &byte) == -1)
+    return;
+  if (rc == -1)
+    return;
+  if (n < 0 || n > UINT16_MAX + 1) {
+    error(r, tok, "DS count %d is out of range", (int)n);
+    return;
+  }
+  if (byte < INT8_MIN || byte > UINT8_MAX) {
+    error(r, tok, "DS value %d does not fit in 1 byte(s)", (int)byte);
+    return;
+  }
+  if (n > 0)
+    addData(r, line, &(EncodedItem){.kind = EI_FILL, .data.fill = {.len = (uint32_t)n, .byte = (uint8_t)byte}});
+}
+
+void Resolver_addBlob(Resolver* r, Token const* tok, size_t line, Blob* blob, Vector* offset, Vector* len) {
+  assert(r);
+  assert(tok);
+  assert(blob);
+
+  int32_t start = 0, n = 0;
+  int rc = offset ? evaluateNow(r, offset, "INCBIN offset", &start) : 0;
+  if (len && evaluateNow(r, len, "INCBIN length", &n) == -1)
+    rc = -1;
+  if (rc == -1)
+    return;
+  if (start < 0 || (size_t)start > blob->len) {
+    error(r, tok, "INCBIN offset %d is out of the %zu bytes of the file", (int)start, blob->len);
+    return;
+  }
+  size_t const rest = blob->len - (size_t)start;
+  if (len && (n < 0 || (size_t)n > rest)) {
+    error(r, tok, "INCBIN length %d is out of the %zu bytes after the offset", (int)n, rest);
+    return;
+  }
+  size_t const size = len ? (size_t)n : rest;
+  if (size > UINT16_MAX + 1) {
+    error(r, tok, "INCBIN of %zu bytes does not fit in the address space", size);
+    return;
+  }
+  if (size > 0)
+    addData(r, line, &(EncodedItem){.kind = EI_BYTES, .data.bytes = Blob_slice(blob, (size_t)start, size)});
+}
+
+int Resolver_evaluateCondition(Resolver* r, Vector* expr, int32_t* value) {
+  assert(r);
+  assert(expr);
+  assert(value);
+
+  return evaluateNow(r, expr, "IF condition", value);
+}
+
+bool Resolver_isDefined(Resolver* r, Token const* tok) {
+  assert(r);
+  assert(tok);
+
+  Symbol const* sym = Resolver_find(r, tok);
+  return sym && sym->kind != SYMBOL_UNKNOWN;
+}
+
+Symbol* Resolver_find(Resolver* r, Token const* tok) {
+  assert(r);
+  assert(tok);
+
+  char name[LEXER_MAX_LINE_LEN + 1];
+  if (tok->len > LEXER_MAX_LINE_LEN)
+    return NULL;
+  memcpy(name, tok->value, tok->len);
+  name[tok->len] = '\0';
+
+  return Map_get(r->symbols, name);
+}
+
+Symbol* Resolver_symbolById(Resolver* r, uint32_t id) {
+  assert(r);
+  assert(id < Vector_len(r->by_id));
+  return *(Symbol**)Vector_at(r->by_id, id);
+}
+
+uint8_t* Resolver_compile(Resolver* r, Vector* expr) {
+  assert(r);
+  assert(expr);
+  return ExprCode_compile(expr, symbolId, r);
+}
+
+void Resolver_checkBanks(Resolver* r) {
+  assert(r);
+
+  if (!r->banked)
+    return;
+
+  /* Reported once per ORG or BANK */
+  IROrg const* org = NULL;
+  bool reported = false;
+  for (size_t i = 0; i < Vector_len(r->nodes); ++i) {
+    IRNode const* n = Vector_at(r->nodes, i);
+    if (n->kind == IR_ORG) {
+      org = &n->data.org;
+      reported = false;
+      continue;
+    }
+    if (n->kind != IR_INSTRUCTION || reported)
+      continue;
+
+    IRInstruction const* iri = &n->data.instruction;
+    uint32_t const offset = iri->bank ? iri->addr % IR_BANK_SIZE : iri->addr;
+    if (offset + IRInstruction_size(iri) <= IR_BANK_SIZE)
+      continue;
+
+    Token const tok = org ? org->tok : (Token){.line = iri->line};
+    error(r, &tok, "code at %u:0x%04x runs past the end of the %u-byte bank", iri->bank, iri->addr, IR_BANK_SIZE);
+    reported = true;
+  }
+}
+
+void Resolver_finish(Resolver* r) {
+  assert(r);
+
+  Vector* pending = Vector_new(sizeof(Symbol*));
+  Vector* stack = Vector_new(sizeof(Symbol*));
+  if (!pending || !stack)
+    die("Vector_new() failed");
+
+  MapIter it = MapIter_init(r->symbols);
+  while (MapIter_next(&it)) {
+    Symbol* sym = it.value;
+    if (sym->kind == SYMBOL_EQU && !sym->defined)
+      if (Vector_push(pending, &sym) == -1)
+        die("Vector_push() failed");
+  }
+
+  /* Search in the source order so the diagnostics don't depend on hashing */
+  if (!Vector_isEmpty(pending))
+    qsort(Vector_at(pending, 0), Vector_len(pending), sizeof(Symbol*), compareSymbolLines);
+
+  for (size_t i = 0; i < Vector_len(pending); ++i) {
+    Symbol* sym = *(Symbol**)Vector_at(pending, i);
+    if (sym->mark == MARK_NONE)
+      reportConstant(r, sym, stack);
+  }
+  Vector_destroy(pending);
+  Vector_destroy(stack);
+  if (r->relocatable)
+    return;
+
+  /* Items waiting for a constant are covered by the constant's error */
+  it = MapIter_init(r->symbols);
+  while (MapIter_next(&it)) {
+    Symbol* sym = it.value;
+    if (sym->defined || !sym->fixups || sym->kind != SYMBOL_UNKNOWN)
+      continue;
+
+    for (size_t i = 0; i < Vector_len(sym->fixups); ++i) {
+      Fixup* f = Vector_at(sym->fixups, i);
+      IRNode* n = Vector_at(r->nodes, f->node);
+      EncodedItem* item = Vector_at(n->data.instruction.encoded_items, f->item);
+
+      /* Evaluate once more to point at the exact reference */
+      int32_t value;
+      ExprError err = {0};
+      Token const* tok = &sym->tok;
+      if (Expr_eval(item->data.expr, lookup, r, &value, &err) == -1)
+        tok = &err.tok;
+      error(r, tok, "undefined symbol: %s", sym->name);
+    }
+  }
+}
+
+static Symbol* intern(Resolver* r, Token const* tok) {
+  Symbol* sym = Resolver_find(r, tok);
+  if (sym)
+    return sym;
+
+  if (Vector_len(r->by_id) == UINT32_MAX)
+    die("intern(): too many symbols");
+  Symbol new_sym = {.name = Token_str(tok), .tok = *tok, .id = (uint32_t)Vector_len(r->by_id)};
+  sym = Map_setCopy(r->symbols, new_sym.name, &new_sym);
+  if (!sym)
+    die("Map_setCopy() failed");
+  if (Vector_push(r->by_id, &sym) == -1)
+    die("Vector_push() failed");
+  return sym;
+}
+
+static void define(Resolver* r, Symbol* sym, int32_t value) {
+  sym->value = value;
+  sym->defined = true;
+  if (Vector_push(r->work, &sym) == -1)
+    die("Vector_push() failed");
+
+  /* Only the outermost call drains the worklist */
+  if (Vector_len(r->work) > 1)
+    return;
+
+  while (!Vector_isEmpty(r->work)) {
+    Symbol* s;
+    Vector_pop(r->work, &s);
+
+    /* Detach the lists first: a fixup may be queued again on another
+     * symbol */
+    Vector* fixups = s->fixups;
+    s->fixups = NULL;
+    if (fixups) {
+      for (size_t i = 0; i < Vector_len(fixups); ++i)
+        resolveItem(r, *(Fixup*)Vector_at(fixups, i));
+      Vector_destroy(fixups);
+    }
+
+    Vector* dependents = s->dependents;
+    s->dependents = NULL;
+    if (dependents) {
+      for (size_t i = 0; i < Vector_len(dependents); ++i) {
+        Symbol* d = *(Symbol**)Vector_at(dependents, i);
+        assert(d->n_deps > 0);
+        d->n_deps -= 1;
+        if (d->n_deps == 0) {
+          d->value = evaluateConstant(r, d);
+          d->defined = true;
+          if (Vector_push(r->constants, &d) == -1)
+            die("Vector_push() failed");
+          if (Vector_push(r->work, &d) == -1)
+            die("Vector_push() failed");
+        }
+      }
+      Vector_destroy(dependents);
+    }
+  }
+}
+
+static void addDependency(Resolver* r, Symbol* constant, Token const* tok) {
+  Symbol* dep = intern(r, tok);
+  if (dep->defined)
+    return;
+
+  if (!dep->dependents) {
+    dep->dependents = Vector_new(sizeof(Symbol*));
+    if (!dep->dependents)
+      die("Vector_new() failed");
+  }
+
+  /* The dependencies of a constant are added in a row, so a repeated one is
+   * the last on the list */
+  size_t const len = Vector_len(dep->dependents);
+  if (len && *(Symbol**)Vector_at(dep->dependents, len - 1) == constant)
+    return;
+
+  if (Vector_push(dep->dependents, &constant) == -1)
+    die("Vector_push() failed");
+  constant->n_deps += 1;
+}
+
+static int32_t evaluateConstant(Resolver* r, Symbol* sym) {
+  /* All dependencies have a value by now. Errors are reported once here;
+   * the constant is set to zero so its users don't fail as well. */
+  int32_t value;
+  Symbol* missing = NULL;
+  if (evaluate(r, sym->expr, &sym->root, &value, &missing) == -1) {
+    assert(!missing);
+    return 0;
+  }
+  return value;
+}
+
+/* Evaluate an expression through the DAG, interning it first if needed
+ *
+ * @param root The root of the expression, EXPR_DAG_NONE if not interned yet
+ * @param missing Set to the symbol without a value, if that's the reason of
+ *   the failure. Any other error is reported.
+ */
+static int evaluate(Resolver* r, Vector* expr, uint32_t* root, int32_t* value, Symbol** missing) {
+  if (*root == EXPR_DAG_NONE) {
+    uint8_t* code = ExprCode_compile(expr, symbolId, r);
+    if (code)
+      *root = ExprDag_intern(&r->dag, code);
+  }
+
+  ExprErrorType type = EXPR_NO_ERROR;
+  uint32_t id;
+  if (*root != EXPR_DAG_NONE) {
+    if (ExprDag_eval(&r->dag, *root, lookupId, r, value, &type, &id) == 0)
+      return 0;
+    if (type == EXPR_ERROR_UNRESOLVED_SYMBOL) {
+      *missing = Resolver_symbolById(r, id);
+      return -1;
+    }
+  }
+
+  /* Malformed or failed: evaluate the tokens to point at the culprit */
+  ExprError err = {0};
+  if (Expr_eval(expr, lookup, r, value, &err) == 0)
+    die("evaluate(): bytecode and expression disagree");
+  error(r, &err.tok, "%s", ExprErrorType_toStr(err.type));
+  return -1;
+}
+
+/* Evaluate an expression which must be computable where it's given, taking
+ * ownership of it; `what` names the value in the diagnostics */
+static int evaluateNow(Resolver* r, Vector* expr, char const* what, int32_t* value) {
+  ExprError err = {0};
+  int rc = Expr_eval(expr, lookup, r, value, &err);
+  Vector_destroy(expr);
+  if (rc == -1) {
+    if (err.type == EXPR_ERROR_UNRESOLVED_SYMBOL)
+      error(r, &err.tok, "%s must be known at this point: %.*s has no value", what, (int)err.tok.len, err.tok.value);
+    else
+      error(r, &err.tok, "%s", ExprErrorType_toStr(err.type));
+  }
+  return rc;
+}
+
+static void setOrg(Resolver* r, Token const* tok, uint16_t bank, uint16_t addr) {
+  IRNode node = {.kind = IR_ORG, .data.org = {.tok = *tok, .bank = bank, .addr = addr}};
+  if (Vector_push(r->nodes, &node) == -1)
+    die("Vector_push() failed");
+  r->bank = bank;
+  r->pc = addr;
+}
+
+/* Append a data node of a single item, which it takes ownership of */
+static void addData(Resolver* r, size_t line, EncodedItem const* item) {
+  Vector* items = Vector_new(sizeof(EncodedItem));
+  if (!items)
+    die("Vector_new() failed");
+  if (Vector_push(items, item) == -1)
+    die("Vector_push() failed");
+  IRNode node = {.kind = IR_INSTRUCTION, .data.instruction = {.encoded_items = items, .line = line, .is_data = true}};
+  Resolver_addInstruction(r, &node);
+}
+
+/* Change the value of a defined symbol, dropping the cached values of the
+ * expressions using it */
+static void setValue(Resolver* r, Symbol* sym, int32_t value) {
+  if (sym->value == value)
+    return;
+  sym->value = value;
+  ExprDag_invalidate(&r->dag, sym->id);
+}
+
+/* Depth-first search through the constants that never got a value, to tell
+ * a missing definition from a circular one */
+static void reportConstant(Resolver* r, Symbol* sym, Vector* stack) {
+  sym->mark = MARK_ACTIVE;
+  if (Vector_push(stack, &sym) == -1)
+    die("Vector_push() failed");
+
+  for (size_t i = 0; i < Vector_len(sym->expr); ++i) {
+    Token const* tok = Vector_at(sym->expr, i);
+    if (tok->type != TOKEN_ID)
+      continue;
+
+    Symbol* dep = Resolver_find(r, tok);
+    assert(dep);
+    if (dep->defined)
+      continue;
+
+    if (dep->kind == SYMBOL_UNKNOWN) {
+      if (!r->relocatable)
+        error(r, tok, "undefined symbol: %s", dep->name);
+    } else if (dep->mark == MARK_NONE) {
+      reportConstant(r, dep, stack);
+    } else if (dep->mark == MARK_ACTIVE) {
+      /* The cycle is the part of the stack starting from dep */
+      size_t start = Vector_len(stack);
+      while (*(Symbol**)Vector_at(stack, start - 1) != dep)
+        start -= 1;
+      start -= 1;
+
+      size_t len = strlen(dep->name) + 1;
+      for (size_t j = start; j < Vector_len(stack); ++j)
+        len += strlen((*(Symbol**)Vector_at(stack, j))->name) + 4;
+
+      char* path = malloc(len);
+      if (!path)
+        die("malloc() failed");
+      path[0] = '\0';
+      for (size_t j = start; j < Vector_len(stack); ++j) {
+        strcat(path, (*(Symbol**)Vector_at(stack, j))->name);
+        strcat(path, " -> ");
+      }
+      strcat(path, dep->name);
+
+      error(r, &dep->tok, "circular definition: %s", path);
+      free(path);
+    }
+  }
+
+  Vector_pop(stack, NULL);
+  sym->mark = MARK_DONE;
+}
+
+static int compareSymbolLines(void const* a, void const* b) {
+  Token const* x = &(*(Symbol* const*)a)->tok;
+  Token const* y = &(*(Symbol* const*)b)->tok;
+  if (x->line != y->line)
+    return x->line < y->line ? -1 : 1;
+  if (x->col != y->col)
+    return x->col < y->col ? -1 : 1;
+  return 0;
+}
+
+static void resolveItem(Resolver* r, Fixup f) {
+  IRNode* n = Vector_at(r->nodes, f.node);
+  EncodedItem* item = Vector_at(n->data.instruction.encoded_items, f.item);
+
+  int32_t value;
+  Symbol* sym = NULL;
+  if (evaluate(r, item->data.expr, &item->node, &value, &sym) == 0) {
+    if (item->kind == EI_REL) {
+      /* Relative to the end of the instruction. The range is checked by the
+       * relaxation pass, which lengthens the branches that don't fit. */
+      IRInstruction const* iri = &n->data.instruction;
+      item->value = value - (int32_t)(iri->addr + IRInstruction_size(iri));
+      item->resolved = true;
+      return;
+    }
+    patch(r, item, value);
+    return;
+  }
+
+  if (sym)
+    waitFor(sym, f);
+}
+
+/* Resolve every expression item of the IR as one batch: evaluate them in
+ * order, check all the ranges in one pass, then store the values */
+static void resolveAll(Resolver* r) {
+  FixupBatch* b = &r->batch;
+  FixupBatch_clear(b);
+  for (size_t i = 0; i < Vector_len(r->nodes); ++i) {
+    IRNode* n = Vector_at(r->nodes, i);
+    if (n->kind != IR_INSTRUCTION)
+      continue;
+    Vector* items = n->data.instruction.encoded_items;
+    for (size_t j = 0; j < Vector_len(items); ++j) {
+      EncodedItem const* item = Vector_at(items, j);
+      if (EncodedItem_isExpr(item))
+        FixupBatch_push(b, i, j, item->kind);
+    }
+  }
+
+  for (size_t k = 0; k < b->len; ++k) {
+    IRInstruction const* iri = &((IRNode*)Vector_at(r->nodes, b->node[k]))->data.instruction;
+    EncodedItem* item = Vector_at(iri->encoded_items, b->item[k]);
+
+    int32_t value;
+    Symbol* sym = NULL;
+    if (evaluate(r, item->data.expr, &item->node, &value, &sym) == -1) {
+      if (sym)
+        waitFor(sym, (Fixup){.node = b->node[k], .item = b->item[k]});
+      continue;
+    }
+    if (b->kind[k] == EI_REL)
+      value -= (int32_t)(iri->addr + IRInstruction_size(iri));
+    b->value[k] = value;
+    b->status[k] = FIXUP_OK;
+  }
+
+  FixupBatch_checkRanges(b);
+  for (size_t k = 0; k < b->len; ++k) {
+    if (b->status[k] == FIXUP_UNRESOLVED)
+      continue;
+    IRNode* n = Vector_at(r->nodes, b->node[k]);
+    EncodedItem* item = Vector_at(n->data.instruction.encoded_items, b->item[k]);
+    if (b->status[k] == FIXUP_OUT_OF_RANGE) {
+      reportRange(r, item, b->value[k]);
+      continue;
+    }
+    item->value = b->value[k];
+    item->resolved = true;
+  }
+}
+
+static void waitFor(Symbol* sym, Fixup f) {
+  if (!sym->fixups) {
+    sym->fixups = Vector_new(sizeof(Fixup));
+    if (!sym->fixups)
+      die("Vector_new() failed");
+  }
+  if (Vector_push(sym->fixups, &f) == -1)
+    die("Vector_push() failed");
+}
+
+static void patch(Resolver* r, EncodedItem* item, int32_t value) {
+  int32_t min = INT8_MIN, max = UINT8_MAX;
+  if (item->kind == EI_ADDR) {
+    min = INT16_MIN;
+    max = UINT16_MAX;
+  }
+
+  if (value < min || value > max) {
+    reportRange(r, item, value);
+    return;
+  }
+
+  item->value = value;
+  item->resolved = true;
+}
+
+static void reportRange(Resolver* r, EncodedItem const* item, int32_t value) {
+  error(r, Vector_at(item->data.expr, 0), "value %d does not fit in %zu byte(s)", (int)value,
+        EncodedItem_size(item));
+}
+
+static int lookup(void* ctx, Token const* sym, int32_t* value) {
+  Symbol* s = Resolver_find(ctx, sym);
+  if (!s || !s->defined)
+    return -1;
+  *value = s->value;
+  return 0;
+}
+
+static int lookupId(void* ctx, uint32_t id, int32_t* value) {
+  Symbol const* s = Resolver_symbolById(ctx, id);
+  if (!s->defined)
+    return -1;
+  *value = s->value;
+  return 0;
+}
+
+static uint32_t symbolId(void* ctx, Token const* sym) { return intern(ctx, sym)->id; }
+
+static void error(Resolver* r, Token const* tok, char const* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* str = vdsprintf(fmt, ap);
+  va_end(ap);
+
+  if (!str)
+    die("vdsprintf() failed");
+
+  ParserError e = ParserError_make(r->lex, tok, str);
+  if (Vector_push(r->errors, &e) == -1)
+    die("Vector_push() failed");
+}
+
+static void destroyNode(IRNode* n) {
+  if (n->kind == IR_INSTRUCTION) {
+    for (size_t i = 0; i < Vector_len(n->data.instruction.encoded_items); ++i)
+      EncodedItem_deinit(Vector_at(n->data.instruction.encoded_items, i));
+    Vector_destroy(n->data.instruction.encoded_items);
+  } else if (n->kind == IR_LABEL) {
+    free(n->data.label.name);
+  }
+}
+
+static void map_destroy_symbol(void* value) {
+  Symbol* sym = value;
+  free(sym->name);
+  CALL_NON_NULL(sym->fixups, Vector_destroy);
+  CALL_NON_NULL(sym->expr, Vector_destroy);
+  CALL_NON_NULL(sym->dependents, Vector_destroy);
+}
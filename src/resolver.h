@@ -0,0 +1,206 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blob.h"
+#include "exprdag.h"
+#include "fixup.h"
+#include "instruction.h"
+#include "lexer.h"
+#include "map.h"
+#include "vector.h"
+
+/* A reference from an encoded item to a symbol that has no value yet */
+typedef struct {
+  size_t node; //< Index of the instruction in the IR
+  size_t item; //< Index of the item in the instruction
+} Fixup;
+
+typedef enum {
+  SYMBOL_UNKNOWN = 0, //< Referenced, but not defined yet
+  SYMBOL_LABEL,
+  SYMBOL_EQU,
+  SYMBOL_DEFL,
+} SymbolKind;
+
+typedef struct Symbol Symbol;
+
+struct Symbol {
+  char* name;
+  Token tok; //< The definition, or the first reference if still undefined
+  SymbolKind kind;
+  int32_t value;
+  bool defined;       //< The value is known
+  Vector* fixups;     //< Vector[Fixup] waiting for the value, NULL if none
+  Vector* expr;       //< SYMBOL_EQU: the defining expression (Vector[Token])
+  uint32_t root;      //< SYMBOL_EQU: expr interned in Resolver.dag, EXPR_DAG_NONE if malformed
+  uint32_t id;        //< Index in Resolver.by_id, the symbol's ID in compiled expressions
+  size_t n_deps;      //< SYMBOL_EQU: number of distinct symbols without a value
+  Vector* dependents; //< Vector[Symbol*]: constants waiting for the value, NULL if none
+  uint8_t mark;       //< Scratch space for the cycle search
+  size_t node;        //< SYMBOL_LABEL: index of the label in the IR
+};
+
+/* Single-pass resolution engine
+ *
+ * Nodes are given addresses as the parser appends them to the IR. Every
+ * expression is evaluated right away if all its symbols are known, otherwise
+ * the item is put on the pending list of the first unknown symbol and patched
+ * in place when that symbol gets defined. Hence the IR is never walked twice
+ * for resolution.
+ *
+ * Expressions are compiled to bytecode (see exprcode.h) and interned into a
+ * shared DAG (see exprdag.h) the first time they are evaluated. Repeated
+ * operands are thus one node with one cached value, and when a relayout
+ * moves labels only the expressions using them are computed again. Other
+ * passes evaluate the interned bytecode with their own symbol values. */
+typedef struct {
+  Lexer* lex;
+  Vector* nodes;  //< IR, borrowed from the parser
+  Vector* errors; //< Vector[ParserError], borrowed from the parser
+  Map* symbols;   //< name -> Symbol
+  Vector* by_id;  //< Vector[Symbol*]: symbols by ID
+  Vector* work;   //< Vector[Symbol*]: got a value, dependents not updated yet
+  Vector* constants; //< Vector[Symbol*]: EQU constants in the order of evaluation
+  ExprDag dag;    //< Every evaluated expression
+  FixupBatch batch; //< Scratch space for Resolver_relayout
+  uint16_t pc;    //< Location counter
+  uint16_t bank;  //< Current bank
+  bool banked;    //< Any bank other than 0 was used
+  bool relocatable; //< Undefined symbols are external, for an object (see object.h)
+  size_t n_relayouts; //< Times Resolver_relayout() ran, as every pass changing the IR has it
+} Resolver;
+
+Resolver Resolver_make(Lexer* lex, Vector* nodes, Vector* errors);
+void Resolver_deinit(Resolver* r);
+
+/* Append a label node and define its symbol at the location counter
+ *
+ * @param tok The label token, used for diagnostics
+ */
+void Resolver_addLabel(Resolver* r, IRNode* node, Token const* tok);
+
+/* Define a constant with EQU or DEFL
+ *
+ * The symbols the expression uses are recorded as its dependencies. An EQU
+ * constant is evaluated as soon as the last of them gets a value, so chains
+ * defined in any order are evaluated once each, in topological order. A DEFL
+ * constant may be redefined and must be computable where it is defined.
+ *
+ * @param tok The name token
+ * @param expr The defining expression, ownership is taken
+ * @param kind SYMBOL_EQU or SYMBOL_DEFL
+ */
+void Resolver_defineConstant(Resolver* r, Token const* tok, Vector* expr, SymbolKind kind);
+
+/* Append an ORG node and move the location counter
+ *
+ * Like a DEFL value, the address must be computable where it is given and
+ * keeps that value.
+ *
+ * @param tok The directive token, used for diagnostics
+ * @param expr The address expression, ownership is taken
+ */
+void Resolver_setOrigin(Resolver* r, Token const* tok, Vector* expr);
+
+/* Append an ORG node switching to another bank, at address 0 in it
+ *
+ * The bank number must be known where it's given, like an ORG address.
+ *
+ * @param tok The directive token, used for diagnostics
+ * @param expr The bank number expression, ownership is taken
+ */
+void Resolver_setBank(Resolver* r, Token const* tok, Vector* expr);
+
+/* Append an instruction node at the location counter and resolve its
+ * expression items as far as possible */
+void Resolver_addInstruction(Resolver* r, IRNode* node);
+
+/* Append the data node of DS: `count` bytes of `value`
+ *
+ * Both must be known where they're given, like an ORG address.
+ *
+ * @param tok The directive token, used for diagnostics
+ * @param line The source line of the node
+ * @param count The byte count expression, ownership is taken
+ * @param value The byte expression, ownership is taken; NULL for 0
+ */
+void Resolver_addFill(Resolver* r, Token const* tok, size_t line, Vector* count, Vector* value);
+
+/* Append the data node of INCBIN: `len` bytes of a blob from `offset` on
+ *
+ * Both must be known where they're given, like an ORG address.
+ *
+ * @param tok The directive token, used for diagnostics
+ * @param line The source line of the node
+ * @param blob The file, a slice of which the node refers to
+ * @param offset The offset expression, ownership is taken; NULL for 0
+ * @param len The length expression, ownership is taken; NULL for the rest
+ */
+void Resolver_addBlob(Resolver* r, Token const* tok, size_t line, Blob* blob, Vector* offset, Vector* len);
+
+/* Evaluate the condition of IF, which must be known where it's given,
+ * like an ORG address
+ *
+ * @param expr The condition expression, ownership is taken
+ * @returns 0 with the value, -1 once the error is reported
+ */
+int Resolver_evaluateCondition(Resolver* r, Vector* expr, int32_t* value);
+
+/* Whether a label or constant of the name is defined by this point, for
+ * IFDEF and IFNDEF */
+bool Resolver_isDefined(Resolver* r, Token const* tok);
+
+/* Find a symbol by an identifier token, NULL if it was never seen */
+Symbol* Resolver_find(Resolver* r, Token const* tok);
+
+/* Find a symbol by its ID in compiled expressions */
+Symbol* Resolver_symbolById(Resolver* r, uint32_t id);
+
+/* Compile an expression with the symbol IDs of the resolver
+ *
+ * @returns Heap-allocated program, NULL if the expression is malformed
+ */
+uint8_t* Resolver_compile(Resolver* r, Vector* expr);
+
+/* Reassign addresses after passes that change or remove instructions
+ *
+ * Labels are moved (and their IR index updated), EQU constants are evaluated again in their original
+ * (topological) order and every expression item is patched again, as one
+ * FixupBatch. DEFL constants keep the value they had where they were
+ * defined.
+ */
+void Resolver_relayout(Resolver* r);
+
+/* Replace the nodes [first, end) of the IR with others, then relay it out
+ *
+ * For a change to a few lines of the source, the rest of whose nodes stay.
+ * Every label of the replaced nodes must be among the new ones, and the
+ * other new labels never seen before. The expressions of the new nodes are
+ * resolved by the relayout, along with those over symbols whose values it
+ * changes.
+ *
+ * @param with Vector[IRNode], whose contents are taken
+ * @param labels Vector[Token], the token of each label of `with`, in order
+ */
+void Resolver_splice(Resolver* r, size_t first, size_t end, Vector* with, Vector* labels);
+
+/* Report code running past the end of its bank, in a program using banks
+ *
+ * In a banked program every bank, the home bank 0 included, holds
+ * IR_BANK_SIZE bytes. Run once the final layout is known.
+ */
+void Resolver_checkBanks(Resolver* r);
+
+/* Report the items and constants left waiting for undefined symbols, and
+ * the circular definitions among constants
+ *
+ * In a relocatable module, undefined symbols are left to the linker and
+ * only the circular definitions are reported.
+ */
+void Resolver_finish(Resolver* r);
+
+#endif // RESOLVER_H
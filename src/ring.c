@@ -0,0 +1,55 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ring.h"
+#include "utility.h"
+
+void Ring_init(Ring* r, size_t n_slots, size_t slot_size) {
+  assert(r);
+  assert(n_slots > 0 && (n_slots & (n_slots - 1)) == 0);
+  assert(slot_size > 0);
+
+  *r = (Ring){.slot_size = slot_size, .mask = n_slots - 1};
+  r->slots = malloc(n_slots * slot_size);
+  if (!r->slots)
+    die("malloc() failed");
+}
+
+void Ring_deinit(Ring* r) {
+  assert(r);
+  free(r->slots);
+  r->slots = NULL;
+}
+
+void* Ring_reserve(Ring* r) {
+  assert(r);
+
+  size_t const tail = r->tail;
+  while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->mask)
+    sched_yield();
+  return r->slots + (tail & r->mask) * r->slot_size;
+}
+
+void Ring_push(Ring* r) {
+  assert(r);
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+void* Ring_front(Ring* r) {
+  assert(r);
+
+  size_t const head = r->head;
+  while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head)
+    sched_yield();
+  return r->slots + (head & r->mask) * r->slot_size;
+}
+
+void Ring_pop(Ring* r) {
+  assert(r);
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
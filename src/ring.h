@@ -0,0 +1,45 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+/* A bounded queue from one thread to another, without locks
+ *
+ * Slots are filled and read in place: the producer reserves the next free
+ * slot, fills it and pushes it, and the consumer reads the front slot and
+ * pops it. Each side only writes its own counter, with release stores
+ * that the other side reads with acquire loads, so a pushed slot is seen
+ * whole. A side that finds the ring full or empty yields its CPU until
+ * it isn't.
+ */
+typedef struct {
+  uint8_t* slots;
+  size_t slot_size;
+  size_t mask; //< Number of slots - 1
+  char pad0[RING_CACHE_LINE];
+  size_t head; //< Slots popped so far, written by the consumer
+  char pad1[RING_CACHE_LINE - sizeof(size_t)];
+  size_t tail; //< Slots pushed so far, written by the producer
+  char pad2[RING_CACHE_LINE - sizeof(size_t)];
+} Ring;
+
+/* @param n_slots A power of 2 */
+void Ring_init(Ring* r, size_t n_slots, size_t slot_size);
+void Ring_deinit(Ring* r);
+
+/* The slot to fill next, once there is one free (producer) */
+void* Ring_reserve(Ring* r);
+
+/* Hand the reserved slot over to the consumer (producer) */
+void Ring_push(Ring* r);
+
+/* The oldest pushed slot, once there is one (consumer) */
+void* Ring_front(Ring* r);
+
+/* Give the front slot back to the producer (consumer) */
+void Ring_pop(Ring* r);
+
+#endif // RING_H
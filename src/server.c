@@ -0,0 +1,454 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "utility.h"
+
+#define SERVER_REQUEST_MAX 65536 //< Bytes of a request: directory and arguments
+#define SERVER_N_FDS 3
+#define SERVER_REPLY_LEN 4 //< The exit code, little-endian
+
+/* A request is a single packet holding the working directory, then the
+ * arguments, each NUL-terminated, with the standard streams attached */
+typedef union {
+  struct cmsghdr header;
+  char buf[CMSG_SPACE(sizeof(int) * SERVER_N_FDS)];
+} FdMessage;
+
+static volatile sig_atomic_t stopping = 0;
+static int reply_fd = -1; //< The connection of a request, until replied
+
+static void stop(int sig);
+static void noticeChild(int sig);
+static int listenOn(char const* path);
+static bool isStale(char const* path);
+static int setAddress(struct sockaddr_un* addr, char const* path);
+static pid_t startWorker(int listener, ServerHandler handle, sigset_t const* mask);
+static void work(int listener, ServerHandler handle, sigset_t const* mask);
+static void serve(int conn, ServerHandler handle, int const saved[SERVER_N_FDS], int here);
+static ssize_t receiveRequest(int conn, char* buf, int fds[SERVER_N_FDS]);
+static char** splitRequest(char* buf, size_t len, int* argc);
+static void replyDied(void);
+static void reply(int conn, int exitcode);
+static char* currentDir(void);
+
+int Server_run(char const* path, size_t n_workers, ServerHandler handle) {
+  assert(path);
+  assert(n_workers > 0);
+  assert(handle);
+
+  int const listener = listenOn(path);
+  if (listener == -1) {
+    perror(path);
+    return -1;
+  }
+
+  /* The signals are blocked but while waiting, so none is missed between
+   * checking for one and waiting */
+  sigset_t signals, mask;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &signals, &mask);
+
+  struct sigaction sa = {.sa_handler = stop}, old_int, old_term, old_chld;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+  sa.sa_handler = noticeChild;
+  sigaction(SIGCHLD, &sa, &old_chld);
+
+  pid_t* workers = calloc(n_workers, sizeof(pid_t));
+  if (!workers)
+    die("calloc() failed");
+
+  /* Replace the workers as they die, until stopped */
+  int rc = 0;
+  while (!stopping) {
+    for (size_t i = 0; i < n_workers && rc == 0; ++i) {
+      if (workers[i] == 0 && (workers[i] = startWorker(listener, handle, &mask)) == -1) {
+        perror("fork");
+        workers[i] = 0;
+        rc = -1;
+      }
+    }
+    if (rc == -1)
+      break;
+
+    sigsuspend(&mask);
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+      for (size_t i = 0; i < n_workers; ++i)
+        if (workers[i] == pid)
+          workers[i] = 0;
+  }
+
+  /* The workers stop once done with their requests */
+  for (size_t i = 0; i < n_workers; ++i)
+    if (workers[i] != 0)
+      kill(workers[i], SIGTERM);
+  for (size_t i = 0; i < n_workers; ++i)
+    if (workers[i] != 0)
+      while (waitpid(workers[i], NULL, 0) == -1 && errno == EINTR)
+        ;
+  free(workers);
+
+  close(listener);
+  unlink(path);
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  sigaction(SIGCHLD, &old_chld, NULL);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+  stopping = 0;
+  return rc;
+}
+
+int Server_forward(char const* path, int argc, char const* const* argv, int const fds[3], int* exitcode) {
+  assert(path);
+  assert(argv);
+  assert(fds);
+  assert(exitcode);
+
+  struct sockaddr_un addr;
+  if (setAddress(&addr, path) == -1)
+    return -1;
+
+  char* cwd = currentDir();
+  if (!cwd)
+    return -1;
+  char* request = malloc(SERVER_REQUEST_MAX);
+  if (!request)
+    die("malloc() failed");
+  size_t len = 0;
+  for (int i = -1; i < argc; ++i) {
+    char const* s = i == -1 ? cwd : argv[i];
+    size_t const n = strlen(s) + 1;
+    if (n > SERVER_REQUEST_MAX - len) {
+      free(cwd);
+      free(request);
+      errno = E2BIG;
+      return -1;
+    }
+    memcpy(request + len, s, n);
+    len += n;
+  }
+  free(cwd);
+
+  int const conn = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (conn == -1 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    int const saved = errno;
+    if (conn != -1)
+      close(conn);
+    free(request);
+    errno = saved;
+    return -1;
+  }
+
+  FdMessage control;
+  memset(&control, 0, sizeof(control));
+  struct iovec iov = {.iov_base = request, .iov_len = len};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SERVER_N_FDS);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * SERVER_N_FDS);
+
+  ssize_t n;
+  while ((n = sendmsg(conn, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    ;
+  free(request);
+
+  uint8_t code[SERVER_REPLY_LEN];
+  if (n != -1)
+    while ((n = recv(conn, code, sizeof(code), 0)) == -1 && errno == EINTR)
+      ;
+  int const saved = errno;
+  close(conn);
+  if (n != SERVER_REPLY_LEN) {
+    /* Closing without a reply, the server couldn't run the command */
+    errno = n == -1 ? saved : ECONNRESET;
+    return -1;
+  }
+
+  *exitcode = (int)((uint32_t)code[0] | (uint32_t)code[1] << 8 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 24);
+  return 0;
+}
+
+static void stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+/* Only to wake the server, which then reaps the worker */
+static void noticeChild(int sig) {
+  (void)sig;
+}
+
+/* @returns The listening socket, or -1 (errno is set) */
+static int listenOn(char const* path) {
+  struct sockaddr_un addr;
+  if (setAddress(&addr, path) == -1)
+    return -1;
+
+  int const fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd == -1)
+    return -1;
+
+  /* Only the user may connect: the server runs commands as them */
+  mode_t const umask_was = umask(077);
+  int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+  if (rc == -1 && errno == EADDRINUSE && isStale(path) && unlink(path) == 0)
+    rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+  umask(umask_was);
+
+  if (rc == -1 || listen(fd, SOMAXCONN) == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    int const saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+/* Whether `path` is a socket nobody listens on */
+static bool isStale(char const* path) {
+  struct stat st;
+  if (lstat(path, &st) == -1 || !S_ISSOCK(st.st_mode))
+    return false;
+
+  struct sockaddr_un addr;
+  int const fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd == -1 || setAddress(&addr, path) == -1) {
+    if (fd != -1)
+      close(fd);
+    return false;
+  }
+  bool const stale = connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno == ECONNREFUSED;
+  close(fd);
+  errno = EADDRINUSE;
+  return stale;
+}
+
+static int setAddress(struct sockaddr_un* addr, char const* path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/* @returns The worker's pid, or -1 (errno is set) */
+static pid_t startWorker(int listener, ServerHandler handle, sigset_t const* mask) {
+  pid_t const pid = fork();
+  if (pid == 0) {
+    work(listener, handle, mask);
+    _exit(0);
+  }
+  return pid;
+}
+
+/* In a worker: answer requests one at a time until stopped
+ *
+ * The signals to stop are taken but while waiting for a request, so the
+ * one running is finished first.
+ */
+static void work(int listener, ServerHandler handle, sigset_t const* mask) {
+  signal(SIGCHLD, SIG_DFL);
+  sigset_t wait_mask = *mask;
+  sigdelset(&wait_mask, SIGINT);
+  sigdelset(&wait_mask, SIGTERM);
+  sigset_t child;
+  sigemptyset(&child);
+  sigaddset(&child, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &child, NULL);
+
+  /* What a request changes is put back after it */
+  int saved[SERVER_N_FDS];
+  for (int i = 0; i < SERVER_N_FDS; ++i)
+    if ((saved[i] = fcntl(i, F_DUPFD_CLOEXEC, SERVER_N_FDS)) == -1)
+      die("fcntl() failed");
+  int const here = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (here == -1)
+    die("open() failed");
+  atexit(replyDied);
+
+  while (!stopping) {
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(listener, &ready);
+    if (pselect(listener + 1, &ready, NULL, NULL, NULL, &wait_mask) == -1) {
+      if (errno == EINTR)
+        continue;
+      die("pselect() failed");
+    }
+
+    /* Another worker, or the client giving up, may have taken it */
+    int const conn = accept(listener, NULL, NULL);
+    if (conn == -1)
+      continue;
+    serve(conn, handle, saved, here);
+    close(conn);
+  }
+}
+
+/* Run a request as the client's command, then reply; a malformed one is
+ * dropped */
+static void serve(int conn, ServerHandler handle, int const saved[SERVER_N_FDS], int here) {
+  static char buf[SERVER_REQUEST_MAX + 1];
+  int fds[SERVER_N_FDS];
+  ssize_t const len = receiveRequest(conn, buf, fds);
+  if (len == -1)
+    return;
+
+  char* const cwd = buf;
+  int argc;
+  char** argv = splitRequest(buf, (size_t)len, &argc);
+
+  reply_fd = conn;
+  for (int i = 0; i < SERVER_N_FDS; ++i)
+    if (dup2(fds[i], i) == -1)
+      die("dup2() failed");
+  for (int i = 0; i < SERVER_N_FDS; ++i)
+    if (fds[i] >= SERVER_N_FDS)
+      close(fds[i]);
+
+  int exitcode = 1;
+  if (chdir(cwd) == -1) {
+    perror(cwd);
+  } else {
+    /* 0 has getopt() start over, forgetting where the last command left it */
+    optind = 0;
+    exitcode = handle(argc, argv);
+  }
+  fflush(NULL);
+
+  for (int i = 0; i < SERVER_N_FDS; ++i)
+    if (dup2(saved[i], i) == -1)
+      die("dup2() failed");
+  if (fchdir(here) == -1)
+    die("fchdir() failed");
+  free(argv);
+  reply(conn, exitcode);
+}
+
+/* @returns The length of the request, or -1 */
+static ssize_t receiveRequest(int conn, char* buf, int fds[SERVER_N_FDS]) {
+  FdMessage control;
+  struct iovec iov = {.iov_base = buf, .iov_len = SERVER_REQUEST_MAX};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t len;
+  while ((len = recvmsg(conn, &msg, 0)) == -1 && errno == EINTR)
+    ;
+  if (len == -1)
+    return -1;
+
+  size_t n_fds = 0;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t const n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int received[SERVER_N_FDS];
+    memcpy(received, CMSG_DATA(cmsg), n * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+      if (n_fds < SERVER_N_FDS)
+        fds[n_fds++] = received[i];
+      else
+        close(received[i]);
+    }
+  }
+
+  /* The arguments must end in a NUL, and there must be a program name */
+  bool const valid = n_fds == SERVER_N_FDS && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && len > 0 &&
+                     buf[len - 1] == '\0' && memchr(buf, '\0', (size_t)len) != buf + len - 1;
+  if (!valid) {
+    for (size_t i = 0; i < n_fds; ++i)
+      close(fds[i]);
+    return -1;
+  }
+  return len;
+}
+
+/* The arguments of a request, after its working directory
+ *
+ * @returns The NULL-terminated arguments, pointing into `buf`, to be freed
+ */
+static char** splitRequest(char* buf, size_t len, int* argc) {
+  *argc = 0;
+  for (size_t i = strlen(buf) + 1; i < len; i += strlen(buf + i) + 1)
+    ++*argc;
+  char** argv = malloc(sizeof(char*) * ((size_t)*argc + 1));
+  if (!argv)
+    die("malloc() failed");
+  char* s = buf + strlen(buf) + 1;
+  for (int i = 0; i < *argc; ++i, s += strlen(s) + 1)
+    argv[i] = s;
+  argv[*argc] = NULL;
+  return argv;
+}
+
+/* Dying, the command still answers the client */
+static void replyDied(void) {
+  if (reply_fd != -1) {
+    fflush(NULL);
+    reply(reply_fd, EX_SOFTWARE);
+  }
+}
+
+static void reply(int conn, int exitcode) {
+  uint8_t const code[SERVER_REPLY_LEN] = {
+      (uint8_t)exitcode,
+      (uint8_t)((unsigned)exitcode >> 8),
+      (uint8_t)((unsigned)exitcode >> 16),
+      (uint8_t)((unsigned)exitcode >> 24),
+  };
+  while (send(conn, code, sizeof(code), MSG_NOSIGNAL) == -1 && errno == EINTR)
+    ;
+  reply_fd = -1;
+}
+
+static char* currentDir(void) {
+  size_t cap = 256;
+  for (;;) {
+    char* buf = malloc(cap);
+    if (!buf)
+      die("malloc() failed");
+    if (getcwd(buf, cap))
+      return buf;
+    free(buf);
+    if (errno != ERANGE)
+      return NULL;
+    cap *= 2;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+/* A resident assembler, answering requests on a Unix domain socket
+ *
+ * A request carries the command line, the working directory and the
+ * standard streams of the client. Workers forked when the server starts
+ * take the requests, each running one command at a time as if it had been
+ * started by the client, then replying with its exit code. A worker lasts
+ * from one request to the next, so whatever a command keeps, such as the
+ * files it included, is there for the commands after. A command that dies
+ * ends its worker, which another replaces, and leaves the server running.
+ */
+
+/* Handles a request, as main() would; its standard streams are the client's
+ *
+ * It runs in the worker's process, so it must leave it as it found it,
+ * but for what it keeps on purpose.
+ */
+typedef int (*ServerHandler)(int argc, char** argv);
+
+/* Serve requests until SIGINT or SIGTERM, then remove the socket
+ *
+ * A socket left behind by a server that is gone is replaced. Once stopped,
+ * the workers finish the requests they were running.
+ *
+ * @param n_workers Requests answered at once, at least 1
+ * @returns 0 once stopped, -1 if the socket can't be set up (reported)
+ */
+int Server_run(char const* path, size_t n_workers, ServerHandler handle);
+
+/* Have the server at `path` run a command, with `fds` as its standard
+ * input, output and error
+ *
+ * @returns 0 with the exit code of the command, -1 if no server answers at
+ *   `path` or the request can't be sent (errno is set)
+ */
+int Server_forward(char const* path, int argc, char const* const* argv, int const fds[3], int* exitcode);
+
+#endif // SERVER_H
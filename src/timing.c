@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "expression.h"
+#include "instruction.h"
+#include "parser.h"
+#include "resolver.h"
+#include "timing.h"
+#include "utility.h"
+#include "vector.h"
+
+#define T(N) {(N), (N)}
+#define C(N, TAKEN) {(N), (TAKEN)}
+#define PREFIX {0, 0}
+
+/* T-states of the unprefixed opcodes (Zilog Z80 CPU User Manual, UM0080)
+ *
+ * Prefixed opcodes (CB, DD, ED, FD) are not emitted by the assembler and have
+ * no entry. */
+static TStates const t_states[UINT8_MAX + 1] = {
+    // nop, ld bc,nn, ld (bc),a, inc bc, inc b, dec b, ld b,n, rlca
+    T(4), T(10), T(7), T(6), T(4), T(4), T(7), T(4),
+    // ex af,af', add hl,bc, ld a,(bc), dec bc, inc c, dec c, ld c,n, rrca
+    T(4), T(11), T(7), T(6), T(4), T(4), T(7), T(4),
+    // djnz e, ld de,nn, ld (de),a, inc de, inc d, dec d, ld d,n, rla
+    C(8, 13), T(10), T(7), T(6), T(4), T(4), T(7), T(4),
+    // jr e, add hl,de, ld a,(de), dec de, inc e, dec e, ld e,n, rra
+    T(12), T(11), T(7), T(6), T(4), T(4), T(7), T(4),
+    // jr nz,e, ld hl,nn, ld (nn),hl, inc hl, inc h, dec h, ld h,n, daa
+    C(7, 12), T(10), T(16), T(6), T(4), T(4), T(7), T(4),
+    // jr z,e, add hl,hl, ld hl,(nn), dec hl, inc l, dec l, ld l,n, cpl
+    C(7, 12), T(11), T(16), T(6), T(4), T(4), T(7), T(4),
+    // jr nc,e, ld sp,nn, ld (nn),a, inc sp, inc (hl), dec (hl), ld (hl),n, scf
+    C(7, 12), T(10), T(13), T(6), T(11), T(11), T(10), T(4),
+    // jr c,e, add hl,sp, ld a,(nn), dec sp, inc a, dec a, ld a,n, ccf
+    C(7, 12), T(11), T(13), T(6), T(4), T(4), T(7), T(4),
+    // ld r,r' and ld r,(hl)
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    // ld (hl),r, halt
+    T(7), T(7), T(7), T(7), T(7), T(7), T(4), T(7),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    // add, adc, sub, sbc, and, xor, or, cp with r and (hl)
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    T(4), T(4), T(4), T(4), T(4), T(4), T(7), T(4),
+    // ret nz, pop bc, jp nz,nn, jp nn, call nz,nn, push bc, add a,n, rst 00h
+    C(5, 11), T(10), T(10), T(10), C(10, 17), T(11), T(7), T(11),
+    // ret z, ret, jp z,nn, (cb), call z,nn, call nn, adc a,n, rst 08h
+    C(5, 11), T(10), T(10), PREFIX, C(10, 17), T(17), T(7), T(11),
+    // ret nc, pop de, jp nc,nn, out (n),a, call nc,nn, push de, sub n, rst 10h
+    C(5, 11), T(10), T(10), T(11), C(10, 17), T(11), T(7), T(11),
+    // ret c, exx, jp c,nn, in a,(n), call c,nn, (dd), sbc a,n, rst 18h
+    C(5, 11), T(4), T(10), T(11), C(10, 17), PREFIX, T(7), T(11),
+    // ret po, pop hl, jp po,nn, ex (sp),hl, call po,nn, push hl, and n, rst 20h
+    C(5, 11), T(10), T(10), T(19), C(10, 17), T(11), T(7), T(11),
+    // ret pe, jp (hl), jp pe,nn, ex de,hl, call pe,nn, (ed), xor n, rst 28h
+    C(5, 11), T(4), T(10), T(4), C(10, 17), PREFIX, T(7), T(11),
+    // ret p, pop af, jp p,nn, di, call p,nn, push af, or n, rst 30h
+    C(5, 11), T(10), T(10), T(4), C(10, 17), T(11), T(7), T(11),
+    // ret m, ld sp,hl, jp m,nn, ei, call m,nn, (fd), cp n, rst 38h
+    C(5, 11), T(6), T(10), T(4), C(10, 17), PREFIX, T(7), T(11),
+};
+
+#undef T
+#undef C
+#undef PREFIX
+
+static size_t opcodeLength(uint8_t opcode);
+static uint16_t worstCase(TStates t);
+static int lookup(void* ctx, Token const* sym, int32_t* value);
+static void error(Resolver* r, Token const* tok, char const* fmt, ...);
+
+TStates TStates_ofInstruction(IRInstruction const* iri) {
+  assert(iri);
+
+  /* Operands may be folded into plain bytes, so opcodes are told apart by
+   * their offsets */
+  TStates sum = {0, 0};
+  if (iri->is_data)
+    return sum;
+  size_t offset = 0, next_opcode = 0;
+  for (size_t i = 0; i < Vector_len(iri->encoded_items); ++i) {
+    EncodedItem const* item = Vector_at(iri->encoded_items, i);
+    if (offset == next_opcode) {
+      assert(item->kind == EI_BYTE);
+      TStates const t = t_states[item->data.byte];
+      assert(t.base != 0 && "prefixed opcode");
+      sum.base = (uint16_t)(sum.base + t.base);
+      sum.taken = (uint16_t)(sum.taken + t.taken);
+      next_opcode += opcodeLength(item->data.byte);
+    }
+    offset += EncodedItem_size(item);
+  }
+  return sum;
+}
+
+void Timing_printReport(FILE* fout, Vector* nodes) {
+  assert(fout);
+  assert(nodes);
+
+  fprintf(fout, "%-24s %-6s %8s %8s\n", "block", "addr", "through", "taken");
+
+  char const* name = "(start)";
+  uint16_t addr = 0;
+  uint32_t through = 0, taken = 0;
+  for (size_t i = 0; i <= Vector_len(nodes); ++i) {
+    IRNode* n = i < Vector_len(nodes) ? Vector_at(nodes, i) : NULL;
+    if (n && n->kind == IR_INSTRUCTION) {
+      TStates const t = TStates_ofInstruction(&n->data.instruction);
+      through += t.base;
+      taken += t.taken;
+      continue;
+    }
+
+    /* A label or the end closes the block; code-less blocks before the
+     * first label are left out */
+    if (i > 0 || through > 0)
+      fprintf(fout, "%-24s 0x%04x %8u %8u\n", name, addr, through, taken);
+    if (n) {
+      name = n->data.label.name;
+      addr = n->data.label.addr;
+      through = taken = 0;
+    }
+  }
+}
+
+void Timing_checkAssertions(Resolver* r, Vector* assertions) {
+  assert(r);
+  assert(assertions);
+
+  for (size_t i = 0; i < Vector_len(assertions); ++i) {
+    CycleAssertion* a = Vector_at(assertions, i);
+
+    Symbol const* start = Resolver_find(r, &a->start);
+    Symbol const* end = Resolver_find(r, &a->end);
+    if (!start || start->kind != SYMBOL_LABEL) {
+      error(r, &a->start, "not a label: %.*s", (int)a->start.len, a->start.value);
+      continue;
+    }
+    if (!end || end->kind != SYMBOL_LABEL) {
+      error(r, &a->end, "not a label: %.*s", (int)a->end.len, a->end.value);
+      continue;
+    }
+    if (end->node < start->node) {
+      error(r, &a->end, "section ends before it starts: %s comes before %s", end->name, start->name);
+      continue;
+    }
+
+    int32_t max;
+    ExprError err = {0};
+    if (Expr_eval(a->max, lookup, r, &max, &err) == -1) {
+      error(r, &err.tok, "%s", ExprErrorType_toStr(err.type));
+      continue;
+    }
+
+    uint32_t total = 0;
+    for (size_t j = start->node; j < end->node; ++j) {
+      IRNode* n = Vector_at(r->nodes, j);
+      if (n->kind == IR_INSTRUCTION)
+        total += worstCase(TStates_ofInstruction(&n->data.instruction));
+    }
+
+    if (max < 0 || total > (uint32_t)max)
+      error(r, &a->tok, "section %s..%s takes %u T-states, over the budget of %d", start->name, end->name, total,
+            max);
+  }
+}
+
+/* Length of an unprefixed instruction in bytes */
+static size_t opcodeLength(uint8_t opcode) {
+  switch (opcode) {
+  /* ld r,n; djnz, jr; alu n; out (n),a; in a,(n) */
+  case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e:
+  case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+  case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+  case 0xd3: case 0xdb:
+    return 2;
+  /* ld rr,nn; ld (nn),hl/a; ld hl/a,(nn); jp [cc,]nn; call [cc,]nn */
+  case 0x01: case 0x11: case 0x21: case 0x31:
+  case 0x22: case 0x2a: case 0x32: case 0x3a:
+  case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe2: case 0xea: case 0xf2: case 0xfa:
+  case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc: case 0xe4: case 0xec: case 0xf4: case 0xfc:
+    return 3;
+  default:
+    return 1;
+  }
+}
+
+static uint16_t worstCase(TStates t) { return t.taken > t.base ? t.taken : t.base; }
+
+static int lookup(void* ctx, Token const* sym, int32_t* value) {
+  Symbol* s = Resolver_find(ctx, sym);
+  if (!s || !s->defined)
+    return -1;
+  *value = s->value;
+  return 0;
+}
+
+static void error(Resolver* r, Token const* tok, char const* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char* str = vdsprintf(fmt, ap);
+  va_end(ap);
+
+  if (!str)
+    die("vdsprintf() failed");
+
+  ParserError e = ParserError_make(r->lex, tok, str);
+  if (Vector_push(r->errors, &e) == -1)
+    die("Vector_push() failed");
+}
@@ -0,0 +1,57 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "instruction.h"
+#include "lexer.h"
+#include "resolver.h"
+#include "vector.h"
+
+/* Execution time in T-states
+ *
+ * For conditional instructions `taken` is the time when the condition holds
+ * (the branch is taken, the call is made, the return happens); for anything
+ * else both times are the same.
+ */
+typedef struct {
+  uint16_t base;
+  uint16_t taken;
+} TStates;
+
+/* ASSERT_CYCLES start, end, max */
+typedef struct {
+  Token tok;   //< The directive
+  Token start; //< First label of the section
+  Token end;   //< Label just past the section
+  Vector* max; //< Budget in T-states (Vector[Token])
+} CycleAssertion;
+
+/* Time of an instruction as encoded
+ *
+ * The times of all opcodes in the encoding are added up, so relaxed DJNZ
+ * (DEC B; JP NZ) is counted right. Data directives take no time.
+ */
+TStates TStates_ofInstruction(IRInstruction const* iri);
+
+/* Print the time of every straight-line block
+ *
+ * A block starts at a label (or at the beginning of the program) and runs
+ * up to the next label. Both the time with every branch falling through and
+ * the time with every condition holding are given.
+ */
+void Timing_printReport(FILE* fout, Vector* nodes);
+
+/* Check ASSERT_CYCLES directives against the final code
+ *
+ * A section is the straight-line code from its start label up to its end
+ * label, timed with every condition holding whenever that is slower. Must be
+ * run after every pass that changes the code; failures are reported as
+ * errors of the resolver.
+ *
+ * @param assertions Vector[CycleAssertion]
+ */
+void Timing_checkAssertions(Resolver* r, Vector* assertions);
+
+#endif // TIMING_H
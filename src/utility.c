@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <errno.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +9,9 @@
 
 #include "utility.h"
 
+/* The innermost DieTrap of the thread */
+static __thread DieTrap* innermost_trap = NULL;
+
 char* dsprintf(char const* format, ...) {
   assert(format);
 
@@ -52,26 +56,16 @@ char* vdsprintf(char const* format, va_list ap) {
   return buf;
 }
 
-int strncasecmp(char const* a, char const* b, size_t len) {
-  assert(a);
-  assert(b);
-  char lower_a, lower_b;
-  for (size_t i = 0; i < len; ++i) {
-    lower_a = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] + 0x20 : a[i];
-    lower_b = (b[i] >= 'A' && b[i] <= 'Z') ? b[i] + 0x20 : b[i];
-    if (lower_a == '\0' && lower_a == lower_b)
-      return 0;
-    else if (lower_a < lower_b)
-      return -1;
-    else if (lower_a > lower_b)
-      return 1;
-  }
-  return 0;
-}
-
 void die(char const* message) {
   assert(message);
 
+  DieTrap* trap = innermost_trap;
+  if (trap) {
+    trap->message = message;
+    DieTrap_pop(trap);
+    longjmp(trap->env, 1);
+  }
+
   if (errno) {
     fprintf(stderr, "%s (errno: %i: %s)\n", message, errno, strerror(errno));
   } else {
@@ -80,3 +74,17 @@ void die(char const* message) {
 
   exit(EX_SOFTWARE);
 }
+
+void DieTrap_push(DieTrap* trap) {
+  assert(trap);
+
+  trap->message = NULL;
+  trap->outer = innermost_trap;
+  innermost_trap = trap;
+}
+
+void DieTrap_pop(DieTrap* trap) {
+  assert(trap);
+  assert(innermost_trap == trap);
+  innermost_trap = trap->outer;
+}
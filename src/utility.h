@@ -1,6 +1,7 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 
@@ -12,8 +13,25 @@ char* dsprintf(char const* format, ...) __attribute__((format(printf, 1, 2), __w
 
 char* vdsprintf(char const* format, va_list ap) __attribute__((__warn_unused_result__));
 
-int strncasecmp(char const* a, char const* b, size_t len);
-
+/* Report an error the program can't go on from and exit, or spring the trap
+ * set in the calling thread */
 void die(char const* message) __attribute__((noreturn));
 
+/* Where die() returns to instead of exiting, for callers that must survive
+ * it (see z80asm.h)
+ *
+ * Once set with setjmp() and pushed, die() in the same thread stores its
+ * message, pops the trap and longjmp()s to `env` with 1. Whatever the
+ * interrupted code had allocated is lost. Other threads have their own
+ * traps, and exit without one.
+ */
+typedef struct DieTrap {
+  jmp_buf env;
+  char const* message;   //< What die() was given
+  struct DieTrap* outer; //< The trap this one hides, restored when it's popped
+} DieTrap;
+
+void DieTrap_push(DieTrap* trap);
+void DieTrap_pop(DieTrap* trap);
+
 #endif
@@ -7,6 +7,8 @@
 
 #include "vector.h"
 
+#define VECTOR_MIN_CAPACITY 16
+
 struct Vector {
   uint8_t* data;
   size_t el_size;
@@ -24,7 +26,7 @@ Vector* Vector_new(size_t elem_size) {
   }
 
   v->el_size = elem_size;
-  v->capacity = 16;
+  v->capacity = VECTOR_MIN_CAPACITY;
   v->len = 0;
   v->data = malloc(v->el_size * v->capacity);
 
@@ -69,7 +71,7 @@ int Vector_pop(Vector* v, void* dest) {
     memcpy(dest, last, v->el_size);
   }
 
-  if (v->len == v->capacity / 2) {
+  if (v->len == v->capacity / 2 && v->capacity > VECTOR_MIN_CAPACITY) {
     if (Vector_resize(v, v->capacity / 2) == -1) {
       return -1;
     }
@@ -121,7 +123,7 @@ int Vector_popFront(Vector* v, void* dest) {
   }
 
   v->len -= 1;
-  if (v->len == v->capacity / 2) {
+  if (v->len == v->capacity / 2 && v->capacity > VECTOR_MIN_CAPACITY) {
     if (Vector_resize(v, v->capacity / 2) == -1) {
       return -1;
     }
@@ -136,12 +138,14 @@ int Vector_resize(Vector* v, size_t size) {
   if (size < v->len)
     return -1;
 
-  v->data = realloc(v->data, size * v->el_size);
-  if (!v->data) {
+  /* On failure the vector keeps its elements, for whoever frees it */
+  uint8_t* data = realloc(v->data, size * v->el_size);
+  if (!data) {
     perror("realloc() failed");
     return -1;
   }
 
+  v->data = data;
   v->capacity = size;
 
   return 0;
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utility.h"
+#include "writer.h"
+
+char const Writer_hex_digits[] = "0123456789ABCDEF";
+
+Writer Writer_make(FILE* f) {
+  assert(f);
+
+  char* buf = malloc(WRITER_BUFFER_LEN);
+  if (!buf)
+    die("malloc() failed");
+  return (Writer){.f = f, .buf = buf};
+}
+
+void Writer_reserve(Writer* w, size_t n) {
+  assert(w);
+  assert(n <= WRITER_BUFFER_LEN);
+
+  if (w->len + n > WRITER_BUFFER_LEN)
+    Writer_flush(w);
+}
+
+void Writer_flush(Writer* w) {
+  assert(w);
+
+  if (w->len && !w->failed && fwrite(w->buf, 1, w->len, w->f) != w->len)
+    w->failed = true;
+  w->len = 0;
+}
+
+void Writer_write(Writer* w, char const* data, size_t n) {
+  assert(w);
+  assert(data || n == 0);
+
+  /* Long runs go straight to the file rather than through the buffer */
+  if (n > WRITER_BUFFER_LEN / 2) {
+    Writer_flush(w);
+    if (!w->failed && fwrite(data, 1, n, w->f) != n)
+      w->failed = true;
+    return;
+  }
+
+  Writer_reserve(w, n);
+  memcpy(w->buf + w->len, data, n);
+  w->len += n;
+}
+
+int Writer_finish(Writer* w) {
+  assert(w);
+
+  Writer_flush(w);
+  free(w->buf);
+  w->buf = NULL;
+  if (fflush(w->f) != 0)
+    w->failed = true;
+  return w->failed ? -1 : 0;
+}
+
+void Writer_putDecimal(Writer* w, size_t value, size_t width) {
+  assert(w);
+  assert(width <= WRITER_MAX_DECIMAL);
+
+  char digits[WRITER_MAX_DECIMAL];
+  size_t n = 0;
+  do {
+    digits[WRITER_MAX_DECIMAL - ++n] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value);
+
+  for (size_t i = n; i < width; ++i)
+    Writer_putChar(w, ' ');
+  memcpy(w->buf + w->len, digits + WRITER_MAX_DECIMAL - n, n);
+  w->len += n;
+}
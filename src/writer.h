@@ -0,0 +1,56 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WRITER_BUFFER_LEN (64 * 1024)
+#define WRITER_MAX_DECIMAL 20 //< Digits of the largest 64-bit value
+
+/* Buffered text output
+ *
+ * Characters are put into a large buffer which is written out whenever it
+ * fills up. The put functions don't check for room: reserve it first with
+ * Writer_reserve(). A write error is remembered and reported by
+ * Writer_finish().
+ */
+typedef struct {
+  FILE* f;
+  char* buf;
+  size_t len;
+  bool failed;
+} Writer;
+
+Writer Writer_make(FILE* f);
+
+/* Make room for n more characters, n being at most WRITER_BUFFER_LEN */
+void Writer_reserve(Writer* w, size_t n);
+
+void Writer_flush(Writer* w);
+
+/* Put n characters, which needn't be reserved */
+void Writer_write(Writer* w, char const* data, size_t n);
+
+/* Flush and free the buffer
+ *
+ * @returns 0 on success, -1 if any write failed (errno is set)
+ */
+int Writer_finish(Writer* w);
+
+extern char const Writer_hex_digits[];
+
+static inline void Writer_putChar(Writer* w, char c) { w->buf[w->len++] = c; }
+
+static inline void Writer_putHex(Writer* w, uint8_t byte) {
+  w->buf[w->len] = Writer_hex_digits[byte >> 4];
+  w->buf[w->len + 1] = Writer_hex_digits[byte & 0xf];
+  w->len += 2;
+}
+
+/* Right-aligned in `width` columns, padded with spaces; takes up to
+ * WRITER_MAX_DECIMAL characters of reserved room */
+void Writer_putDecimal(Writer* w, size_t value, size_t width);
+
+#endif // WRITER_H
@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "lexer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "relax.h"
+#include "resolver.h"
+#include "timing.h"
+#include "utility.h"
+#include "vector.h"
+#include "z80asm.h"
+
+struct z80asm_ctx {
+  char* src;         //< The last source, NUL-terminated
+  size_t src_cap;    //< Bytes allocated for `src`
+  Lexer lex;         //< Over `src`
+  Parser parser;     //< The program of the last call, if `has_program`; it points into the struct
+  bool has_program;  //< Set once `parser` is made, so a call that dies still frees it
+  Image img;         //< Laid out by the last call, its data in the caller's buffer
+  bool optimize;
+  char const* fatal; //< Why the last call failed, if it returned Z80ASM_EFATAL
+  uint32_t origin;   //< Of the last binary
+};
+
+static int assemble(z80asm_ctx* ctx);
+static void release(z80asm_ctx* ctx);
+
+z80asm_ctx* z80asm_new(void) { return calloc(1, sizeof(z80asm_ctx)); }
+
+void z80asm_free(z80asm_ctx* ctx) {
+  if (!ctx)
+    return;
+  release(ctx);
+  free(ctx->src);
+  free(ctx);
+}
+
+void z80asm_set_optimize(z80asm_ctx* ctx, bool optimize) {
+  assert(ctx);
+  ctx->optimize = optimize;
+}
+
+int z80asm_assemble(z80asm_ctx* ctx, char const* src, size_t len, uint8_t* out, size_t* outlen) {
+  assert(ctx);
+  assert(src || len == 0);
+  assert(outlen);
+  assert(out || *outlen == 0);
+
+  release(ctx);
+  if (len + 1 > ctx->src_cap) {
+    char* src_copy = realloc(ctx->src, len + 1);
+    if (!src_copy) {
+      ctx->fatal = "realloc() failed";
+      return Z80ASM_EFATAL;
+    }
+    ctx->src = src_copy;
+    ctx->src_cap = len + 1;
+  }
+  if (len)
+    memcpy(ctx->src, src, len);
+  ctx->src[len] = '\0';
+
+  /* Allocation failures and the limits of the assembler end up in die(),
+   * in this thread or, through the pool, in those emitting the banks */
+  DieTrap trap;
+  if (setjmp(trap.env)) {
+    release(ctx);
+    ctx->fatal = trap.message;
+    return Z80ASM_EFATAL;
+  }
+  DieTrap_push(&trap);
+  int const status = assemble(ctx);
+  if (status != Z80ASM_OK) {
+    DieTrap_pop(&trap);
+    return status;
+  }
+
+  Image* img = &ctx->img;
+  if (img->len > *outlen) {
+    DieTrap_pop(&trap);
+    *outlen = img->len;
+    return Z80ASM_ENOSPC;
+  }
+
+  memset(out, 0, img->len);
+  img->data = out;
+  Image_emit(img, ctx->parser.nodes);
+  DieTrap_pop(&trap);
+  ctx->origin = img->base;
+  *outlen = img->len;
+  return Z80ASM_OK;
+}
+
+uint32_t z80asm_origin(z80asm_ctx const* ctx) {
+  assert(ctx);
+  return ctx->origin;
+}
+
+size_t z80asm_error_count(z80asm_ctx const* ctx) {
+  assert(ctx);
+  if (ctx->fatal)
+    return 1;
+  return ctx->has_program ? Vector_len(ctx->parser.errors) : 0;
+}
+
+char const* z80asm_error(z80asm_ctx const* ctx, size_t i, size_t* line, size_t* col) {
+  assert(ctx);
+  assert(i < z80asm_error_count(ctx));
+
+  if (ctx->fatal) {
+    if (line)
+      *line = 0;
+    if (col)
+      *col = 0;
+    return ctx->fatal;
+  }
+
+  ParserError const* err = Vector_at(ctx->parser.errors, i);
+  if (line)
+    *line = err->lineno;
+  if (col)
+    *col = err->col;
+  return err->reason;
+}
+
+char const* z80asm_strerror(int status) {
+  switch (status) {
+  case Z80ASM_OK:
+    return "success";
+  case Z80ASM_ESOURCE:
+    return "the source has errors";
+  case Z80ASM_ENOSPC:
+    return "the output buffer is too small";
+  case Z80ASM_EFATAL:
+    return "the assembler failed";
+  default:
+    return "unknown status";
+  }
+}
+
+/* Parse the source in `ctx->src` and lay out its program, as the
+ * command line does (see check() in main.c)
+ *
+ * @returns A z80asm_status
+ */
+static int assemble(z80asm_ctx* ctx) {
+  ctx->lex = Lexer_make(ctx->src);
+  ctx->parser = Parser_make(&ctx->lex);
+  ctx->has_program = true;
+
+  Parser* p = &ctx->parser;
+  Parser_parse(p);
+  if (!Parser_hasErrors(p)) {
+    if (ctx->optimize)
+      Peephole_optimize(&p->resolver);
+    Relax_branches(&p->resolver);
+    Resolver_checkBanks(&p->resolver);
+    Timing_checkAssertions(&p->resolver, p->cycle_assertions);
+  }
+  if (Parser_hasErrors(p))
+    return Z80ASM_ESOURCE;
+
+  ctx->img = Image_layout(p->nodes);
+  return Z80ASM_OK;
+}
+
+/* Forget the last call */
+static void release(z80asm_ctx* ctx) {
+  if (ctx->has_program)
+    Parser_deinit(&ctx->parser);
+  ctx->has_program = false;
+  ctx->img.data = NULL;
+  Image_deinit(&ctx->img);
+  ctx->img = (Image){0};
+  ctx->fatal = NULL;
+  ctx->origin = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef Z80ASM_H
+#define Z80ASM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The interface of libz80asmc, for assembling in-process
+ *
+ * A context holds what an assembly needs and keeps its buffers from one
+ * call to the next, so a tool assembling many variants of a source only
+ * pays for the work. Contexts share nothing: each may be used by one
+ * thread at a time, alongside others in other threads. No file is read or
+ * written and the process never exits; failures come back as a status.
+ */
+
+#define Z80ASM_API __attribute__((visibility("default")))
+
+typedef struct z80asm_ctx z80asm_ctx;
+
+typedef enum {
+  Z80ASM_OK = 0,
+  Z80ASM_ESOURCE, //< The source has errors, see z80asm_error()
+  Z80ASM_ENOSPC,  //< The output doesn't fit, `*outlen` is the size it needs
+  Z80ASM_EFATAL,  //< Out of memory, or past a limit of the assembler, see z80asm_error()
+} z80asm_status;
+
+/* @returns A new context, or NULL if out of memory */
+Z80ASM_API z80asm_ctx* z80asm_new(void);
+Z80ASM_API void z80asm_free(z80asm_ctx* ctx);
+
+/* Run the peephole optimizer in the following calls (off by default) */
+Z80ASM_API void z80asm_set_optimize(z80asm_ctx* ctx, bool optimize);
+
+/* Assemble `len` bytes of source into a raw binary
+ *
+ * The source needn't end in NUL, and stops at one. `*outlen` is the size of
+ * `out` on entry, and that of the binary on return; it starts at the
+ * address z80asm_origin() gives and ORG gaps are zero, as with -f bin.
+ * Should it not fit, nothing is written and `*outlen` is set to the size
+ * needed.
+ *
+ * @returns A z80asm_status
+ */
+Z80ASM_API int z80asm_assemble(z80asm_ctx* ctx, char const* src, size_t len, uint8_t* out, size_t* outlen);
+
+/* @returns The address of the first byte of the last binary */
+Z80ASM_API uint32_t z80asm_origin(z80asm_ctx const* ctx);
+
+/* The errors of the last call, valid until the next one
+ *
+ * @returns How many errors z80asm_error() has
+ */
+Z80ASM_API size_t z80asm_error_count(z80asm_ctx const* ctx);
+
+/* @returns The message of error `i`, with its 1-based line and column
+ *          stored if `line` and `col` aren't NULL (0 for Z80ASM_EFATAL) */
+Z80ASM_API char const* z80asm_error(z80asm_ctx const* ctx, size_t i, size_t* line, size_t* col);
+
+/* @returns A description of a z80asm_status */
+Z80ASM_API char const* z80asm_strerror(int status);
+
+#endif // Z80ASM_H
@@ -1,7 +1,20 @@
 #ifndef TEST_COMMON_H
 #define TEST_COMMON_H
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utility.h>
 
 #define STRINGIZE(EXP) #EXP
 
@@ -63,4 +76,108 @@
     tests_failed += failed;                                                                                            \
   } while (0)
 
+#define TEST_DIR_TEMPLATE "/tmp/z80asmc_testXXXXXX"
+#define TEST_DIR_MAX_FILES 8
+
+/* A temporary directory for the files of a test */
+typedef struct {
+  char path[sizeof(TEST_DIR_TEMPLATE)];
+  char* files[TEST_DIR_MAX_FILES]; //< Paths of the files written so far
+  size_t n_files;
+} TestDir;
+
+/* @returns 0 on success, 1 on failure */
+static inline int TestDir_make(TestDir* d) {
+  memset(d, 0, sizeof(*d));
+  strcpy(d->path, TEST_DIR_TEMPLATE);
+  CHECK(mkdtemp(d->path), (void)0);
+  return 0;
+}
+
+/* The path of `name` in the directory, to be freed */
+static inline char* TestDir_path(TestDir const* d, char const* name) {
+  char* path = dsprintf("%s/%s", d->path, name);
+  if (!path)
+    die("dsprintf() failed");
+  return path;
+}
+
+/* Write a file of the directory, each write a second later than the one
+ * before so that the file shows as changed
+ *
+ * @returns The path of the file, which lasts as long as the directory; NULL
+ *   on failure
+ */
+static inline char const* TestDir_write(TestDir* d, char const* name, void const* data, size_t len) {
+  static time_t mtime = 1000;
+  char* path = TestDir_path(d, name);
+  size_t i = 0;
+  while (i < d->n_files && strcmp(d->files[i], path) != 0)
+    ++i;
+  if (i < d->n_files) {
+    free(path);
+    path = d->files[i];
+  } else if (d->n_files < TEST_DIR_MAX_FILES) {
+    d->files[d->n_files++] = path;
+  } else {
+    free(path);
+    return NULL;
+  }
+
+  FILE* f = fopen(path, "wb");
+  if (!f)
+    return NULL;
+  size_t const written = fwrite(data, 1, len, f);
+  if (fclose(f) != 0 || written != len)
+    return NULL;
+  struct timespec const times[] = {{.tv_sec = mtime}, {.tv_sec = mtime}};
+  mtime += 1;
+  return utimensat(AT_FDCWD, path, times, 0) == 0 ? path : NULL;
+}
+
+static inline char const* TestDir_writeText(TestDir* d, char const* name, char const* text) {
+  return TestDir_write(d, name, text, strlen(text));
+}
+
+/* Remove the directory, with the files written and those left by the test */
+static inline void TestDir_remove(TestDir* d) {
+  DIR* dir = opendir(d->path);
+  if (dir) {
+    struct dirent const* entry;
+    while ((entry = readdir(dir)) != NULL)
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        unlinkat(dirfd(dir), entry->d_name, 0);
+    closedir(dir);
+  }
+  rmdir(d->path);
+  for (size_t i = 0; i < d->n_files; ++i)
+    free(d->files[i]);
+  d->n_files = 0;
+}
+
+/* Run a program in the directory, with its standard error into `err`
+ *
+ * @returns The exit status of the program, -1 if it couldn't run to the end
+ */
+static inline int TestDir_run(TestDir const* d, char const* const* argv, char* err, size_t err_len) {
+  FILE* ferr = tmpfile();
+  if (!ferr)
+    return -1;
+  fflush(NULL);
+  pid_t const pid = fork();
+  if (pid == 0) {
+    if (chdir(d->path) == 0 && dup2(fileno(ferr), STDERR_FILENO) != -1)
+      execv(argv[0], (char* const*)(uintptr_t)argv); // execv() doesn't change them
+    _exit(127);
+  }
+
+  int status = 0;
+  bool const ran = pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status);
+  rewind(ferr);
+  size_t const len = ran ? fread(err, 1, err_len - 1, ferr) : 0;
+  err[len] = '\0';
+  fclose(ferr);
+  return ran ? WEXITSTATUS(status) : -1;
+}
+
 #endif // TEST_COMMON_H
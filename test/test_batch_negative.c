@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+static int testBatchFail(char const* const* args, char const* reason, char const* written, char const* missing);
+
+int main(void) {
+  int tests_failed = 0;
+
+  // Sources with the same output are refused before anything is written
+  {
+    char const* args[] = {"a.asm", "a.s", NULL};
+    TEST_CASE(testBatchFail(args, "a.s: the output a.bin would overwrite that of a.asm\n", NULL, "a.bin"));
+  }
+  {
+    char const* args[] = {"a.asm", "./a.asm", NULL};
+    TEST_CASE(testBatchFail(args, "./a.asm: the output ./a.bin would overwrite that of a.asm\n", NULL, "a.bin"));
+  }
+  {
+    char const* args[] = {"-c", "@list.txt", "a.s", NULL};
+    TEST_CASE(testBatchFail(args, "a.s: the output a.o would overwrite that of a.asm\n", NULL, "a.o"));
+  }
+
+  // Other failures are the source's own
+  {
+    char const* args[] = {"b.bin", "a.asm", NULL};
+    TEST_CASE(testBatchFail(args, "b.bin: the output would overwrite the source\n", "a.bin", NULL));
+  }
+  {
+    char const* args[] = {"missing.asm", "a.asm", NULL};
+    TEST_CASE(testBatchFail(args, "missing.asm: No such file or directory\n", "a.bin", NULL));
+  }
+  {
+    char const* args[] = {"a.asm", "@missing.txt", NULL};
+    TEST_CASE(testBatchFail(args, "missing.txt: No such file or directory\n", NULL, "a.bin"));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* A batch of `args`, in a directory with a.asm, a.s and list.txt naming
+ * a.asm, fails with `reason`, having written `written` but not `missing` */
+static int testBatchFail(char const* const* args, char const* reason, char const* written, char const* missing) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  CHECK(TestDir_writeText(&d, "a.asm", "ld a, 1\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "a.s", "nop\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "list.txt", "a.asm\n"), TestDir_remove(&d));
+
+  char const* argv[8] = {Z80ASMC};
+  for (size_t i = 0; args[i]; ++i)
+    argv[i + 1] = args[i];
+  char err[512];
+  int const rc = TestDir_run(&d, argv, err, sizeof(err));
+
+  char* written_path = written ? TestDir_path(&d, written) : NULL;
+  char* missing_path = missing ? TestDir_path(&d, missing) : NULL;
+  bool const was_written = !written || access(written_path, F_OK) == 0;
+  bool const was_missing = !missing || access(missing_path, F_OK) == -1;
+  free(written_path);
+  free(missing_path);
+  TestDir_remove(&d);
+
+  CHECK_EQUAL(rc, 1, (void)0);
+  CHECK_STREQUAL(err, reason, (void)0);
+  CHECK(was_written, (void)0);
+  CHECK(was_missing, (void)0);
+  return 0;
+}
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+static int testBatch(void);
+static int testList(void);
+static int testIsolated(void);
+static int checkFile(TestDir const* d, char const* name, void const* expected, size_t len);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testBatch());
+  TEST_CASE(testList());
+  TEST_CASE(testIsolated());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Each source goes to its own output, named after it in the format asked */
+static int testBatch(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  CHECK(TestDir_writeText(&d, "a.asm", "ld a, 1\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "b.s", "nop\nret\n"), TestDir_remove(&d));
+
+  char err[512];
+  char const* bin[] = {Z80ASMC, "a.asm", "b.s", NULL};
+  int result = TestDir_run(&d, bin, err, sizeof(err)) != 0 || err[0];
+  if (!result)
+    result = checkFile(&d, "a.bin", "\x3e\x01", 2) || checkFile(&d, "b.bin", "\x00\xc9", 2);
+
+  char const* ihex[] = {Z80ASMC, "-f", "ihex", "a.asm", "b.s", NULL};
+  if (!result)
+    result = TestDir_run(&d, ihex, err, sizeof(err)) != 0 || err[0];
+  char const a_hex[] = ":020000003E01BF\n:00000001FF\n";
+  char const b_hex[] = ":0200000000C935\n:00000001FF\n";
+  if (!result)
+    result = checkFile(&d, "a.hex", a_hex, strlen(a_hex)) || checkFile(&d, "b.hex", b_hex, strlen(b_hex));
+
+  TestDir_remove(&d);
+  CHECK(!result, fprintf(stderr, "%s", err));
+  return 0;
+}
+
+/* A list names a source per line, blanks around it and blank lines aside,
+ * and mixes with sources named directly */
+static int testList(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  CHECK(TestDir_writeText(&d, "a.asm", "ld a, 1\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "b.asm", "nop\nret\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "c.asm", "ret\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "sources.txt", "\n  a.asm\n\n\tb.asm  \n"), TestDir_remove(&d));
+
+  char err[512];
+  char const* argv[] = {Z80ASMC, "c.asm", "@sources.txt", NULL};
+  int result = TestDir_run(&d, argv, err, sizeof(err)) != 0 || err[0];
+  if (!result)
+    result = checkFile(&d, "a.bin", "\x3e\x01", 2) || checkFile(&d, "b.bin", "\x00\xc9", 2) ||
+             checkFile(&d, "c.bin", "\xc9", 1);
+
+  TestDir_remove(&d);
+  CHECK(!result, fprintf(stderr, "%s", err));
+  return 0;
+}
+
+/* A source that fails doesn't keep the others from their outputs, and the
+ * reports come in the order of the sources, whatever the order they are
+ * assembled in */
+static int testIsolated(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  CHECK(TestDir_writeText(&d, "bad1.asm", "ld a, 300\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "good.asm", "ld a, 1\n"), TestDir_remove(&d));
+  CHECK(TestDir_writeText(&d, "bad2.asm", "nop\nnop\nnop\nnop\nbogus\n"), TestDir_remove(&d));
+
+  char const expected[] = "bad1.asm:1:9: error: value 300 does not fit in 1 byte(s)\n"
+                          "ld a, 300\n"
+                          "        ^\n"
+                          "bad2.asm:5:1: error: unknown instruction: bogus\n";
+  char err[512];
+  char const* argv[] = {Z80ASMC, "bad1.asm", "good.asm", "bad2.asm", NULL};
+  int result = 0;
+  for (int i = 0; i < 3 && !result; ++i) {
+    result = TestDir_run(&d, argv, err, sizeof(err)) != 1 || strncmp(err, expected, strlen(expected)) != 0;
+    if (!result)
+      result = checkFile(&d, "good.bin", "\x3e\x01", 2);
+  }
+
+  TestDir_remove(&d);
+  CHECK(!result, fprintf(stderr, "%s", err));
+  return 0;
+}
+
+/* The file of the directory holds `expected` */
+static int checkFile(TestDir const* d, char const* name, void const* expected, size_t len) {
+  char* path = TestDir_path(d, name);
+  FILE* f = fopen(path, "rb");
+  free(path);
+  CHECK(f, (void)0);
+  char buf[64];
+  size_t const n_read = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  CHECK(n_read == len && memcmp(buf, expected, len) == 0, (void)0);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cache.h>
+
+#include "common.h"
+
+#define ENTRY_HEADER_LEN 24
+
+static int testRoundTrip(void);
+static int testMiss(void);
+static int testEviction(void);
+static int checkEntry(Cache* c, uint64_t key, char const* expected);
+static int setUse(Cache const* c, uint64_t key, time_t when);
+static void removeCache(Cache* c);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testRoundTrip());
+  TEST_CASE(testMiss());
+  TEST_CASE(testEviction());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testRoundTrip(void) {
+  char dir[] = TEST_DIR_TEMPLATE;
+  CHECK(mkdtemp(dir), (void)0);
+  Cache c;
+  CHECK_EQUAL(Cache_open(&c, dir, 1 << 20), 0, rmdir(dir));
+
+  CHECK_EQUAL(Cache_put(&c, 1, "\x3e\x01", 2), 0, removeCache(&c));
+  CHECK_EQUAL(Cache_put(&c, 2, "", 0), 0, removeCache(&c));
+  CHECK_EQUAL(checkEntry(&c, 1, "\x3e\x01"), 0, removeCache(&c));
+  CHECK_EQUAL(checkEntry(&c, 2, ""), 0, removeCache(&c));
+
+  // A later put replaces the entry
+  CHECK_EQUAL(Cache_put(&c, 1, "\xc9", 1), 0, removeCache(&c));
+  CHECK_EQUAL(checkEntry(&c, 1, "\xc9"), 0, removeCache(&c));
+
+  removeCache(&c);
+  return 0;
+}
+
+static int testMiss(void) {
+  char dir[] = TEST_DIR_TEMPLATE;
+  CHECK(mkdtemp(dir), (void)0);
+  Cache c;
+  CHECK_EQUAL(Cache_open(&c, dir, 1 << 20), 0, rmdir(dir));
+
+  CacheEntry e;
+  CHECK_EQUAL(Cache_get(&c, 1, &e), -1, removeCache(&c));
+
+  // A truncated entry is a miss, not a short output
+  CHECK_EQUAL(Cache_put(&c, 1, "\x00\x01\x02\x03", 4), 0, removeCache(&c));
+  char path[sizeof(TEST_DIR_TEMPLATE) + 32];
+  snprintf(path, sizeof(path), "%s/%016llx", dir, 1ull);
+  CHECK_EQUAL(truncate(path, ENTRY_HEADER_LEN + 2), 0, removeCache(&c));
+  CHECK_EQUAL(Cache_get(&c, 1, &e), -1, removeCache(&c));
+
+  removeCache(&c);
+  return 0;
+}
+
+/* With room for two entries, a third evicts the least recently used one */
+static int testEviction(void) {
+  char dir[] = TEST_DIR_TEMPLATE;
+  CHECK(mkdtemp(dir), (void)0);
+  Cache c;
+  CHECK_EQUAL(Cache_open(&c, dir, 2 * (ENTRY_HEADER_LEN + 4)), 0, rmdir(dir));
+
+  CHECK_EQUAL(Cache_put(&c, 1, "aaaa", 4), 0, removeCache(&c));
+  CHECK_EQUAL(Cache_put(&c, 2, "bbbb", 4), 0, removeCache(&c));
+  CHECK_EQUAL(setUse(&c, 1, 1000), 0, removeCache(&c));
+  CHECK_EQUAL(setUse(&c, 2, 2000), 0, removeCache(&c));
+
+  // The hit makes 1 the most recently used, so 2 goes
+  CHECK_EQUAL(checkEntry(&c, 1, "aaaa"), 0, removeCache(&c));
+  CHECK_EQUAL(Cache_put(&c, 3, "cccc", 4), 0, removeCache(&c));
+
+  CacheEntry e;
+  CHECK_EQUAL(Cache_get(&c, 2, &e), -1, removeCache(&c));
+  CHECK_EQUAL(checkEntry(&c, 1, "aaaa"), 0, removeCache(&c));
+  CHECK_EQUAL(checkEntry(&c, 3, "cccc"), 0, removeCache(&c));
+
+  removeCache(&c);
+  return 0;
+}
+
+static int checkEntry(Cache* c, uint64_t key, char const* expected) {
+  CacheEntry e;
+  CHECK_EQUAL(Cache_get(c, key, &e), 0, (void)0);
+  size_t const len = strlen(expected);
+  CHECK_EQUAL(e.len, len, CacheEntry_release(&e));
+  CHECK(memcmp(e.data, expected, len) == 0, CacheEntry_release(&e));
+  CacheEntry_release(&e);
+  return 0;
+}
+
+static int setUse(Cache const* c, uint64_t key, time_t when) {
+  char path[sizeof(TEST_DIR_TEMPLATE) + 32];
+  snprintf(path, sizeof(path), "%s/%016llx", c->dir, (unsigned long long)key);
+  struct timespec const times[2] = {{.tv_sec = when}, {.tv_sec = when}};
+  return utimensat(AT_FDCWD, path, times, 0);
+}
+
+static void removeCache(Cache* c) {
+  DIR* dir = opendir(c->dir);
+  if (dir) {
+    struct dirent* d;
+    while ((d = readdir(dir)) != NULL)
+      if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0)
+        unlinkat(dirfd(dir), d->d_name, 0);
+    closedir(dir);
+  }
+  rmdir(c->dir);
+  Cache_close(c);
+}
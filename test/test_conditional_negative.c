@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <parser.h>
+
+#include "common.h"
+
+static int testConditionalFail(char const* src, char const* reason, size_t lineno);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testConditionalFail("  if later\n  nop\n  endif\nlater:\n",
+                                "IF condition must be known at this point: later has no value", 1));
+  TEST_CASE(testConditionalFail("  if 1 / 0\n  endif\n", "division by zero", 1));
+  TEST_CASE(testConditionalFail("  nop\n  if 1\n  nop\n", "IF without ENDIF", 2));
+  TEST_CASE(testConditionalFail("  ifdef x\n  if 1\n  endif\n", "IFDEF without ENDIF", 1));
+  TEST_CASE(testConditionalFail("  nop\n  else\n", "ELSE without IF", 2));
+  TEST_CASE(testConditionalFail("  endif\n", "ENDIF without IF", 1));
+  TEST_CASE(testConditionalFail("  if 1\n  else\n  else\n  endif\n", "ELSE after ELSE", 3));
+  TEST_CASE(testConditionalFail("  if 1\n  else x\n  endif\n", "excessive characters after ELSE: x", 2));
+  TEST_CASE(testConditionalFail("  if 1\n  endif x\n", "excessive characters after ENDIF: x", 2));
+  TEST_CASE(testConditionalFail("  ifdef x y\n  endif\n", "excessive characters after the condition: y", 1));
+  TEST_CASE(testConditionalFail("  ifdef 3\n  endif\n", "expected a symbol name", 1));
+  TEST_CASE(testConditionalFail("  ifndef\n  endif\n", "expected a symbol name", 2));
+
+  // Errors in a branch taken point at its lines
+  TEST_CASE(testConditionalFail("  if 1\n  nop\n  bad\n  endif\n", "unknown instruction: bad", 3));
+  TEST_CASE(testConditionalFail("  if 0\n  else\n  nop\n  ld a, 300\n  endif\n", "value 300 does not fit", 4));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The only error starts with `reason`, at `lineno` */
+static int testConditionalFail(char const* src, char const* reason, size_t lineno) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, (fprintf(stderr, "%zu errors\n", Vector_len(p.errors)), Parser_deinit(&p)));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK(strncmp(err->reason, reason, strlen(reason)) == 0,
+        (fprintf(stderr, "%s\n", err->reason), Parser_deinit(&p)));
+  CHECK_EQUAL(err->lineno, lineno, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
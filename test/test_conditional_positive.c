@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <image.h>
+#include <include.h>
+#include <parser.h>
+#include <pipeline.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testIf(void);
+static int testIfdef(void);
+static int testNested(void);
+static int testMacro(void);
+static int testIncluded(void);
+static int testLines(void);
+static int checkSame(IncludeCache* c, char const* src, char const* expected);
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testIf());
+  TEST_CASE(testIfdef());
+  TEST_CASE(testNested());
+  TEST_CASE(testMacro());
+  TEST_CASE(testIncluded());
+  TEST_CASE(testLines());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The condition is evaluated with the symbols defined so far */
+static int testIf(void) {
+  CHECK_EQUAL(checkSame(NULL, "if 1\n  nop\nelse\n  halt x\nendif\n", "nop\n"), 0, (void)0);
+  CHECK_EQUAL(checkSame(NULL, "IF 2 - 2\n  halt x\nELSE\n  nop\nENDIF\n", "nop\n"), 0, (void)0);
+  CHECK_EQUAL(checkSame(NULL, "if 0\n  halt x\nendif\n  nop\n", "nop\n"), 0, (void)0);
+  CHECK_EQUAL(checkSame(NULL, "if 1\nendif\nif 0\nelse\nendif\n  nop\n", "nop\n"), 0, (void)0);
+  CHECK_EQUAL(checkSame(NULL,
+                        "SIZE equ 4\n"
+                        "start: nop\n"
+                        "  if SIZE > 2 && start == 0\n"
+                        "    ld a, SIZE\n"
+                        "  endif\n",
+                        "nop\nld a, 4\n"),
+              0, (void)0);
+  CHECK_EQUAL(checkSame(NULL,
+                        "n defl 1\n"
+                        "  if n\n"
+                        "n defl 0\n"
+                        "  endif\n"
+                        "  if n\n"
+                        "    halt x\n"
+                        "  else\n"
+                        "    ld b, n\n"
+                        "  endif\n",
+                        "ld b, 0\n"),
+              0, (void)0);
+  return 0;
+}
+
+/* IFDEF and IFNDEF go by labels and constants defined so far */
+static int testIfdef(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "here: nop\n"
+                        "  ifdef here\n"
+                        "    ld a, 1\n"
+                        "  endif\n"
+                        "  ifdef there\n"
+                        "    ld a, 2\n"
+                        "  endif\n"
+                        "  ifndef there\n"
+                        "    ld a, 3\n"
+                        "  else\n"
+                        "    ld a, 4\n"
+                        "  endif\n"
+                        "there equ 5\n",
+                        "nop\nld a, 1\nld a, 3\n"),
+              0, (void)0);
+
+  /* A symbol used before its definition is no defined one */
+  CHECK_EQUAL(checkSame(NULL, "  jp later\n  ifdef later\n  nop\n  endif\nlater:\n", "jp 3\n"), 0, (void)0);
+  return 0;
+}
+
+/* Lines of a branch not taken are never parsed, nested conditionals and
+ * all */
+static int testNested(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "  if 0\n"
+                        "    if ((\n"
+                        "      ld a, +\n"
+                        "    else garbage\n"
+                        "    endif\n"
+                        "    \"unterminated\n"
+                        "  else\n"
+                        "    if 1\n"
+                        "      ld a, 1\n"
+                        "      ifndef x\n"
+                        "        ld a, 2\n"
+                        "      endif\n"
+                        "    else\n"
+                        "      ld a, 3\n"
+                        "    endif\n"
+                        "  endif\n",
+                        "ld a, 1\nld a, 2\n"),
+              0, (void)0);
+  return 0;
+}
+
+/* A conditional in a macro body is parsed for each expansion, with the
+ * arguments spliced into its lines too */
+static int testMacro(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "put macro n, r\n"
+                        "  if n > 1\n"
+                        "    ld r, n\n"
+                        "    if n > 2\n"
+                        "      sub r\n"
+                        "    endif\n"
+                        "  else\n"
+                        "    xor r\n"
+                        "  endif\n"
+                        "  endm\n"
+                        "  put 2, b\n"
+                        "  put 1, c\n"
+                        "  put 3, d\n"
+                        "  put 2, b\n",
+                        "ld b, 2\nxor c\nld d, 3\nsub d\nld b, 2\n"),
+              0, (void)0);
+  return 0;
+}
+
+/* A conditional in an included file works as in the main one */
+static int testIncluded(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* path = TestDir_writeText(
+      &d, "config.inc", "  ifndef DONE\nDONE equ 1\n  if FAST\n  ld a, 1\n  endif\n  else\n  ld a, 2\n  endif\n");
+  CHECK(path, TestDir_remove(&d));
+  char* src = dsprintf("FAST equ 1\n  include \"%s\"\n  include \"%s\"\n", path, path);
+  CHECK(src, TestDir_remove(&d));
+
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int const result = checkSame(&c, src, "ld a, 1\nld a, 2\n");
+  IncludeCache_deinit(&c);
+  TestDir_remove(&d);
+  free(src);
+  return result;
+}
+
+/* The statements of a branch keep their own lines */
+static int testLines(void) {
+  Lexer lex = Lexer_make("  nop\n  if 1\n  nop\n\n  nop\n  endif\n");
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+  CHECK_EQUAL(Vector_len(p.nodes), 3, Parser_deinit(&p));
+  size_t const lines[] = {1, 3, 5};
+  for (size_t i = 0; i < 3; ++i) {
+    IRNode const* node = Vector_at(p.nodes, i);
+    CHECK_EQUAL(node->data.instruction.line, lines[i], Parser_deinit(&p));
+  }
+  Parser_deinit(&p);
+  return 0;
+}
+
+/* The program is the one of `expected`, with or without the pipeline */
+static int checkSame(IncludeCache* c, char const* src, char const* expected) {
+  Image wanted;
+  CHECK_EQUAL(assemble(NULL, expected, false, &wanted), 0, (void)0);
+  for (int i = 0; i < 2; ++i) {
+    Image actual;
+    CHECK_EQUAL(assemble(c, src, i == 1, &actual), 0, Image_deinit(&wanted));
+    int const result = actual.base != wanted.base || actual.len != wanted.len ||
+                       (actual.len && memcmp(actual.data, wanted.data, actual.len) != 0);
+    Image_deinit(&actual);
+    CHECK(!result, Image_deinit(&wanted));
+  }
+  Image_deinit(&wanted);
+  return 0;
+}
+
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  if (pipelined)
+    Pipeline_parse(&p);
+  else
+    Parser_parse(&p);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  int const result = Parser_hasErrors(&p);
+  if (!result)
+    *img = Image_fromIR(p.nodes);
+  Parser_deinit(&p);
+  return result;
+}
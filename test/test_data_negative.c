@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <include.h>
+#include <parser.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testDataFail(IncludeCache* c, char const* src, char const* reason, size_t lineno);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testDataFail(NULL, "nop\ndb 1, 300\n", "value 300 does not fit in 1 byte(s)", 2));
+  TEST_CASE(testDataFail(NULL, "dw 70000\n", "value 70000 does not fit in 2 byte(s)", 1));
+  TEST_CASE(testDataFail(NULL, "db 1,\n", "expected a list of bytes and strings", 1));
+  TEST_CASE(testDataFail(NULL, "dw , 1\n", "expected a list of words", 1));
+  TEST_CASE(testDataFail(NULL, "db nowhere\n", "undefined symbol: nowhere", 1));
+  TEST_CASE(testDataFail(NULL, "ds later\nlater:\n", "DS count must be known at this point", 1));
+  TEST_CASE(testDataFail(NULL, "ds 70000\n", "DS count 70000 is out of range", 1));
+  TEST_CASE(testDataFail(NULL, "ds -1\n", "DS count -1 is out of range", 1));
+  TEST_CASE(testDataFail(NULL, "ds 1, 300\n", "DS value 300 does not fit in 1 byte(s)", 1));
+  TEST_CASE(testDataFail(NULL, "ds , 1\n", "expected a byte count", 1));
+  TEST_CASE(testDataFail(NULL, "incbin data\n", "expected a file name in quotes", 1));
+  TEST_CASE(testDataFail(NULL, "incbin \"data\"\n", "cannot include files here", 1));
+
+  TestDir d;
+  if (TestDir_make(&d) != 0)
+    return EXIT_FAILURE;
+  char const* path = TestDir_writeText(&d, "data.bin", "ABCD");
+  if (!path)
+    return EXIT_FAILURE;
+  char* missing = dsprintf("incbin \"%s/missing.bin\"\n", d.path);
+  char* past_end = dsprintf("incbin \"%s\", 5\n", path);
+  char* too_long = dsprintf("incbin \"%s\", 1, 4\n", path);
+  if (!missing || !past_end || !too_long)
+    return EXIT_FAILURE;
+
+  IncludeCache c;
+  IncludeCache_init(&c);
+  TEST_CASE(testDataFail(&c, missing, "cannot include", 1));
+  TEST_CASE(testDataFail(&c, past_end, "INCBIN offset 5 is out of the 4 bytes of the file", 1));
+  TEST_CASE(testDataFail(&c, too_long, "INCBIN length 4 is out of the 3 bytes after the offset", 1));
+  IncludeCache_deinit(&c);
+
+  TestDir_remove(&d);
+  free(missing);
+  free(past_end);
+  free(too_long);
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The only error starts with `reason`, at `lineno` */
+static int testDataFail(IncludeCache* c, char const* src, char const* reason, size_t lineno) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  Parser_parse(&p);
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, Parser_deinit(&p));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK(strncmp(err->reason, reason, strlen(reason)) == 0,
+        (fprintf(stderr, "%s\n", err->reason), Parser_deinit(&p)));
+  CHECK_EQUAL(err->lineno, lineno, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
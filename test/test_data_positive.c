@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <image.h>
+#include <include.h>
+#include <instruction.h>
+#include <parser.h>
+#include <pipeline.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testBytes(void);
+static int testWords(void);
+static int testFill(void);
+static int testIncbin(void);
+static int testIncluded(void);
+static int checkImage(IncludeCache* c, char const* src, uint8_t const* expected, size_t len, size_t n_items,
+                      bool pipelined);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testBytes());
+  TEST_CASE(testWords());
+  TEST_CASE(testFill());
+  TEST_CASE(testIncbin());
+  TEST_CASE(testIncluded());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Constants and strings gather into one blob, up to an expression */
+static int testBytes(void) {
+  uint8_t const expected[] = {1, 2, 'h', 'i', '\n', 'x', 0xff, 0x80, 0x0a, 0x09};
+  CHECK_EQUAL(checkImage(NULL, "org 0x100\nstart: db 1, 2, \"hi\\n\", 'x', -1, 0x80, end & 0xff, 9\nend:\n",
+                         expected, sizeof(expected), 3, false),
+              0, (void)0);
+  uint8_t const lone[] = {'a', 0x3e, 0x05};
+  CHECK_EQUAL(checkImage(NULL, "defb 'a'\nld a, 5\n", lone, sizeof(lone), 1, false), 0, (void)0);
+  return 0;
+}
+
+static int testWords(void) {
+  uint8_t const expected[] = {0x34, 0x12, 0x00, 0x01, 0xff, 0xff, 0x08, 0x01};
+  CHECK_EQUAL(checkImage(NULL, "org 0x100\nstart: dw 0x1234, start, -1\ndefw end\nend:\n", expected,
+                         sizeof(expected), 3, false),
+              0, (void)0);
+  return 0;
+}
+
+static int testFill(void) {
+  uint8_t const expected[] = {0xaa, 0xaa, 0xaa, 0x00, 0x00, 0x00};
+  CHECK_EQUAL(checkImage(NULL, "N equ 3\nds N, 0xaa\ndefs 2\nds 0\nnop\n", expected, sizeof(expected), 1, false), 0,
+              (void)0);
+  return 0;
+}
+
+/* The file is mapped once and sliced by every INCBIN of it */
+static int testIncbin(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* path = TestDir_write(&d, "data.bin", "ABCDEFGHIJ", 10);
+  CHECK(path, TestDir_remove(&d));
+  char* src = dsprintf("incbin \"%s\", 2, 3\nincbin \"%s\", 8\nincbin \"%s\"\n", path, path, path);
+  CHECK(src, TestDir_remove(&d));
+
+  int result = 0;
+  uint8_t const expected[] = "CDEIJABCDEFGHIJ";
+  IncludeCache c;
+  IncludeCache_init(&c);
+  for (int i = 0; i < 2 && !result; ++i)
+    result = checkImage(&c, src, expected, sizeof(expected) - 1, 1, i == 1);
+  if (!result && Vector_len(c.files) != 1) {
+    fprintf(stderr, "%zu files cached\n", Vector_len(c.files));
+    result = 1;
+  }
+  IncludeCache_deinit(&c);
+  TestDir_remove(&d);
+  free(src);
+  return result;
+}
+
+/* Data replayed from an included file shares the blobs parsed there */
+static int testIncluded(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* path = TestDir_writeText(&d, "data.inc", "db \"abc\", 1\nds 2, 7\n");
+  CHECK(path, TestDir_remove(&d));
+  char* src = dsprintf("include \"%s\"\ninclude \"%s\"\n", path, path);
+  CHECK(src, TestDir_remove(&d));
+
+  uint8_t const expected[] = {'a', 'b', 'c', 1, 7, 7, 'a', 'b', 'c', 1, 7, 7};
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int const result = checkImage(&c, src, expected, sizeof(expected), 1, false);
+  IncludeCache_deinit(&c);
+  TestDir_remove(&d);
+  free(src);
+  return result;
+}
+
+/* The program is `expected`, and its first node has `n_items` items */
+static int checkImage(IncludeCache* c, char const* src, uint8_t const* expected, size_t len, size_t n_items,
+                      bool pipelined) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  if (pipelined)
+    Pipeline_parse(&p);
+  else
+    Parser_parse(&p);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  IRNode const* first = NULL;
+  for (size_t i = 0; i < Vector_len(p.nodes) && !first; ++i)
+    if (((IRNode*)Vector_at(p.nodes, i))->kind == IR_INSTRUCTION)
+      first = Vector_at(p.nodes, i);
+  CHECK(first && first->data.instruction.is_data, Parser_deinit(&p));
+  CHECK_EQUAL(Vector_len(first->data.instruction.encoded_items), n_items, Parser_deinit(&p));
+
+  Image img = Image_fromIR(p.nodes);
+  Parser_deinit(&p);
+  int const result = img.len != len || memcmp(img.data, expected, len) != 0;
+  Image_deinit(&img);
+  CHECK(!result, (void)0);
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <expression.h>
+#include <exprcode.h>
+#include <lexer.h>
+
+#include "common.h"
+
+/* Symbols x = 7, y = -3; z has no value */
+static char const* const names[] = {"x", "y", "z"};
+static int32_t const values[] = {7, -3, 0};
+
+static int testCompile(char const* input, bool compiles);
+static int testStore(char const* input);
+static Vector* parse(char const* input);
+static uint32_t symbolId(void* ctx, Token const* sym);
+static int lookupId(void* ctx, uint32_t id, int32_t* value);
+static int lookup(void* ctx, Token const* sym, int32_t* value);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testCompile("1", true));
+  TEST_CASE(testCompile("x", true));
+  TEST_CASE(testCompile("x + y * 2", true));
+  TEST_CASE(testCompile("-x + +y - ~x + !y", true));
+  TEST_CASE(testCompile("(x << 3) | (y >> 1) ^ (x & 5)", true));
+  TEST_CASE(testCompile("x * 4 + x / -2", true));
+  TEST_CASE(testCompile("x < y || x > y && x <= 7 && y >= -3", true));
+  TEST_CASE(testCompile("x == 7 != (y != -3)", true));
+  TEST_CASE(testCompile("x << 32 + y >> -1", true));
+  TEST_CASE(testCompile("2147483647 + x", true));
+  TEST_CASE(testCompile("x / (y + 3)", true));
+  TEST_CASE(testCompile("x + z", true));
+  TEST_CASE(testCompile("x +", false));
+
+  TEST_CASE(testStore("x"));
+  TEST_CASE(testStore("-2147483647 - 1 + (y << 3) - 258"));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The bytecode must agree with Expr_eval, failures included */
+static int testCompile(char const* input, bool compiles) {
+  Vector* expr = parse(input);
+  CHECK(expr, NULL);
+
+  uint8_t* code = ExprCode_compile(expr, symbolId, NULL);
+  CHECK((code != NULL) == compiles, Vector_destroy(expr));
+  if (!code) {
+    Vector_destroy(expr);
+    return 0;
+  }
+
+  int32_t expected = 0, result = 0;
+  ExprError err = {0};
+  int const rc = Expr_eval(expr, lookup, NULL, &expected, &err);
+
+  ExprErrorType type = EXPR_NO_ERROR;
+  uint32_t sym = UINT32_MAX;
+  CHECK_EQUAL(ExprCode_eval(code, lookupId, NULL, &result, &type, &sym), rc, (free(code), Vector_destroy(expr)));
+  if (rc == 0) {
+    CHECK_EQUAL(result, expected, (free(code), Vector_destroy(expr)));
+  } else {
+    CHECK_EQUAL(type, err.type, (free(code), Vector_destroy(expr)));
+    if (type == EXPR_ERROR_UNRESOLVED_SYMBOL)
+      CHECK_EQUAL(sym, symbolId(NULL, &err.tok), (free(code), Vector_destroy(expr)));
+  }
+
+  free(code);
+  Vector_destroy(expr);
+  return 0;
+}
+
+/* A stored program loads back the same, and a truncated one doesn't load */
+static int testStore(char const* input) {
+  Vector* expr = parse(input);
+  CHECK(expr, NULL);
+  uint8_t* code = ExprCode_compile(expr, symbolId, NULL);
+  Vector_destroy(expr);
+  CHECK(code, NULL);
+
+  size_t const size = ExprCode_size(code);
+  uint8_t* stored = malloc(size);
+  CHECK(stored, free(code));
+  ExprCode_store(code, stored);
+
+  size_t used = 0;
+  uint8_t* loaded = ExprCode_load(stored, size, &used);
+  CHECK(loaded, (free(code), free(stored)));
+  CHECK_EQUAL(used, size, (free(code), free(stored), free(loaded)));
+  CHECK(memcmp(loaded, code, size) == 0, (free(code), free(stored), free(loaded)));
+  free(loaded);
+
+  CHECK(!ExprCode_load(stored, size - 1, &used), (free(code), free(stored)));
+
+  free(code);
+  free(stored);
+  return 0;
+}
+
+static Vector* parse(char const* input) {
+  Lexer lex = Lexer_make(input);
+  ExprParser parser = ExprParser_make();
+  while (true) {
+    Token tok = Lexer_next(&lex);
+    if (ExprParser_get(&parser, tok) == -1) {
+      ExprParser_deinit(&parser);
+      return NULL;
+    }
+    if (tok.type == TOKEN_END)
+      break;
+  }
+  Vector* expr = ExprParser_copyExpr(&parser);
+  ExprParser_deinit(&parser);
+  return expr;
+}
+
+static uint32_t symbolId(void* ctx, Token const* sym) {
+  (void)ctx;
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(*names); ++i)
+    if (strlen(names[i]) == sym->len && strncmp(names[i], sym->value, sym->len) == 0)
+      return i;
+  return UINT32_MAX;
+}
+
+static int lookupId(void* ctx, uint32_t id, int32_t* value) {
+  (void)ctx;
+  if (id >= 2)
+    return -1;
+  *value = values[id];
+  return 0;
+}
+
+static int lookup(void* ctx, Token const* sym, int32_t* value) { return lookupId(ctx, symbolId(ctx, sym), value); }
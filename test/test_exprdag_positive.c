@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <exprcode.h>
+#include <exprdag.h>
+#include <expression.h>
+#include <lexer.h>
+#include <utility.h>
+
+#include "common.h"
+
+/* Symbols x and y, by ID */
+static char const* const names[] = {"x", "y"};
+
+typedef struct {
+  int32_t values[2];
+  size_t lookups; //< Number of calls to lookup()
+} Symbols;
+
+static int testSharing(void);
+static int testCaching(void);
+static int testDivisionByZero(void);
+static uint32_t intern(ExprDag* dag, char const* input);
+static uint32_t symbolId(void* ctx, Token const* sym);
+static int lookup(void* ctx, uint32_t id, int32_t* value);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testSharing());
+  TEST_CASE(testCaching());
+  TEST_CASE(testDivisionByZero());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testSharing(void) {
+  ExprDag dag = ExprDag_make();
+
+  /* x, y, 2, y * 2, x + y * 2 */
+  uint32_t const root = intern(&dag, "x + y * 2");
+  CHECK_EQUAL(ExprDag_len(&dag), 5, ExprDag_deinit(&dag));
+
+  /* Equal expressions are one node */
+  CHECK_EQUAL(intern(&dag, "x + (y * 2)"), root, ExprDag_deinit(&dag));
+  CHECK_EQUAL(ExprDag_len(&dag), 5, ExprDag_deinit(&dag));
+
+  /* Only the new operator is added */
+  uint32_t const other = intern(&dag, "y * 2 - x");
+  CHECK(other != root, ExprDag_deinit(&dag));
+  CHECK_EQUAL(ExprDag_len(&dag), 6, ExprDag_deinit(&dag));
+
+  /* The subexpression got the program of its own */
+  uint32_t const sub = intern(&dag, "y * 2");
+  CHECK_EQUAL(ExprDag_len(&dag), 6, ExprDag_deinit(&dag));
+  CHECK(ExprDag_code(&dag, sub) != ExprDag_code(&dag, root), ExprDag_deinit(&dag));
+
+  ExprDag_deinit(&dag);
+  return 0;
+}
+
+static int testCaching(void) {
+  ExprDag dag = ExprDag_make();
+  uint32_t const sum = intern(&dag, "x + y * 2");
+  uint32_t const product = intern(&dag, "y * 2");
+
+  Symbols s = {.values = {7, -3}};
+  int32_t value = 0;
+  ExprErrorType err = EXPR_NO_ERROR;
+  uint32_t sym = UINT32_MAX;
+
+  CHECK_EQUAL(ExprDag_eval(&dag, sum, lookup, &s, &value, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(value, 1, ExprDag_deinit(&dag));
+  CHECK_EQUAL(s.lookups, 2, ExprDag_deinit(&dag));
+
+  /* Cached, including the shared subexpression */
+  CHECK_EQUAL(ExprDag_eval(&dag, sum, lookup, &s, &value, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(ExprDag_eval(&dag, product, lookup, &s, &value, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(value, -6, ExprDag_deinit(&dag));
+  CHECK_EQUAL(s.lookups, 2, ExprDag_deinit(&dag));
+
+  /* Only the nodes using x are computed again */
+  s.values[0] = 10;
+  ExprDag_invalidate(&dag, 0);
+  CHECK_EQUAL(ExprDag_eval(&dag, product, lookup, &s, &value, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(s.lookups, 2, ExprDag_deinit(&dag));
+  CHECK_EQUAL(ExprDag_eval(&dag, sum, lookup, &s, &value, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(value, 4, ExprDag_deinit(&dag));
+  CHECK_EQUAL(s.lookups, 3, ExprDag_deinit(&dag));
+
+  /* Same as the bytecode */
+  int32_t expected = 0;
+  CHECK_EQUAL(ExprCode_eval(ExprDag_code(&dag, sum), lookup, &s, &expected, &err, &sym), 0, ExprDag_deinit(&dag));
+  CHECK_EQUAL(value, expected, ExprDag_deinit(&dag));
+
+  ExprDag_deinit(&dag);
+  return 0;
+}
+
+static int testDivisionByZero(void) {
+  ExprDag dag = ExprDag_make();
+  uint32_t const root = intern(&dag, "x / (y - y)");
+
+  Symbols s = {.values = {7, -3}};
+  int32_t value = 0;
+  ExprErrorType err = EXPR_NO_ERROR;
+  uint32_t sym = UINT32_MAX;
+
+  CHECK_EQUAL(ExprDag_eval(&dag, root, lookup, &s, &value, &err, &sym), -1, ExprDag_deinit(&dag));
+  CHECK_EQUAL(err, EXPR_ERROR_DIVISION_BY_ZERO, ExprDag_deinit(&dag));
+
+  ExprDag_deinit(&dag);
+  return 0;
+}
+
+static uint32_t intern(ExprDag* dag, char const* input) {
+  Lexer lex = Lexer_make(input);
+  ExprParser parser = ExprParser_make();
+  while (true) {
+    Token tok = Lexer_next(&lex);
+    if (ExprParser_get(&parser, tok) == -1)
+      die("intern(): invalid expression");
+    if (tok.type == TOKEN_END)
+      break;
+  }
+
+  Vector* expr = ExprParser_copyExpr(&parser);
+  ExprParser_deinit(&parser);
+  uint8_t* code = ExprCode_compile(expr, symbolId, NULL);
+  Vector_destroy(expr);
+  if (!code)
+    die("intern(): malformed expression");
+  return ExprDag_intern(dag, code);
+}
+
+static uint32_t symbolId(void* ctx, Token const* sym) {
+  (void)ctx;
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(*names); ++i)
+    if (strlen(names[i]) == sym->len && strncmp(names[i], sym->value, sym->len) == 0)
+      return i;
+  return UINT32_MAX;
+}
+
+static int lookup(void* ctx, uint32_t id, int32_t* value) {
+  Symbols* s = ctx;
+  s->lookups += 1;
+  if (id >= 2)
+    return -1;
+  *value = s->values[id];
+  return 0;
+}
@@ -11,39 +11,42 @@ typedef struct {
   char const* lit;
   TokenType type;
   bool unary;
+  bool folded;
+  int32_t value; //< Value of a folded token
 } ClueToken;
 
 int testExpression(char const* input, size_t n_tokens, ...);
+int testReuse(void);
 
 int main(void) {
   int tests_failed = 0;
 
   {
-    ClueToken t1 = {.lit = "1", .type = TOKEN_DECIMAL}, t2 = {.lit = "2", .type = TOKEN_DECIMAL},
+    ClueToken t1 = {.lit = "x", .type = TOKEN_ID}, t2 = {.lit = "2", .type = TOKEN_DECIMAL},
               t3 = {.type = TOKEN_PLUS};
-    tests_failed += testExpression("1+2", 3, t1, t2, t3);
+    tests_failed += testExpression("x+2", 3, t1, t2, t3);
   }
 
   {
-    ClueToken t1 = {.lit = "1"}, t2 = {.lit = "2"}, t3 = {.lit = "3"}, t4 = {.type = TOKEN_STAR},
+    ClueToken t1 = {.lit = "x"}, t2 = {.lit = "y"}, t3 = {.lit = "z"}, t4 = {.type = TOKEN_STAR},
               t5 = {.type = TOKEN_PLUS};
-    tests_failed += testExpression("1+2*3", 5, t1, t2, t3, t4, t5);
+    tests_failed += testExpression("x+y*z", 5, t1, t2, t3, t4, t5);
   }
 
   {
-    ClueToken t1 = {.lit = "1"}, t2 = {.lit = "2"}, t3 = {.type = TOKEN_PLUS}, t4 = {.lit = "3"},
+    ClueToken t1 = {.lit = "x"}, t2 = {.lit = "y"}, t3 = {.type = TOKEN_PLUS}, t4 = {.lit = "z"},
               t5 = {.type = TOKEN_STAR};
-    tests_failed += testExpression("(1+2)*3", 5, t1, t2, t3, t4, t5);
+    tests_failed += testExpression("(x+y)*z", 5, t1, t2, t3, t4, t5);
   }
 
   {
-    ClueToken t1 = {.lit = "1"}, t2 = {.type = TOKEN_MINUS, .unary = true};
-    tests_failed += testExpression("-1", 2, t1, t2);
+    ClueToken t1 = {.lit = "x"}, t2 = {.type = TOKEN_MINUS, .unary = true};
+    tests_failed += testExpression("-x", 2, t1, t2);
   }
 
   {
-    ClueToken t1 = {.lit = "1"}, t2 = {.type = TOKEN_PLUS, .unary = true}, t3 = {.type = TOKEN_MINUS, .unary = true};
-    tests_failed += testExpression("-(+1)", 3, t1, t2, t3);
+    ClueToken t1 = {.lit = "x"}, t2 = {.type = TOKEN_PLUS, .unary = true}, t3 = {.type = TOKEN_MINUS, .unary = true};
+    tests_failed += testExpression("-(+x)", 3, t1, t2, t3);
   }
 
   {
@@ -85,9 +88,65 @@ int main(void) {
     tests_failed += testExpression("a == b != c == d", 7, t1, t2, t3, t4, t5, t6, t7);
   }
 
+  {
+    // Constant subexpressions are folded
+    ClueToken t1 = {.folded = true, .value = 13};
+    tests_failed += testExpression("3*4+1", 1, t1);
+  }
+
+  {
+    ClueToken t1 = {.folded = true, .value = -9};
+    tests_failed += testExpression("-(1+2)*3", 1, t1);
+  }
+
+  {
+    // x 7 + 1 -: only the constant operands of an operator fold
+    ClueToken t1 = {.lit = "x"}, t2 = {.folded = true, .value = 7}, t3 = {.type = TOKEN_PLUS}, t4 = {.lit = "1"},
+              t5 = {.type = TOKEN_MINUS};
+    tests_failed += testExpression("x + (2+5) - 1", 5, t1, t2, t3, t4, t5);
+  }
+
+  {
+    // Division by zero is left for evaluation to report
+    ClueToken t1 = {.lit = "1"}, t2 = {.folded = true, .value = 0}, t3 = {.type = TOKEN_SLASH};
+    tests_failed += testExpression("1/(2-2)", 3, t1, t2, t3);
+  }
+
+  tests_failed += testReuse();
+
   return tests_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+/* One parser for several expressions, the first of which outgrows the
+ * inline stacks */
+int testReuse(void) {
+  char const* const inputs[] = {"((((((((((x+y)))))))))) * (x-(y-(x-(y-(x-y)))))", "x-1", "2*(3+4)"};
+  size_t const lengths[] = {15, 3, 1};
+
+  ExprParser parser = ExprParser_make();
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); ++i) {
+    ExprParser_reset(&parser);
+    Lexer lex = Lexer_make(inputs[i]);
+    while (true) {
+      Token tok = Lexer_next(&lex);
+      CHECK(ExprParser_get(&parser, tok) == 0, ExprParser_deinit(&parser));
+      if (tok.type == TOKEN_END)
+        break;
+    }
+
+    Vector* expr = ExprParser_copyExpr(&parser);
+    size_t const len = Vector_len(expr);
+    Vector_destroy(expr);
+    CHECK(len == lengths[i], ExprParser_deinit(&parser));
+  }
+
+  int32_t value = 0;
+  CHECK(ExprParser_isConstant(&parser, &value) && value == 14, ExprParser_deinit(&parser));
+
+  ExprParser_deinit(&parser);
+  return 0;
+}
+
 int testExpression(char const* input, size_t n_tokens, ...) {
   Lexer lex = Lexer_make(input);
   ExprParser parser = ExprParser_make();
@@ -106,19 +165,21 @@ int testExpression(char const* input, size_t n_tokens, ...) {
       break;
   }
 
-  for (size_t i = 0; i < Vector_len(parser.e); ++i) {
-    char* tok_str = Token_format(Vector_at(parser.e, i));
+  Vector* expr = ExprParser_copyExpr(&parser);
+
+  for (size_t i = 0; i < Vector_len(expr); ++i) {
+    char* tok_str = Token_format(Vector_at(expr, i));
     printf("%s ", tok_str);
     free(tok_str);
   }
   printf("\n");
 
-  CHECK(Vector_len(parser.e) == n_tokens, NULL);
+  CHECK(Vector_len(expr) == n_tokens, NULL);
 
   va_list ap;
   va_start(ap, n_tokens);
   for (size_t i = 0; i < n_tokens; ++i) {
-    Token* tok = Vector_at(parser.e, i);
+    Token* tok = Vector_at(expr, i);
     ClueToken clue = va_arg(ap, ClueToken);
 
     if (clue.type)
@@ -126,8 +187,12 @@ int testExpression(char const* input, size_t n_tokens, ...) {
     if (clue.lit)
       CHECK(strncasecmp(tok->value, clue.lit, tok->len) == 0, NULL);
     CHECK(tok->unary == clue.unary, NULL);
+    CHECK(tok->folded == clue.folded, NULL);
+    if (clue.folded)
+      CHECK(tok->folded_value == clue.value, NULL);
   }
   va_end(ap);
+  Vector_destroy(expr);
 
   ExprParser_deinit(&parser);
 
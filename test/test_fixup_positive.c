@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fixup.h>
+#include <instruction.h>
+
+#include "common.h"
+
+typedef struct {
+  EncodedItemKind kind;
+  int32_t value;
+  bool evaluated;
+  FixupStatus expected;
+} Case;
+
+static int testRanges(void);
+static int testReuse(void);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testRanges());
+  TEST_CASE(testReuse());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testRanges(void) {
+  static Case const cases[] = {
+      {EI_EXPR, 0, true, FIXUP_OK},
+      {EI_EXPR, -128, true, FIXUP_OK},
+      {EI_EXPR, 255, true, FIXUP_OK},
+      {EI_EXPR, -129, true, FIXUP_OUT_OF_RANGE},
+      {EI_EXPR, 256, true, FIXUP_OUT_OF_RANGE},
+      {EI_ADDR, -32768, true, FIXUP_OK},
+      {EI_ADDR, 65535, true, FIXUP_OK},
+      {EI_ADDR, 65536, true, FIXUP_OUT_OF_RANGE},
+      {EI_ADDR, -32769, true, FIXUP_OUT_OF_RANGE},
+      {EI_REL, 1000, true, FIXUP_OK},
+      {EI_EXPR, 1000, false, FIXUP_UNRESOLVED},
+  };
+  size_t const n_cases = sizeof(cases) / sizeof(*cases);
+
+  /* Repeated, so the batch grows and the loop runs over full vectors */
+  FixupBatch b = FixupBatch_make();
+  for (size_t round = 0; round < 20; ++round) {
+    for (size_t i = 0; i < n_cases; ++i) {
+      size_t const k = FixupBatch_push(&b, round, i & 3, cases[i].kind);
+      CHECK_EQUAL(b.status[k], FIXUP_UNRESOLVED, FixupBatch_deinit(&b));
+      if (cases[i].evaluated) {
+        b.value[k] = cases[i].value;
+        b.status[k] = FIXUP_OK;
+      }
+    }
+  }
+
+  CHECK_EQUAL(FixupBatch_checkRanges(&b), 20 * 4, FixupBatch_deinit(&b));
+  for (size_t k = 0; k < b.len; ++k) {
+    size_t const round = k / n_cases, i = k - round * n_cases, item = i & 3;
+    CHECK_EQUAL(b.status[k], cases[i].expected, FixupBatch_deinit(&b));
+    CHECK_EQUAL(b.node[k], round, FixupBatch_deinit(&b));
+    CHECK_EQUAL(b.item[k], item, FixupBatch_deinit(&b));
+  }
+
+  FixupBatch_deinit(&b);
+  return 0;
+}
+
+static int testReuse(void) {
+  FixupBatch b = FixupBatch_make();
+  size_t k = FixupBatch_push(&b, 0, 1, EI_EXPR);
+  b.value[k] = 300;
+  b.status[k] = FIXUP_OK;
+  CHECK_EQUAL(FixupBatch_checkRanges(&b), 1, FixupBatch_deinit(&b));
+
+  FixupBatch_clear(&b);
+  CHECK_EQUAL(b.len, 0, FixupBatch_deinit(&b));
+  k = FixupBatch_push(&b, 0, 1, EI_EXPR);
+  CHECK_EQUAL(b.status[k], FIXUP_UNRESOLVED, FixupBatch_deinit(&b));
+  CHECK_EQUAL(FixupBatch_checkRanges(&b), 0, FixupBatch_deinit(&b));
+
+  FixupBatch_deinit(&b);
+  return 0;
+}
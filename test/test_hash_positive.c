@@ -0,0 +1,40 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hash.h>
+
+#include "common.h"
+
+static int testHash(void const* data, size_t len, uint64_t seed, uint64_t expected);
+
+int main(void) {
+  int tests_failed = 0;
+
+  // Reference values of XXH64
+  TEST_CASE(testHash("", 0, 0, 0xef46db3751d8e999ull));
+  TEST_CASE(testHash("a", 1, 0, 0xd24ec4f1a98c6e5bull));
+  TEST_CASE(testHash("abc", 3, 0, 0x44bc2cf5ad770999ull));
+  TEST_CASE(testHash("abc", 3, 1, 0xbea9ca8199328908ull));
+
+  {
+    // Through the lanes, then every tail: 8, 4 and single bytes
+    uint8_t bytes[32 * 3 + 8 + 4 + 3];
+    for (size_t i = 0; i < sizeof(bytes); ++i)
+      bytes[i] = (uint8_t)i;
+    TEST_CASE(testHash(bytes, sizeof(bytes), 0, 0x666cc5e38345de58ull));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testHash(void const* data, size_t len, uint64_t seed, uint64_t expected) {
+  uint64_t const h = Hash_bytes(data, len, seed);
+  if (h != expected) {
+    fprintf(stderr, "Hash_bytes() = %016llx, expected %016llx\n", (unsigned long long)h,
+            (unsigned long long)expected);
+    return 1;
+  }
+  return 0;
+}
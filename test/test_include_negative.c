@@ -0,0 +1,84 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <include.h>
+#include <parser.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testIncludeFail(IncludeCache* c, char const* src, char const* reason, char const* file, size_t lineno);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TestDir d;
+  if (TestDir_make(&d) != 0)
+    return EXIT_FAILURE;
+  char const* dir = d.path;
+  char* bad = TestDir_path(&d, "bad.inc");
+  char* self = TestDir_path(&d, "self.inc");
+  char* missing = TestDir_path(&d, "missing.inc");
+  char* include_bad = dsprintf("nop\ninclude \"%s\"\n", bad);
+  char* include_self = dsprintf("include \"%s\"\n", self);
+  char* include_missing = dsprintf("nop\ninclude \"%s\"\n", missing);
+  char* missing_reason = dsprintf("cannot include %s: No such file or directory", missing);
+  char* self_reason = dsprintf("%s includes itself", self);
+  char* dir_reason = dsprintf("cannot include %s: Is a directory", dir);
+  char* include_dir = dsprintf("include \"%s\"\n", dir);
+  if (!include_bad || !include_self || !include_missing || !missing_reason || !self_reason || !dir_reason ||
+      !include_dir)
+    return EXIT_FAILURE;
+
+  IncludeCache c;
+  IncludeCache_init(&c);
+
+  // Errors in an included file point into it
+  TEST_CASE(!TestDir_writeText(&d, "bad.inc", "nop\n  bogus\n"));
+  TEST_CASE(testIncludeFail(&c, include_bad, "unknown instruction: bogus", bad, 2));
+  TEST_CASE(!TestDir_writeText(&d, "bad.inc", "ld a, nowhere\n"));
+  TEST_CASE(testIncludeFail(&c, include_bad, "undefined symbol: nowhere", bad, 1));
+
+  TEST_CASE(testIncludeFail(&c, include_missing, missing_reason, NULL, 2));
+  TEST_CASE(testIncludeFail(&c, include_dir, dir_reason, NULL, 1));
+  TEST_CASE(!TestDir_writeText(&d, "self.inc", include_self));
+  TEST_CASE(testIncludeFail(&c, include_self, self_reason, self, 1));
+
+  TEST_CASE(testIncludeFail(&c, "include nowhere\n", "expected a file name in quotes", NULL, 1));
+  TEST_CASE(testIncludeFail(NULL, include_missing, "cannot include files here", NULL, 2));
+
+  IncludeCache_deinit(&c);
+  TestDir_remove(&d);
+  free(bad);
+  free(self);
+  free(missing);
+  free(include_bad);
+  free(include_self);
+  free(include_missing);
+  free(missing_reason);
+  free(self_reason);
+  free(dir_reason);
+  free(include_dir);
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The only error starts with `reason`, in `file` at `lineno` */
+static int testIncludeFail(IncludeCache* c, char const* src, char const* reason, char const* file, size_t lineno) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  Parser_parse(&p);
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, Parser_deinit(&p));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK(strncmp(err->reason, reason, strlen(reason)) == 0,
+        (fprintf(stderr, "%s\n", err->reason), Parser_deinit(&p)));
+  CHECK(file ? err->file && strcmp(err->file, file) == 0 : !err->file, Parser_deinit(&p));
+  CHECK_EQUAL(err->lineno, lineno, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
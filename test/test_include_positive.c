@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <image.h>
+#include <include.h>
+#include <parser.h>
+#include <pipeline.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testReplay(void);
+static int testShared(void);
+static int testChanged(void);
+static int testNested(void);
+static int testMany(void);
+static int testHash(void);
+static int hashOf(char const* src, uint64_t* hash);
+static int checkSame(IncludeCache* c, char const* src, char const* expected, bool pipelined);
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testReplay());
+  TEST_CASE(testShared());
+  TEST_CASE(testChanged());
+  TEST_CASE(testNested());
+  TEST_CASE(testMany());
+  TEST_CASE(testHash());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The program is the one of the source with the file pasted in */
+static int testReplay(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* defs = TestDir_writeText(&d, "defs.inc", "PORT equ 0x10\nstart: nop\n  ld b, PORT + 1\n");
+  CHECK(defs, TestDir_remove(&d));
+
+  char* src = dsprintf("org 0x100\ninclude \"%s\"\nld a, PORT\njp start\n", defs);
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int const result = checkSame(&c, src, "org 0x100\nPORT equ 0x10\nstart: nop\n  ld b, PORT + 1\nld a, PORT\njp start\n",
+                               false);
+  IncludeCache_deinit(&c);
+  free(src);
+  TestDir_remove(&d);
+  return result;
+}
+
+/* Parsers sharing a cache parse the file once */
+static int testShared(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* defs = TestDir_writeText(&d, "defs.inc", "PORT equ 0x10\n");
+  CHECK(defs, TestDir_remove(&d));
+
+  char* src = dsprintf("include \"%s\"\nld a, PORT\n", defs);
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int result = 0;
+  for (int i = 0; i < 3 && !result; ++i)
+    result = checkSame(&c, src, "PORT equ 0x10\nld a, PORT\n", i == 2);
+  if (!result && Vector_len(c.files) != 1) {
+    fprintf(stderr, "%zu files cached\n", Vector_len(c.files));
+    result = 1;
+  }
+  IncludeCache_deinit(&c);
+  free(src);
+  TestDir_remove(&d);
+  return result;
+}
+
+/* A file that changed on disk is parsed again */
+static int testChanged(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* defs = TestDir_writeText(&d, "defs.inc", "PORT equ 0x10\n");
+  CHECK(defs, TestDir_remove(&d));
+
+  char* src = dsprintf("include \"%s\"\nld a, PORT\n", defs);
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int result = checkSame(&c, src, "PORT equ 0x10\nld a, PORT\n", false);
+  if (!result)
+    result = !TestDir_writeText(&d, "defs.inc", "PORT equ 0x20\n");
+  if (!result)
+    result = checkSame(&c, src, "PORT equ 0x20\nld a, PORT\n", false);
+  if (!result && Vector_len(c.files) != 2) {
+    fprintf(stderr, "%zu files cached\n", Vector_len(c.files));
+    result = 1;
+  }
+  IncludeCache_deinit(&c);
+  free(src);
+  TestDir_remove(&d);
+  return result;
+}
+
+/* Included files include others, prefetched as their parsers see them, and
+ * a file may be included more than once */
+static int testNested(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* b = TestDir_writeText(&d, "b.inc", "B defl 0x30\nnop\n");
+  CHECK(b, TestDir_remove(&d));
+  char* a_text = dsprintf("include \"%s\"\nld a, B\nA equ B + 1\n", b);
+  CHECK(a_text, TestDir_remove(&d));
+  char const* a = TestDir_writeText(&d, "a.inc", a_text);
+  free(a_text);
+  CHECK(a, TestDir_remove(&d));
+
+  char* src = dsprintf("include \"%s\"\nld b, A\ninclude \"%s\"\n", a, b);
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int result = 0;
+  for (int i = 0; i < 2 && !result; ++i)
+    result = checkSame(&c, src, "B defl 0x30\nnop\nld a, B\nA equ B + 1\nld b, A\nB defl 0x30\nnop\n", i == 1);
+  IncludeCache_deinit(&c);
+  free(src);
+  TestDir_remove(&d);
+  return result;
+}
+
+/* Files are queued for the one helper thread, and a file the parser needs
+ * before the helper got to it is loaded by the parser */
+static int testMany(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char* src = dsprintf("%s", "");
+  char* expected = dsprintf("%s", "");
+  for (int i = 0; i < TEST_DIR_MAX_FILES && src && expected; ++i) {
+    char name[32], text[64];
+    snprintf(name, sizeof(name), "f%d.inc", i);
+    snprintf(text, sizeof(text), "F%d equ %d\nnop\n", i, i);
+    char const* path = TestDir_writeText(&d, name, text);
+    CHECK(path, (free(src), free(expected), TestDir_remove(&d)));
+    char* more_src = dsprintf("%sinclude \"%s\"\n", src, path);
+    char* more_expected = dsprintf("%s%s", expected, text);
+    free(src);
+    free(expected);
+    src = more_src;
+    expected = more_expected;
+  }
+  char* full_src = src ? dsprintf("%sld a, F0 + F7\n", src) : NULL;
+  char* full_expected = expected ? dsprintf("%sld a, F0 + F7\n", expected) : NULL;
+  free(src);
+  free(expected);
+  CHECK(full_src && full_expected, (free(full_src), free(full_expected), TestDir_remove(&d)));
+
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int result = checkSame(&c, full_src, full_expected, false);
+  if (!result && (!c.has_helper || Vector_len(c.files) != TEST_DIR_MAX_FILES)) {
+    fprintf(stderr, "helper %d, %zu files cached\n", c.has_helper, Vector_len(c.files));
+    result = 1;
+  }
+  IncludeCache_deinit(&c);
+  free(full_src);
+  free(full_expected);
+  TestDir_remove(&d);
+  return result;
+}
+
+/* The hash covers every file included, in blocks and files included in
+ * turn, and only files */
+static int testHash(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* b = TestDir_writeText(&d, "b.inc", "B equ 1\n");
+  char const* c = TestDir_write(&d, "c.bin", "\x01\x02", 2);
+  CHECK(b && c, TestDir_remove(&d));
+  char* a_text = dsprintf("include \"%s\"\n", b);
+  CHECK(a_text, TestDir_remove(&d));
+  char const* a = TestDir_writeText(&d, "a.inc", a_text);
+  free(a_text);
+  CHECK(a, TestDir_remove(&d));
+  char* src = dsprintf("included: nop ; incbin\n  if 0\n  include \"%s\"\n  endif\n  incbin \"%s\", 1\n", a, c);
+  CHECK(src, TestDir_remove(&d));
+
+  uint64_t first = 0, again = 0, changed = 0, binary = 0;
+  int result = hashOf(src, &first) || hashOf(src, &again) || first != again;
+  if (!result)
+    result = !TestDir_writeText(&d, "b.inc", "B equ 2\n") || hashOf(src, &changed) || changed == first;
+  if (!result)
+    result = !TestDir_write(&d, "c.bin", "\x01\x03", 2) || hashOf(src, &binary) || binary == changed;
+
+  /* Without files the hash stays, a file gone or named by a parameter fails */
+  uint64_t none = 42;
+  if (!result)
+    result = Include_hash("include: nop ; include \"nowhere\"\n", &none) != 0 || none != 42;
+  if (!result)
+    result = Include_hash("  include \"/nonexistent/z80asmc.inc\"\n", &none) != -1;
+  if (!result)
+    result = Include_hash("m macro f\n  include f\n  endm\n", &none) != -1;
+
+  free(src);
+  TestDir_remove(&d);
+  CHECK(!result, (void)0);
+  return 0;
+}
+
+static int hashOf(char const* src, uint64_t* hash) {
+  *hash = 0;
+  CHECK_EQUAL(Include_hash(src, hash), 0, (void)0);
+  return 0;
+}
+
+static int checkSame(IncludeCache* c, char const* src, char const* expected, bool pipelined) {
+  Image actual, wanted;
+  CHECK_EQUAL(assemble(c, src, pipelined, &actual), 0, (void)0);
+  CHECK_EQUAL(assemble(NULL, expected, false, &wanted), 0, Image_deinit(&actual));
+  int const result = actual.base != wanted.base || actual.len != wanted.len ||
+                     (actual.len && memcmp(actual.data, wanted.data, actual.len) != 0);
+  Image_deinit(&actual);
+  Image_deinit(&wanted);
+  CHECK(!result, (void)0);
+  return 0;
+}
+
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  if (pipelined)
+    Pipeline_parse(&p);
+  else
+    Parser_parse(&p);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  int const result = Parser_hasErrors(&p);
+  if (!result)
+    *img = Image_fromIR(p.nodes);
+  Parser_deinit(&p);
+  return result;
+}
@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <incremental.h>
+#include <instruction.h>
+#include <parser.h>
+
+#include "common.h"
+
+static int testUpdate(Incremental* inc, char const* src, size_t n_reparsed);
+static int testSplice(Incremental* inc, char const* src, size_t n_reparsed, size_t n_applied);
+static char* dump(Parser* p);
+
+int main(void) {
+  int tests_failed = 0;
+
+  Incremental inc;
+  Incremental_init(&inc);
+
+  char const* base = "start: ld a, 1\n"
+                     "  jr later\n"
+                     "x equ later + 1\n"
+                     "  nop ; padding\n"
+                     "later: ld b, x\n"
+                     "  ret";
+  TEST_CASE(testUpdate(&inc, base, 6));
+  TEST_CASE(testSplice(&inc, base, 0, 0));
+
+  // One line changes, moving the labels after it and the constant using one
+  TEST_CASE(testSplice(&inc,
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, x\n"
+                       "  ret",
+                       1, 1));
+
+  // Lines come in and go, and the lines after them are numbered again
+  TEST_CASE(testSplice(&inc,
+                       "; header\n"
+                       "\n"
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, x\n"
+                       "  ret",
+                       2, 0));
+  TEST_CASE(testSplice(&inc,
+                       "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, x\n"
+                       "  ret",
+                       0, 0));
+
+  // A label comes in, and one moves to another line
+  TEST_CASE(testSplice(&inc,
+                       "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later:\n"
+                       "more: ld b, x\n"
+                       "  ret",
+                       2, 3));
+
+  // A change that would need an error is made by a full build, which
+  // reports it in its own order
+  TEST_CASE(testSplice(&inc,
+                       "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp far\n"
+                       "later:\n"
+                       "more: ld b, x\n"
+                       "  ret",
+                       1, 9));
+
+  // So is one after the program was changed by a pass
+  char const* header = "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr later\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, x\n"
+                       "  ret";
+  TEST_CASE(testSplice(&inc, header, 2, 8));
+  Resolver_relayout(&inc.parser.resolver);
+  TEST_CASE(testSplice(&inc, header, 0, 8));
+
+  // Errors point at the right lines, before and after the change; with two
+  // changes, the lines between them are parsed again too
+  TEST_CASE(testUpdate(&inc,
+                       "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr nowhere\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, 300\n"
+                       "  ret",
+                       4));
+  TEST_CASE(testUpdate(&inc,
+                       "; header\n"
+                       "start: ld a, 1\n"
+                       "  jr nowhere\n"
+                       "  bogus a, b\n"
+                       "x equ later + 1\n"
+                       "  jp start\n"
+                       "later: ld b, 300\n"
+                       "  ret",
+                       1));
+
+  // A change to the body of a macro parses the macro again, and the lines
+  // expanding it are resolved again
+  TEST_CASE(testUpdate(&inc,
+                       "load macro r, v\n"
+                       "  ld r, v\n"
+                       "  endm\n"
+                       "start: load a, 1\n"
+                       "  load b, 2\n"
+                       "  jp start",
+                       6));
+  TEST_CASE(testUpdate(&inc,
+                       "load macro r, v\n"
+                       "ld r, v + 1\n"
+                       "  endm\n"
+                       "start: load a, 1\n"
+                       "  load b, 2\n"
+                       "  jp start",
+                       3));
+  TEST_CASE(testSplice(&inc,
+                       "load macro r, v\n"
+                       "ld r, v + 1\n"
+                       "  endm\n"
+                       "start: load a, 1\n"
+                       "  load b, 2\n"
+                       "  jr start",
+                       1, 1));
+
+  // So does a change to a branch of a conditional, or to its condition
+  TEST_CASE(testUpdate(&inc, "start: nop\n  if 1\n  ld a, 1\n  else\n  ld a, 2\n  endif\n  jp start", 7));
+  TEST_CASE(testUpdate(&inc, "start: nop\n  if 0\n  ld a, 1\n  else\n  ld a, 2\n  endif\n  jp start", 5));
+  TEST_CASE(testUpdate(&inc, "start: nop\n  if 0\n  ld a, 1\n  else\n  ld a, 3\n  endif\n  jp start", 5));
+
+  // Only a line's first word opens or closes a block, not one in a name or
+  // a comment
+  TEST_CASE(testUpdate(&inc, "endmark: ld a, 1 ; endif\n  call endmark\n; endm\n  nop\n  ret", 5));
+  TEST_CASE(testSplice(&inc, "endmark: ld a, 1 ; endif\n  call endmark\n; endm\n  ld b, 2\n  ret", 1, 1));
+
+  TEST_CASE(testUpdate(&inc, "", 0));
+  TEST_CASE(testUpdate(&inc, base, 6));
+
+  Incremental_deinit(&inc);
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The update gives the program of a full parse, having parsed `n_reparsed`
+ * lines */
+static int testUpdate(Incremental* inc, char const* src, size_t n_reparsed) {
+  Incremental_update(inc, src);
+  CHECK_EQUAL(inc->n_reparsed, n_reparsed, (void)0);
+
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  char* expected = dump(&p);
+  Parser_deinit(&p);
+  char* actual = dump(&inc->parser);
+
+  CHECK(expected && actual, (free(expected), free(actual)));
+  CHECK_STREQUAL(actual, expected, (free(expected), free(actual)));
+  free(expected);
+  free(actual);
+  return 0;
+}
+
+/* The update, as testUpdate(), resolved `n_applied` statements */
+static int testSplice(Incremental* inc, char const* src, size_t n_reparsed, size_t n_applied) {
+  if (testUpdate(inc, src, n_reparsed))
+    return 1;
+  CHECK_EQUAL(inc->n_applied, n_applied, (void)0);
+  return 0;
+}
+
+/* The IR and the errors */
+static char* dump(Parser* p) {
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* f = open_memstream(&buf, &len);
+  if (!f)
+    return NULL;
+  for (size_t i = 0; i < Vector_len(p->nodes); ++i) {
+    IRNode* n = Vector_at(p->nodes, i);
+    IRNode_print(f, n);
+    if (n->kind == IR_INSTRUCTION)
+      fprintf(f, "line %zu\n", n->data.instruction.line);
+  }
+  for (size_t i = 0; i < Vector_len(p->errors); ++i)
+    ParserError_print(Vector_at(p->errors, i), f);
+  fclose(f);
+  return buf;
+}
@@ -10,6 +10,8 @@ typedef struct {
 } ClueToken;
 
 static int testLexer(char const* str, int n_tokens, ClueToken const* tok_arr);
+static int testRange(void);
+static int testBlock(void);
 
 int main(void) {
   int tests_failed = 0;
@@ -29,6 +31,14 @@ int main(void) {
     TEST_CASE(testLexer(";a comment before\na;a comment after", 2, tokens));
   }
 
+  {
+    ClueToken tokens[] = {{.lit = "a", .type = TOKEN_ID},
+                          {.type = TOKEN_NEWLINE},
+                          {.lit = "b", .type = TOKEN_ID},
+                          {.type = TOKEN_END}};
+    TEST_CASE(testLexer("a ; a comment after\nb", 4, tokens));
+  }
+
   {
     ClueToken tokens[] = {{.lit = "a", .type = TOKEN_CHAR}, {.type = TOKEN_END}};
     TEST_CASE(testLexer("'a'", 2, tokens));
@@ -64,6 +74,35 @@ int main(void) {
     TEST_CASE(testLexer("42q", 2, tokens));
   }
 
+  {
+    ClueToken tokens[] = {{.lit = "0", .type = TOKEN_DECIMAL}, {.type = TOKEN_RIGHT_PAREN}, {.type = TOKEN_END}};
+    TEST_CASE(testLexer("0)", 3, tokens));
+  }
+
+  {
+    ClueToken tokens[] = {{.lit = "if", .type = TOKEN_ID},
+                          {.lit = "x", .type = TOKEN_ID},
+                          {.type = TOKEN_NEWLINE},
+                          {.lit = "  a\n  if y\n  b\n  endif\n", .type = TOKEN_BLOCK},
+                          {.lit = "Else", .type = TOKEN_ID},
+                          {.type = TOKEN_NEWLINE},
+                          {.lit = "  c ; else\n", .type = TOKEN_BLOCK},
+                          {.lit = "endif", .type = TOKEN_ID},
+                          {.type = TOKEN_NEWLINE},
+                          {.lit = "d", .type = TOKEN_ID},
+                          {.type = TOKEN_END}};
+    TEST_CASE(testLexer("if x\n  a\n  if y\n  b\n  endif\nElse\n  c ; else\nendif\nd", 11, tokens));
+  }
+
+  {
+    ClueToken tokens[] = {{.lit = "a", .type = TOKEN_ID}, {.type = TOKEN_COLON}, {.lit = "if", .type = TOKEN_ID},
+                          {.type = TOKEN_NEWLINE}, {.lit = "endif", .type = TOKEN_ID}, {.type = TOKEN_END}};
+    TEST_CASE(testLexer("a: if\nendif", 6, tokens));
+  }
+
+  TEST_CASE(testRange());
+  TEST_CASE(testBlock());
+
   // XXX
   // {
   //   ClueToken tokens[] = {{.lit = "010101", .type = TOKEN_BINARY}, {.type = TOKEN_END}};
@@ -108,3 +147,56 @@ static int testLexer(char const* str, int n_tokens, ClueToken const* tok_arr) {
 
   return 0;
 }
+
+/* The lines of a block are lexed as in place, nested blocks included */
+static int testBlock(void) {
+  char const* src = "if 1\nnop\n  if 2\n  x\n  endif\n  y\nendif\n";
+  Lexer lex = Lexer_make(src);
+  for (int i = 0; i < 3; ++i)
+    Lexer_next(&lex);
+  Token const block = Lexer_next(&lex);
+  CHECK_TOKEN_TYPES_EQUAL(block.type, TOKEN_BLOCK, NULL);
+  CHECK_EQUAL(block.line, 2, NULL);
+  CHECK_STREQUALN(Lexer_next(&lex).value, "endif", 5, NULL);
+
+  Lexer inner = Lexer_makeBlock(&block);
+  Token tok = Lexer_next(&inner);
+  CHECK_STREQUALN(tok.value, "nop", tok.len, NULL);
+  CHECK_EQUAL(tok.line, 2, NULL);
+  CHECK_TOKEN_TYPES_EQUAL(Lexer_next(&inner).type, TOKEN_NEWLINE, NULL);
+  for (int i = 0; i < 3; ++i)
+    Lexer_next(&inner);
+  tok = Lexer_next(&inner);
+  CHECK_TOKEN_TYPES_EQUAL(tok.type, TOKEN_BLOCK, NULL);
+  CHECK_EQUAL(tok.line, 4, NULL);
+  CHECK_STREQUALN(Lexer_next(&inner).value, "endif", 5, NULL);
+  Lexer_next(&inner);
+  tok = Lexer_next(&inner);
+  CHECK_STREQUALN(tok.value, "y", tok.len, NULL);
+  CHECK_EQUAL(tok.line, 6, NULL);
+  CHECK_EQUAL(tok.col, 3, NULL);
+  Lexer_next(&inner);
+  CHECK_TOKEN_TYPES_EQUAL(Lexer_next(&inner).type, TOKEN_END, NULL);
+  return 0;
+}
+
+/* A range is lexed as part of the whole buffer */
+static int testRange(void) {
+  char const* src = "a\n  b c\nd\n";
+  Lexer lex = Lexer_makeRange(src, 2, 8, 2);
+
+  Token tok = Lexer_next(&lex);
+  CHECK_STREQUALN(tok.value, "b", tok.len, NULL);
+  CHECK_EQUAL(tok.line, 2, NULL);
+  CHECK_EQUAL(tok.col, 3, NULL);
+  tok = Lexer_next(&lex);
+  CHECK_STREQUALN(tok.value, "c", tok.len, NULL);
+  CHECK_TOKEN_TYPES_EQUAL(Lexer_next(&lex).type, TOKEN_NEWLINE, NULL);
+  CHECK_TOKEN_TYPES_EQUAL(Lexer_next(&lex).type, TOKEN_END, NULL);
+
+  char* line = Lexer_line(&lex, 1);
+  CHECK(line, NULL);
+  CHECK_STREQUAL(line, "a", free(line));
+  free(line);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <image.h>
+#include <link.h>
+#include <object.h>
+#include <parser.h>
+#include <relax.h>
+
+#include "common.h"
+
+#define MAX_OBJECTS 4
+
+static int testLinkFail(char const* const* srcs, size_t n, size_t culprit, size_t other, char const* reason);
+static int testLoadFail(char const* data, size_t len, char const* reason);
+static int checkDiagnostic(FILE* ferr, char const* path, char const* reason);
+static int assemble(char const* src, char* path);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    char const* srcs[] = {"ld a, nowhere\n"};
+    TEST_CASE(testLinkFail(srcs, 1, 0, 0, "undefined symbol: nowhere"));
+  }
+
+  {
+    char const* srcs[] = {"jp x\n", "x: nop\n", "x: nop\n"};
+    TEST_CASE(testLinkFail(srcs, 3, 2, 1, "x is already defined in %s"));
+  }
+
+  {
+    // Even if no other object uses it
+    char const* srcs[] = {"main: nop\n", "main: ret\n"};
+    TEST_CASE(testLinkFail(srcs, 2, 1, 0, "main is already defined in %s"));
+  }
+
+  {
+    // Relocatable code goes around absolute sections, which mustn't overlap
+    char const* srcs[] = {"nop\n", "org 0\nld a, 5\n", "org 1\nnop\n"};
+    TEST_CASE(testLinkFail(srcs, 3, 2, 1, "code at 0x0001 overlaps code of %s"));
+  }
+
+  {
+    char const* srcs[] = {"x equ y + 1\nld a, x\n", "y equ x\n"};
+    TEST_CASE(testLinkFail(srcs, 2, 0, 0, "circular definition of x"));
+  }
+
+  {
+    char const* srcs[] = {"ld a, far\n", "far equ 300\n"};
+    TEST_CASE(testLinkFail(srcs, 2, 0, 0, "value 300 does not fit in 1 byte(s)"));
+  }
+
+  {
+    // Fits where the module was assembled, not after the 200 bytes before it,
+    // which go past its ORG section
+    static char filler[200 * 4 + 1];
+    for (size_t i = 0; i < 200; ++i)
+      memcpy(filler + 4 * i, "nop\n", 4);
+    char const* srcs[] = {filler, "jr target\norg 0x40\ntarget: nop\n"};
+    TEST_CASE(testLinkFail(srcs, 2, 1, 0, "displacement -203 does not fit in a signed byte"));
+  }
+
+  TEST_CASE(testLoadFail("ld a, b\n", 8, "not an object file"));
+  TEST_CASE(testLoadFail(OBJECT_MAGIC "\x01\x00\x00\x00\xff", 9, "malformed object"));
+  TEST_CASE(testLoadFail(OBJECT_MAGIC "\x02\x00\x00\x00", 8, "unsupported object version 2"));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The link fails with one diagnostic, about the object at index `culprit`;
+ * a %s in `reason` stands for the path of the object at index `other` */
+static int testLinkFail(char const* const* srcs, size_t n, size_t culprit, size_t other, char const* reason) {
+  char paths[MAX_OBJECTS][sizeof(TEST_DIR_TEMPLATE)];
+  char const* objects[MAX_OBJECTS] = {0};
+  size_t n_written = 0;
+  for (; n_written < n; ++n_written) {
+    if (assemble(srcs[n_written], paths[n_written]) != 0)
+      break;
+    objects[n_written] = paths[n_written];
+  }
+  FILE* ferr = tmpfile();
+
+  Image img = {0};
+  int const rc = n_written == n && ferr ? Link_objects(objects, n, ferr, &img) : 0;
+  for (size_t i = 0; i < n_written; ++i)
+    unlink(paths[i]);
+  CHECK(ferr, (void)0);
+  CHECK_EQUAL(rc, -1, fclose(ferr));
+
+  char expected[256];
+  snprintf(expected, sizeof(expected), reason, paths[other]);
+  int const failed = checkDiagnostic(ferr, paths[culprit], expected);
+  fclose(ferr);
+  return failed;
+}
+
+static int testLoadFail(char const* data, size_t len, char const* reason) {
+  char path[] = TEST_DIR_TEMPLATE;
+  int const fd = mkstemp(path);
+  CHECK(fd != -1, (void)0);
+  bool const written = write(fd, data, len) == (ssize_t)len;
+  close(fd);
+  FILE* ferr = tmpfile();
+
+  Image img = {0};
+  char const* objects[] = {path};
+  int const rc = written && ferr ? Link_objects(objects, 1, ferr, &img) : 0;
+  unlink(path);
+  CHECK(ferr, (void)0);
+  CHECK_EQUAL(rc, -1, fclose(ferr));
+
+  int const failed = checkDiagnostic(ferr, path, reason);
+  fclose(ferr);
+  return failed;
+}
+
+static int checkDiagnostic(FILE* ferr, char const* path, char const* reason) {
+  char buf[512] = {0};
+  rewind(ferr);
+  size_t const len = fread(buf, 1, sizeof(buf) - 1, ferr);
+  CHECK(len > 0, (void)0);
+
+  char expected[512];
+  snprintf(expected, sizeof(expected), "%s: error: %s\n", path, reason);
+  CHECK_STREQUAL(buf, expected, (void)0);
+  return 0;
+}
+
+/* Assemble a relocatable module into an object at a new path */
+static int assemble(char const* src, char* path) {
+  strcpy(path, TEST_DIR_TEMPLATE);
+  int const fd = mkstemp(path);
+  CHECK(fd != -1, (void)0);
+  FILE* f = fdopen(fd, "wb");
+  CHECK(f, (close(fd), unlink(path)));
+
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.resolver.relocatable = true;
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), (Parser_deinit(&p), fclose(f), unlink(path)));
+  Relax_branches(&p.resolver);
+
+  int const rc = Object_write(f, &p.resolver);
+  Parser_deinit(&p);
+  CHECK_EQUAL(fclose(f), 0, unlink(path));
+  CHECK_EQUAL(rc, 0, unlink(path));
+  return 0;
+}
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <image.h>
+#include <link.h>
+#include <object.h>
+#include <parser.h>
+#include <relax.h>
+
+#include "common.h"
+
+#define MAX_OBJECTS 4
+
+static int testLink(char const* const* srcs, size_t n, uint8_t const* expected, size_t expected_len);
+static int assemble(char const* src, char* path);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    // Calls both ways, a constant from labels of both modules, and a branch
+    // to an external label, which is long
+    char const* srcs[] = {
+        "start: call print\njr loop\nloop: ld a, (msg)\njp start\ncount equ msg - start\nld a, count\n",
+        "print: ld a, 1\nret\nmsg: nop\njr start\n",
+    };
+    uint8_t const bin[] = {0xcd, 0x0d, 0x00, 0x18, 0x00, 0x3a, 0x10, 0x00, 0xc3, 0x00,
+                           0x00, 0x3e, 0x10, 0x3e, 0x01, 0xc9, 0x00, 0xc3, 0x00, 0x00};
+    TEST_CASE(testLink(srcs, 2, bin, sizeof(bin)));
+  }
+
+  {
+    // The ORG section stays at 0x10; the second module follows the first
+    // one's relocatable section
+    char const* srcs[] = {"nop\norg 0x10\nld a, (here)\n", "here: ld a, 2\n"};
+    uint8_t const bin[0x13] = {[1] = 0x3e, [2] = 0x02, [0x10] = 0x3a, [0x11] = 0x01};
+    TEST_CASE(testLink(srcs, 2, bin, sizeof(bin)));
+  }
+
+  {
+    // Relocatable code goes around the absolute sections of later modules
+    char const* srcs[] = {"nop\nnop\n", "org 0\nld a, 5\n", "org 5\nret\n", "loop: jr loop\n"};
+    uint8_t const bin[] = {0x3e, 0x05, 0x00, 0x00, 0x00, 0xc9, 0x18, 0xfe};
+    TEST_CASE(testLink(srcs, 4, bin, sizeof(bin)));
+  }
+
+  {
+    // A constant depending on labels of another module
+    char const* srcs[] = {"size equ last - first\nld a, size\n", "first: nop\nnop\nlast:\n"};
+    uint8_t const bin[] = {0x3e, 0x02, 0x00, 0x00};
+    TEST_CASE(testLink(srcs, 2, bin, sizeof(bin)));
+  }
+
+  {
+    // Each module has its own LOCAL labels of a macro
+    char const* srcs[] = {"w macro\n  local l\nl: jp l\n  endm\n  w\n", "w macro\n  local l\nl: jp l\n  endm\n  w\n"};
+    uint8_t const bin[] = {0xc3, 0x00, 0x00, 0xc3, 0x03, 0x00};
+    TEST_CASE(testLink(srcs, 2, bin, sizeof(bin)));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testLink(char const* const* srcs, size_t n, uint8_t const* expected, size_t expected_len) {
+  char paths[MAX_OBJECTS][sizeof(TEST_DIR_TEMPLATE)];
+  char const* objects[MAX_OBJECTS] = {0};
+  size_t n_written = 0;
+  for (; n_written < n; ++n_written) {
+    if (assemble(srcs[n_written], paths[n_written]) != 0)
+      break;
+    objects[n_written] = paths[n_written];
+  }
+
+  Image img = {0};
+  int const rc = n_written == n ? Link_objects(objects, n, stderr, &img) : -1;
+  for (size_t i = 0; i < n_written; ++i)
+    unlink(paths[i]);
+  CHECK_EQUAL(rc, 0, (void)0);
+
+  CHECK_EQUAL(img.base, 0, Image_deinit(&img));
+  CHECK_EQUAL(img.len, expected_len, Image_deinit(&img));
+  CHECK(memcmp(img.data, expected, expected_len) == 0, Image_deinit(&img));
+
+  Image_deinit(&img);
+  return 0;
+}
+
+/* Assemble a relocatable module into an object at a new path */
+static int assemble(char const* src, char* path) {
+  strcpy(path, TEST_DIR_TEMPLATE);
+  int const fd = mkstemp(path);
+  CHECK(fd != -1, (void)0);
+  FILE* f = fdopen(fd, "wb");
+  CHECK(f, (close(fd), unlink(path)));
+
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.resolver.relocatable = true;
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), (Parser_deinit(&p), fclose(f), unlink(path)));
+  Relax_branches(&p.resolver);
+
+  int const rc = Object_write(f, &p.resolver);
+  Parser_deinit(&p);
+  CHECK_EQUAL(fclose(f), 0, unlink(path));
+  CHECK_EQUAL(rc, 0, unlink(path));
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <listing.h>
+#include <parser.h>
+#include <peephole.h>
+#include <relax.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testListing(char const* src, size_t n_extra, bool optimize, char const* expected);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testListing("start: ld a, 1\n"
+                        "  ; comment\n"
+                        "loop: ld a, (data)\n"
+                        " jr loop\n"
+                        "\n"
+                        "data: nop\n"
+                        "end:",
+                        0,
+                        false,
+                        "     1  0000  3E 01        start: ld a, 1\n"
+                        "     2                       ; comment\n"
+                        "     3  0002  3A 07 00     loop: ld a, (data)\n"
+                        "     4  0005  18 FB         jr loop\n"
+                        "     5                     \n"
+                        "     6  0007  00           data: nop\n"
+                        "     7  0008               end:\n"));
+
+  // Bytes past the fourth go on continuation rows
+  TEST_CASE(testListing("nop\n",
+                        5,
+                        false,
+                        "     1  0000  00 A0 A1 A2  nop\n"
+                        "        0004  A3 A4\n"));
+
+  // A rewritten instruction is listed on the line of the one it replaces
+  TEST_CASE(testListing("start: nop\n"
+                        "  ld a, 0\n"
+                        "  ret\n",
+                        0,
+                        true,
+                        "     1  0000  00           start: nop\n"
+                        "     2  0001  AF             ld a, 0\n"
+                        "     3  0002  C9             ret\n"));
+
+  TEST_CASE(testListing("", 0, false, ""));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Appends n_extra bytes, 0xa0 and on, to the first instruction; with
+ * `optimize`, runs the passes of -O first */
+static int testListing(char const* src, size_t n_extra, bool optimize, char const* expected) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+  if (optimize) {
+    Peephole_optimize(&p.resolver);
+    Relax_branches(&p.resolver);
+    CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+  }
+
+  if (n_extra) {
+    IRNode* n = Vector_at(p.nodes, 0);
+    CHECK(n && n->kind == IR_INSTRUCTION, Parser_deinit(&p));
+    for (size_t i = 0; i < n_extra; ++i) {
+      EncodedItem item = {.kind = EI_BYTE, .data.byte = (uint8_t)(0xa0 + i)};
+      if (Vector_push(n->data.instruction.encoded_items, &item) == -1)
+        die("Vector_push() failed");
+    }
+  }
+
+  FILE* f = tmpfile();
+  CHECK(f, Parser_deinit(&p));
+  CHECK_EQUAL(Listing_write(f, src, p.nodes), 0, (fclose(f), Parser_deinit(&p)));
+  Parser_deinit(&p);
+
+  char buf[1024] = {0};
+  rewind(f);
+  size_t const len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+
+  CHECK_EQUAL(len, strlen(expected), fprintf(stderr, "%s", buf));
+  CHECK_STREQUAL(buf, expected, (void)0);
+  return 0;
+}
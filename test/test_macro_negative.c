@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <parser.h>
+
+#include "common.h"
+
+static int testMacroFail(char const* src, char const* reason, size_t lineno);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testMacroFail("nop\n  bogus a, b\n", "unknown instruction: bogus", 2));
+  TEST_CASE(testMacroFail("  later 1\nlater macro x\n  nop\n  endm\n", "unknown instruction: later", 1));
+  TEST_CASE(testMacroFail("m macro x, y\n  nop\n  endm\n  m 1\n", "macro m takes 2 argument(s), given 1", 4));
+  TEST_CASE(testMacroFail("m macro\n  nop\n  endm\n  m 1\n", "macro m takes 0 argument(s), given 1", 4));
+  TEST_CASE(testMacroFail("m macro x\n  nop\n", "MACRO without ENDM: m", 1));
+  TEST_CASE(testMacroFail("m macro x, x\n  nop\n  endm\n", "duplicate parameter: x", 1));
+  TEST_CASE(testMacroFail("m macro x, 1\n  nop\n  endm\n", "expected parameter names", 1));
+  TEST_CASE(testMacroFail("m macro x y\n  nop\n  endm\n", "expected parameter names", 1));
+  TEST_CASE(testMacroFail("m macro\n  nop\n  endm x\n", "excessive characters after ENDM", 3));
+  TEST_CASE(testMacroFail("m macro\n  nop\n  endm\nm macro\n  endm\n", "redefinition of macro m", 4));
+  TEST_CASE(testMacroFail("m macro\n  m\n  endm\n  m\n", "macro expansions nest deeper than", 2));
+
+  TEST_CASE(testMacroFail("m macro\n  local\n  endm\n", "expected local label names", 2));
+  TEST_CASE(testMacroFail("m macro\n  local a 1\n  endm\n", "expected local label names", 2));
+  TEST_CASE(testMacroFail("m macro x\n  local a, x\n  endm\n", "duplicate local label: x", 2));
+  TEST_CASE(testMacroFail("m macro\n  local a, a\n  endm\n", "duplicate local label: a", 2));
+  // A label of the body that LOCAL doesn't name is defined again by the next expansion
+  TEST_CASE(testMacroFail("m macro\nhere: nop\n  endm\n  m\n  m\n", "redefinition of here in a macro expansion", 2));
+
+  // Errors in an expansion point into the body, or at the argument
+  TEST_CASE(testMacroFail("m macro x\n  ld a, x\n  bad\n  endm\n  m 1\n", "unknown instruction: bad", 3));
+  TEST_CASE(testMacroFail("m macro x\n  ld a, x\n  endm\n  nop\n  m 300\n", "value 300 does not fit", 5));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The only error starts with `reason`, at `lineno` */
+static int testMacroFail(char const* src, char const* reason, size_t lineno) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, (fprintf(stderr, "%zu errors\n", Vector_len(p.errors)), Parser_deinit(&p)));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK(strncmp(err->reason, reason, strlen(reason)) == 0,
+        (fprintf(stderr, "%s\n", err->reason), Parser_deinit(&p)));
+  CHECK_EQUAL(err->lineno, lineno, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <image.h>
+#include <include.h>
+#include <macro.h>
+#include <parser.h>
+#include <pipeline.h>
+#include <utility.h>
+
+#include "common.h"
+
+static int testExpand(void);
+static int testSplice(void);
+static int testNested(void);
+static int testMemoized(void);
+static int testLocal(void);
+static int testIncluded(void);
+static int checkSame(IncludeCache* c, char const* src, char const* expected);
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img);
+static int countExpansions(char const* src, char const* name, size_t expected);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testExpand());
+  TEST_CASE(testSplice());
+  TEST_CASE(testNested());
+  TEST_CASE(testMemoized());
+  TEST_CASE(testLocal());
+  TEST_CASE(testIncluded());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The program is the one of the bodies pasted in */
+static int testExpand(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "org 0x100\n"
+                        "load macro reg, val\n"
+                        "  ld reg, val\n"
+                        "  db val + 1\n"
+                        "endm\n"
+                        "start: load a, 5\n"
+                        "  load B, 5\n"
+                        "  jp start\n",
+                        "org 0x100\n"
+                        "start: ld a, 5\n"
+                        "  db 5 + 1\n"
+                        "  ld B, 5\n"
+                        "  db 5 + 1\n"
+                        "  jp start\n"),
+              0, (void)0);
+  CHECK_EQUAL(checkSame(NULL, "pad: macro\n  nop\n  nop\n  endm\n  pad\n  pad\n", "nop\nnop\nnop\nnop\n"), 0, (void)0);
+  return 0;
+}
+
+/* Arguments are spliced in as tokens: commas within parentheses stay, and
+ * a parameter may stand for a label or an instruction name */
+static int testSplice(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "ops macro op, name, val\n"
+                        "name: op a, val\n"
+                        "  jp name\n"
+                        "  endm\n"
+                        "  ops add, here, (1 + 2) * 3\n"
+                        "  ops sub, there, -1\n",
+                        "here: add a, (1 + 2) * 3\n"
+                        "  jp here\n"
+                        "there: sub a, -1\n"
+                        "  jp there\n"),
+              0, (void)0);
+  return 0;
+}
+
+/* A macro expands others, defined before or after it */
+static int testNested(void) {
+  CHECK_EQUAL(checkSame(NULL,
+                        "outer macro x\n"
+                        "  inner x\n"
+                        "  inner x + 1\n"
+                        "  endm\n"
+                        "inner macro y\n"
+                        "  ld a, y\n"
+                        "  endm\n"
+                        "  outer 3\n",
+                        "ld a, 3\nld a, 3 + 1\n"),
+              0, (void)0);
+  return 0;
+}
+
+/* Expansions of constant arguments are parsed once per arguments */
+static int testMemoized(void) {
+  char const* def = "put macro v\n  db v\n  endm\n";
+  char* constant = dsprintf("%sput 1\nput 1\nput 2\nput (0 + 1)\nput 1\n", def);
+  char* symbolic = dsprintf("%sN equ 1\nput N\nput N\n", def);
+  CHECK(constant && symbolic, (free(constant), free(symbolic)));
+
+  int result = countExpansions(constant, "put", 3);
+  if (!result)
+    result = countExpansions(symbolic, "put", 0);
+  if (!result)
+    result = checkSame(NULL, constant, "db 1\ndb 1\ndb 2\ndb 1\ndb 1\n");
+  free(constant);
+  free(symbolic);
+  return result;
+}
+
+/* The labels named by LOCAL are new in each expansion, and aren't those of
+ * another macro; the expansions aren't memoized */
+static int testLocal(void) {
+  char const* src = "wait macro n\n"
+                    "  local again, done\n"
+                    "  ld b, n\n"
+                    "again: djnz again\n"
+                    "  jr done\n"
+                    "  if n > 3\n"
+                    "  jr again\n"
+                    "  endif\n"
+                    "done: nop\n"
+                    "  endm\n"
+                    "spin macro\n"
+                    "  LOCAL again\n"
+                    "again: jr again\n"
+                    "  endm\n"
+                    "  wait 3\n"
+                    "  spin\n"
+                    "  wait 3\n"
+                    "  wait 4\n";
+  CHECK_EQUAL(checkSame(NULL, src,
+                        "ld b, 3\na1: djnz a1\n  jr d1\nd1: nop\n"
+                        "a2: jr a2\n"
+                        "ld b, 3\na3: djnz a3\n  jr d3\nd3: nop\n"
+                        "ld b, 4\na4: djnz a4\n  jr d4\n  jr a4\nd4: nop\n"),
+              0, (void)0);
+  CHECK_EQUAL(countExpansions(src, "wait", 0), 0, (void)0);
+  return 0;
+}
+
+/* A macro defined in an included file is expanded where it is included */
+static int testIncluded(void) {
+  TestDir d;
+  CHECK_EQUAL(TestDir_make(&d), 0, (void)0);
+  char const* path = TestDir_writeText(&d, "macros.inc", "load macro r, v\n  ld r, v\n  endm\n");
+  CHECK(path, TestDir_remove(&d));
+  char* src = dsprintf("include \"%s\"\n  load b, 9\n", path);
+  CHECK(src, TestDir_remove(&d));
+
+  IncludeCache c;
+  IncludeCache_init(&c);
+  int const result = checkSame(&c, src, "ld b, 9\n");
+  IncludeCache_deinit(&c);
+  TestDir_remove(&d);
+  free(src);
+  return result;
+}
+
+/* The program is the one of `expected`, with or without the pipeline */
+static int checkSame(IncludeCache* c, char const* src, char const* expected) {
+  Image wanted;
+  CHECK_EQUAL(assemble(NULL, expected, false, &wanted), 0, (void)0);
+  for (int i = 0; i < 2; ++i) {
+    Image actual;
+    CHECK_EQUAL(assemble(c, src, i == 1, &actual), 0, Image_deinit(&wanted));
+    int const result = actual.base != wanted.base || actual.len != wanted.len ||
+                       (actual.len && memcmp(actual.data, wanted.data, actual.len) != 0);
+    Image_deinit(&actual);
+    CHECK(!result, Image_deinit(&wanted));
+  }
+  Image_deinit(&wanted);
+  return 0;
+}
+
+static int assemble(IncludeCache* c, char const* src, bool pipelined, Image* img) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  p.includes = c;
+  if (pipelined)
+    Pipeline_parse(&p);
+  else
+    Parser_parse(&p);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  int const result = Parser_hasErrors(&p);
+  if (!result)
+    *img = Image_fromIR(p.nodes);
+  Parser_deinit(&p);
+  return result;
+}
+
+/* The macro ends up with `expected` memoized expansions */
+static int countExpansions(char const* src, char const* name, size_t expected) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p) && p.macros, Parser_deinit(&p));
+  Macro const* m = Map_get(p.macros, name);
+  CHECK(m, Parser_deinit(&p));
+  CHECK_EQUAL(Map_len(m->expansions), expected, Parser_deinit(&p));
+  Parser_deinit(&p);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <image.h>
+#include <output.h>
+#include <parser.h>
+
+#include "common.h"
+
+static int testOutput(Image const* img, OutputFormat format, char const* expected);
+static int testFromIR(void);
+static int testWriteIR(char const* src, OutputFormat format, char const* expected, size_t expected_len);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    uint8_t bytes[] = {0x3e, 0x01, 0x00};
+    Image img = {.data = bytes, .len = sizeof(bytes)};
+    TEST_CASE(testOutput(&img, OUTPUT_BIN, "\x3e\x01\x00"));
+    TEST_CASE(testOutput(&img, OUTPUT_IHEX, ":030000003E0100BE\n:00000001FF\n"));
+    TEST_CASE(testOutput(&img, OUTPUT_SREC, "S0030000FC\nS10600003E0100BA\nS9030000FC\n"));
+  }
+
+  {
+    // Records are split at 16 bytes
+    uint8_t bytes[17] = {[0] = 0x11, [16] = 0x22};
+    Image img = {.data = bytes, .len = sizeof(bytes)};
+    TEST_CASE(testOutput(&img, OUTPUT_IHEX,
+                         ":1000000011000000000000000000000000000000DF\n:0100100022CD\n:00000001FF\n"));
+  }
+
+  {
+    // Crossing 64K: an extended linear address record, and S2 records
+    uint8_t bytes[] = {0xaa, 0xbb};
+    Image img = {.data = bytes, .base = 0xffff, .len = sizeof(bytes)};
+    TEST_CASE(testOutput(&img, OUTPUT_IHEX, ":01FFFF00AA57\n:020000040001F9\n:01000000BB44\n:00000001FF\n"));
+    TEST_CASE(testOutput(&img, OUTPUT_SREC, "S0030000FC\nS20500FFFFAA52\nS205010000BB3E\nS804000000FB\n"));
+  }
+
+  {
+    Image img = {.data = NULL, .len = 0};
+    TEST_CASE(testOutput(&img, OUTPUT_IHEX, ":00000001FF\n"));
+  }
+
+  TEST_CASE(testFromIR());
+
+  {
+    // ORG backwards and right after the previous region: two regions, a gap
+    // of zeros in the raw binary (written through a mapping of the file)
+    char const src[] = "org 0x20\nld a, 1\norg 0x10\nnop\norg 0x22\nnop\n";
+    char const bin[0x13] = {[0x10] = 0x3e, [0x11] = 0x01};
+    TEST_CASE(testWriteIR(src, OUTPUT_BIN, bin, sizeof(bin)));
+    TEST_CASE(testWriteIR(src, OUTPUT_IHEX, ":0100100000EF\n:030020003E01009E\n:00000001FF\n", 0));
+  }
+
+  {
+    // Bank 5 at 0x4000 is at 5 * 16K, bank 4 at 0x8000 at 4 * 16K; records
+    // don't cross banks
+    char const src[] = "nop\nbank 5\norg 0x4000\nld a, 1\nbank 4\norg 0xbffe\nnop\nnop\n";
+    TEST_CASE(testWriteIR(src, OUTPUT_IHEX,
+                          ":0100000000FF\n:020000040001F9\n:023FFE000000C1\n:024000003E017F\n:00000001FF\n", 0));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testOutput(Image const* img, OutputFormat format, char const* expected) {
+  FILE* f = tmpfile();
+  CHECK(f, (void)0);
+  CHECK_EQUAL(Output_write(f, img, format), 0, fclose(f));
+
+  char buf[256] = {0};
+  rewind(f);
+  size_t const len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+
+  size_t const expected_len = format == OUTPUT_BIN ? img->len : strlen(expected);
+  CHECK_EQUAL(len, expected_len, (void)0);
+  CHECK(memcmp(buf, expected, len) == 0, fprintf(stderr, "%s", buf));
+  return 0;
+}
+
+static int testFromIR(void) {
+  Lexer lex = Lexer_make("start: ld a, 1\nld a, (data)\njr start\ndata: nop\n");
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  uint8_t const expected[] = {0x3e, 0x01, 0x3a, 0x07, 0x00, 0x18, 0xf9, 0x00};
+  Image img = Image_fromIR(p.nodes);
+  Parser_deinit(&p);
+
+  CHECK_EQUAL(img.base, 0, Image_deinit(&img));
+  CHECK_EQUAL(img.len, sizeof(expected), Image_deinit(&img));
+  CHECK(memcmp(img.data, expected, img.len) == 0, Image_deinit(&img));
+  Image_deinit(&img);
+  return 0;
+}
+
+/* expected_len is only given for the raw binary */
+static int testWriteIR(char const* src, OutputFormat format, char const* expected, size_t expected_len) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  FILE* f = tmpfile();
+  CHECK(f, Parser_deinit(&p));
+  CHECK_EQUAL(Output_writeIR(f, p.nodes, format), 0, (fclose(f), Parser_deinit(&p)));
+  Parser_deinit(&p);
+
+  char buf[256] = {0};
+  rewind(f);
+  size_t const len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+
+  if (format != OUTPUT_BIN)
+    expected_len = strlen(expected);
+  CHECK_EQUAL(len, expected_len, (void)0);
+  CHECK(memcmp(buf, expected, len) == 0, (void)0);
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <parser.h>
+#include <peephole.h>
+
+#include "common.h"
+
+static int testPeephole(char const* src, size_t n_bytes, uint8_t const* bytes);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    uint8_t bytes[] = {0xaf, 0xb7};
+    TEST_CASE(testPeephole("ld a, 0\ncp 0\n", 2, bytes));
+  }
+
+  {
+    // Operands that depend on addresses are left alone
+    uint8_t bytes[] = {0x3e, 0x00, 0xaf};
+    TEST_CASE(testPeephole("top: ld a, top\nld a, ZERO\nZERO equ 1 - 1\n", 3, bytes));
+  }
+
+  {
+    // Only unconditional calls become jumps; the target moves with the code
+    uint8_t bytes[] = {0xc3, 0x07, 0x00, 0xcc, 0x07, 0x00, 0xc9};
+    TEST_CASE(testPeephole("call sub\nret\ncall z, sub\nret\nsub: ld a, a\n", 7, bytes));
+  }
+
+  {
+    // Deleting LD B, B exposes the PUSH/POP pair
+    uint8_t bytes[] = {0xc5, 0xd1};
+    TEST_CASE(testPeephole("push bc\nld b, b\npop bc\npush bc\npop de\n", 2, bytes));
+  }
+
+  {
+    // Patterns don't span labels
+    uint8_t bytes[] = {0xc5, 0xc1, 0x18, 0xfd};
+    TEST_CASE(testPeephole("push bc\nback: pop bc\njr back\n", 4, bytes));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testPeephole(char const* src, size_t n_bytes, uint8_t const* bytes) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  Peephole_optimize(&p.resolver);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  size_t k = 0;
+  for (size_t i = 0; i < Vector_len(p.nodes); ++i) {
+    IRNode* n = Vector_at(p.nodes, i);
+    if (n->kind != IR_INSTRUCTION)
+      continue;
+
+    Vector* items = n->data.instruction.encoded_items;
+    for (size_t j = 0; j < Vector_len(items); ++j) {
+      EncodedItem* item = Vector_at(items, j);
+      CHECK(item->kind == EI_BYTE || item->resolved, Parser_deinit(&p));
+
+      uint8_t encoded[2] = {item->data.byte, 0};
+      if (item->kind != EI_BYTE)
+        encoded[0] = (uint8_t)item->value, encoded[1] = (uint8_t)(item->value >> 8);
+
+      for (size_t b = 0; b < EncodedItem_size(item); ++b, ++k) {
+        CHECK(k < n_bytes, Parser_deinit(&p));
+        CHECK_EQUAL(encoded[b], bytes[k], Parser_deinit(&p));
+      }
+    }
+  }
+  CHECK_EQUAL(k, n_bytes, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
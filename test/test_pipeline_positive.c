@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <parser.h>
+#include <pipeline.h>
+
+#include "common.h"
+
+static int testPipeline(char const* src);
+static char* dump(Parser* p);
+static char* generate(size_t n_lines);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testPipeline(""));
+  TEST_CASE(testPipeline("ld a, 1\nret"));
+  TEST_CASE(testPipeline("start: ld a, 1\n"
+                         "  jr later\n"
+                         "x equ later + 1\n"
+                         "  nop ; padding\n"
+                         "later: ld b, x\n"
+                         "  ret\n"));
+
+  // Errors of the parser and of the resolver keep their order
+  TEST_CASE(testPipeline("  bogus\n"
+                         "ld a, 300\n"
+                         "  jr nowhere\n"
+                         "  ld (ix+1\n"
+                         "assert_cycles start, end, 4\n"
+                         "start: nop\n"
+                         "end:\n"));
+
+  // Many batches of tokens and statements
+  char* big = generate(2000);
+  TEST_CASE(big == NULL || testPipeline(big));
+  free(big);
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* The pipeline gives the program of Parser_parse() */
+static int testPipeline(char const* src) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  char* expected = dump(&p);
+  Parser_deinit(&p);
+
+  lex = Lexer_make(src);
+  p = Parser_make(&lex);
+  Pipeline_parse(&p);
+  char* actual = dump(&p);
+  Parser_deinit(&p);
+
+  CHECK(expected && actual, (free(expected), free(actual)));
+  CHECK_STREQUAL(actual, expected, (free(expected), free(actual)));
+  free(expected);
+  free(actual);
+  return 0;
+}
+
+/* The labels, the IR and the errors */
+static char* dump(Parser* p) {
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* f = open_memstream(&buf, &len);
+  if (!f)
+    return NULL;
+  for (size_t i = 0; i < Vector_len(p->nodes); ++i) {
+    IRNode* n = Vector_at(p->nodes, i);
+    IRNode_print(f, n);
+    if (n->kind == IR_INSTRUCTION)
+      fprintf(f, "line %zu\n", n->data.instruction.line);
+  }
+  for (size_t i = 0; i < Vector_len(p->errors); ++i)
+    ParserError_print(Vector_at(p->errors, i), f);
+  fprintf(f, "%zu cycle assertions\n", Vector_len(p->cycle_assertions));
+  fclose(f);
+  return buf;
+}
+
+/* Lines of labels, constants, instructions and forward jumps */
+static char* generate(size_t n_lines) {
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* f = open_memstream(&buf, &len);
+  if (!f)
+    return NULL;
+  for (size_t i = 0; i < n_lines; ++i) {
+    switch (i % 4) {
+    case 0:
+      fprintf(f, "l%zu: ld a, %zu\n", i, i % 256);
+      break;
+    case 1:
+      fprintf(f, "c%zu equ l%zu + 2\n", i, i - 1);
+      break;
+    case 2:
+      fprintf(f, "  jp l%zu\n", i + 2 < n_lines ? i + 2 : 0);
+      break;
+    default:
+      fprintf(f, "  ld hl, c%zu ; comment\n", i - 2);
+      break;
+    }
+  }
+  fclose(f);
+  return buf;
+}
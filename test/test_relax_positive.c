@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <parser.h>
+#include <relax.h>
+#include <utility.h>
+
+#include "common.h"
+
+typedef struct {
+  size_t node;
+  uint8_t opcode; //< First byte of the instruction
+  size_t size;
+} ClueBranch;
+
+static char* makeSource(char const* head, size_t n_filler, char const* tail);
+static int testRelax(char const* src, size_t n_branches, ClueBranch const* branches);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    // Everything is in range
+    ClueBranch branches[] = {{.node = 2, .opcode = 0x18, .size = 2}, {.node = 3, .opcode = 0x10, .size = 2}};
+    TEST_CASE(testRelax("top: ld a, b\njr top\ndjnz top\n", 2, branches));
+  }
+
+  {
+    // 45 * 3 + 4 bytes away: JR Z becomes JP Z, DJNZ becomes DEC B; JP NZ
+    char* src = makeSource("jr z, far\ndjnz far\n", 45, "far: ld a, b\n");
+    ClueBranch branches[] = {{.node = 0, .opcode = 0xca, .size = 3}, {.node = 1, .opcode = 0x05, .size = 4}};
+    TEST_CASE(testRelax(src, 2, branches));
+    free(src);
+  }
+
+  {
+    // The first JR is just in range (+127) until the second one grows
+    char* src = makeSource("jr far\njr farther\n", 41, "ld a, b\nld a, b\nfar: ld a, b\nld a, (0)\nfarther: ld a, b\n");
+    ClueBranch branches[] = {{.node = 0, .opcode = 0xc3, .size = 3}, {.node = 1, .opcode = 0xc3, .size = 3}};
+    TEST_CASE(testRelax(src, 2, branches));
+    free(src);
+  }
+
+  {
+    // The first JR grows, but the ORG pins the second one, which stays at -128
+    ClueBranch branches[] = {{.node = 2, .opcode = 0xc3, .size = 3}, {.node = 4, .opcode = 0x18, .size = 2}};
+    TEST_CASE(testRelax("target: nop\njr far\norg 0x7e\njr target\norg 0x1000\nfar: nop\n", 2, branches));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Puts n_filler 3-byte instructions between head and tail */
+static char* makeSource(char const* head, size_t n_filler, char const* tail) {
+  char const filler[] = "ld a, (0)\n";
+  size_t const len = strlen(head) + n_filler * (sizeof(filler) - 1) + strlen(tail);
+  char* src = malloc(len + 1);
+  if (!src)
+    die("malloc() failed");
+  strcpy(src, head);
+  for (size_t i = 0; i < n_filler; ++i)
+    strcat(src, filler);
+  strcat(src, tail);
+  return src;
+}
+
+static int testRelax(char const* src, size_t n_branches, ClueBranch const* branches) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  Relax_branches(&p.resolver);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  for (size_t i = 0; i < n_branches; ++i) {
+    IRNode* n = Vector_at(p.nodes, branches[i].node);
+    CHECK(n && n->kind == IR_INSTRUCTION, Parser_deinit(&p));
+    EncodedItem* first = Vector_at(n->data.instruction.encoded_items, 0);
+    CHECK_EQUAL(first->data.byte, branches[i].opcode, Parser_deinit(&p));
+    CHECK_EQUAL(IRInstruction_size(&n->data.instruction), branches[i].size, Parser_deinit(&p));
+
+    /* Short forms must be in range, long ones must point at the target */
+    EncodedItem* last =
+        Vector_at(n->data.instruction.encoded_items, Vector_len(n->data.instruction.encoded_items) - 1);
+    CHECK(last->resolved, Parser_deinit(&p));
+    if (last->kind == EI_REL)
+      CHECK(last->value >= INT8_MIN && last->value <= INT8_MAX, Parser_deinit(&p));
+  }
+
+  Parser_deinit(&p);
+  return 0;
+}
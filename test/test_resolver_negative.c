@@ -0,0 +1,42 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <parser.h>
+
+#include "common.h"
+
+static int testResolveFail(char const* src, char const* reason);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testResolveFail("ld a, nowhere\n", "undefined symbol: nowhere"));
+  TEST_CASE(testResolveFail("x: ld a, b\nx: ld a, c\n", "redefinition of x (previously defined on line 1)"));
+  TEST_CASE(testResolveFail("ld a, 256\n", "value 256 does not fit in 1 byte(s)"));
+  TEST_CASE(testResolveFail("ld a, 1 / (FOO - 3)\nFOO equ 3\n", "division by zero"));
+  TEST_CASE(testResolveFail("FOO equ FOO + 1\n", "circular definition: FOO -> FOO"));
+  TEST_CASE(testResolveFail("ld a, FOO\nFOO equ BAR\nBAR equ BAZ\nBAZ equ FOO\n",
+                            "circular definition: FOO -> BAR -> BAZ -> FOO"));
+  TEST_CASE(testResolveFail("FOO equ BAR + 1\nBAR equ nowhere\n", "undefined symbol: nowhere"));
+  TEST_CASE(testResolveFail("CNT defl later\nlater: ld a, b\n", "DEFL value must be known at this point: later has no value"));
+  TEST_CASE(testResolveFail("FOO equ 1\nFOO equ 2\n", "redefinition of FOO (previously defined on line 1)"));
+  TEST_CASE(testResolveFail("org later\nlater: nop\n", "ORG address must be known at this point: later has no value"));
+  TEST_CASE(testResolveFail("org 0x10000\n", "ORG address 65536 is out of range"));
+  TEST_CASE(testResolveFail("bank -1\n", "BANK number -1 is out of range"));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testResolveFail(char const* src, char const* reason) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, Parser_deinit(&p));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK_STREQUAL(err->reason, reason, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
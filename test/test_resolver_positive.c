@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <parser.h>
+
+#include "common.h"
+
+typedef struct {
+  size_t node;
+  size_t item;
+  int32_t value;
+} ClueItem;
+
+static int testResolve(char const* src, size_t n_items, ClueItem const* items);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    ClueItem items[] = {{.node = 2, .item = 1, .value = 0x00}};
+    TEST_CASE(testResolve("back: ld a, b\n"
+                          "ld c, back\n",
+                          1, items));
+  }
+
+  {
+    ClueItem items[] = {{.node = 0, .item = 1, .value = 0x08}, {.node = 1, .item = 1, .value = 0x19}};
+    TEST_CASE(testResolve("ld a, fwd + 3\n"
+                          "ld a, (fwd * 5)\n"
+                          "fwd: ld b, c\n",
+                          2, items));
+  }
+
+  {
+    // The first fixup waits for `x`, then moves to the list of `y`
+    ClueItem items[] = {{.node = 0, .item = 1, .value = 0x06}};
+    TEST_CASE(testResolve("ld a, x + y\n"
+                          "x: ld a, (hl)\n"
+                          "ld a, b\n"
+                          "y: ld a, c\n",
+                          1, items));
+  }
+
+  {
+    // Constants defined out of order are evaluated once their dependencies are
+    ClueItem items[] = {{.node = 0, .item = 1, .value = 0x05}};
+    TEST_CASE(testResolve("ld a, FOO\n"
+                          "FOO EQU BAR + 1\n"
+                          "BAR: EQU BAZ * 2\n"
+                          "BAZ equ lbl + BAZ_2 - BAZ_2\n"
+                          "BAZ_2 equ 5\n"
+                          "lbl: ld b, c\n",
+                          1, items));
+  }
+
+  {
+    ClueItem items[] = {{.node = 0, .item = 1, .value = 0x02}, {.node = 1, .item = 1, .value = 0x0a}};
+    TEST_CASE(testResolve("CNT defl 1\n"
+                          "CNT defl CNT + 1\n"
+                          "ld a, CNT\n"
+                          "CNT defl 10\n"
+                          "ld a, CNT\n",
+                          2, items));
+  }
+
+  {
+    // Constant operands are folded into plain bytes
+    ClueItem items[] = {{.node = 0, .item = 1, .value = 0x0d},
+                        {.node = 1, .item = 1, .value = 0x01},
+                        {.node = 1, .item = 2, .value = 0x02},
+                        {.node = 2, .item = 1, .value = 0x07}};
+    TEST_CASE(testResolve("ld a, 3 * 4 + 1\n"
+                          "jp (2 << 8) + 1\n"
+                          "ld a, N + 1\n"
+                          "N equ 2 * 3\n",
+                          4, items));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testResolve(char const* src, size_t n_items, ClueItem const* items) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  for (size_t i = 0; i < n_items; ++i) {
+    IRNode* n = Vector_at(p.nodes, items[i].node);
+    CHECK(n && n->kind == IR_INSTRUCTION, Parser_deinit(&p));
+    EncodedItem* item = Vector_at(n->data.instruction.encoded_items, items[i].item);
+    CHECK(item, Parser_deinit(&p));
+    if (item->kind == EI_BYTE) {
+      CHECK_EQUAL(item->data.byte, items[i].value, Parser_deinit(&p));
+      continue;
+    }
+    CHECK(item->resolved, Parser_deinit(&p));
+    CHECK_EQUAL(item->value, items[i].value, Parser_deinit(&p));
+  }
+
+  Parser_deinit(&p);
+  return 0;
+}
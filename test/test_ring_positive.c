@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ring.h>
+
+#include "common.h"
+
+#define N_ITEMS 100000
+
+typedef struct {
+  uint32_t seq;
+  uint32_t check;
+} Item;
+
+static int testTransfer(size_t n_slots);
+static void* produce(void* arg);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testTransfer(1));
+  TEST_CASE(testTransfer(4));
+  TEST_CASE(testTransfer(64));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Every item arrives whole, once, in order */
+static int testTransfer(size_t n_slots) {
+  Ring r;
+  Ring_init(&r, n_slots, sizeof(Item));
+  pthread_t producer;
+  CHECK_EQUAL(pthread_create(&producer, NULL, produce, &r), 0, Ring_deinit(&r));
+
+  uint32_t bad = 0;
+  for (uint32_t i = 0; i < N_ITEMS; ++i) {
+    Item const* item = Ring_front(&r);
+    if (item->seq != i || item->check != ~i)
+      ++bad;
+    Ring_pop(&r);
+  }
+  pthread_join(producer, NULL);
+  Ring_deinit(&r);
+  CHECK_EQUAL(bad, 0, (void)0);
+  return 0;
+}
+
+static void* produce(void* arg) {
+  Ring* r = arg;
+  for (uint32_t i = 0; i < N_ITEMS; ++i) {
+    Item* item = Ring_reserve(r);
+    item->seq = i;
+    item->check = ~i;
+    Ring_push(r);
+  }
+  return NULL;
+}
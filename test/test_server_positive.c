@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <include.h>
+#include <parser.h>
+#include <server.h>
+#include <utility.h>
+
+#include "common.h"
+
+static IncludeCache resident; //< The worker's, in testResident()
+
+static int testRequests(char const* path);
+static int testResident(char const* path, TestDir* d);
+static int testNoServer(char const* path);
+static int forward(char const* path, int argc, char const* const* argv, int* exitcode, char* out, size_t out_len);
+static int handle(int argc, char** argv);
+static int handleResident(int argc, char** argv);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TestDir d;
+  if (TestDir_make(&d) != 0)
+    return EXIT_FAILURE;
+  char* path = TestDir_path(&d, "sock");
+
+  TEST_CASE(testNoServer(path));
+  TEST_CASE(testRequests(path));
+  TEST_CASE(testResident(path, &d));
+
+  TestDir_remove(&d);
+  free(path);
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testRequests(char const* path) {
+  pid_t const server = fork();
+  CHECK(server != -1, (void)0);
+  if (server == 0)
+    _exit(Server_run(path, 1, handle) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+  // The command sees the arguments and writes to the client's output
+  char const* argv[] = {"z80asmc", "-o", "out.bin", "in.asm", NULL};
+  char out[256];
+  int exitcode = -1;
+  int rc = -1;
+  for (int tries = 0; tries < 100 && rc == -1; ++tries) {
+    rc = forward(path, 4, argv, &exitcode, out, sizeof(out));
+    if (rc == -1)
+      nanosleep(&(struct timespec){.tv_nsec = 10 * 1000 * 1000}, NULL);
+  }
+  CHECK_EQUAL(rc, 0, (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+  CHECK_EQUAL(exitcode, 4, (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+  CHECK_STREQUAL(out, "z80asmc -o out.bin in.asm\n", (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+
+  // A command that dies still gets an answer, and another worker takes over
+  char const* dying[] = {"z80asmc", "die", NULL};
+  CHECK_EQUAL(forward(path, 2, dying, &exitcode, out, sizeof(out)), 0,
+              (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+  CHECK_EQUAL(exitcode, EX_SOFTWARE, (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+  CHECK_EQUAL(forward(path, 4, argv, &exitcode, out, sizeof(out)), 0,
+              (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+  CHECK_EQUAL(exitcode, 4, (kill(server, SIGKILL), waitpid(server, NULL, 0)));
+
+  // Stopped, it removes the socket
+  int status;
+  kill(server, SIGTERM);
+  CHECK_EQUAL(waitpid(server, &status, 0), server, (void)0);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, (void)0);
+  CHECK_EQUAL(access(path, F_OK), -1, unlink(path));
+  return 0;
+}
+
+/* The files a worker loaded for a request are kept for the next ones, which
+ * parse them no more as long as they don't change */
+static int testResident(char const* path, TestDir* d) {
+  char const* defs = TestDir_writeText(d, "defs.inc", "PORT equ 0x10\n");
+  CHECK(defs, (void)0);
+  char* src = dsprintf("include \"%s\"\nld a, PORT\n", defs);
+  CHECK(src, (void)0);
+
+  pid_t const server = fork();
+  CHECK(server != -1, free(src));
+  if (server == 0) {
+    IncludeCache_init(&resident);
+    _exit(Server_run(path, 1, handleResident) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  // The first command loads the file, the next one finds it
+  char const* argv[] = {"z80asmc", src, NULL};
+  char out[16];
+  int exitcode = -1;
+  int rc = -1;
+  for (int tries = 0; tries < 100 && rc == -1; ++tries) {
+    rc = forward(path, 2, argv, &exitcode, out, sizeof(out));
+    if (rc == -1)
+      nanosleep(&(struct timespec){.tv_nsec = 10 * 1000 * 1000}, NULL);
+  }
+  int result = rc != 0 || exitcode != 1;
+  if (!result)
+    result = forward(path, 2, argv, &exitcode, out, sizeof(out)) != 0 || exitcode != 11;
+
+  // A change is loaded again, next to the version before
+  if (!result)
+    result = !TestDir_writeText(d, "defs.inc", "PORT equ 0x20\n");
+  if (!result)
+    result = forward(path, 2, argv, &exitcode, out, sizeof(out)) != 0 || exitcode != 12;
+
+  int status;
+  kill(server, SIGTERM);
+  waitpid(server, &status, 0);
+  free(src);
+  CHECK(!result, fprintf(stderr, "exit code %d\n", exitcode));
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, (void)0);
+  return 0;
+}
+
+static int testNoServer(char const* path) {
+  char const* argv[] = {"z80asmc", NULL};
+  int exitcode = -1;
+  char out[16];
+  CHECK_EQUAL(forward(path, 1, argv, &exitcode, out, sizeof(out)), -1, (void)0);
+  CHECK_EQUAL(exitcode, -1, (void)0);
+  return 0;
+}
+
+/* Forward a command, collecting its standard output */
+static int forward(char const* path, int argc, char const* const* argv, int* exitcode, char* out, size_t out_len) {
+  FILE* fout = tmpfile();
+  if (!fout)
+    return -1;
+  int const fds[3] = {STDIN_FILENO, fileno(fout), STDERR_FILENO};
+  int const rc = Server_forward(path, argc, argv, fds, exitcode);
+
+  rewind(fout);
+  size_t const len = fread(out, 1, out_len - 1, fout);
+  out[len] = '\0';
+  fclose(fout);
+  return rc;
+}
+
+/* Echo the arguments; "die" dies */
+static int handle(int argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "die") == 0) {
+    errno = 0;
+    die("dying as asked");
+  }
+  for (int i = 0; i < argc; ++i)
+    printf("%s%c", argv[i], i + 1 < argc ? ' ' : '\n');
+  return argc;
+}
+
+/* Assemble the source with the files of the worker
+ *
+ * @returns 10 times how many files the worker had loaded, plus how many it
+ *   has after; 100 if the source has errors
+ */
+static int handleResident(int argc, char** argv) {
+  if (argc != 2)
+    return 100;
+  size_t const n_loaded = Vector_len(resident.files);
+  Lexer lex = Lexer_make(argv[1]);
+  Parser p = Parser_make(&lex);
+  p.includes = &resident;
+  Parser_parse(&p);
+  bool const failed = Parser_hasErrors(&p);
+  Parser_deinit(&p);
+  return failed ? 100 : (int)(n_loaded * 10 + Vector_len(resident.files));
+}
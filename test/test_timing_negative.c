@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <parser.h>
+#include <relax.h>
+#include <timing.h>
+
+#include "common.h"
+
+static int testTimingFail(char const* src, char const* reason);
+
+int main(void) {
+  int tests_failed = 0;
+
+  TEST_CASE(testTimingFail("a0: ret z\na1: nop\nassert_cycles a0, a1, 10\n",
+                           "section a0..a1 takes 11 T-states, over the budget of 10"));
+  TEST_CASE(testTimingFail("a0: nop\na1: nop\nassert_cycles a1, a0, 100\n",
+                           "section ends before it starts: a0 comes before a1"));
+  TEST_CASE(testTimingFail("a0: nop\nN equ 1\nassert_cycles a0, N, 100\n", "not a label: N"));
+  TEST_CASE(testTimingFail("a0: nop\nassert_cycles a0, a1, 100\n", "not a label: a1"));
+  TEST_CASE(testTimingFail("a0: nop\nassert_cycles a0, a0, nowhere\n", "undefined symbol"));
+  TEST_CASE(testTimingFail("a0: nop\nassert_cycles a0, 100\n", "expected start label, end label and a budget in T-states"));
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testTimingFail(char const* src, char const* reason) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+
+  if (!Parser_hasErrors(&p)) {
+    Relax_branches(&p.resolver);
+    Timing_checkAssertions(&p.resolver, p.cycle_assertions);
+  }
+
+  CHECK_EQUAL(Vector_len(p.errors), 1, Parser_deinit(&p));
+  ParserError* err = Vector_at(p.errors, 0);
+  CHECK_STREQUAL(err->reason, reason, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
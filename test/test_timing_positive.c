@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <instruction.h>
+#include <parser.h>
+#include <relax.h>
+#include <timing.h>
+#include <utility.h>
+
+#include "common.h"
+
+static char* makeSource(char const* head, size_t n_filler, char const* tail);
+static int testTiming(char const* src, size_t n_times, TStates const* times);
+
+int main(void) {
+  int tests_failed = 0;
+
+  {
+    TStates times[] = {{4, 4}, {7, 7}, {7, 7}, {11, 11}, {10, 10}, {17, 17}, {5, 11}, {10, 10}};
+    TEST_CASE(testTiming("ld a, b\nld a, (hl)\nld a, 1\npush bc\npop bc\ncall 0\nret nz\nret\n", 8, times));
+  }
+
+  {
+    TStates times[] = {{8, 13}, {7, 12}, {12, 12}, {10, 17}};
+    TEST_CASE(testTiming("top: djnz top\njr z, top\njr top\ncall c, top\n", 4, times));
+  }
+
+  {
+    // Relaxed DJNZ is DEC B; JP NZ
+    char* src = makeSource("djnz far\n", 50, "far: nop\n");
+    TStates times[] = {{14, 14}};
+    TEST_CASE(testTiming(src, 1, times));
+    free(src);
+  }
+
+  {
+    // Budgets that hold
+    TEST_CASE(testTiming("a0: ld a, b\nret z\na1: nop\nASSERT_CYCLES a0, a1, 15\nassert_cycles a1, a1, 0\n", 0, NULL));
+    TEST_CASE(testTiming("assert_cycles a0, a1, MAX\na0: jr nz, a0\na1: nop\nMAX equ 12\n", 0, NULL));
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Puts n_filler 3-byte instructions between head and tail */
+static char* makeSource(char const* head, size_t n_filler, char const* tail) {
+  char const filler[] = "ld a, (0)\n";
+  size_t const len = strlen(head) + n_filler * (sizeof(filler) - 1) + strlen(tail);
+  char* src = malloc(len + 1);
+  if (!src)
+    die("malloc() failed");
+  strcpy(src, head);
+  for (size_t i = 0; i < n_filler; ++i)
+    strcat(src, filler);
+  strcat(src, tail);
+  return src;
+}
+
+/* Checks the times of the first n_times instructions */
+static int testTiming(char const* src, size_t n_times, TStates const* times) {
+  Lexer lex = Lexer_make(src);
+  Parser p = Parser_make(&lex);
+  Parser_parse(&p);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  Relax_branches(&p.resolver);
+  Timing_checkAssertions(&p.resolver, p.cycle_assertions);
+  for (size_t i = 0; i < Vector_len(p.errors); ++i)
+    ParserError_print(Vector_at(p.errors, i), stderr);
+  CHECK(!Parser_hasErrors(&p), Parser_deinit(&p));
+
+  size_t k = 0;
+  for (size_t i = 0; i < Vector_len(p.nodes) && k < n_times; ++i) {
+    IRNode* n = Vector_at(p.nodes, i);
+    if (n->kind != IR_INSTRUCTION)
+      continue;
+    TStates const t = TStates_ofInstruction(&n->data.instruction);
+    CHECK_EQUAL(t.base, times[k].base, Parser_deinit(&p));
+    CHECK_EQUAL(t.taken, times[k].taken, Parser_deinit(&p));
+    k += 1;
+  }
+  CHECK_EQUAL(k, n_times, Parser_deinit(&p));
+
+  Parser_deinit(&p);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pool.h>
+#include <utility.h>
+#include <z80asm.h>
+
+#include "common.h"
+
+static int testErrors(z80asm_ctx* ctx, char const* src, size_t n_errors, char const* const* reasons,
+                      size_t const* lines);
+static int testDieTrap(void);
+static int testPoolDie(void);
+static void dieAt10(void* ctx, size_t i);
+
+int main(void) {
+  int tests_failed = 0;
+
+  z80asm_ctx* ctx = z80asm_new();
+  if (!ctx)
+    return EXIT_FAILURE;
+
+  {
+    char const* reasons[] = {"value 300 does not fit in 1 byte(s)", "unknown instruction: bogus"};
+    size_t lines[] = {1, 2};
+    TEST_CASE(testErrors(ctx, "ld a, 300\n  bogus\n", 2, reasons, lines));
+  }
+
+  {
+    char const* reasons[] = {"undefined symbol: nowhere"};
+    size_t lines[] = {3};
+    TEST_CASE(testErrors(ctx, "nop\nnop\njp nowhere\n", 1, reasons, lines));
+  }
+
+  {
+    // Files can't be included, which is told at the directive
+    char const* reasons[] = {"cannot include files here: x.asm", "cannot include files here: y.bin"};
+    size_t lines[] = {2, 3};
+    TEST_CASE(testErrors(ctx, "nop\n  include \"x.asm\"\n  incbin \"y.bin\"\n", 2, reasons, lines));
+  }
+
+  {
+    // The errors go with the next call
+    uint8_t out[4];
+    size_t outlen = sizeof(out);
+    TEST_CASE(z80asm_assemble(ctx, "nop\n", 4, out, &outlen) != Z80ASM_OK);
+    TEST_CASE(z80asm_error_count(ctx) != 0);
+  }
+
+  z80asm_free(ctx);
+
+  TEST_CASE(testDieTrap());
+  TEST_CASE(testPoolDie());
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testErrors(z80asm_ctx* ctx, char const* src, size_t n_errors, char const* const* reasons,
+                      size_t const* lines) {
+  uint8_t out[16] = {0};
+  size_t outlen = sizeof(out);
+  CHECK_EQUAL(z80asm_assemble(ctx, src, strlen(src), out, &outlen), Z80ASM_ESOURCE, (void)0);
+  CHECK_EQUAL(outlen, sizeof(out), (void)0);
+  CHECK_EQUAL(z80asm_error_count(ctx), n_errors, (void)0);
+
+  /* In whichever order the passes found them */
+  for (size_t i = 0; i < n_errors; ++i) {
+    size_t line, col;
+    char const* reason = z80asm_error(ctx, i, &line, &col);
+    bool found = false;
+    for (size_t j = 0; j < n_errors && !found; ++j)
+      found = strcmp(reason, reasons[j]) == 0 && line == lines[j] && col > 0;
+    CHECK(found, fprintf(stderr, "%zu:%zu: %s\n", line, col, reason));
+  }
+  return 0;
+}
+
+/* die() returns to the innermost trap of the thread, which it pops */
+static int testDieTrap(void) {
+  DieTrap outer, inner;
+  volatile int n_sprung = 0;
+
+  if (setjmp(outer.env) == 0) {
+    DieTrap_push(&outer);
+    if (setjmp(inner.env) == 0) {
+      DieTrap_push(&inner);
+      die("inner");
+    }
+    ++n_sprung;
+    CHECK_STREQUAL(inner.message, "inner", DieTrap_pop(&outer));
+    die("outer");
+  }
+  ++n_sprung;
+  CHECK_STREQUAL(outer.message, "outer", (void)0);
+  CHECK_EQUAL(n_sprung, 2, (void)0);
+  return 0;
+}
+
+/* A job dying on any worker springs the trap of the thread running the pool */
+static int testPoolDie(void) {
+  DieTrap trap;
+  if (setjmp(trap.env) == 0) {
+    DieTrap_push(&trap);
+    Pool_run(64, dieAt10, NULL);
+    DieTrap_pop(&trap);
+    CHECK(false, (void)0);
+  }
+  CHECK_STREQUAL(trap.message, "job 10", (void)0);
+  return 0;
+}
+
+static void dieAt10(void* ctx, size_t i) {
+  (void)ctx;
+  if (i == 10)
+    die("job 10");
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <z80asm.h>
+
+#include "common.h"
+
+#define N_VARIANTS 200
+#define N_THREADS 4
+
+/* Of a string literal or array, without its NUL */
+#define LEN(STR) (sizeof(STR) - 1)
+
+static int testAssemble(z80asm_ctx* ctx, char const* src, size_t len, uint32_t origin, size_t n_bytes,
+                        uint8_t const* bytes);
+static int testVariants(z80asm_ctx* ctx);
+static void* runVariants(void* arg);
+
+static char failure; //< What a failed thread returns
+
+int main(void) {
+  int tests_failed = 0;
+
+  z80asm_ctx* ctx = z80asm_new();
+  if (!ctx)
+    return EXIT_FAILURE;
+
+  {
+    uint8_t bytes[] = {0x3e, 0x01, 0xc9};
+    TEST_CASE(testAssemble(ctx, "ld a, 1\nret\n", LEN("ld a, 1\nret\n"), 0, 3, bytes));
+  }
+
+  {
+    // The gap between the regions is zero, and the binary starts at the first
+    char const src[] = "org 0x8000\njr far\norg 0x8004\nfar: ret\n";
+    uint8_t bytes[] = {0x18, 0x02, 0x00, 0x00, 0xc9};
+    TEST_CASE(testAssemble(ctx, src, LEN(src), 0x8000, 5, bytes));
+  }
+
+  {
+    // Only `len` bytes are assembled, with no NUL after them
+    uint8_t bytes[] = {0x00, 0x00};
+    TEST_CASE(testAssemble(ctx, "nop\nnop\nhalt\n", 7, 0, 2, bytes));
+  }
+
+  TEST_CASE(testAssemble(ctx, "", 0, 0, 0, NULL));
+  TEST_CASE(testAssemble(ctx, NULL, 0, 0, 0, NULL));
+
+  {
+    uint8_t bytes[] = {0xaf, 0xb7};
+    z80asm_set_optimize(ctx, true);
+    TEST_CASE(testAssemble(ctx, "ld a, 0\ncp 0\n", LEN("ld a, 0\ncp 0\n"), 0, 2, bytes));
+    z80asm_set_optimize(ctx, false);
+    uint8_t plain[] = {0x3e, 0x00, 0xfe, 0x00};
+    TEST_CASE(testAssemble(ctx, "ld a, 0\ncp 0\n", LEN("ld a, 0\ncp 0\n"), 0, 4, plain));
+  }
+
+  {
+    // Too small a buffer is left alone, and told the size needed
+    uint8_t out[2] = {0x55, 0x55};
+    size_t outlen = sizeof(out);
+    TEST_CASE(z80asm_assemble(ctx, "ld a, 1\nret\n", LEN("ld a, 1\nret\n"), out, &outlen) != Z80ASM_ENOSPC);
+    TEST_CASE(outlen != 3 || out[0] != 0x55 || out[1] != 0x55);
+  }
+
+  TEST_CASE(testVariants(ctx));
+  z80asm_free(ctx);
+
+  // Contexts in different threads don't meet
+  pthread_t threads[N_THREADS];
+  size_t n_started = 0;
+  for (; n_started < N_THREADS; ++n_started)
+    if (pthread_create(&threads[n_started], NULL, runVariants, NULL) != 0)
+      break;
+  TEST_CASE(n_started != N_THREADS);
+  for (size_t i = 0; i < n_started; ++i) {
+    void* result;
+    pthread_join(threads[i], &result);
+    TEST_CASE(result != NULL);
+  }
+
+  return tests_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int testAssemble(z80asm_ctx* ctx, char const* src, size_t len, uint32_t origin, size_t n_bytes,
+                        uint8_t const* bytes) {
+  uint8_t out[16];
+  size_t outlen = sizeof(out);
+  int const status = z80asm_assemble(ctx, src, len, out, &outlen);
+  CHECK_EQUAL(status, Z80ASM_OK, (void)0);
+  CHECK_EQUAL(z80asm_error_count(ctx), 0, (void)0);
+  CHECK_EQUAL(z80asm_origin(ctx), origin, (void)0);
+  CHECK_EQUAL(outlen, n_bytes, (void)0);
+  for (size_t i = 0; i < n_bytes; ++i)
+    CHECK_EQUAL(out[i], bytes[i], fprintf(stderr, "at byte %zu\n", i));
+  return 0;
+}
+
+/* Patched copies of a routine, through one context */
+static int testVariants(z80asm_ctx* ctx) {
+  for (int i = 0; i < N_VARIANTS; ++i) {
+    char src[64];
+    int const len = snprintf(src, sizeof(src), "org 0x%x\nld a, %d\nloop: djnz loop\n", 0x100 + i, i);
+    CHECK(len > 0 && (size_t)len < sizeof(src), (void)0);
+
+    uint8_t bytes[] = {0x3e, (uint8_t)i, 0x10, 0xfe};
+    CHECK_EQUAL(testAssemble(ctx, src, (size_t)len, (uint32_t)(0x100 + i), 4, bytes), 0,
+                fprintf(stderr, "variant %d\n", i));
+  }
+  return 0;
+}
+
+/* @returns NULL on success */
+static void* runVariants(void* arg) {
+  (void)arg;
+  z80asm_ctx* ctx = z80asm_new();
+  if (!ctx)
+    return &failure;
+  int const failed = testVariants(ctx);
+  z80asm_free(ctx);
+  return failed ? &failure : NULL;
+}